@@ -73,8 +73,8 @@ void MX_AppMain(void);
 void MX_UTIL_Init(void);
 void MX_AppISR(uint16_t GPIO_Pin);
 uint32_t MX_RNG_Get(void);
-bool MX_AES_CTR_Encrypt(uint8_t *key, uint8_t *plaintext, uint16_t len, uint8_t *ciphertext);
-bool MX_AES_CTR_Decrypt(uint8_t *key, uint8_t *ciphertext, uint16_t len, uint8_t *plaintext);
+bool MX_AES_CTR_Encrypt(uint8_t *key, uint32_t *iv, uint8_t *plaintext, uint16_t len, uint8_t *ciphertext);
+bool MX_AES_CTR_Decrypt(uint8_t *key, uint32_t *iv, uint8_t *ciphertext, uint16_t len, uint8_t *plaintext);
 
 void Error_Handler(void);
 
@@ -65,6 +65,8 @@ __ALIGN_BEGIN static uint32_t keyAES[8] __ALIGN_END = {
     0x00000000,0x00000000,0x00000000,0x00000000,0x00000000,0x00000000,0x00000000,0x00000000
 };
 __ALIGN_BEGIN static uint32_t AESIV_CTR[4] __ALIGN_END = {0xF0F1F2F3, 0xF4F5F6F7, 0xF8F9FAFB, 0xFCFDFEFF};
+__ALIGN_BEGIN static uint32_t ivAES[4] __ALIGN_END = {0};
+#define AES_TIMEOUT_MS      100
 
 // Linker-related symbols
 #if defined( __ICCARM__ )   // IAR
@@ -655,8 +657,23 @@ void MX_SUBGHZ_DeInit(void)
     HAL_SUBGHZ_DeInit(&hsubghz);
 }
 
+// Begin or continue a crypto session using the specified key.  The peripheral stays
+// initialized across a burst of packets (such as the chunks and ACKs of a transfer)
+// rather than being initialized and de-initialized for each one.  Because the peripheral
+// is configured with CRYP_KEYIVCONFIG_ALWAYS, it loads the key and IV that the handle
+// refers to at the start of every operation, and so a session is re-keyed simply by
+// changing them.  If iv is NULL, the legacy static IV is used.
+static void MX_AES_Session(uint8_t *key, uint32_t *iv)
+{
+    memcpy(keyAES, key, sizeof(keyAES));
+    memcpy(ivAES, iv == NULL ? AESIV_CTR : iv, sizeof(ivAES));
+    if ((peripherals & PERIPHERAL_CRYP) == 0) {
+        MX_AES_Init();
+    }
+}
+
 // Encrypt using AES as configured
-bool MX_AES_CTR_Encrypt(uint8_t *key, uint8_t *plaintext, uint16_t len, uint8_t *ciphertext)
+bool MX_AES_CTR_Encrypt(uint8_t *key, uint32_t *iv, uint8_t *plaintext, uint16_t len, uint8_t *ciphertext)
 {
     if ((((uint32_t) plaintext) & 0x03) != 0) {
         return false;
@@ -664,18 +681,12 @@ bool MX_AES_CTR_Encrypt(uint8_t *key, uint8_t *plaintext, uint16_t len, uint8_t
     if ((((uint32_t) ciphertext) & 0x03) != 0) {
         return false;
     }
-    memcpy(keyAES, key, sizeof(keyAES));
-    MX_AES_Init();
-    bool success = HAL_CRYP_Encrypt_IT(&hcryp, (uint32_t *)plaintext, len, (uint32_t *)ciphertext) == HAL_OK;
-    if (success) {
-        while (HAL_CRYP_GetState(&hcryp) != HAL_CRYP_STATE_READY) ;
-    }
-    MX_AES_DeInit();
-    return success;
+    MX_AES_Session(key, iv);
+    return (HAL_CRYP_Encrypt(&hcryp, (uint32_t *)plaintext, len, (uint32_t *)ciphertext, AES_TIMEOUT_MS) == HAL_OK);
 }
 
 // Decrypt using AES as configured
-bool MX_AES_CTR_Decrypt(uint8_t *key, uint8_t *ciphertext, uint16_t len, uint8_t *plaintext)
+bool MX_AES_CTR_Decrypt(uint8_t *key, uint32_t *iv, uint8_t *ciphertext, uint16_t len, uint8_t *plaintext)
 {
     if ((((uint32_t) plaintext) & 0x03) != 0) {
         return false;
@@ -683,14 +694,8 @@ bool MX_AES_CTR_Decrypt(uint8_t *key, uint8_t *ciphertext, uint16_t len, uint8_t
     if ((((uint32_t) ciphertext) & 0x03) != 0) {
         return false;
     }
-    memcpy(keyAES, key, sizeof(keyAES));
-    MX_AES_Init();
-    bool success = HAL_CRYP_Decrypt_IT(&hcryp, (uint32_t *)ciphertext, len, (uint32_t *)plaintext) == HAL_OK;
-    if (success) {
-        while (HAL_CRYP_GetState(&hcryp) != HAL_CRYP_STATE_READY) ;
-    }
-    MX_AES_DeInit();
-    return success;
+    MX_AES_Session(key, iv);
+    return (HAL_CRYP_Decrypt(&hcryp, (uint32_t *)ciphertext, len, (uint32_t *)plaintext, AES_TIMEOUT_MS) == HAL_OK);
 }
 
 // Init AES
@@ -700,7 +705,7 @@ void MX_AES_Init()
     hcryp.Init.DataType = CRYP_DATATYPE_1B;
     hcryp.Init.KeySize = CRYP_KEYSIZE_256B;
     hcryp.Init.pKey = (uint32_t *)keyAES;
-    hcryp.Init.pInitVect = AESIV_CTR;
+    hcryp.Init.pInitVect = ivAES;
     hcryp.Init.Algorithm = CRYP_AES_CTR;
     hcryp.Init.DataWidthUnit = CRYP_DATAWIDTHUNIT_BYTE;
     hcryp.Init.HeaderWidthUnit = CRYP_HEADERWIDTHUNIT_WORD;
@@ -708,11 +713,16 @@ void MX_AES_Init()
     if (HAL_CRYP_Init(&hcryp) != HAL_OK) {
         Error_Handler();
     }
+    peripherals |= PERIPHERAL_CRYP;
 }
 
-// DeInit AES
+// DeInit AES, ending any crypto session
 void MX_AES_DeInit(void)
 {
+    if ((peripherals & PERIPHERAL_CRYP) == 0) {
+        return;
+    }
+    peripherals &= ~PERIPHERAL_CRYP;
     HAL_CRYP_DeInit(&hcryp);
 }
 
@@ -32,6 +32,9 @@ void PWR_EnterStopMode(void)
     // Suspend
     MX_DBG_Suspend();
 
+    // AES is not retained in STOP2, so end any crypto session
+    MX_AES_DeInit();
+
     // Suspend sysTick : work around for degugger problem in dual core (tickets 71085,  72038, 71087 )
     HAL_SuspendTick();
 
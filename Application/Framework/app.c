@@ -21,6 +21,14 @@ bool TraceEventOccurred = false;
 // Running sequence of request IDs issued to the gateway
 uint32_t LastRequestID = 0;
 
+// Message version most recently received from the gateway, or 0 if not yet known
+uint8_t gatewayMessageVersion = 0;
+
+// Epoch of the gateway configuration most recently received in full, and whether or not
+// an ACK has indicated that we're missing a configuration change.
+uint8_t gatewayAckEpoch = 0;
+bool gatewayAckSync = true;
+
 // Addresses and Keys
 uint8_t wildcardAddress[ADDRESS_LEN] = {0};
 uint8_t invalidAddress[ADDRESS_LEN] = {0};
@@ -38,6 +46,10 @@ uint16_t batteryMillivolts = 0;
 // Time Windowing
 uint16_t twLBTRetries = 10;
 uint16_t twLBTRetriesRemaining;
+int64_t lbtBeganMs = 0;
+#if LBT_MODE == LBT_MODE_CAD
+static UTIL_TIMER_Object_t lbtBackoffTimer;
+#endif
 uint32_t twLastActiveSensors = 0;
 uint32_t TWModulusSecs = 0;
 uint16_t TWModulusOffsetSecs = 0;
@@ -45,11 +57,15 @@ uint16_t TWSlotBeginsSecs = 0;
 bool TWSlotBeginsTweak = false;
 uint16_t TWSlotEndsSecs = 0;
 uint16_t TWListenBeforeTalkMs = 0;
+uint8_t TWSpreadingFactor = LORA_SPREADING_FACTOR;
+bool twSendInSlot = false;
 uint32_t twSlotBeginsTime;
 uint32_t twSlotExpiresTime;
 bool twForceIgnore = false;
 bool twSlotExpiresTimeWasValid;
 static UTIL_TIMER_Object_t twSleepTimer;
+static UTIL_TIMER_Object_t housekeepingTimer;
+static UTIL_TIMER_Object_t twSlotTimer;
 
 // Sent message state
 uint32_t sensorSendRetriesRemaining;
@@ -61,6 +77,11 @@ uint8_t *messageToSendData;
 uint32_t messageToSendDataLen;
 bool messageToSendDataDealloc;
 uint32_t messageToSendAcknowledgedLen;
+bool messageToSendWindowed;
+uint32_t messageToSendReceivedMap;
+uint32_t messageToSendWindowMap;
+bool messageToSendWindowContinuing;
+int32_t messageToSendTimeStampOffset = -1;
 int64_t sentMessageMs;
 uint16_t sentMessageCarrierLen;
 wireMessageCarrier sentMessageCarrier;
@@ -70,6 +91,7 @@ wireMessage sentMessage;
 wireMessageCarrier wireReceivedCarrier;
 wireMessage wireReceived;
 uint32_t wireReceivedLen;
+uint32_t wireReceivedMs;
 uint32_t wireReceiveTimeoutMs;
 
 // Gateway's per-sensor request state
@@ -86,6 +108,12 @@ typedef struct {
     uint16_t sensorMv;
     uint16_t twSlotBeginsSecs;
     uint16_t twSlotEndsSecs;
+    uint16_t twRequestBytes;
+    uint16_t twResponseBytes;
+    uint8_t twFrameMultiplier;
+    uint8_t twFramePhase;
+    uint8_t twLane;
+    uint32_t sendPeriodSecs;
     uint32_t lastReceivedTime;
     uint8_t sensorAddress[ADDRESS_LEN];
     uint32_t currentRequestID;
@@ -96,9 +124,70 @@ typedef struct {
     uint8_t *data;
     uint32_t dataTotalLen;
     uint32_t dataAcknowledgedLen;
+    uint32_t dataReceivedMap;
+    bool dataCompressed;
+    bool dataWindowed;
+    bool processingPending;
+    uint8_t messageVersion;
+    uint8_t ackEpoch;
+    uint32_t ackConfigCRC;
+    uint8_t sfAssigned;
+    uint8_t sfHeard;
+    sensorDBShadow dbShadow;
+    uint32_t dataBeganMs;
+    uint8_t dataRetries;
+    linkHistory links;
+    int16_t mruPrev;
+    int16_t mruNext;
 } requestState;
+
+// A place in the time window frame.  Sensors whose slots recur less often than every frame
+// share it by being assigned different phases, and it is as long as the longest of their
+// slots.  Its use is in units of 1/TW_SUPERFRAME_MAX of the frames.
+typedef struct {
+    uint16_t secs;
+    uint16_t used;
+    uint16_t beginsSecs;
+} twLane;
+
+// The sensor cache.  Entries occupy stable slots once assigned, and are located by an
+// open-addressed (linear probing) hash index over the sensor address.  Recency of use
+// is tracked by a doubly-linked MRU list threaded through the slots, so that receiving
+// a packet never requires entries to be searched linearly or copied.
+#define SENSOR_CACHE_ENTRY_BYTES    (sizeof(requestState) + 2*sizeof(int16_t))
+#define SENSOR_CACHE_BUDGETED       (SENSOR_CACHE_RAM_BYTES / SENSOR_CACHE_ENTRY_BYTES)
+#define MAX_CACHED_SENSORS          (SENSOR_CACHE_BUDGETED < MAX_PEERS ? SENSOR_CACHE_BUDGETED : MAX_PEERS)
+#define SENSOR_HASH_BUCKETS         (MAX_CACHED_SENSORS*2)
+_Static_assert(MAX_CACHED_SENSORS == MAX_PEERS,
+               "SENSOR_CACHE_RAM_BYTES is too small to cache every peer that can be paired");
+#define SENSOR_SLOT_NONE            -1
 requestState requestCache[MAX_CACHED_SENSORS] = {0};
-uint8_t cachedSensors = 0;
+uint32_t cachedSensors = 0;
+static int16_t sensorHash[SENSOR_HASH_BUCKETS];
+static int16_t sensorMRUHead = SENSOR_SLOT_NONE;
+static int16_t sensorMRUTail = SENSOR_SLOT_NONE;
+
+// Stats of sensors evicted from the cache that have yet to be flushed to the sensor DB,
+// so that the Notecard isn't used while a packet is being received.  These are flushed
+// by housekeeping, to which they are presented as the cache entries that follow the
+// cache itself.
+typedef struct {
+    uint8_t sensorAddress[ADDRESS_LEN];
+    int8_t gatewayRSSI;
+    int8_t gatewaySNR;
+    int8_t sensorRSSI;
+    int8_t sensorSNR;
+    int8_t sensorTXP;
+    int8_t sensorLTP;
+    uint16_t sensorMv;
+    uint32_t lastReceivedTime;
+    uint32_t requestsProcessed;
+    uint32_t requestsLost;
+    sensorDBShadow dbShadow;
+} evictedState;
+static evictedState evictedCache[SENSOR_EVICTED_MAX];
+static uint32_t evictedFirst = 0;
+static uint32_t evictedCount = 0;
 
 // Sensor database update info
 bool forceSensorRefresh = false;
@@ -112,6 +201,8 @@ typedef struct {
     uint8_t *data;
     uint32_t dataTotalLen;
     uint32_t dataAcknowledgedLen;
+    uint32_t dataReceivedMap;
+    bool dataCompressed;
     bool requestFullySent;
 } responseState;
 responseState response = {0};
@@ -127,18 +218,50 @@ void sendToPeer(bool useTW, uint8_t flags, int8_t rssi, int8_t snr, uint8_t *toA
                 uint8_t *message, uint32_t length, bool dealloc);
 void sendMessageToPeer(bool useTW, uint8_t *toAddress);
 bool sendTimeout(void);
+void sensorResendAfterTimeout(void);
 void freeMessageToSendBuffer(void);
 void restartReceive(uint32_t timeoutMs);
 bool validateReceivedMessage(void);
 void processSensorRequest(requestState *request, bool respond);
 bool lbtListenBeforeTalk(void);
 void lbtTalk(void);
+#if LBT_MODE == LBT_MODE_CAD
+void lbtBackoffEvent(void *context);
+#endif
 void twRefresh(void);
 void twOpenEvent(void *context);
 uint32_t twMinimumModulusSecs(void);
+uint32_t twSlotSecs(requestState *request);
+uint32_t twSlotStartSecs(requestState *request);
+bool twSensorActive(requestState *request, uint32_t now);
+uint32_t twFrameMultiplier(requestState *request, uint32_t frameSecs);
+uint32_t twPack(uint32_t now, uint32_t estimateSecs, twLane *lanes, bool apply);
+uint32_t twTransferMs(uint8_t sf, uint32_t len, bool windowed);
+uint16_t twTypicalBytes(uint16_t typicalBytes, uint32_t observedBytes);
+uint32_t twSecsUntilQuiet(uint32_t quietSecs);
+requestState *twSlotOwner(uint32_t now, uint32_t *slotBeginTime, uint32_t *slotLeftSecs);
+uint8_t twSlotSpreadingFactor(uint32_t *untilSecs);
+void twSlotEvent(void *context);
+void twSlotTimerStart(uint32_t untilSecs);
+uint8_t gatewaySpreadingFactor(requestState *request);
+void gatewayHousekeepingPlan(void);
+void housekeepingTimerEvent(void *context);
 void sensorCoreIdle(void);
 void sensorGatewayRequestFailure(bool wasTX, const char *why);
-void showReceivedTime(char *msg, uint32_t beginSecs, uint32_t endSecs);
+void showReceivedTime(char *msg, requestState *request);
+void sensorCacheInit(void);
+requestState *sensorCacheLookup(uint8_t *address, bool *isNew);
+requestState *sensorCacheFind(uint8_t *address);
+void gatewaySendResponse(requestState *request);
+bool gatewayProcessPending(void);
+uint8_t sensorCacheMessageVersion(uint8_t *address);
+bool compressPayload(uint8_t peerVersion, uint8_t **data, uint32_t *dataLen);
+uint8_t peerMessageVersion(uint8_t *address);
+uint32_t gatewayAckEncode(requestState *request, gatewayAckBody *body, bool full, bool withTime, uint8_t *out, int32_t *timeOffset);
+bool sensorAckDecode(uint8_t *data, uint32_t len, gatewayAckBody *body, bool *hasTime, int32_t *timeMs);
+void windowPlan(void);
+bool windowSendNext(uint8_t *toAddress);
+bool windowReceive(uint8_t *data, uint32_t totalLen, uint32_t *ackedLen, uint32_t *receivedMap);
 
 // Set the current application state, potentially from an ISR
 void appSetCoreState(States_t newState)
@@ -192,6 +315,10 @@ void freeMessageToSendBuffer(void)
     messageToSendDataLen = 0;
     messageToSendDataDealloc = false;
     messageToSendAcknowledgedLen = 0;
+    messageToSendWindowed = false;
+    messageToSendReceivedMap = 0;
+    messageToSendWindowMap = 0;
+    messageToSendTimeStampOffset = -1;
 
 }
 
@@ -214,17 +341,48 @@ void sendToPeer(bool useTW, uint8_t flags, int8_t rssi, int8_t snr, uint8_t *toA
     messageToSendRSSI = rssi;
     messageToSendSNR = snr;
 
+    // Send payloads spanning multiple chunks in windows, if the peer supports it
+    messageToSendWindowed = (length > MESSAGE_MAX_CHUNK
+                             && (flags & (MESSAGE_FLAG_ACK|MESSAGE_FLAG_BEACON)) == 0
+                             && peerMessageVersion(toAddress) >= MESSAGE_VERSION_WINDOW);
+    windowPlan();
+
     // Send the next chunk
     sendMessageToPeer(useTW, toAddress);
 
 }
 
+// The AES-CTR counter block with which a carrier's message is encrypted, which is its nonce
+// followed by a zero block counter, or NULL for the static counter block of legacy carriers
+uint32_t *appCarrierIV(wireMessageCarrier *carrier, uint32_t *iv)
+{
+    if (carrier->Version < MESSAGE_VERSION_NONCE) {
+        return NULL;
+    }
+    iv[0] = carrier->Nonce.Salt;
+    iv[1] = carrier->Nonce.Sequence;
+    iv[2] = 0;
+    iv[3] = 0;
+    return iv;
+}
+
 // Send the next message in sequence to the peer.  If key is NULL, it is looked up.
 void sendMessageToPeer(bool useTW, uint8_t *toAddress)
 {
 
-    // Format the header for the next chunk
-    sentMessageCarrier.Version = MESSAGE_VERSION;
+    // Assign the nonce of this transmission
+    static uint32_t nonceSalt = 0;
+    static uint32_t nonceSequence = 0;
+    if (nonceSalt == 0) {
+        MX_RNG_Init();
+        nonceSalt = MX_RNG_Get();
+        MX_RNG_DeInit();
+    }
+    sentMessageCarrier.Nonce.Salt = nonceSalt;
+    sentMessageCarrier.Nonce.Sequence = (++nonceSequence & ~NONCE_SEQUENCE_GATEWAY) | (appIsGateway ? NONCE_SEQUENCE_GATEWAY : 0);
+
+    // Format the header for the next chunk, replying to sensors in the version that they sent
+    sentMessageCarrier.Version = appIsGateway ? sensorCacheMessageVersion(toAddress) : MESSAGE_VERSION;
     sentMessageCarrier.Algorithm = ((messageToSendFlags & MESSAGE_FLAG_BEACON) != 0) ? MESSAGE_ALG_CLEAR : MESSAGE_ALG_CTR;
     sentMessage.Signature = MESSAGE_SIGNATURE;
     sentMessage.Millivolts = batteryMillivolts;
@@ -234,17 +392,32 @@ void sendMessageToPeer(bool useTW, uint8_t *toAddress)
     sentMessage.SNR = messageToSendSNR;
     sentMessage.Flags = messageToSendFlags;
     sentMessage.RequestID = messageToSendRequestID;
-    uint32_t left = messageToSendDataLen - messageToSendAcknowledgedLen;
-    if (messageToSendAcknowledgedLen > messageToSendDataLen) {
+    if (!appIsGateway && gatewayAckSync && (messageToSendFlags & MESSAGE_FLAG_ACK) == 0) {
+        sentMessage.Flags |= MESSAGE_FLAG_SYNC;
+    }
+
+    // In a windowed transfer, send the lowest chunk that remains to be sent in this window
+    uint32_t offset = messageToSendAcknowledgedLen;
+    if (messageToSendWindowed && messageToSendWindowMap != 0 && (messageToSendFlags & MESSAGE_FLAG_ACK) == 0) {
+        for (uint32_t map = messageToSendWindowMap; (map & 1) == 0; map >>= 1) {
+            offset += MESSAGE_MAX_CHUNK;
+        }
+        sentMessage.Flags |= MESSAGE_FLAG_WINDOW;
+        if ((messageToSendWindowMap & (messageToSendWindowMap-1)) == 0) {
+            sentMessage.Flags |= MESSAGE_FLAG_WINDOW_END;
+        }
+    }
+    uint32_t left = messageToSendDataLen - offset;
+    if (offset > messageToSendDataLen) {
         left = 0;
     }
-    sentMessage.Offset = messageToSendAcknowledgedLen;
-    sentMessage.Len = (left <= MESSAGE_MAX_BODY) ? (uint16_t) left : MESSAGE_MAX_BODY;
+    sentMessage.Offset = offset;
+    sentMessage.Len = (left <= MESSAGE_MAX_CHUNK) ? (uint16_t) left : MESSAGE_MAX_CHUNK;
     sentMessage.TotalLen = messageToSendDataLen;
     memcpy(sentMessageCarrier.Sender, ourAddress, sizeof(sentMessageCarrier.Sender));
     memcpy(sentMessageCarrier.Receiver, toAddress, sizeof(sentMessageCarrier.Receiver));
     if (sentMessage.Len) {
-        memcpy(sentMessage.Body, &messageToSendData[messageToSendAcknowledgedLen], sentMessage.Len);
+        memcpy(sentMessage.Body, &messageToSendData[offset], sentMessage.Len);
     }
 
     const char *m1 = "sending (";
@@ -271,6 +444,22 @@ void sendMessageToPeer(bool useTW, uint8_t *toAddress)
         sentMessage.Body[sentMessage.Len+i] = i;
     }
 
+    // Now that its time-on-air is known, stamp the time into an ACK as of when the peer will have
+    // finished receiving it, and then send it at exactly the time that the stamp assumes.  The
+    // transmit itself begins only after lbtTalk() has waited for the radio to wake up.
+    bool sendAtStamp = false;
+    uint32_t sendAtMs = 0;
+    uint32_t stampLen = sizeof(uint32_t) + sizeof(uint16_t);
+    if (messageToSendTimeStampOffset >= 0 && offset == 0 && (uint32_t) messageToSendTimeStampOffset + stampLen <= sentMessage.Len && timeSyncValid()) {
+        sendAtStamp = true;
+        sendAtMs = (uint32_t) TIMER_IF_GetTimeMs() + RADIO_TURNAROUND_ALLOWANCE_MS;
+        uint64_t receivedMs = timeSyncAt(sendAtMs + radioWakeupRequiredMs() + radioTimeOnAirMs(sentMessageCarrierLen) + TIME_SYNC_LATENCY_MS);
+        uint32_t secs = (uint32_t) (receivedMs / 1000);
+        uint16_t ms = (uint16_t) (receivedMs % 1000);
+        memcpy(&sentMessage.Body[messageToSendTimeStampOffset], &secs, sizeof(secs));
+        memcpy(&sentMessage.Body[messageToSendTimeStampOffset+sizeof(secs)], &ms, sizeof(ms));
+    }
+
     // See if encryption is necessary
     if (sentMessageCarrier.Algorithm == MESSAGE_ALG_CLEAR) {
 
@@ -300,14 +489,28 @@ void sendMessageToPeer(bool useTW, uint8_t *toAddress)
 #endif
 
         // Encrypt the data
-        bool success = MX_AES_CTR_Encrypt(key, (uint8_t *)&sentMessage, sentMessageCarrier.MessageLen, (uint8_t *)&sentMessageCarrier.Message);
+        uint32_t nonceIV[4];
+        uint32_t *iv = appCarrierIV(&sentMessageCarrier, nonceIV);
+        bool success = MX_AES_CTR_Encrypt(key, iv, (uint8_t *)&sentMessage, sentMessageCarrier.MessageLen, (uint8_t *)&sentMessageCarrier.Message);
         memcpy(key, invalidKey, sizeof(key));
+
+        // Never send a message that couldn't be encrypted, but rather fail it as though
+        // it couldn't be transmitted
         if (!success) {
             APP_PRINTF("encryption error\r\n");
+            memset(&sentMessageCarrier.Message, 0, sizeof(sentMessageCarrier.Message));
+            appSetCoreState(TX_TIMEOUT);
+            return;
         }
 
     }
 
+    // Legacy carriers have no nonce
+    if (sentMessageCarrier.Version < MESSAGE_VERSION_NONCE) {
+        memmove(&sentMessageCarrier.Nonce, &sentMessageCarrier.Message, sentMessageCarrier.MessageLen);
+        sentMessageCarrierLen -= sizeof(sentMessageCarrier.Nonce);
+    }
+
     // If this is the gateway, just send it
     if (!useTW) {
 
@@ -315,7 +518,16 @@ void sendMessageToPeer(bool useTW, uint8_t *toAddress)
         // receive mode quickly enough, and our reply got there too soon.
         // This gives some breathing room.  Note that we don't need
         // to do this if we're using LBT because the LBT delay is sufficient.
-        if (RADIO_TURNAROUND_ALLOWANCE_MS != 0) {
+        // Within a window, the peer is only restarting its receive and isn't
+        // turning around to transmit, and so a much shorter gap is sufficient.
+        if (messageToSendWindowContinuing) {
+            HAL_Delay(MESSAGE_WINDOW_GAP_MS);
+        } else if (sendAtStamp) {
+            int32_t waitMs = (int32_t) (sendAtMs - (uint32_t) TIMER_IF_GetTimeMs());
+            if (waitMs > 0) {
+                HAL_Delay(waitMs);
+            }
+        } else if (RADIO_TURNAROUND_ALLOWANCE_MS != 0) {
             HAL_Delay(RADIO_TURNAROUND_ALLOWANCE_MS);
         }
 
@@ -339,7 +551,11 @@ void sendMessageToPeer(bool useTW, uint8_t *toAddress)
     HAL_Delay(100);
     ledIndicateTransmitInProgress(false);
     UTIL_TIMER_Create(&twSleepTimer, 0xFFFFFFFFU, UTIL_TIMER_ONESHOT, twOpenEvent, NULL);
-    UTIL_TIMER_SetPeriod(&twSleepTimer, (sleepSecs*1000)+1);
+    uint32_t sleepMs = (sleepSecs*1000)+1;
+    if (twSendInSlot && timeSyncValid()) {
+        sleepMs = timeSyncMsUntil(twSlotBeginsTime)+1;
+    }
+    UTIL_TIMER_SetPeriod(&twSleepTimer, sleepMs);
     UTIL_TIMER_Start(&twSleepTimer);
 
     // Wait
@@ -347,6 +563,84 @@ void sendMessageToPeer(bool useTW, uint8_t *toAddress)
 
 }
 
+// Choose the chunks of the next window of a windowed transfer, which are the first of
+// those that the peer's most recent selective ACK indicates it hasn't yet received.
+void windowPlan()
+{
+    messageToSendWindowMap = 0;
+    if (!messageToSendWindowed) {
+        return;
+    }
+    uint32_t chunks = 0;
+    for (uint32_t i=0; i<32 && chunks<MESSAGE_WINDOW_CHUNKS; i++) {
+        if (messageToSendAcknowledgedLen + (i*MESSAGE_MAX_CHUNK) >= messageToSendDataLen) {
+            break;
+        }
+        if ((messageToSendReceivedMap & (1UL << i)) == 0) {
+            messageToSendWindowMap |= (1UL << i);
+            chunks++;
+        }
+    }
+}
+
+// Having transmitted a chunk of a window, send the next chunk without waiting for an ACK.
+// Returns false if the window is complete and the ACK should now be awaited.
+bool windowSendNext(uint8_t *toAddress)
+{
+    if (!messageToSendWindowed || (sentMessage.Flags & (MESSAGE_FLAG_ACK|MESSAGE_FLAG_WINDOW)) != MESSAGE_FLAG_WINDOW) {
+        return false;
+    }
+    messageToSendWindowMap &= messageToSendWindowMap - 1;
+    if (messageToSendWindowMap == 0) {
+        return false;
+    }
+    messageToSendWindowContinuing = true;
+    sendMessageToPeer(false, toAddress);
+    messageToSendWindowContinuing = false;
+    return true;
+}
+
+// Place a received chunk of a windowed transfer into the receive buffer, advancing the
+// length received contiguously.  Returns false if the chunk is inconsistent with the transfer.
+bool windowReceive(uint8_t *data, uint32_t totalLen, uint32_t *ackedLen, uint32_t *receivedMap)
+{
+
+    // Chunks below the contiguously-received length are duplicates
+    uint32_t offset = wireReceived.Offset;
+    if (offset < *ackedLen) {
+        APP_PRINTF("%s *** duplicate chunk ***\r\n", tracePeer());
+        macStat.duplicates++;
+        return true;
+    }
+
+    // Validate the chunk's position and length
+    uint32_t chunk = (offset - *ackedLen) / MESSAGE_MAX_CHUNK;
+    uint32_t expectedLen = (totalLen - offset < MESSAGE_MAX_CHUNK) ? totalLen - offset : MESSAGE_MAX_CHUNK;
+    if (offset >= totalLen || ((offset - *ackedLen) % MESSAGE_MAX_CHUNK) != 0 || chunk >= 32 || wireReceived.Len != expectedLen) {
+        APP_PRINTF("%s *** chunk has wrong offset or length *** (%d/%d)\r\n", tracePeer(), offset, wireReceived.Len);
+        return false;
+    }
+
+    // Place it
+    if ((*receivedMap & (1UL << chunk)) != 0) {
+        APP_PRINTF("%s *** duplicate chunk ***\r\n", tracePeer());
+        macStat.duplicates++;
+    } else {
+        if (data != NULL) {
+            memcpy(&data[offset], wireReceived.Body, wireReceived.Len);
+        }
+        *receivedMap |= (1UL << chunk);
+    }
+
+    // Advance over everything now received contiguously
+    while ((*receivedMap & 1) != 0) {
+        *ackedLen += (totalLen - *ackedLen < MESSAGE_MAX_CHUNK) ? totalLen - *ackedLen : MESSAGE_MAX_CHUNK;
+        *receivedMap >>= 1;
+    }
+    return true;
+
+}
+
 // Get stats relating to last wire message received, both from our perspective and the remote perspective
 void appReceivedMessageStats(int8_t *gtxdb, int8_t *grssi, int8_t *grsnr, int8_t *stxdb, int8_t *srssi, int8_t *srsnr)
 {
@@ -418,7 +712,7 @@ uint32_t appTransmitWindowWaitMaxSecs()
 // Compute the next transmit window and its expiration
 uint32_t appNextTransmitWindowDueSecs()
 {
-    uint32_t now = NoteTimeST();
+    uint32_t now = timeSyncNowSecs();
 
     // Make sure the modulus and other params are within range
     if (!NoteTimeValidST() && !MX_DBG_Active() && twSlotBeginsTime == 0) {
@@ -487,8 +781,10 @@ uint32_t appNextTransmitWindowDueSecs()
             slotBeginsSecs += (TWSlotEndsSecs - TWSlotBeginsSecs) / 2;
         }
 
-        // If we're within the first 3 seconds of the current slot, the time is NOW
-        if (windowRelativeNowTime < thisWindowBeginTime + (slotBeginsSecs + 3)) {
+        // If we're within the first few seconds of the current slot, the time is NOW.  If our time
+        // is synchronized to the millisecond, the gateway expects us only at the start of the slot.
+        uint32_t lateSecs = timeSyncValid() ? TW_SLOT_START_SYNCED_SECS-1 : 3;
+        if (windowRelativeNowTime < thisWindowBeginTime + (slotBeginsSecs + lateSecs)) {
             twSlotBeginsTime = now + ((thisWindowBeginTime + slotBeginsSecs) - windowRelativeNowTime);
             twSlotExpiresTime = now + ((thisWindowBeginTime + TWSlotEndsSecs) - windowRelativeNowTime);
 #ifdef TW_TRACE
@@ -512,8 +808,10 @@ uint32_t appNextTransmitWindowDueSecs()
     }
 
     // If an override for a manual ping, do it now
+    twSendInSlot = NoteTimeValidST();
     if (twForceIgnore) {
         twForceIgnore = false;
+        twSendInSlot = false;
         return 1;
     }
 
@@ -532,7 +830,12 @@ bool lbtListenBeforeTalk()
         ListenPhaseBeforeTalk = false;
         return false;
     }
+    uint32_t attempt = twLBTRetries - twLBTRetriesRemaining;
     twLBTRetriesRemaining--;
+    macStat.lbtListens++;
+    if (attempt == 0) {
+        lbtBeganMs = TIMER_IF_GetTimeMs();
+    }
 
     // Listen before talk
     memset(&wireReceivedCarrier, 0, sizeof(wireReceivedCarrier));
@@ -541,16 +844,39 @@ bool lbtListenBeforeTalk()
     ledIndicateTransmitInProgress(true);
     radioSetChannel();
     ListenPhaseBeforeTalk = true;
+#if LBT_MODE == LBT_MODE_CAD
+    if (attempt == 0) {
+        radioCad();
+    } else {
+        uint32_t exp = (attempt-1 < LBT_CAD_BACKOFF_EXP_MAX) ? attempt-1 : LBT_CAD_BACKOFF_EXP_MAX;
+        uint32_t windowMs = radioTimeOnAirMs(sentMessageCarrierLen) << exp;
+        MX_RNG_Init();
+        uint32_t backoffMs = (MX_RNG_Get() % windowMs) + 1;
+        MX_RNG_DeInit();
+        UTIL_TIMER_Create(&lbtBackoffTimer, 0xFFFFFFFFU, UTIL_TIMER_ONESHOT, lbtBackoffEvent, NULL);
+        UTIL_TIMER_SetPeriod(&lbtBackoffTimer, backoffMs);
+        UTIL_TIMER_Start(&lbtBackoffTimer);
+    }
+#else
     if (TWListenBeforeTalkMs < TW_LBT_PERIOD_MS) {
         TWListenBeforeTalkMs = TW_LBT_PERIOD_MS;
     }
     radioRx(TWListenBeforeTalkMs);
+#endif
     appSetCoreState(LOWPOWER);
 
     return true;
 
 }
 
+#if LBT_MODE == LBT_MODE_CAD
+// Detect channel activity again after backing off from a busy channel
+void lbtBackoffEvent(void *context)
+{
+    appSetCoreState(LBT_CAD);
+}
+#endif
+
 // Talk after a successful listen
 void lbtTalk()
 {
@@ -561,6 +887,11 @@ void lbtTalk()
     if (!appIsGateway) {
         atpGatewayMessageSent();
     }
+    if (ListenPhaseBeforeTalk && lbtBeganMs != 0) {
+        macStat.lbtTalks++;
+        macStat.lbtDelayMs += (uint32_t) (TIMER_IF_GetTimeMs() - lbtBeganMs);
+    }
+    lbtBeganMs = 0;
     radioSetChannel();
     HAL_Delay(radioWakeupRequiredMs());
     sentMessageMs = TIMER_IF_GetTimeMs();
@@ -581,18 +912,35 @@ void sensorSendReqToGateway(J *req, bool responseRequested)
     // Show the request ID
     APP_PRINTF("%s %s\r\n", tracePeer(), JGetString(req, "req"));
 
-    // Convert it to JSON and send it
-    uint8_t *reqJSON = (uint8_t *) JConvertToJSONString(req);
-    uint32_t reqJSONLen = strlen((char *)reqJSON);
+    // Let the gateway know how often to expect us, so that it can schedule our slot
+    uint32_t periodSecs = noteSendPeriodSecs(schedSendPeriodSecs());
+    if (periodSecs != 0 && gatewayMessageVersion >= MESSAGE_VERSION_PERIOD) {
+        JAddNumberToObject(req, REQUEST_FIELD_PERIOD, periodSecs);
+    }
+
+    // Learn the number formats of any template, so that notes are encoded compactly
+    bjsonLearnTemplate(req);
+
+    // Convert it to binary if the gateway understands it, else to JSON, and send it
+    uint8_t *reqData;
+    uint32_t reqDataLen = 0;
+    if (gatewayMessageVersion >= MESSAGE_VERSION_BINARY) {
+        reqData = bjsonEncode(req, &reqDataLen);
+    } else {
+        reqData = (uint8_t *) JConvertToJSONString(req);
+        if (reqData != NULL) {
+            reqDataLen = strlen((char *)reqData);
+        }
+    }
 
     // Delete the request now that it's converted
     JDelete(req);
 
     // Send it to the gateway
-    if (reqJSON == NULL) {
+    if (reqData == NULL) {
         sensorSendToGateway(false, NULL, 0, false);
     } else {
-        sensorSendToGateway(responseRequested, reqJSON, reqJSONLen, true);
+        sensorSendToGateway(responseRequested, reqData, reqDataLen, true);
     }
 
 }
@@ -621,9 +969,15 @@ void sensorSendToGateway(bool responseRequested, uint8_t *message, uint32_t leng
     uint32_t requestID = ++LastRequestID;
     traceSetID("to", gatewayAddress, requestID);
 
+    // Compress it if it would otherwise require multiple chunks
+    uint8_t flags = responseRequested ? MESSAGE_FLAG_RESPONSE : 0;
+    if (dealloc && compressPayload(gatewayMessageVersion, &message, &length)) {
+        flags |= MESSAGE_FLAG_COMPRESSED;
+    }
+
     // Send it
     APP_PRINTF("%s sensor sending request (%d)\r\n", tracePeer(), length);
-    sendToPeer(true, responseRequested ? MESSAGE_FLAG_RESPONSE : 0,
+    sendToPeer(true, flags,
                wireReceiveRSSI, wireReceiveSNR, gatewayAddress,
                requestID, message, length, dealloc);
 
@@ -638,6 +992,7 @@ bool sensorResendToGateway()
         return false;
     }
     sensorSendRetriesRemaining--;
+    macStat.requestsRetried++;
 
     // Set sensor response state
     bool responseRequested = (messageToSendFlags & MESSAGE_FLAG_RESPONSE) != 0;
@@ -684,6 +1039,15 @@ bool sendTimeout()
     return false;
 }
 
+// Resend what we last sent to the gateway after a timeout.  The window of a windowed
+// transfer will have been used up as its chunks were sent, and so it is planned again
+// so that the chunks are resent as a window, which the gateway requires of them.
+void sensorResendAfterTimeout()
+{
+    windowPlan();
+    sendMessageToPeer(false, gatewayAddress);
+}
+
 // Process a request from a gateway
 void processSensorRequest(requestState *request, bool respond)
 {
@@ -691,16 +1055,33 @@ void processSensorRequest(requestState *request, bool respond)
     // Free the existing buffer and initialize for sending the message back
     uint8_t *reqJSON = request->data;
     uint32_t reqJSONLen = request->dataTotalLen;
+    bool reqCompressed = request->dataCompressed;
     request->data = NULL;
     request->dataTotalLen = 0;
     request->dataAcknowledgedLen = 0;
+    request->dataCompressed = false;
+
+    // Decompress the request if necessary
+    if (reqCompressed && reqJSON != NULL) {
+        uint32_t decompressedLen;
+        uint8_t *decompressed = compressDecode(reqJSON, reqJSONLen, &decompressedLen);
+        memset(reqJSON, '?', reqJSONLen);
+        free(reqJSON);
+        reqJSON = decompressed;
+        reqJSONLen = decompressed == NULL ? 0 : decompressedLen;
+        if (reqJSON == NULL) {
+            APP_PRINTF("%s *** can't decompress request ***\r\n", tracePeer());
+        }
+    }
 
     // Process the request if we haven't successfully processed it before and if no response is required
     if (!respond && request->lastProcessedRequestID != 0 && request->currentRequestID == request->lastProcessedRequestID) {
         APP_PRINTF("%s *** ignoring duplicate request ***\r\n", tracePeer());
-        memset(reqJSON, '?', reqJSONLen);
-        free(reqJSON);
-    } else {
+        if (reqJSON != NULL) {
+            memset(reqJSON, '?', reqJSONLen);
+            free(reqJSON);
+        }
+    } else if (reqJSON != NULL) {
         uint8_t *rspData;
         uint32_t rspDataLen;
         bool success = gatewayProcessSensorRequest(request->sensorAddress, reqJSON, reqJSONLen, &rspData, &rspDataLen);
@@ -710,6 +1091,7 @@ void processSensorRequest(requestState *request, bool respond)
 
             // Bump request statistics
             request->requestsProcessed++;
+            macStat.requestsCompleted++;
             if (request->lastProcessedRequestID != 0 && request->currentRequestID > request->lastProcessedRequestID) {
                 request->requestsLost += (request->currentRequestID - request->lastProcessedRequestID) - 1;
             }
@@ -726,16 +1108,24 @@ void processSensorRequest(requestState *request, bool respond)
     // Transmit the response to the sensor if one was requested
     if (respond) {
 
+        // Compress the response if it would otherwise require multiple chunks
+        if (request->data != NULL) {
+            request->dataCompressed = compressPayload(request->messageVersion, &request->data, &request->dataTotalLen);
+        }
+        request->twResponseBytes = twTypicalBytes(request->twResponseBytes, request->dataTotalLen);
+
         // Send response.  Note that we will retain responsibility for deallocation
         request->receivingRequest = false;
         request->sendingResponse = true;
-        sendToPeer(false, 0, request->gatewayRSSI, request->gatewaySNR,
+        sendToPeer(false, request->dataCompressed ? MESSAGE_FLAG_COMPRESSED : 0, request->gatewayRSSI, request->gatewaySNR,
                    request->sensorAddress, request->currentRequestID,
                    request->data, request->dataTotalLen, false);
+        request->dataWindowed = messageToSendWindowed;
 
     } else {
 
         // Done, because no response is required
+        request->twResponseBytes = twTypicalBytes(request->twResponseBytes, 0);
         request->receivingRequest = false;
         request->sendingResponse = false;
         if (request->data != NULL) {
@@ -743,14 +1133,46 @@ void processSensorRequest(requestState *request, bool respond)
             free(request->data);
             request->data = NULL;
         }
-        gatewayWaitForAnySensorMessage();
 
-        // Do housekeeping by borrowing time from the sensor's window
-        gatewayHousekeeping(forceSensorRefresh, cachedSensors);
-        forceSensorRefresh = false;
+    }
+
+}
 
+// Perform a request that was queued because the sensor needn't wait for its response.
+// This is done while the radio is listening for any sensor, so that the gateway isn't
+// deaf for the duration of the Notecard transaction, and only one is done per pass so
+// that received packets are dispatched in between.  Returns true if one was performed.
+bool gatewayProcessPending()
+{
+    for (int i=sensorMRUTail; i!=SENSOR_SLOT_NONE; i=requestCache[i].mruPrev) {
+        requestState *request = &requestCache[i];
+        if (request->processingPending) {
+            request->processingPending = false;
+            traceSetID("fm", request->sensorAddress, request->currentRequestID);
+            processSensorRequest(request, false);
+            return true;
+        }
     }
+    return false;
+}
 
+// Resume sending a response from where the sensor's session left off.  The transmitter
+// is shared, and so it is reloaded from the session because transfers with other sensors
+// may have used it since this sensor's previous chunk was sent.
+void gatewaySendResponse(requestState *request)
+{
+    freeMessageToSendBuffer();
+    messageToSendData = request->data;
+    messageToSendDataLen = request->dataTotalLen;
+    messageToSendAcknowledgedLen = request->dataAcknowledgedLen;
+    messageToSendRequestID = request->currentRequestID;
+    messageToSendFlags = request->dataCompressed ? MESSAGE_FLAG_COMPRESSED : 0;
+    messageToSendRSSI = request->gatewayRSSI;
+    messageToSendSNR = request->gatewaySNR;
+    messageToSendWindowed = request->dataWindowed;
+    messageToSendReceivedMap = request->dataReceivedMap;
+    windowPlan();
+    sendMessageToPeer(false, request->sensorAddress);
 }
 
 // Wait for a message from a specific sensor
@@ -767,17 +1189,24 @@ void gatewayWaitForSensorMessage()
     appSetCoreState(LOWPOWER);
 }
 
-// Wait for a message from any sensor
+// Wait for a message from any sensor, at the spreading factor of the sensor (if any) that
+// is expected to be transmitting, coming back when that changes.
 void gatewayWaitForAnySensorMessage()
 {
     memset(&wireReceivedCarrier, 0, sizeof(wireReceivedCarrier));
     memset(&wireReceived, 0, sizeof(wireReceived));
     ledIndicateReceiveInProgress(true);
+    uint32_t untilSecs;
+    radioSetSpreadingFactor(twSlotSpreadingFactor(&untilSecs));
+    UTIL_TIMER_Stop(&twSlotTimer);
+    if (untilSecs != 0) {
+        twSlotTimerStart(untilSecs);
+    }
     radioSetChannel();
     wireReceiveTimeoutMs = UNSOLICITED_RX_TIMEOUT_VALUE;
     ListenPhaseBeforeTalk = false;
     radioRx(wireReceiveTimeoutMs);
-    showReceivedTime("rx", 0, 0);
+    showReceivedTime("rx", NULL);
     APP_PRINTF("\r\n");
     appSetCoreState(LOWPOWER);
 }
@@ -819,7 +1248,7 @@ void restartReceive(uint32_t timeoutMs)
     radioSetChannel();
     ListenPhaseBeforeTalk = false;
     radioRx(timeoutMs);
-    showReceivedTime("restarting rx", 0, 0);
+    showReceivedTime("restarting rx", NULL);
     APP_PRINTF("\r\n");
     appSetCoreState(LOWPOWER);
     return;
@@ -830,6 +1259,9 @@ void appSensorInit()
 {
     // Initialize the scheduler
     schedInit();
+
+    // Recover any notes that were retained across a reset
+    outboxInit();
 }
 
 // Set sensor task in a low power core state
@@ -886,13 +1318,19 @@ void appSensorProcess()
     // Dispatch based upon state
     switch (CurrentStateCore) {
 
+    case LBT_CAD:
+        radioCad();
+        appSetCoreState(LOWPOWER);
+        break;
+
     case TW_OPEN:
-        if (NoteTimeST() >= twSlotExpiresTime) {
+        if (timeSyncNowSecs() >= twSlotExpiresTime) {
             APP_PRINTF("%s *** transmit window expired ***\r\n", tracePeer());
             schedRequestResponseTimeout();
             sensorCoreIdle();
             break;
         }
+        radioSetSpreadingFactor((twSendInSlot && !ledIsPairInProgress()) ? TWSpreadingFactor : LORA_SPREADING_FACTOR);
         twLBTRetriesRemaining = twLBTRetries;
         if (!lbtListenBeforeTalk()) {
             lbtTalk();
@@ -905,6 +1343,7 @@ void appSensorProcess()
         // If we've successfully received something while we're in an LBT 'listening'
         // phase, it means that we need to try again until there is nobody speaking.
         if (ListenPhaseBeforeTalk) {
+            macStat.lbtBusy++;
             if (lbtListenBeforeTalk()) {
                 break;
             }
@@ -916,14 +1355,16 @@ void appSensorProcess()
 
         // Decrypt and validate the received message, ignoring it if invalid
         if (!validateReceivedMessage()) {
+            macStat.rxInvalid++;
             if (sendTimeout()) {
-                sendMessageToPeer(false, gatewayAddress);
+                sensorResendAfterTimeout();
             } else {
                 restartReceive(wireReceiveTimeoutMs);
             }
             break;
         }
         traceSetID("fm", wireReceivedCarrier.Sender, wireReceived.RequestID);
+        gatewayMessageVersion = wireReceivedCarrier.Version;
 
         // If this is a beacon ACK, set the gateway address and turn off beacon mode
         if (ledIsPairInProgress()) {
@@ -961,7 +1402,7 @@ void appSensorProcess()
         if (memcmp(gatewayAddress, wireReceivedCarrier.Sender, sizeof(gatewayAddress)) != 0) {
             APP_PRINTF("%s message received by sensor from wrong gateway\r\n", tracePeer());
             if (sendTimeout()) {
-                sendMessageToPeer(false, gatewayAddress);
+                sensorResendAfterTimeout();
             } else {
                 restartReceive(wireReceiveTimeoutMs);
             }
@@ -972,21 +1413,39 @@ void appSensorProcess()
         if ((wireReceived.Flags & MESSAGE_FLAG_ACK) != 0) {
             APP_PRINTF("%s ack received\r\n", tracePeer());
 
+            // Remove the selective acknowledgement of a windowed transfer from the end of the body
+            wireWindowAck windowAck = {0};
+            bool windowAcked = false;
+            if ((wireReceived.Flags & MESSAGE_FLAG_WINDOW) != 0 && wireReceived.Len >= sizeof(windowAck)) {
+                wireReceived.Len -= sizeof(windowAck);
+                memcpy(&windowAck, &wireReceived.Body[wireReceived.Len], sizeof(windowAck));
+                windowAcked = true;
+            }
+
+            // Decode the body, noting that a compact body only updates what was last received
+            static gatewayAckBody ackConfig = {0};
+            bool ackValid = false;
+            bool ackHasTime = false;
+            int32_t ackTimeMs = -1;
+            bool gatewayRebooted = false;
+            if (wireReceivedCarrier.Version >= MESSAGE_VERSION_COMPACT_ACK) {
+                ackValid = sensorAckDecode(wireReceived.Body, wireReceived.Len, &ackConfig, &ackHasTime, &ackTimeMs);
+            } else if (wireReceived.Len >= sizeof(gatewayAckBody)-SENSOR_NAME_MAX && wireReceived.Len <= sizeof(gatewayAckBody)) {
+                uint32_t sensorNameLen = wireReceived.Len - (sizeof(gatewayAckBody)-SENSOR_NAME_MAX);
+                memcpy(&ackConfig, wireReceived.Body, wireReceived.Len);
+                ackConfig.Name[sensorNameLen == 0 ? 0 : sensorNameLen-1] = '\0';
+                ackValid = ackHasTime = true;
+            }
+
             // Extract and set the sensor time
-            if (wireReceived.Len >= sizeof(gatewayAckBody)-SENSOR_NAME_MAX) {
-                gatewayAckBody *body = (gatewayAckBody *)wireReceived.Body;
+            if (ackValid) {
+                gatewayAckBody *body = &ackConfig;
 
                 // Extract sensor name
-                uint32_t sensorNameLen = wireReceived.Len - (sizeof(gatewayAckBody)-SENSOR_NAME_MAX);
-                if (sensorNameLen == 0) {
-                    sensorName[0] = '\0';
-                } else {
-                    memcpy(sensorName, body->Name, sizeof(sensorName));
-                    sensorName[sensorNameLen-1] = '\0';
-                    for (size_t i=0; i<sensorNameLen-1; i++) {
-                        if (sensorName[i] < ' ') {
-                            sensorName[i] = '?';
-                        }
+                strlcpy(sensorName, body->Name, sizeof(sensorName));
+                for (size_t i=0; sensorName[i] != '\0'; i++) {
+                    if (sensorName[i] < ' ') {
+                        sensorName[i] = '?';
                     }
                 }
 
@@ -994,18 +1453,24 @@ void appSensorProcess()
                 // way of resetting the world remotely.
                 if (body->BootTime != 0) {
                     if (gatewayBootTime != 0 && body->BootTime != gatewayBootTime) {
-                        NVIC_SystemReset();
+                        gatewayRebooted = true;
                     }
                     gatewayBootTime = body->BootTime;
                 }
 
                 // Extract the gateway's date/time and set it locally
-                char zone[4];
-                zone[0] = body->ZoneName[0];
-                zone[1] = body->ZoneName[1];
-                zone[2] = body->ZoneName[2];
-                zone[3] = '\0';
-                NoteTimeSet(body->Time, body->ZoneOffsetMins, zone, NULL, NULL);
+                if (ackHasTime) {
+                    char zone[4];
+                    zone[0] = body->ZoneName[0];
+                    zone[1] = body->ZoneName[1];
+                    zone[2] = body->ZoneName[2];
+                    zone[3] = '\0';
+                    if (ackTimeMs >= 0) {
+                        timeSyncSet(((uint64_t) body->Time * 1000) + ackTimeMs, wireReceivedMs);
+                        body->Time = timeSyncNowSecs();
+                    }
+                    NoteTimeSet(body->Time, body->ZoneOffsetMins, zone, NULL, NULL);
+                }
 
                 // Trace
                 if (TWModulusSecs != body->TWModulusSecs) {
@@ -1036,8 +1501,26 @@ void appSensorProcess()
 
             }
 
-            // Send the next chunk of the request
-            messageToSendAcknowledgedLen += sentMessage.Len;
+            // Send the next chunk of the request, or the next window of chunks
+            if (windowAcked && messageToSendWindowed) {
+                messageToSendAcknowledgedLen = (windowAck.Offset < messageToSendDataLen) ? windowAck.Offset : messageToSendDataLen;
+                messageToSendReceivedMap = windowAck.Received;
+                windowPlan();
+            } else {
+                messageToSendAcknowledgedLen += sentMessage.Len;
+            }
+
+            // Restart because the gateway rebooted, but first settle the notes of the request
+            // in flight, which the outbox keeps across the restart.  Those that reached the
+            // gateway mustn't be sent again, and those that didn't must be retained.
+            if (gatewayRebooted) {
+                if (messageToSendAcknowledgedLen < messageToSendDataLen) {
+                    noteRequestFailed(messageToSendData, messageToSendDataLen, (messageToSendFlags & MESSAGE_FLAG_COMPRESSED) != 0);
+                } else {
+                    noteRequestCompleted();
+                }
+                NVIC_SystemReset();
+            }
             if (messageToSendAcknowledgedLen < messageToSendDataLen) {
                 sendMessageToPeer(false, gatewayAddress);
                 break;
@@ -1045,6 +1528,8 @@ void appSensorProcess()
 
             // If a response is coming, wait for that response from the gateway
             schedRequestCompleted();
+            noteRequestCompleted();
+            macStat.requestsCompleted++;
             response.sendingRequest = false;
             response.receivingResponse = false;
             if (response.responseRequired) {
@@ -1060,7 +1545,10 @@ void appSensorProcess()
         // If this is the first chunk of the response, allocate the receive buffer.  Note that
         // we are careful to allocate 1 byte more than TotalLen because after the response is
         // received we will need to convert it to a null-terminated string so we can parse it.
-        if (wireReceived.Offset == 0 || wireReceived.RequestID != response.requestID) {
+        // In a windowed transfer the first chunk may arrive out of order, and so it only begins
+        // the response if we're not already receiving it.
+        bool windowed = (wireReceived.Flags & MESSAGE_FLAG_WINDOW) != 0;
+        if (wireReceived.RequestID != response.requestID || (wireReceived.Offset == 0 && !(windowed && response.receivingResponse))) {
             if (response.data != NULL) {
                 memset(response.data, '?', response.dataTotalLen);
                 free(response.data);
@@ -1072,13 +1560,25 @@ void appSensorProcess()
             response.data = (uint8_t *) malloc(wireReceived.TotalLen+1);
             response.dataTotalLen = wireReceived.TotalLen;
             response.dataAcknowledgedLen = 0;
+            response.dataReceivedMap = 0;
+            response.dataCompressed = (wireReceived.Flags & MESSAGE_FLAG_COMPRESSED) != 0;
             response.requestID = wireReceived.RequestID;
         }
 
+        // Place a chunk of a windowed transfer wherever it belongs
+        if (windowed) {
+
+            if (!windowReceive(response.data, response.dataTotalLen, &response.dataAcknowledgedLen, &response.dataReceivedMap)) {
+                schedRequestResponseTimeout();
+                sensorCoreIdle();
+                break;
+            }
+
         // If this is a duplicate, skip it
-        if (wireReceived.Offset+wireReceived.Len == response.dataAcknowledgedLen) {
+        } else if (wireReceived.Offset+wireReceived.Len == response.dataAcknowledgedLen) {
 
             APP_PRINTF("%s *** re-acking duplicate message ***\r\n", tracePeer());
+            macStat.duplicates++;
 
         } else {
 
@@ -1108,22 +1608,57 @@ void appSensorProcess()
         // We can no longer retry this request because we're about to free the message buffer
         sensorSendRetriesRemaining = 0;
 
-        // Ack this received packet
+        // Within a window, only the last chunk is acknowledged
+        if (windowed && (wireReceived.Flags & MESSAGE_FLAG_WINDOW_END) == 0 && response.dataAcknowledgedLen < response.dataTotalLen) {
+            sensorWaitForGatewayMessage();
+            break;
+        }
+
+        // Ack this received packet, telling the gateway which chunks of a window were received
         messageToSendRequestID = response.requestID;
         messageToSendFlags = MESSAGE_FLAG_ACK;
         freeMessageToSendBuffer();
+        if (windowed) {
+            static wireWindowAck windowAck;
+            windowAck.Offset = response.dataAcknowledgedLen;
+            windowAck.Received = response.dataReceivedMap;
+            messageToSendFlags |= MESSAGE_FLAG_WINDOW;
+            messageToSendData = (uint8_t *) &windowAck;
+            messageToSendDataLen = sizeof(windowAck);
+        }
         sendMessageToPeer(false, gatewayAddress);
         break;
     }
 
     case TX: {
 
-        // Process the gateway response when it's completely received
+        // Send the rest of the window without waiting for an ACK
         traceSetID("to", sentMessageCarrier.Receiver, sentMessage.RequestID);
+        if (response.sendingRequest && windowSendNext(gatewayAddress)) {
+            break;
+        }
+
+        // Process the gateway response when it's completely received
         if (response.receivingResponse && response.dataAcknowledgedLen == response.dataTotalLen) {
             response.sendingRequest = false;
             response.receivingResponse = false;
 
+            // Decompress it if necessary, which also yields a null-terminated buffer
+            if (response.dataCompressed) {
+                uint32_t decompressedLen = 0;
+                uint8_t *decompressed = compressDecode(response.data, response.dataTotalLen, &decompressedLen);
+                memset(response.data, '?', response.dataTotalLen);
+                free(response.data);
+                response.data = decompressed;
+                response.dataTotalLen = decompressedLen;
+                response.dataCompressed = false;
+                if (response.data == NULL) {
+                    APP_PRINTF("%s *** can't decompress sensor response ***\r\n", tracePeer());
+                    sensorCoreIdle();
+                    break;
+                }
+            }
+
             // Convert it to a null-terminated string and parse it.  Note that we had explicitly
             // allocated this buffer 1 byte larger than we had needed explicitly for this purpose.
             response.data[response.dataTotalLen] = '\0';
@@ -1134,7 +1669,7 @@ void appSensorProcess()
                 schedResponseCompleted(rsp);
                 JDelete(rsp);
                 if (twSlotExpiresTimeWasValid && NoteTimeValidST()) {
-                    uint32_t now = NoteTimeST();
+                    uint32_t now = timeSyncNowSecs();
                     if (now > twSlotExpiresTime) {
                         APP_PRINTF("%s *** sensor used too much time (%d)\r\n", tracePeer(), now-twSlotExpiresTime);
                     } else {
@@ -1176,6 +1711,7 @@ void appSensorProcess()
         // If in LBT mode, this means the channel is busy and we couldn't successfully receive,
         // so we should either retry the listen or give up.
         if (ListenPhaseBeforeTalk) {
+            macStat.lbtBusy++;
             if (lbtListenBeforeTalk()) {
                 break;
             }
@@ -1220,13 +1756,23 @@ void sensorGatewayRequestFailure(bool wasTX, const char *why)
     // failures at the "boundary" that might happen as often as every other message.
     atpGatewayMessageLost();
 
+    // The link may no longer support the spreading factor that the gateway assigned to our
+    // slot, so revert to the default, at which the gateway listens outside of slots.
+    if (TWSpreadingFactor != LORA_SPREADING_FACTOR) {
+        APP_PRINTF("%s reverting from SF%d to SF%d\r\n", tracePeer(), TWSpreadingFactor, LORA_SPREADING_FACTOR);
+        TWSpreadingFactor = LORA_SPREADING_FACTOR;
+        sensorIgnoreTimeWindow();
+    }
+
     // If we can retry, do so during the next transmit window
     if (sensorResendToGateway()) {
         return;
     }
 
-    // Free the message buffer
+    // Retain its notes so that they may be sent later, then free the message buffer
+    noteRequestFailed(messageToSendData, messageToSendDataLen, (messageToSendFlags & MESSAGE_FLAG_COMPRESSED) != 0);
     freeMessageToSendBuffer();
+    macStat.requestsFailed++;
 
     // Abort with a lost message indication
     memset(&wireReceivedCarrier, 0, sizeof(wireReceivedCarrier));
@@ -1239,10 +1785,44 @@ void sensorGatewayRequestFailure(bool wasTX, const char *why)
 // Initialize gateway state machine
 void appGatewayInit()
 {
+    sensorCacheInit();
     gatewayHousekeeping(false, cachedSensors);
+    UTIL_TIMER_Create(&housekeepingTimer, 0xFFFFFFFFU, UTIL_TIMER_ONESHOT, housekeepingTimerEvent, NULL);
+    UTIL_TIMER_Create(&twSlotTimer, 0xFFFFFFFFU, UTIL_TIMER_ONESHOT, twSlotEvent, NULL);
     gatewayWaitForAnySensorMessage();
 }
 
+// Come back to housekeeping
+void housekeepingTimerEvent(void *context)
+{
+    UTIL_SEQ_SetTask((1 << CFG_SEQ_Task_Sparrow_Process), CFG_SEQ_Prio_0);
+}
+
+// Perform housekeeping a slice at a time while no sensor is expected to be transmitting,
+// otherwise coming back when it's next due or when the next quiet period begins.
+void gatewayHousekeepingPlan()
+{
+    uint32_t waitSecs = forceSensorRefresh ? 0 : gatewayHousekeepingDueSecs();
+    if (waitSecs == 0) {
+        waitSecs = twSecsUntilQuiet(GATEWAY_HOUSEKEEPING_SLICE_SECS);
+        if (waitSecs == 0) {
+            bool sliceDone = gatewayHousekeepingSlice(forceSensorRefresh, cachedSensors);
+            forceSensorRefresh = false;
+            if (sliceDone) {
+                UTIL_SEQ_SetTask((1 << CFG_SEQ_Task_Sparrow_Process), CFG_SEQ_Prio_0);
+                return;
+            }
+            waitSecs = gatewayHousekeepingDueSecs();
+            if (waitSecs == 0) {
+                waitSecs = GATEWAY_HOUSEKEEPING_RETRY_SECS;
+            }
+        }
+    }
+    UTIL_TIMER_Stop(&housekeepingTimer);
+    UTIL_TIMER_SetPeriod(&housekeepingTimer, waitSecs*1000);
+    UTIL_TIMER_Start(&housekeepingTimer);
+}
+
 // Application state machine for Gateway
 void appGatewayProcess()
 {
@@ -1262,12 +1842,16 @@ void appGatewayProcess()
     if (TraceEventOccurred) {
         TraceEventOccurred = false;
         traceInput();
-        gatewayHousekeeping(forceSensorRefresh, cachedSensors);
     }
 
     // Dispatch based upon state
     switch (CurrentStateCore) {
 
+    case LBT_CAD:
+        radioCad();
+        appSetCoreState(LOWPOWER);
+        break;
+
     case TW_OPEN:
         APP_PRINTF("%s *** INVALID STATE FOR GATEWAY ***\r\n", tracePeer());
         gatewayWaitForAnySensorMessage();
@@ -1278,6 +1862,7 @@ void appGatewayProcess()
         // If we've successfully received something while we're in an LBT 'listening'
         // phase, it means that we need to try again until there is nobody speaking.
         if (ListenPhaseBeforeTalk) {
+            macStat.lbtBusy++;
             if (lbtListenBeforeTalk()) {
                 break;
             }
@@ -1288,6 +1873,7 @@ void appGatewayProcess()
 
         // Decrypt and validate the received message, ignoring it if invalid
         if (!validateReceivedMessage()) {
+            macStat.rxInvalid++;
             restartReceive(wireReceiveTimeoutMs);
             break;
         }
@@ -1299,34 +1885,15 @@ void appGatewayProcess()
             radioSetTxPowerUnknown();
         }
 
-        // Find the sensor that is sending to us, and bubble it down to the 0th entry of the cache
-        requestState foundRequest;
-        int found = -1;
-        for (int i=0; i<cachedSensors; i++) {
-            if (memcmp(requestCache[i].sensorAddress, wireReceivedCarrier.Sender, sizeof(wireReceivedCarrier.Sender)) == 0) {
-                foundRequest = requestCache[i];
-                found = i;
-                break;
-            }
-        }
-        if (found == -1) {
-            if (cachedSensors < MAX_CACHED_SENSORS) {
-                cachedSensors++;
-            }
-            memset(&foundRequest, 0, sizeof(requestState));
-            memcpy(foundRequest.sensorAddress, wireReceivedCarrier.Sender, sizeof(wireReceivedCarrier.Sender));
+        // Find the sensor that is sending to us, making it the most recently used
+        bool isNewSensor;
+        requestState *request = sensorCacheLookup(wireReceivedCarrier.Sender, &isNewSensor);
+        if (isNewSensor) {
             APP_PRINTF("%s *** new sensor being cached ***\r\n", tracePeer());
-            found = cachedSensors-1;
             forceSensorRefresh = true;
         }
-        for (int i=cachedSensors-1; i>0; --i) {
-            if (i <= found) {
-                requestCache[i] = requestCache[i-1];
-            }
-        }
-        requestCache[0] = foundRequest;
-        requestState *request = &requestCache[0];
-        request->lastReceivedTime = NoteTimeST();
+        request->messageVersion = (wireReceivedCarrier.Version < MESSAGE_VERSION) ? wireReceivedCarrier.Version : MESSAGE_VERSION;
+        request->lastReceivedTime = timeSyncNowSecs();
         traceSetID("fm", request->sensorAddress, request->currentRequestID);
         APP_PRINTF("%s rcv txp:%d rssi:%d snr:%d\r\n", tracePeer(), wireReceived.TXP, wireReceived.RSSI, wireReceived.SNR);
 
@@ -1340,26 +1907,37 @@ void appGatewayProcess()
         request->sensorTXP = wireReceived.TXP;
         request->sensorLTP = wireReceived.LTP;
         request->sensorMv = wireReceived.Millivolts;
+        request->sfHeard = radioSpreadingFactor();
 
         // Notify atp subsystem of the power of the last message received
         atpMatchPowerLevel(wireReceived.TXP);
 
         // Display time of receipt
-        showReceivedTime((wireReceived.Flags & MESSAGE_FLAG_ACK) != 0 ? "rcv ack" : "rcv msg",
-                         request->twSlotBeginsSecs, request->twSlotEndsSecs);
+        showReceivedTime((wireReceived.Flags & MESSAGE_FLAG_ACK) != 0 ? "rcv ack" : "rcv msg", request);
 
         // We're sending a response back to the sensor and we get an ack on a chunk
         if ((wireReceived.Flags & MESSAGE_FLAG_ACK) != 0) {
 
-            // Send the next chunk of the response
+            // An ACK can't be for this sensor's request buffer, which is still being received
+            if (request->receivingRequest) {
+                APP_PRINTF("%s *** ignoring ACK while receiving request ***\r\n", tracePeer());
+                gatewayWaitForAnySensorMessage();
+                break;
+            }
+
+            // A windowed transfer is acknowledged selectively
+            bool windowAcked = (wireReceived.Flags & MESSAGE_FLAG_WINDOW) != 0 && wireReceived.Len >= sizeof(wireWindowAck);
+            if (windowAcked) {
+                wireWindowAck windowAck;
+                memcpy(&windowAck, &wireReceived.Body[wireReceived.Len-sizeof(windowAck)], sizeof(windowAck));
+                request->dataAcknowledgedLen = (windowAck.Offset < request->dataTotalLen) ? windowAck.Offset : request->dataTotalLen;
+                request->dataReceivedMap = windowAck.Received;
+            }
+
+            // Send the next chunk of the response, or the next window of chunks
             if (request->dataAcknowledgedLen < request->dataTotalLen) {
-                freeMessageToSendBuffer();
-                messageToSendData = request->data;
-                messageToSendDataLen = request->dataTotalLen;
-                messageToSendAcknowledgedLen = request->dataAcknowledgedLen;
-                messageToSendRequestID = request->currentRequestID;
-                messageToSendFlags = 0;
-                sendMessageToPeer(false, request->sensorAddress);
+                request->dataWindowed = windowAcked;
+                gatewaySendResponse(request);
                 break;
             }
 
@@ -1378,28 +1956,67 @@ void appGatewayProcess()
 
         }
 
-        // If this is the first chunk of the message, allocate the receive buffer
-        if (wireReceived.Offset == 0 || wireReceived.RequestID != request->currentRequestID) {
+        // If this is the first chunk of the message, allocate the receive buffer.  In a windowed
+        // transfer the first chunk may arrive out of order, or be retransmitted by a retry of
+        // the request, and so it only begins the request if we're not already receiving it.
+        bool windowed = (wireReceived.Flags & MESSAGE_FLAG_WINDOW) != 0;
+        if (wireReceived.RequestID != request->currentRequestID
+                || (wireReceived.Offset == 0 && !(windowed && request->receivingRequest && request->dataTotalLen == wireReceived.TotalLen))) {
+            if (request->processingPending) {
+                APP_PRINTF("%s performing queued request before receiving next\r\n", tracePeer());
+                request->processingPending = false;
+                processSensorRequest(request, false);
+            }
             if (request->data != NULL) {
                 memset(request->data, '?', request->dataTotalLen);
                 free(request->data);
                 request->data = NULL;
             }
+            if (wireReceived.RequestID == request->currentRequestID) {
+                request->dataRetries++;
+            } else {
+                request->dataRetries = 0;
+                request->dataBeganMs = (uint32_t) TIMER_IF_GetTimeMs();
+            }
             request->receivingRequest = true;
             request->sendingResponse = false;
             request->responseRequired = (wireReceived.Flags & MESSAGE_FLAG_RESPONSE) != 0;
+            request->dataCompressed = (wireReceived.Flags & MESSAGE_FLAG_COMPRESSED) != 0;
             request->data = (uint8_t *) malloc(wireReceived.TotalLen);
             request->dataTotalLen = wireReceived.TotalLen;
             request->dataAcknowledgedLen = 0;
+            request->dataReceivedMap = 0;
+            request->dataWindowed = windowed;
             request->currentRequestID = wireReceived.RequestID;
             traceSetID("fm", request->sensorAddress, request->currentRequestID);
             APP_PRINTF("%s now receiving request from sensor\r\n", tracePeer());
         }
 
+        // Note what we knew of the transfer before this chunk, for link statistics
+        bool wasReceived = (request->dataAcknowledgedLen >= request->dataTotalLen);
+        uint32_t duplicates = macStat.duplicates;
+
+        // Place a chunk of a windowed transfer wherever it belongs
+        if (windowed) {
+
+            if (!windowReceive(request->data, request->dataTotalLen, &request->dataAcknowledgedLen, &request->dataReceivedMap)) {
+                gatewayWaitForAnySensorMessage();
+                break;
+            }
+
+        // A windowed transfer's received map is relative to what has been received contiguously,
+        // and so it can't be continued by a chunk that isn't placed within the window
+        } else if (request->dataWindowed) {
+
+            APP_PRINTF("%s *** chunk is not windowed ***\r\n", tracePeer());
+            gatewayWaitForAnySensorMessage();
+            break;
+
         // If this is a duplicate, skip it
-        if (wireReceived.Offset+wireReceived.Len == request->dataAcknowledgedLen) {
+        } else if (wireReceived.Offset+wireReceived.Len == request->dataAcknowledgedLen) {
 
             APP_PRINTF("%s *** re-acking duplicate message ***\r\n", tracePeer());
+            macStat.duplicates++;
 
         } else {
 
@@ -1426,6 +2043,25 @@ void appGatewayProcess()
 
         }
 
+        // When the transfer has been fully received, add a sample to the link history
+        request->dataRetries += (macStat.duplicates - duplicates);
+        if (!wasReceived && request->dataAcknowledgedLen >= request->dataTotalLen) {
+            linkStatsSample(&request->links, request->gatewayRSSI, request->gatewaySNR, request->sensorTXP,
+                            (uint32_t) TIMER_IF_GetTimeMs() - request->dataBeganMs, request->dataRetries);
+            request->twRequestBytes = twTypicalBytes(request->twRequestBytes, request->dataTotalLen);
+            uint8_t sf = gatewaySpreadingFactor(request);
+            if (sf != request->sfAssigned) {
+                APP_PRINTF("%s slot spreading factor changed from SF%d to SF%d\r\n", tracePeer(), request->sfAssigned, sf);
+                request->sfAssigned = sf;
+            }
+        }
+
+        // Within a window, only the last chunk is acknowledged
+        if (windowed && (wireReceived.Flags & MESSAGE_FLAG_WINDOW_END) == 0 && request->dataAcknowledgedLen < request->dataTotalLen) {
+            gatewayWaitForSensorMessage();
+            break;
+        }
+
         // If this was a beacon, we're completing a peering request
         if ((wireReceived.Flags & MESSAGE_FLAG_BEACON) != 0) {
 
@@ -1473,10 +2109,10 @@ void appGatewayProcess()
         extractNameComponents(name, body.Name, NULL, 0);
         body.LastProcessedRequestID = request->lastProcessedRequestIDForAck;
         twRefresh();
-        body.TWModulusSecs = TWModulusSecs;
+        body.TWModulusSecs = TWModulusSecs * request->twFrameMultiplier;
         body.TWModulusOffsetSecs = TWModulusOffsetSecs;
-        body.TWSlotBeginsSecs = request->twSlotBeginsSecs;
-        body.TWSlotEndsSecs = request->twSlotEndsSecs;
+        body.TWSlotBeginsSecs = (request->twFramePhase * TWModulusSecs) + request->twSlotBeginsSecs;
+        body.TWSlotEndsSecs = (request->twFramePhase * TWModulusSecs) + request->twSlotEndsSecs;
         body.TWListenBeforeTalkMs = TWListenBeforeTalkMs;
 #if REBOOT_SENSORS_WHEN_GATEWAY_REBOOTS
         body.BootTime = gatewayBootTime;
@@ -1493,21 +2129,34 @@ void appGatewayProcess()
         // so that we are as close as possible to synchronized times.  There is also
         // unfortunately a "transit time" for is message to be AES-encrypted and
         // transmitted over the wire (given the slow LoRa wire speed), so an
-        // additional adjustment is made.  (This was measured empically.)
+        // additional adjustment is made.  (This was measured empically.)  Sensors
+        // that support ACK_TAG_TIME_MS instead get the time as of when they finish
+        // receiving the ACK, which is stamped into it as it is sent.
         body.Time = NoteTimeST();
-        body.Time += 4;                 // Estimated transit time from gateway to sensor
-        if (TW_LBT_PERIOD_MS != 0) {    // Delay in transmitting when window is opened
-            body.Time += (TW_LBT_PERIOD_MS/1000)+1;
+        if (request->messageVersion < MESSAGE_VERSION_TIME_MS) {
+            body.Time += 4;                 // Estimated transit time from gateway to sensor
+            if (TW_LBT_PERIOD_MS != 0) {    // Delay in transmitting when window is opened
+                body.Time += (TW_LBT_PERIOD_MS/1000)+1;
+            }
         }
 
         // Make sure that the send buffer is deallocated
         freeMessageToSendBuffer();
 
-        // Set the length to what's necessary to transmit the name, using the
-        // assumption that the name is always at the very end of the structure.
-        messageToSendDataLen = sizeof(body);
-        messageToSendDataLen -= SENSOR_NAME_MAX;
-        messageToSendDataLen += strlen(body.Name)+1;
+        // Encode the body compactly if the sensor supports it.  Otherwise, set the length to
+        // what's necessary to transmit the name, using the assumption that the name is always
+        // at the very end of the structure.
+        static uint8_t ackData[ACK_COMPACT_MAX+sizeof(wireWindowAck)];
+        if (request->messageVersion >= MESSAGE_VERSION_COMPACT_ACK) {
+            bool full = (wireReceived.Flags & MESSAGE_FLAG_SYNC) != 0;
+            bool final = request->dataAcknowledgedLen >= request->dataTotalLen;
+            messageToSendDataLen = gatewayAckEncode(request, &body, full, final, ackData, &messageToSendTimeStampOffset);
+        } else {
+            messageToSendDataLen = sizeof(body);
+            messageToSendDataLen -= SENSOR_NAME_MAX;
+            messageToSendDataLen += strlen(body.Name)+1;
+            memcpy(ackData, &body, messageToSendDataLen);
+        }
 
         // Ack this received packet with the current gateway time
         messageToSendRequestID = request->currentRequestID;
@@ -1515,8 +2164,18 @@ void appGatewayProcess()
         if ((wireReceived.Flags & MESSAGE_FLAG_BEACON) != 0) {
             messageToSendFlags |= MESSAGE_FLAG_BEACON;
         }
-        messageToSendData = (uint8_t *) &body;
+        messageToSendData = ackData;
         messageToSendAcknowledgedLen = 0;
+
+        // In a windowed transfer, follow the body with which chunks of the window were received
+        if (windowed) {
+            wireWindowAck windowAck;
+            windowAck.Offset = request->dataAcknowledgedLen;
+            windowAck.Received = request->dataReceivedMap;
+            memcpy(&ackData[messageToSendDataLen], &windowAck, sizeof(windowAck));
+            messageToSendDataLen += sizeof(windowAck);
+            messageToSendFlags |= MESSAGE_FLAG_WINDOW;
+        }
         sendMessageToPeer(false, request->sensorAddress);
         break;
     }
@@ -1529,25 +2188,45 @@ void appGatewayProcess()
             break;
         }
 
-        // The last received message is the one most recent in the cache
-        requestState *request = &requestCache[0];
-        traceSetID("to", request->sensorAddress, request->currentRequestID);
-        if (memcmp(sentMessageCarrier.Receiver, request->sensorAddress, sizeof(request->sensorAddress)) != 0) {
-            APP_PRINTF("%s $$$ WRONG SENDER $$$\r\n", tracePeer());
+        // Continue the session with the sensor that we just transmitted to, which isn't
+        // necessarily the one most recently heard from when transfers are interleaved.
+        requestState *request = sensorCacheFind(sentMessageCarrier.Receiver);
+        if (request == NULL) {
+            traceSetID("to", sentMessageCarrier.Receiver, sentMessage.RequestID);
+            APP_PRINTF("%s *** sensor is no longer cached ***\r\n", tracePeer());
+            gatewayWaitForAnySensorMessage();
+            break;
         }
+        traceSetID("to", request->sensorAddress, request->currentRequestID);
 
         // Process the sensor request when it's completely received
         if (request->receivingRequest) {
             if (request->dataAcknowledgedLen == request->dataTotalLen) {
                 request->receivingRequest = false;
                 request->sendingResponse = false;
-                processSensorRequest(request, request->responseRequired);
+
+                // The sensor has its ACK, and so unless it is awaiting a response the
+                // request is queued and performed while we listen for other sensors.
+                if (!request->responseRequired) {
+                    request->processingPending = true;
+                    gatewayWaitForAnySensorMessage();
+                    break;
+                }
+                processSensorRequest(request, true);
                 break;
             }
         }
 
-        // We're done when our response is fully acknowledged
+        // We're done when our response is fully acknowledged, which for a windowed
+        // transfer is only known from the selective ACK that follows each window.
         if (request->sendingResponse) {
+            if (windowSendNext(request->sensorAddress)) {
+                break;
+            }
+            if (request->dataWindowed) {
+                gatewayWaitForSensorMessage();
+                break;
+            }
             request->dataAcknowledgedLen += sentMessage.Len;
             if (request->dataAcknowledgedLen >= sentMessage.TotalLen) {
                 request->receivingRequest = false;
@@ -1583,14 +2262,15 @@ void appGatewayProcess()
         // If in LBT mode, this means the channel is busy and we couldn't successfully receive,
         // so we should either retry the listen or give up.
         if (ListenPhaseBeforeTalk) {
+            macStat.lbtBusy++;
             if (lbtListenBeforeTalk()) {
                 break;
             }
-            showReceivedTime("*** rx error and transmit retries expired ***", 0, 0);
+            showReceivedTime("*** rx error and transmit retries expired ***", NULL);
             sensorCoreIdle();
             break;
         }
-        showReceivedTime("*** error receiving from sensor ***", 0, 0);
+        showReceivedTime("*** error receiving from sensor ***", NULL);
         restartReceive(wireReceiveTimeoutMs);
         break;
 
@@ -1605,6 +2285,27 @@ void appGatewayProcess()
         break;
     }
 
+    // While listening for any sensor, listen at the spreading factor of the current part of the
+    // slot schedule, and perform queued requests one at a time, coming back for the next unless
+    // a radio event has meanwhile been dispatched to us.  Housekeeping is only done once nothing
+    // is queued.
+    if (CurrentStateCore == LOWPOWER && !ListenPhaseBeforeTalk && wireReceiveTimeoutMs == UNSOLICITED_RX_TIMEOUT_VALUE
+            && !radioIsTransmitting()) {
+        uint32_t untilSecs;
+        if (radioSpreadingFactor() != twSlotSpreadingFactor(&untilSecs)) {
+            gatewayWaitForAnySensorMessage();
+        } else if (untilSecs != 0 && !UTIL_TIMER_IsRunning(&twSlotTimer)) {
+            twSlotTimerStart(untilSecs);
+        }
+        if (gatewayProcessPending()) {
+            if (CurrentStateCore == LOWPOWER) {
+                UTIL_SEQ_SetTask((1 << CFG_SEQ_Task_Sparrow_Process), CFG_SEQ_Prio_0);
+            }
+        } else {
+            gatewayHousekeepingPlan();
+        }
+    }
+
 #ifdef TRACE_STATE
     APP_PRINTF("EXIT %d\r\n", CurrentStateCore);
 #endif
@@ -1612,51 +2313,36 @@ void appGatewayProcess()
 }
 
 // Show the time that a message was received, as well as when it SHOULD have been received
-void showReceivedTime(char *msg, uint32_t beginSecs, uint32_t endSecs)
+// if it was received from the specified sensor
+void showReceivedTime(char *msg, requestState *request)
 {
-    uint32_t now = NoteTimeST();
+    uint32_t now = timeSyncNowSecs();
     uint32_t modSecs = (TWModulusSecs == 0 ? twMinimumModulusSecs() : TWModulusSecs);
-    uint32_t slotSecs = twMinimumModulusSecs();
     uint32_t windowRelativeNowTime = now - TWModulusOffsetSecs;
     uint32_t thisWindowBeginTime = (windowRelativeNowTime / modSecs) * modSecs;
     uint32_t nextWindowBeginTime = ((windowRelativeNowTime / modSecs) + 1) * modSecs;
-    uint32_t thisSlotNumber = (windowRelativeNowTime - thisWindowBeginTime) / slotSecs;
-    uint32_t thisSlotOffset = (windowRelativeNowTime - thisWindowBeginTime) % slotSecs;
-    uint32_t thisSlotBeginTime = (thisSlotNumber * slotSecs) + thisWindowBeginTime;
-    uint32_t nextSlotBeginTime = thisSlotBeginTime + slotSecs;
-    uint32_t sensorSlotNumber = beginSecs / slotSecs;
-    uint32_t sensorSlotBeginTime = thisWindowBeginTime + beginSecs;
-    uint32_t sensorSlotEndTime = thisWindowBeginTime + endSecs;
     DEBUG_VARIABLE(nextWindowBeginTime);
-    DEBUG_VARIABLE(thisSlotOffset);
-    DEBUG_VARIABLE(nextSlotBeginTime);
-    DEBUG_VARIABLE(sensorSlotEndTime);
     APP_PRINTF("%s %s", tracePeer(), msg);
-    if (appIsGateway && NoteTimeValidST() && thisWindowBeginTime > gatewayBootTime) {
+    if (appIsGateway && NoteTimeValidST() && thisWindowBeginTime > gatewayBootTime && TWModulusSecs != 0) {
         APP_PRINTF(" window:%d-%d", thisWindowBeginTime-gatewayBootTime, nextWindowBeginTime-gatewayBootTime);
-        APP_PRINTF(" slot#%d/%d(", thisSlotNumber, modSecs/slotSecs);
+        uint32_t slotBeginTime, slotLeftSecs;
+        requestState *owner = twSlotOwner(now, &slotBeginTime, &slotLeftSecs);
+        uint32_t thisSlotBeginTime = (slotBeginTime - TWModulusOffsetSecs);
+        uint32_t thisSlotOffset = now - slotBeginTime;
         char slotOwner[SENSOR_NAME_MAX];
         strlcpy(slotOwner, "+++ UNKNOWN +++", sizeof(slotOwner));
-        for (int i=0; i<cachedSensors; i++) {
-            if ((thisSlotBeginTime-thisWindowBeginTime) == requestCache[i].twSlotBeginsSecs) {
-                flashConfigFindPeerByAddress(requestCache[i].sensorAddress, NULL, NULL, slotOwner);
-                break;
-            }
+        if (owner != NULL) {
+            flashConfigFindPeerByAddress(owner->sensorAddress, NULL, NULL, slotOwner);
         }
-        APP_PRINTF("%s)=%d%%%d:%d-%d", slotOwner, thisSlotOffset, slotSecs,
-                   thisSlotBeginTime-thisWindowBeginTime, nextSlotBeginTime-thisWindowBeginTime);
-        if (endSecs > 0) {
-            APP_PRINTF("sensor#%d(", sensorSlotNumber);
+        APP_PRINTF(" slot(%s)=%d%%%d:%d-%d", slotOwner, thisSlotOffset, thisSlotOffset+slotLeftSecs,
+                   thisSlotBeginTime-thisWindowBeginTime, thisSlotBeginTime-thisWindowBeginTime+thisSlotOffset+slotLeftSecs);
+        if (request != NULL && request->twSlotEndsSecs != 0) {
             strlcpy(slotOwner, "+++ UNKNOWN +++", sizeof(slotOwner));
-            for (int i=0; i<cachedSensors; i++) {
-                if (beginSecs == requestCache[i].twSlotBeginsSecs) {
-                    flashConfigFindPeerByAddress(requestCache[i].sensorAddress, NULL, NULL, slotOwner);
-                    break;
-                }
-            }
-            APP_PRINTF("%s)=%d:%d-%d", slotOwner, endSecs-beginSecs,
-                       sensorSlotBeginTime-thisWindowBeginTime, sensorSlotEndTime-thisWindowBeginTime);
-            if (thisSlotBeginTime != sensorSlotBeginTime || thisSlotNumber != sensorSlotNumber) {
+            flashConfigFindPeerByAddress(request->sensorAddress, NULL, NULL, slotOwner);
+            APP_PRINTF(" sensor(%s)=%d:%d-%d frame:%d/%d", slotOwner, request->twSlotEndsSecs-request->twSlotBeginsSecs,
+                       request->twSlotBeginsSecs, request->twSlotEndsSecs,
+                       request->twFramePhase, request->twFrameMultiplier);
+            if (owner != request) {
                 APP_PRINTF(" +++ WRONG SLOT +++");
             }
         }
@@ -1672,11 +2358,21 @@ bool validateReceivedMessage()
     // Clear the message because it's not yet decrypted
     traceSetID("fm", 0, 0);
 
-    // Exit if not the right protocol version
-    if (wireReceivedCarrier.Version != MESSAGE_VERSION) {
+    // Exit if not a supported protocol version.  Versions above our own share our carrier layout.
+    if (wireReceivedCarrier.Version < MESSAGE_VERSION_LEGACY) {
         APP_PRINTF("%s invalid protocol version\r\n", tracePeer());
         return false;
     }
+    if (wireReceivedCarrier.MessageLen > sizeof(wireReceived)) {
+        APP_PRINTF("%s message has incorrect length\r\n", tracePeer());
+        return false;
+    }
+
+    // Legacy carriers have no nonce, so move the message to where it belongs
+    if (wireReceivedCarrier.Version < MESSAGE_VERSION_NONCE) {
+        memmove(&wireReceivedCarrier.Message, &wireReceivedCarrier.Nonce, wireReceivedCarrier.MessageLen);
+        memset(&wireReceivedCarrier.Nonce, 0, sizeof(wireReceivedCarrier.Nonce));
+    }
 
     // Exit if not intended for us
     if (appIsGateway && ledIsPairInProgress() && memcmp(wildcardAddress, wireReceivedCarrier.Receiver, sizeof(ourAddress)) == 0) {
@@ -1690,10 +2386,6 @@ bool validateReceivedMessage()
 
     // If it's cleartext, we're done
     if (wireReceivedCarrier.Algorithm == MESSAGE_ALG_CLEAR) {
-        if (wireReceivedCarrier.MessageLen > sizeof(wireReceived)) {
-            APP_PRINTF("%s cleartext message has incorrect length\r\n", tracePeer());
-            return false;
-        }
         memcpy((uint8_t *)&wireReceived, (uint8_t *)&wireReceivedCarrier.Message, wireReceivedCarrier.MessageLen);
         return true;
     }
@@ -1726,7 +2418,9 @@ bool validateReceivedMessage()
 #endif
 
     // Decrypt it
-    bool success = MX_AES_CTR_Decrypt(key, (uint8_t *)&wireReceivedCarrier.Message, wireReceivedCarrier.MessageLen, (uint8_t *)&wireReceived);
+    uint32_t nonceIV[4];
+    uint32_t *iv = appCarrierIV(&wireReceivedCarrier, nonceIV);
+    bool success = MX_AES_CTR_Decrypt(key, iv, (uint8_t *)&wireReceivedCarrier.Message, wireReceivedCarrier.MessageLen, (uint8_t *)&wireReceived);
     memcpy(key, invalidKey, sizeof(key));
     if (success && wireReceived.Signature != MESSAGE_SIGNATURE) {
         success = false;
@@ -1744,73 +2438,919 @@ bool validateReceivedMessage()
 }
 
 // Use the request cache to re-compute the time window parameters, based on the
-// devices that we consider "active"
+// devices that we consider "active", on the length of slot that each of them needs,
+// and on how often each of them expects to send
 void twRefresh()
 {
+    uint32_t now = timeSyncNowSecs();
 
-    // Count the active sensors
-    uint32_t inactiveTime = NoteTimeST() - TW_ACTIVE_SECS;
+    // Count the active sensors, and see if any has outgrown its slot or needs it more often
     uint32_t activeSensors = 0;
+    bool outgrown = false;
     for (int i=0; i<cachedSensors; i++) {
-        if (memcmp(requestCache[i].sensorAddress, gatewayAddress, ADDRESS_LEN) == 0) {
+        requestState *request = &requestCache[i];
+        if (!twSensorActive(request, now)) {
             continue;
         }
-        if (requestCache[i].lastReceivedTime < inactiveTime) {
+        activeSensors++;
+        if (request->twSlotEndsSecs == 0) {
             continue;
         }
-        activeSensors++;
+        if (twSlotSecs(request) > (uint32_t) (request->twSlotEndsSecs - request->twSlotBeginsSecs)) {
+            outgrown = true;
+        }
+        if (request->twFrameMultiplier > 1 && request->sendPeriodSecs < request->twFrameMultiplier * TWModulusSecs) {
+            outgrown = true;
+        }
     }
 
-    // Only reassign slots if we change active sensors
-    if (twLastActiveSensors == activeSensors) {
-        return;
+    // Plan the frame, beginning with every slot recurring in every frame, and then letting
+    // slots recur less often within the shorter frames that result
+    twLane *lanes = NULL;
+    uint32_t estimateSecs = 0;
+    uint32_t frameSecs = 0;
+    if (activeSensors > 0) {
+        lanes = (twLane *) malloc(activeSensors * sizeof(twLane));
+        if (lanes == NULL) {
+            return;
+        }
+        frameSecs = twPack(now, 0, lanes, false);
+        for (int pass=0; pass<TW_SUPERFRAME_PASSES; pass++) {
+            uint32_t packedSecs = twPack(now, frameSecs, lanes, false);
+            if (packedSecs >= frameSecs) {
+                break;
+            }
+            estimateSecs = frameSecs;
+            frameSecs = packedSecs;
+        }
+    }
+
+    // Only reassign slots if we change active sensors, if a sensor has outgrown its slot, or
+    // if the frame has shrunk by enough to be worth moving every sensor's slot
+    bool shrunk = (activeSensors > 0 && (frameSecs * 100) <= (TWModulusSecs * (100 - TW_SLOT_SHRINK_PCT)));
+    if (twLastActiveSensors == activeSensors && !outgrown && !shrunk) {
+        if (lanes != NULL) {
+            free(lanes);
+        }
+        return;
     }
-    twLastActiveSensors = activeSensors;
 
     // Force the database to be updated
-    APP_PRINTF("%s **** active sensors changed to %d ****\r\n", tracePeer(), activeSensors);
+    if (twLastActiveSensors != activeSensors) {
+        APP_PRINTF("%s **** active sensors changed to %d ****\r\n", tracePeer(), activeSensors);
+    } else {
+        APP_PRINTF("%s **** slots resized, modulus %d -> %d ****\r\n", tracePeer(), TWModulusSecs, frameSecs);
+    }
+    twLastActiveSensors = activeSensors;
     forceSensorRefresh = true;
 
     // Update active sensors and modulus, assigning a modulus offset to keep us from
     // interfering with other local gateways
-    TWModulusSecs = activeSensors * twMinimumModulusSecs();
+    TWModulusSecs = frameSecs;
     MX_RNG_Init();
     TWModulusOffsetSecs = MX_RNG_Get() % 123;
     MX_RNG_DeInit();
     TWListenBeforeTalkMs = TW_LBT_PERIOD_MS;
 
     // Re-assign slots to active sensors
-    uint32_t slotBeginsSecs = 0;
     for (int i=0; i<cachedSensors; i++) {
         requestCache[i].twSlotBeginsSecs = 0;
-        if (memcmp(requestCache[i].sensorAddress, gatewayAddress, ADDRESS_LEN) == 0) {
+        requestCache[i].twSlotEndsSecs = 0;
+        requestCache[i].twFrameMultiplier = 1;
+        requestCache[i].twFramePhase = 0;
+    }
+    if (lanes == NULL) {
+        return;
+    }
+    twPack(now, estimateSecs, lanes, true);
+    free(lanes);
+
+    // Display the slot assignments
+    for (int i=0; i<cachedSensors; i++) {
+        if (requestCache[i].twSlotEndsSecs == 0) {
             continue;
         }
-        if (requestCache[i].lastReceivedTime < inactiveTime) {
+        char msg[40];
+        utilAddressToText(requestCache[i].sensorAddress, msg, sizeof(msg));
+        APP_PRINTF("%s %s assigned slot %d-%d frame %d/%d (req:%d rsp:%d SF%d period:%d)\r\n", tracePeer(), msg,
+                   requestCache[i].twSlotBeginsSecs, requestCache[i].twSlotEndsSecs,
+                   requestCache[i].twFramePhase, requestCache[i].twFrameMultiplier,
+                   requestCache[i].twRequestBytes, requestCache[i].twResponseBytes, requestCache[i].sfAssigned,
+                   requestCache[i].sendPeriodSecs);
+    }
+
+}
+
+// Pack the slots of the active sensors into a frame, returning the length of the frame.  The
+// slot of each sensor recurs every 2^n frames, such that given a frame of the estimated length
+// it recurs at least once per period in which the sensor expects to send.  Slots are placed in
+// order of how often they recur, so that each sensor's share of a lane is a power-of-two
+// fraction that is aligned to its size, whose index with its bits reversed is the phase of the
+// frames in which it recurs.  This keeps the phases of sensors sharing a lane distinct.  If
+// apply is true, the slots are assigned to the sensors.
+uint32_t twPack(uint32_t now, uint32_t estimateSecs, twLane *lanes, bool apply)
+{
+
+    // Place each sensor in the lane that it would lengthen the least, or in a new lane
+    uint32_t laneCount = 0;
+    for (uint32_t multiplier=1; multiplier<=TW_SUPERFRAME_MAX; multiplier*=2) {
+        uint32_t units = TW_SUPERFRAME_MAX / multiplier;
+        for (int i=0; i<cachedSensors; i++) {
+            requestState *request = &requestCache[i];
+            if (!twSensorActive(request, now) || twFrameMultiplier(request, estimateSecs) != multiplier) {
+                continue;
+            }
+            uint32_t slotSecs = twSlotSecs(request);
+            int lane = -1;
+            uint32_t laneGrowthSecs = 0;
+            for (uint32_t l=0; l<laneCount; l++) {
+                if (lanes[l].used + units > TW_SUPERFRAME_MAX) {
+                    continue;
+                }
+                uint32_t growthSecs = (slotSecs > lanes[l].secs) ? slotSecs - lanes[l].secs : 0;
+                if (lane < 0 || growthSecs < laneGrowthSecs) {
+                    lane = l;
+                    laneGrowthSecs = growthSecs;
+                }
+            }
+            if (lane < 0) {
+                lane = laneCount++;
+                memset(&lanes[lane], 0, sizeof(twLane));
+            }
+            if (apply) {
+                uint32_t index = lanes[lane].used / units;
+                uint32_t phase = 0;
+                for (uint32_t bit=1; bit<multiplier; bit*=2) {
+                    phase = (phase << 1) | ((index & bit) ? 1 : 0);
+                }
+                request->twFrameMultiplier = multiplier;
+                request->twFramePhase = phase;
+                request->twLane = lane;
+            }
+            lanes[lane].used += units;
+            if (slotSecs > lanes[lane].secs) {
+                lanes[lane].secs = slotSecs;
+            }
+        }
+    }
+
+    // Lay the lanes out back-to-back.  Sensors won't accept a modulus shorter than the minimum,
+    // so leave any remainder unassigned.
+    uint32_t frameSecs = 0;
+    for (uint32_t l=0; l<laneCount; l++) {
+        lanes[l].beginsSecs = frameSecs;
+        frameSecs += lanes[l].secs;
+    }
+    if (frameSecs < twMinimumModulusSecs()) {
+        frameSecs = twMinimumModulusSecs();
+    }
+
+    // Assign the slots
+    if (apply) {
+        for (int i=0; i<cachedSensors; i++) {
+            requestState *request = &requestCache[i];
+            if (!twSensorActive(request, now)) {
+                continue;
+            }
+            request->twSlotBeginsSecs = lanes[request->twLane].beginsSecs;
+            request->twSlotEndsSecs = request->twSlotBeginsSecs + twSlotSecs(request);
+        }
+    }
+
+    return frameSecs;
+
+}
+
+// True if we consider a sensor to be active, and thus reserve a slot for it.  A sensor that
+// has told us how often it sends is inactive after several of its periods without having been
+// heard from, and otherwise it is inactive after TW_ACTIVE_SECS.
+bool twSensorActive(requestState *request, uint32_t now)
+{
+    if (memcmp(request->sensorAddress, gatewayAddress, ADDRESS_LEN) == 0) {
+        return false;
+    }
+    uint32_t activeSecs = TW_ACTIVE_SECS;
+    if (request->sendPeriodSecs != 0 && request->sendPeriodSecs < TW_ACTIVE_SECS / TW_ACTIVE_PERIODS) {
+        activeSecs = request->sendPeriodSecs * TW_ACTIVE_PERIODS;
+    }
+    return (request->lastReceivedTime >= now - activeSecs);
+}
+
+// Number of frames of the specified length after which a sensor's slot recurs, which is the
+// largest power of two that has the slot recurring at least once per the sensor's send period
+uint32_t twFrameMultiplier(requestState *request, uint32_t frameSecs)
+{
+    uint32_t multiplier = 1;
+    if (request->sendPeriodSecs == 0 || frameSecs == 0) {
+        return multiplier;
+    }
+    while (multiplier < TW_SUPERFRAME_MAX
+            && (multiplier * 2 * frameSecs) <= request->sendPeriodSecs
+            && (multiplier * 2 * frameSecs) <= 0xffff) {
+        multiplier *= 2;
+    }
+    return multiplier;
+}
+
+// Length of the slot needed by a sensor, derived from the time-on-air of its typical exchange.
+// Until a transfer from the sensor has been observed, it gets the minimum modulus as its slot.
+uint32_t twSlotSecs(requestState *request)
+{
+    if (request->twRequestBytes == 0) {
+        return twMinimumModulusSecs();
+    }
+    uint8_t sf = (request->sfHeard > request->sfAssigned) ? request->sfHeard : request->sfAssigned;
+    bool windowed = (request->messageVersion >= MESSAGE_VERSION_WINDOW);
+    uint32_t ms = twTransferMs(sf, request->twRequestBytes, windowed);
+    if (request->twResponseBytes > 0) {
+        ms += TW_SLOT_PROCESSING_MS + twTransferMs(sf, request->twResponseBytes, windowed);
+    }
+    return twSlotStartSecs(request) + ((ms + 999) / 1000);
+}
+
+// Number of seconds from the start of a sensor's slot within which it begins to transmit, which
+// is short if the sensor's time is synchronized to ours to the millisecond
+uint32_t twSlotStartSecs(requestState *request)
+{
+    if (request->messageVersion >= MESSAGE_VERSION_TIME_MS) {
+        return TW_SLOT_START_SYNCED_SECS;
+    }
+    return TW_SLOT_START_SECS;
+}
+
+// Time to transfer a payload of the specified length, as its chunks along with their ACKs,
+// the turnaround on either side of each ACK, and the gaps between chunks of a window
+uint32_t twTransferMs(uint8_t sf, uint32_t len, bool windowed)
+{
+    uint32_t overhead = sizeof(wireMessageCarrier) - MESSAGE_MAX_CHUNK;
+    uint32_t chunks = (len == 0) ? 1 : (len + MESSAGE_MAX_CHUNK - 1) / MESSAGE_MAX_CHUNK;
+    uint32_t lastChunkLen = len - ((chunks - 1) * MESSAGE_MAX_CHUNK);
+    uint32_t acks = windowed ? (chunks + MESSAGE_WINDOW_CHUNKS - 1) / MESSAGE_WINDOW_CHUNKS : chunks;
+    uint32_t ms = (chunks - 1) * radioTimeOnAirAtMs(sf, (uint8_t) (overhead + MESSAGE_MAX_CHUNK));
+    ms += radioTimeOnAirAtMs(sf, (uint8_t) (overhead + lastChunkLen));
+    ms += acks * (radioTimeOnAirAtMs(sf, (uint8_t) (overhead + TW_SLOT_ACK_BYTES)) + (2 * RADIO_TURNAROUND_ALLOWANCE_MS));
+    if (windowed) {
+        ms += (chunks - acks) * MESSAGE_WINDOW_GAP_MS;
+    }
+    return ms;
+}
+
+// Update the typical length of a sensor's transfers with an observed length.  Growth is
+// taken immediately so that the sensor's slot is big enough, while shrinkage is averaged.
+uint16_t twTypicalBytes(uint16_t typicalBytes, uint32_t observedBytes)
+{
+    if (observedBytes > 0xffff) {
+        observedBytes = 0xffff;
+    }
+    if (observedBytes >= typicalBytes) {
+        return (uint16_t) observedBytes;
+    }
+    return (uint16_t) (((3 * (uint32_t) typicalBytes) + observedBytes) / 4);
+}
+
+// Number of seconds until a period of at least the specified length begins in which
+// no sensor is expected to be transmitting, or 0 if such a period has begun.  The rest
+// of a slot is quiet if no sensor is assigned to it, if its sensor has already completed
+// an exchange within it (because a sensor's next request waits for its slot in the next
+// window), or if its sensor didn't begin transmitting at the start of the slot.
+uint32_t twSecsUntilQuiet(uint32_t quietSecs)
+{
+
+    // Without a schedule, no time is known to be quieter than another
+    if (!NoteTimeValidST() || twLastActiveSensors == 0 || TWModulusSecs == 0) {
+        return 0;
+    }
+
+    // See if the sensor assigned to the slot that we're in, if any, is done with it
+    uint32_t now = timeSyncNowSecs();
+    uint32_t slotBeginTime, slotLeftSecs;
+    requestState *request = twSlotOwner(now, &slotBeginTime, &slotLeftSecs);
+    bool quiet = true;
+    if (request != NULL) {
+        if (request->lastReceivedTime >= slotBeginTime) {
+            quiet = !request->receivingRequest && !request->sendingResponse;
+        } else {
+            quiet = (now >= slotBeginTime + twSlotStartSecs(request));
+        }
+    }
+    if (quiet && slotLeftSecs >= quietSecs) {
+        return 0;
+    }
+
+    // Come back when the next slot begins
+    return slotLeftSecs;
+
+}
+
+// Locate the slot that we're in, returning the sensor assigned to it or NULL if none.  Time
+// between assigned slots, or beyond the last of them, or in a slot whose sensor isn't due in
+// this frame, is treated as an unassigned slot.
+requestState *twSlotOwner(uint32_t now, uint32_t *slotBeginTime, uint32_t *slotLeftSecs)
+{
+    uint32_t windowRelativeNowTime = now - TWModulusOffsetSecs;
+    uint32_t frame = windowRelativeNowTime / TWModulusSecs;
+    uint32_t thisWindowBeginTime = frame * TWModulusSecs;
+    uint32_t offsetSecs = windowRelativeNowTime - thisWindowBeginTime;
+    requestState *owner = NULL;
+    uint32_t slotBeginsSecs = 0;
+    uint32_t slotEndsSecs = TWModulusSecs;
+    for (int i=0; i<cachedSensors; i++) {
+        requestState *request = &requestCache[i];
+        if (request->twSlotEndsSecs == 0) {
+            continue;
+        }
+        if (request->twFrameMultiplier > 1 && (frame % request->twFrameMultiplier) != request->twFramePhase) {
             continue;
         }
+        if (offsetSecs >= request->twSlotBeginsSecs && offsetSecs < request->twSlotEndsSecs) {
+            owner = request;
+            slotBeginsSecs = request->twSlotBeginsSecs;
+            slotEndsSecs = request->twSlotEndsSecs;
+            break;
+        }
+        if (request->twSlotEndsSecs <= offsetSecs && request->twSlotEndsSecs > slotBeginsSecs) {
+            slotBeginsSecs = request->twSlotEndsSecs;
+        }
+        if (request->twSlotBeginsSecs > offsetSecs && request->twSlotBeginsSecs < slotEndsSecs) {
+            slotEndsSecs = request->twSlotBeginsSecs;
+        }
+    }
+    if (slotEndsSecs > TWModulusSecs || slotEndsSecs <= offsetSecs) {
+        slotEndsSecs = TWModulusSecs;
+    }
+    *slotBeginTime = now - (offsetSecs - slotBeginsSecs);
+    *slotLeftSecs = slotEndsSecs - offsetSecs;
+    return owner;
+}
 
-        // Update the slot
-        requestCache[i].twSlotBeginsSecs = slotBeginsSecs;
-        requestCache[i].twSlotEndsSecs = slotBeginsSecs + twMinimumModulusSecs();
-        slotBeginsSecs += twMinimumModulusSecs();
+// Spreading factor at which the gateway should be listening for any sensor.  Within the start
+// of a slot it is that assigned to the slot's sensor, for the rest of the slot it is that of the
+// exchange with the sensor if one is in progress, and otherwise it is the default.  If the
+// spreading factor may change, the number of seconds until it does so is also returned.
+uint8_t twSlotSpreadingFactor(uint32_t *untilSecs)
+{
+    if (untilSecs != NULL) {
+        *untilSecs = 0;
+    }
 
-        // Display the slot assignment
-        char msg[40];
-        utilAddressToText(requestCache[i].sensorAddress, msg, sizeof(msg));
-        APP_PRINTF("%s %s assigned slot %d-%d\r\n", tracePeer(), msg, requestCache[i].twSlotBeginsSecs, requestCache[i].twSlotEndsSecs);
+    // Without a schedule, or if no sensor has been assigned a spreading factor, use the default
+    if (!NoteTimeValidST() || twLastActiveSensors == 0 || TWModulusSecs == 0) {
+        return LORA_SPREADING_FACTOR;
+    }
+    bool assigned = false;
+    for (int i=0; i<cachedSensors; i++) {
+        if (requestCache[i].twSlotEndsSecs != 0 && requestCache[i].sfAssigned != LORA_SPREADING_FACTOR) {
+            assigned = true;
+            break;
+        }
+    }
+    if (!assigned) {
+        return LORA_SPREADING_FACTOR;
+    }
 
+    // Determine it from the slot's sensor
+    uint32_t now = timeSyncNowSecs();
+    uint32_t slotBeginTime, slotLeftSecs;
+    requestState *request = twSlotOwner(now, &slotBeginTime, &slotLeftSecs);
+    uint8_t sf = LORA_SPREADING_FACTOR;
+    uint32_t secs = slotLeftSecs;
+    if (request != NULL) {
+        if (request->lastReceivedTime >= slotBeginTime && (request->receivingRequest || request->sendingResponse)) {
+            sf = request->sfHeard;
+        } else if (now < slotBeginTime + twSlotStartSecs(request)) {
+            sf = request->sfAssigned;
+            secs = (slotBeginTime + twSlotStartSecs(request)) - now;
+        }
+    }
+    if (untilSecs != NULL) {
+        *untilSecs = (secs == 0) ? 1 : secs;
     }
+    return sf;
 
 }
 
+// Come back to change the spreading factor at which we're listening
+void twSlotEvent(void *context)
+{
+    UTIL_SEQ_SetTask((1 << CFG_SEQ_Task_Sparrow_Process), CFG_SEQ_Prio_0);
+}
+
+// Come back when the spreading factor may next change, which is on a second boundary that is
+// the specified number of seconds after the current time truncated to the second.
+void twSlotTimerStart(uint32_t untilSecs)
+{
+    uint32_t untilMs = (untilSecs*1000) - (uint32_t) (timeSyncNowMs() % 1000);
+    UTIL_TIMER_SetPeriod(&twSlotTimer, untilMs);
+    UTIL_TIMER_Start(&twSlotTimer);
+}
+
+// Choose the spreading factor for a sensor's slot, from the weaker direction of its link
+uint8_t gatewaySpreadingFactor(requestState *request)
+{
+    if (request->messageVersion < MESSAGE_VERSION_SF) {
+        return LORA_SPREADING_FACTOR;
+    }
+    int snr = request->gatewaySNR;
+    if ((request->sensorRSSI != 0 || request->sensorSNR != 0) && request->sensorSNR < snr) {
+        snr = request->sensorSNR;
+    }
+    uint8_t sf = LORA_SPREADING_FACTOR_MIN;
+    while (sf < LORA_SPREADING_FACTOR && (snr*10) < (LORA_SPREADING_FACTOR_MARGIN_DB*10) - (75 + ((sf-7)*25))) {
+        sf++;
+    }
+    if (sf < request->sfAssigned-1) {
+        sf = request->sfAssigned-1;
+    }
+    return sf;
+}
+
+// Initialize the sensor cache and its index
+void sensorCacheInit()
+{
+    cachedSensors = 0;
+    for (int i=0; i<SENSOR_HASH_BUCKETS; i++) {
+        sensorHash[i] = SENSOR_SLOT_NONE;
+    }
+    sensorMRUHead = sensorMRUTail = SENSOR_SLOT_NONE;
+}
+
+// Hash a sensor address (FNV-1a) to its home bucket
+static uint32_t sensorCacheHash(const uint8_t *address)
+{
+    uint32_t hash = 2166136261U;
+    for (int i=0; i<ADDRESS_LEN; i++) {
+        hash ^= address[i];
+        hash *= 16777619U;
+    }
+    return hash % SENSOR_HASH_BUCKETS;
+}
+
+// Find the hash bucket holding the specified address, or -1 if not present
+static int sensorCacheFindBucket(const uint8_t *address)
+{
+    uint32_t bucket = sensorCacheHash(address);
+    for (int probes=0; probes<SENSOR_HASH_BUCKETS; probes++) {
+        int slot = sensorHash[bucket];
+        if (slot == SENSOR_SLOT_NONE) {
+            break;
+        }
+        if (memcmp(requestCache[slot].sensorAddress, address, ADDRESS_LEN) == 0) {
+            return bucket;
+        }
+        bucket = (bucket + 1) % SENSOR_HASH_BUCKETS;
+    }
+    return -1;
+}
+
+// Add a slot to the hash index.  Because there are twice as many buckets as
+// slots, there is always an empty bucket to be found.
+static void sensorCacheIndexAdd(int slot)
+{
+    uint32_t bucket = sensorCacheHash(requestCache[slot].sensorAddress);
+    while (sensorHash[bucket] != SENSOR_SLOT_NONE) {
+        bucket = (bucket + 1) % SENSOR_HASH_BUCKETS;
+    }
+    sensorHash[bucket] = slot;
+}
+
+// Remove a slot from the hash index, shifting back any entries in the same probe
+// sequence so that lookups never need tombstones.
+static void sensorCacheIndexRemove(int slot)
+{
+    int hole = sensorCacheFindBucket(requestCache[slot].sensorAddress);
+    if (hole < 0) {
+        return;
+    }
+    sensorHash[hole] = SENSOR_SLOT_NONE;
+    uint32_t bucket = (hole + 1) % SENSOR_HASH_BUCKETS;
+    while (sensorHash[bucket] != SENSOR_SLOT_NONE) {
+        uint32_t home = sensorCacheHash(requestCache[sensorHash[bucket]].sensorAddress);
+        uint32_t distBucket = (bucket + SENSOR_HASH_BUCKETS - home) % SENSOR_HASH_BUCKETS;
+        uint32_t distHole = ((uint32_t)hole + SENSOR_HASH_BUCKETS - home) % SENSOR_HASH_BUCKETS;
+        if (distHole < distBucket) {
+            sensorHash[hole] = sensorHash[bucket];
+            sensorHash[bucket] = SENSOR_SLOT_NONE;
+            hole = bucket;
+        }
+        bucket = (bucket + 1) % SENSOR_HASH_BUCKETS;
+    }
+}
+
+// Unlink a slot from the MRU list
+static void sensorCacheUnlink(int slot)
+{
+    requestState *entry = &requestCache[slot];
+    if (entry->mruPrev != SENSOR_SLOT_NONE) {
+        requestCache[entry->mruPrev].mruNext = entry->mruNext;
+    } else if (sensorMRUHead == slot) {
+        sensorMRUHead = entry->mruNext;
+    }
+    if (entry->mruNext != SENSOR_SLOT_NONE) {
+        requestCache[entry->mruNext].mruPrev = entry->mruPrev;
+    } else if (sensorMRUTail == slot) {
+        sensorMRUTail = entry->mruPrev;
+    }
+    entry->mruPrev = entry->mruNext = SENSOR_SLOT_NONE;
+}
+
+// Make a slot the most recently used
+static void sensorCacheTouch(int slot)
+{
+    if (sensorMRUHead == slot) {
+        return;
+    }
+    sensorCacheUnlink(slot);
+    requestCache[slot].mruNext = sensorMRUHead;
+    if (sensorMRUHead != SENSOR_SLOT_NONE) {
+        requestCache[sensorMRUHead].mruPrev = slot;
+    }
+    sensorMRUHead = slot;
+    if (sensorMRUTail == SENSOR_SLOT_NONE) {
+        sensorMRUTail = slot;
+    }
+}
+
+// Hold aside the stats of a sensor being evicted, to be flushed to the DB by housekeeping
+static void sensorCacheEvict(int slot)
+{
+
+    // Make room by flushing the oldest if there are too many awaiting a flush
+    if (evictedCount >= SENSOR_EVICTED_MAX) {
+        uint32_t index;
+        appSensorEvictedNext(&index);
+        gatewaySensorFlush(index);
+        appSensorEvictedFlushed();
+    }
+
+    // Copy the stats aside
+    requestState *entry = &requestCache[slot];
+    evictedState *evicted = &evictedCache[(evictedFirst + evictedCount) % SENSOR_EVICTED_MAX];
+    memcpy(evicted->sensorAddress, entry->sensorAddress, ADDRESS_LEN);
+    evicted->gatewayRSSI = entry->gatewayRSSI;
+    evicted->gatewaySNR = entry->gatewaySNR;
+    evicted->sensorRSSI = entry->sensorRSSI;
+    evicted->sensorSNR = entry->sensorSNR;
+    evicted->sensorTXP = entry->sensorTXP;
+    evicted->sensorLTP = entry->sensorLTP;
+    evicted->sensorMv = entry->sensorMv;
+    evicted->lastReceivedTime = entry->lastReceivedTime;
+    evicted->requestsProcessed = entry->requestsProcessed;
+    evicted->requestsLost = entry->requestsLost;
+    evicted->dbShadow = entry->dbShadow;
+    evictedCount++;
+
+}
+
+// Get the index, as presented to housekeeping, of the oldest evicted sensor awaiting a flush
+bool appSensorEvictedNext(uint32_t *index)
+{
+    if (evictedCount == 0) {
+        return false;
+    }
+    *index = MAX_CACHED_SENSORS + evictedFirst;
+    return true;
+}
+
+// Discard the oldest evicted sensor, once it has been flushed
+void appSensorEvictedFlushed()
+{
+    if (evictedCount == 0) {
+        return;
+    }
+    memset(&evictedCache[evictedFirst], 0, sizeof(evictedState));
+    evictedFirst = (evictedFirst + 1) % SENSOR_EVICTED_MAX;
+    evictedCount--;
+}
+
+// Find a sensor in the cache, creating an entry for it if necessary, and make it the
+// most recently used.  When the cache is full, the least recently used entry is reused.
+requestState *sensorCacheLookup(uint8_t *address, bool *isNew)
+{
+
+    // Fast path for an already-cached sensor
+    int bucket = sensorCacheFindBucket(address);
+    if (bucket >= 0) {
+        int slot = sensorHash[bucket];
+        sensorCacheTouch(slot);
+        *isNew = false;
+        return &requestCache[slot];
+    }
+
+    // Allocate a new slot, or reuse the least recently used slot
+    int slot;
+    if (cachedSensors < MAX_CACHED_SENSORS) {
+        slot = cachedSensors++;
+    } else {
+
+        // Prefer the least recently used sensor that isn't in the midst of a transfer
+        slot = sensorMRUTail;
+        for (int i=sensorMRUTail; i!=SENSOR_SLOT_NONE; i=requestCache[i].mruPrev) {
+            if (!requestCache[i].receivingRequest && !requestCache[i].sendingResponse && !requestCache[i].processingPending) {
+                slot = i;
+                break;
+            }
+        }
+        char evicted[40];
+        utilAddressToText(requestCache[slot].sensorAddress, evicted, sizeof(evicted));
+        APP_PRINTF("%s *** sensor cache full: evicting %s ***\r\n", tracePeer(), evicted);
+
+        // If every sensor has a request queued, the one being evicted has already been
+        // ACK'ed and so its request must be performed now rather than being dropped
+        if (requestCache[slot].processingPending) {
+            requestCache[slot].processingPending = false;
+            traceSetID("fm", requestCache[slot].sensorAddress, requestCache[slot].currentRequestID);
+            APP_PRINTF("%s performing queued request before evicting\r\n", tracePeer());
+            processSensorRequest(&requestCache[slot], false);
+            traceSetID("fm", address, 0);
+        }
+        sensorCacheEvict(slot);
+        sensorCacheIndexRemove(slot);
+        sensorCacheUnlink(slot);
+        if (requestCache[slot].data != NULL) {
+            memset(requestCache[slot].data, '?', requestCache[slot].dataTotalLen);
+            free(requestCache[slot].data);
+        }
+    }
+
+    // Initialize it
+    requestState *entry = &requestCache[slot];
+    memset(entry, 0, sizeof(requestState));
+    memcpy(entry->sensorAddress, address, ADDRESS_LEN);
+    entry->sfAssigned = entry->sfHeard = LORA_SPREADING_FACTOR;
+    entry->twFrameMultiplier = 1;
+    entry->mruPrev = entry->mruNext = SENSOR_SLOT_NONE;
+    sensorCacheIndexAdd(slot);
+    sensorCacheTouch(slot);
+    *isNew = true;
+    return entry;
+
+}
+
+// Find a sensor in the cache without changing its recency of use, or NULL if not cached
+requestState *sensorCacheFind(uint8_t *address)
+{
+    int bucket = sensorCacheFindBucket(address);
+    if (bucket < 0) {
+        return NULL;
+    }
+    return &requestCache[sensorHash[bucket]];
+}
+
+// Compress a payload that we own if it would otherwise require multiple chunks, the peer
+// is able to decompress it, and doing so makes it smaller.
+bool compressPayload(uint8_t peerVersion, uint8_t **data, uint32_t *dataLen)
+{
+    if (peerVersion < MESSAGE_VERSION_COMPRESS || *dataLen <= MESSAGE_MAX_CHUNK) {
+        return false;
+    }
+    uint32_t compressedLen;
+    uint8_t *compressed = compressEncode(*data, *dataLen, &compressedLen);
+    if (compressed == NULL) {
+        return false;
+    }
+    APP_PRINTF("%s compressed (%d) to (%d)\r\n", tracePeer(), *dataLen, compressedLen);
+    memset(*data, '?', *dataLen);
+    free(*data);
+    *data = compressed;
+    *dataLen = compressedLen;
+    return true;
+}
+
+// Append a TLV to a compact ACK body
+static uint32_t ackPutTLV(uint8_t *out, uint8_t tag, const void *value, uint8_t len)
+{
+    out[0] = tag;
+    out[1] = len;
+    memcpy(&out[2], value, len);
+    return len + 2;
+}
+
+// Encode a compact ACK body for a sensor.  The configuration is sent only when it has
+// changed since it was last sent to this sensor or when the sensor asks for it, and the
+// time is sent only in the final ACK of a request.
+uint32_t gatewayAckEncode(requestState *request, gatewayAckBody *body, bool full, bool withTime, uint8_t *out, int32_t *timeOffset)
+{
+
+    // Bump the epoch if the configuration has changed
+    gatewayAckBody config = *body;
+    config.Time = 0;
+    config.LastProcessedRequestID = 0;
+    uint32_t crc = utilCRC32(0, &config, offsetof(gatewayAckBody, Name));
+    crc = utilCRC32(crc, config.Name, strlen(config.Name));
+    bool sendSF = (request->messageVersion >= MESSAGE_VERSION_SF);
+    if (sendSF) {
+        crc = utilCRC32(crc, &request->sfAssigned, sizeof(request->sfAssigned));
+    }
+    if (request->ackEpoch == 0 || crc != request->ackConfigCRC) {
+        request->ackConfigCRC = crc;
+        if (++request->ackEpoch == 0) {
+            request->ackEpoch = 1;
+        }
+        full = true;
+    }
+
+    // If the sensor isn't using the spreading factor that we assigned, such as because it
+    // has reverted to the default after a failure, make sure that it gets it again.
+    if (sendSF && withTime && request->sfHeard != request->sfAssigned) {
+        full = true;
+    }
+
+    // Encode it
+    uint32_t len = 0;
+    out[len++] = request->ackEpoch;
+    if (full) {
+        uint8_t zone[sizeof(body->ZoneOffsetMins)+sizeof(body->ZoneName)];
+        memcpy(zone, &body->ZoneOffsetMins, sizeof(body->ZoneOffsetMins));
+        memcpy(&zone[sizeof(body->ZoneOffsetMins)], body->ZoneName, sizeof(body->ZoneName));
+        len += ackPutTLV(&out[len], ACK_TAG_TW_MODULUS, &body->TWModulusSecs, sizeof(body->TWModulusSecs));
+        len += ackPutTLV(&out[len], ACK_TAG_TW_MODULUS_OFFSET, &body->TWModulusOffsetSecs, sizeof(body->TWModulusOffsetSecs));
+        len += ackPutTLV(&out[len], ACK_TAG_TW_SLOT, &body->TWSlotBeginsSecs, sizeof(body->TWSlotBeginsSecs)+sizeof(body->TWSlotEndsSecs));
+        len += ackPutTLV(&out[len], ACK_TAG_TW_LBT, &body->TWListenBeforeTalkMs, sizeof(body->TWListenBeforeTalkMs));
+        len += ackPutTLV(&out[len], ACK_TAG_BOOT_TIME, &body->BootTime, sizeof(body->BootTime));
+        len += ackPutTLV(&out[len], ACK_TAG_ZONE, zone, sizeof(zone));
+        len += ackPutTLV(&out[len], ACK_TAG_NAME, body->Name, strlen(body->Name));
+        if (sendSF) {
+            len += ackPutTLV(&out[len], ACK_TAG_SF, &request->sfAssigned, sizeof(request->sfAssigned));
+        }
+    }
+    if (full || withTime) {
+        len += ackPutTLV(&out[len], ACK_TAG_LAST_PROCESSED, &body->LastProcessedRequestID, sizeof(body->LastProcessedRequestID));
+        if (request->messageVersion >= MESSAGE_VERSION_TIME_MS) {
+            uint8_t stamp[sizeof(body->Time)+sizeof(uint16_t)] = {0};
+            memcpy(stamp, &body->Time, sizeof(body->Time));
+            *timeOffset = len + 2;
+            len += ackPutTLV(&out[len], ACK_TAG_TIME_MS, stamp, sizeof(stamp));
+        } else {
+            len += ackPutTLV(&out[len], ACK_TAG_TIME, &body->Time, sizeof(body->Time));
+        }
+    }
+    return len;
+
+}
+
+// Decode a compact ACK body, updating the configuration last received from the gateway,
+// and noting whether we've missed a configuration change and must ask for it again.
+bool sensorAckDecode(uint8_t *data, uint32_t len, gatewayAckBody *body, bool *hasTime, int32_t *timeMs)
+{
+    if (len < 1) {
+        return false;
+    }
+    uint8_t epoch = data[0];
+    bool hasConfig = false;
+    uint8_t sf = LORA_SPREADING_FACTOR;
+    *hasTime = false;
+    for (uint32_t i=1; i+2 <= len;) {
+        uint8_t tag = data[i];
+        uint8_t tagLen = data[i+1];
+        uint8_t *value = &data[i+2];
+        i += 2 + tagLen;
+        if (i > len) {
+            return false;
+        }
+        switch (tag) {
+        case ACK_TAG_TW_MODULUS:
+            if (tagLen == sizeof(body->TWModulusSecs)) {
+                memcpy(&body->TWModulusSecs, value, tagLen);
+                hasConfig = true;
+            }
+            break;
+        case ACK_TAG_TW_MODULUS_OFFSET:
+            if (tagLen == sizeof(body->TWModulusOffsetSecs)) {
+                memcpy(&body->TWModulusOffsetSecs, value, tagLen);
+            }
+            break;
+        case ACK_TAG_TW_SLOT:
+            if (tagLen == sizeof(body->TWSlotBeginsSecs)+sizeof(body->TWSlotEndsSecs)) {
+                memcpy(&body->TWSlotBeginsSecs, value, tagLen);
+            }
+            break;
+        case ACK_TAG_TW_LBT:
+            if (tagLen == sizeof(body->TWListenBeforeTalkMs)) {
+                memcpy(&body->TWListenBeforeTalkMs, value, tagLen);
+            }
+            break;
+        case ACK_TAG_LAST_PROCESSED:
+            if (tagLen == sizeof(body->LastProcessedRequestID)) {
+                memcpy(&body->LastProcessedRequestID, value, tagLen);
+            }
+            break;
+        case ACK_TAG_BOOT_TIME:
+            if (tagLen == sizeof(body->BootTime)) {
+                memcpy(&body->BootTime, value, tagLen);
+            }
+            break;
+        case ACK_TAG_TIME:
+            if (tagLen == sizeof(body->Time)) {
+                memcpy(&body->Time, value, tagLen);
+                *hasTime = true;
+            }
+            break;
+        case ACK_TAG_TIME_MS:
+            if (tagLen == sizeof(body->Time)+sizeof(uint16_t)) {
+                uint16_t ms;
+                memcpy(&body->Time, value, sizeof(body->Time));
+                memcpy(&ms, &value[sizeof(body->Time)], sizeof(ms));
+                if (ms < 1000) {
+                    *timeMs = ms;
+                    *hasTime = true;
+                }
+            }
+            break;
+        case ACK_TAG_ZONE:
+            if (tagLen == sizeof(body->ZoneOffsetMins)+sizeof(body->ZoneName)) {
+                memcpy(&body->ZoneOffsetMins, value, sizeof(body->ZoneOffsetMins));
+                memcpy(body->ZoneName, &value[sizeof(body->ZoneOffsetMins)], sizeof(body->ZoneName));
+            }
+            break;
+        case ACK_TAG_NAME:
+            if (tagLen < sizeof(body->Name)) {
+                memcpy(body->Name, value, tagLen);
+                body->Name[tagLen] = '\0';
+            }
+            break;
+        case ACK_TAG_SF:
+            if (tagLen == sizeof(sf) && value[0] >= LORA_SPREADING_FACTOR_MIN && value[0] <= LORA_SPREADING_FACTOR) {
+                sf = value[0];
+            }
+            break;
+        }
+    }
+
+    // Track the epoch of the configuration that we have, using the spreading factor that
+    // it assigns to our slot beginning with our next transmission in the slot.
+    if (hasConfig) {
+        if (TWSpreadingFactor != sf) {
+            APP_PRINTF("%s TWSpreadingFactor: from %d to %d\r\n", tracePeer(), TWSpreadingFactor, sf);
+            TWSpreadingFactor = sf;
+        }
+        gatewayAckEpoch = epoch;
+        gatewayAckSync = false;
+    } else if (epoch != gatewayAckEpoch) {
+        APP_PRINTF("%s gateway configuration changed: requesting it\r\n", tracePeer());
+        gatewayAckSync = true;
+    }
+
+    // The body is only meaningful if we've ever received the configuration
+    return (gatewayAckEpoch != 0);
+
+}
+
+// Get the message version that determines which features may be used with a peer
+uint8_t peerMessageVersion(uint8_t *address)
+{
+    if (appIsGateway) {
+        return sensorCacheMessageVersion(address);
+    }
+    return gatewayMessageVersion;
+}
+
+// Get the message version to be used when sending to a sensor
+uint8_t sensorCacheMessageVersion(uint8_t *address)
+{
+    requestState *request = sensorCacheFind(address);
+    if (request == NULL || request->messageVersion == 0) {
+        return MESSAGE_VERSION;
+    }
+    return request->messageVersion;
+}
+
 // Clear request info in a cache entry
 void appSensorCacheEntryResetStats(uint32_t index)
 {
+    if (index >= MAX_CACHED_SENSORS) {
+        evictedCache[index - MAX_CACHED_SENSORS].requestsProcessed = 0;
+        evictedCache[index - MAX_CACHED_SENSORS].requestsLost = 0;
+        return;
+    }
     requestCache[index].requestsProcessed = 0;
     requestCache[index].requestsLost = 0;
 }
 
+// Get the sensor DB shadow of a cache entry
+sensorDBShadow *appSensorCacheShadow(uint32_t index)
+{
+    if (index >= MAX_CACHED_SENSORS) {
+        return &evictedCache[index - MAX_CACHED_SENSORS].dbShadow;
+    }
+    return &requestCache[index].dbShadow;
+}
+
+// Get the link history of a cache entry
+linkHistory *appSensorCacheLinks(uint32_t index)
+{
+    return &requestCache[index].links;
+}
+
+// Set the period at which a sensor has said that it expects to send
+void appSensorCacheSetSendPeriod(uint8_t *address, uint32_t periodSecs)
+{
+    requestState *request = sensorCacheFind(address);
+    if (request != NULL && request->sendPeriodSecs != periodSecs) {
+        APP_PRINTF("%s sensor send period changed from %d to %d\r\n", tracePeer(), request->sendPeriodSecs, periodSecs);
+        request->sendPeriodSecs = periodSecs;
+    }
+}
+
 // Get info about a sensor cache entry
 bool appSensorCacheEntry(uint32_t i, uint8_t *address,
                          int8_t *gatewayRSSI, int8_t *gatewaySNR,
@@ -1820,6 +3360,29 @@ bool appSensorCacheEntry(uint32_t i, uint8_t *address,
                          uint32_t *requestsProcessed, uint32_t *requestsLost)
 {
 
+    // An evicted sensor awaiting a flush
+    if (i >= MAX_CACHED_SENSORS) {
+        uint32_t n = i - MAX_CACHED_SENSORS;
+        if (n >= SENSOR_EVICTED_MAX || ((n + SENSOR_EVICTED_MAX - evictedFirst) % SENSOR_EVICTED_MAX) >= evictedCount) {
+            return false;
+        }
+        evictedState *evicted = &evictedCache[n];
+        if (address != NULL) {
+            memcpy(address, evicted->sensorAddress, ADDRESS_LEN);
+        }
+        *gatewayRSSI = evicted->gatewayRSSI;
+        *gatewaySNR = evicted->gatewaySNR;
+        *sensorRSSI = evicted->sensorRSSI;
+        *sensorSNR = evicted->sensorSNR;
+        *sensorTXP = evicted->sensorTXP;
+        *sensorLTP = evicted->sensorLTP;
+        *sensorMv = evicted->sensorMv;
+        *lastReceivedTime = evicted->lastReceivedTime;
+        *requestsProcessed = evicted->requestsProcessed;
+        *requestsLost = evicted->requestsLost;
+        return true;
+    }
+
     // Out of range
     if (i >= cachedSensors) {
         return false;
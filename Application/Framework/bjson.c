@@ -0,0 +1,498 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Compact binary encoding of JSON requests, so that typical notes sent by sensors
+// fit into a single LoRa packet.  Keys and common string values are replaced by
+// indices into a static dictionary, integers are zigzag varints, and numbers are
+// sent as float16 when the sensor has registered a note.template declaring them so.
+//
+// An encoded request begins with BJSON_MARKER, which can never begin a JSON text.
+// Every other value is a tag byte followed by its data.  Strings (including keys)
+// are a byte that is either a literal length 0-127, 0x80+index into the dictionary,
+// or 0xFF followed by a varint literal length, followed by the literal bytes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "framework.h"
+
+// Tags
+#define BJSON_MARKER        0xB1
+#define BJ_FALSE            0x00
+#define BJ_TRUE             0x01
+#define BJ_NULL             0x02
+#define BJ_INT              0x03    // Zigzag varint
+#define BJ_FLOAT16          0x04    // IEEE half, little-endian
+#define BJ_FLOAT32          0x05    // IEEE single, little-endian
+#define BJ_FLOAT64          0x06    // IEEE double, little-endian
+#define BJ_STRING           0x07    // String
+#define BJ_OBJECT           0x08    // Varint count, then pairs of key string and value
+#define BJ_ARRAY            0x09    // Varint count, then values
+
+// String encoding
+#define BJ_STR_DICT         0x80
+#define BJ_STR_LONG         0xFF
+
+// Maximum nesting that will be decoded
+#define BJSON_MAX_DEPTH     8
+
+// Dictionary of keys and string values.  Entries may only ever be appended, because
+// the index of each entry is part of the wire format.
+static const char *bjsonDict[] = {
+    "req", "cmd", "id", "file", "body", "payload", "note", "sync", "time", "text",
+    "radio", "err", "start", "stop", "mode", "count", "total", "sensor", "temperature",
+    "humidity", "pressure", "voltage", "note.add", "note.template", "note.get",
+    "note.update", "hub.log", "card.time", "env.get", "*#data.qo", "*#air.qo",
+    "*#motion.qo", "motion", "alert", "name", "status", "value", "delete", "seconds",
+    BATCH_REQUEST, BATCH_FIELD_REQUESTS, REQUEST_FIELD_PERIOD,
+};
+#define BJSON_DICT_ENTRIES  (sizeof(bjsonDict)/sizeof(bjsonDict[0]))
+
+// Number formats learned from note.template requests, keyed by notefile and field name
+// because the same field name may be declared with different precision in different files
+#define BJSON_TEMPLATE_FIELDS   16
+#define BJSON_TEMPLATE_FILE_MAX 24
+#define BJSON_TEMPLATE_KEY_MAX  24
+typedef struct {
+    char file[BJSON_TEMPLATE_FILE_MAX];
+    char key[BJSON_TEMPLATE_KEY_MAX];
+    uint8_t tag;
+} bjsonTemplateField;
+static bjsonTemplateField templateField[BJSON_TEMPLATE_FIELDS];
+static uint32_t templateFields = 0;
+
+// Decoder state
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool err;
+} bjsonCursor;
+
+// Forwards
+static uint32_t encodeValue(J *item, const char *file, const char *key, uint8_t *out);
+static J *decodeValue(bjsonCursor *c, const char *key, uint32_t depth);
+
+// Convert a float to IEEE half precision, rounding to nearest
+static uint16_t floatToHalf(float f)
+{
+    union {
+        float f;
+        uint32_t u;
+    } v = { .f = f };
+    uint32_t sign = (v.u >> 16) & 0x8000;
+    uint32_t fexp = (v.u >> 23) & 0xff;
+    uint32_t mant = v.u & 0x7fffff;
+    int32_t exp = (int32_t) fexp - 127 + 15;
+    if (fexp == 0xff) {
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    }
+    if (exp >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    if (exp <= 0) {
+        if (exp < -10) {
+            return sign;
+        }
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        if ((mant >> (shift-1)) & 1) {
+            half++;
+        }
+        return sign | half;
+    }
+    uint32_t half = sign | (exp << 10) | (mant >> 13);
+    if (mant & 0x1000) {
+        half++;
+    }
+    return half;
+}
+
+// Convert an IEEE half to a float
+static float halfToFloat(uint16_t h)
+{
+    union {
+        float f;
+        uint32_t u;
+    } v;
+    uint32_t sign = (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {
+        v.f = (float) mant / 16777216.0f;
+        v.u |= sign;
+    } else if (exp == 0x1f) {
+        v.u = sign | 0x7f800000 | (mant << 13);
+    } else {
+        v.u = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    }
+    return v.f;
+}
+
+// Learn the number formats of the fields of a note.template request
+void bjsonLearnTemplate(J *req)
+{
+    if (strcmp(JGetString(req, "req"), "note.template") != 0) {
+        return;
+    }
+    const char *file = JGetString(req, "file");
+    if (strlen(file) >= BJSON_TEMPLATE_FILE_MAX) {
+        return;
+    }
+    J *field;
+    JObjectForEach(field, JGetObject(req, "body")) {
+        if (field->type != JNumber || field->string == NULL || strlen(field->string) >= BJSON_TEMPLATE_KEY_MAX) {
+            continue;
+        }
+        uint8_t tag;
+        if (field->valuenumber == TFLOAT16) {
+            tag = BJ_FLOAT16;
+        } else if (field->valuenumber == TFLOAT32) {
+            tag = BJ_FLOAT32;
+        } else {
+            continue;
+        }
+        uint32_t i;
+        for (i=0; i<templateFields; i++) {
+            if (strcmp(templateField[i].file, file) == 0 && strcmp(templateField[i].key, field->string) == 0) {
+                break;
+            }
+        }
+        if (i == templateFields) {
+            if (templateFields >= BJSON_TEMPLATE_FIELDS) {
+                continue;
+            }
+            strlcpy(templateField[templateFields].file, file, BJSON_TEMPLATE_FILE_MAX);
+            strlcpy(templateField[templateFields++].key, field->string, BJSON_TEMPLATE_KEY_MAX);
+        }
+        templateField[i].tag = tag;
+    }
+}
+
+// Append a byte to the output, if there is output
+static inline uint32_t putByte(uint8_t *out, uint32_t len, uint8_t b)
+{
+    if (out != NULL) {
+        out[len] = b;
+    }
+    return 1;
+}
+
+// Append a varint
+static uint32_t putVarint(uint8_t *out, uint64_t v)
+{
+    uint32_t len = 0;
+    while (v >= 0x80) {
+        len += putByte(out, len, (uint8_t) (v | 0x80));
+        v >>= 7;
+    }
+    len += putByte(out, len, (uint8_t) v);
+    return len;
+}
+
+// Append little-endian bytes
+static uint32_t putBytes(uint8_t *out, const void *data, uint32_t bytes)
+{
+    if (out != NULL) {
+        memcpy(out, data, bytes);
+    }
+    return bytes;
+}
+
+// Append a string, using the dictionary if possible
+static uint32_t encodeString(const char *str, uint8_t *out)
+{
+    for (uint32_t i=0; i<BJSON_DICT_ENTRIES; i++) {
+        if (strcmp(str, bjsonDict[i]) == 0) {
+            return putByte(out, 0, BJ_STR_DICT + i);
+        }
+    }
+    uint32_t strLen = strlen(str);
+    uint32_t len = 0;
+    if (strLen < BJ_STR_DICT) {
+        len += putByte(out, len, strLen);
+    } else {
+        len += putByte(out, len, BJ_STR_LONG);
+        len += putVarint(out == NULL ? NULL : &out[len], strLen);
+    }
+    len += putBytes(out == NULL ? NULL : &out[len], str, strLen);
+    return len;
+}
+
+// Append a number in the most compact form that preserves it
+static uint32_t encodeNumber(JNUMBER n, const char *file, const char *key, uint8_t *out)
+{
+    uint32_t len = 0;
+
+    // Integers
+    if (n == floor(n) && fabs(n) < 9.0e18) {
+        int64_t i = (int64_t) n;
+        len += putByte(out, len, BJ_INT);
+        len += putVarint(out == NULL ? NULL : &out[len], ((uint64_t) i << 1) ^ (uint64_t) (i >> 63));
+        return len;
+    }
+
+    // Use the precision declared by the template, if any
+    uint8_t tag = BJ_FLOAT64;
+    if (file != NULL && key != NULL) {
+        for (uint32_t i=0; i<templateFields; i++) {
+            if (strcmp(templateField[i].file, file) == 0 && strcmp(templateField[i].key, key) == 0) {
+                tag = templateField[i].tag;
+                break;
+            }
+        }
+    }
+    if (tag == BJ_FLOAT64 && (JNUMBER) ((float) n) == n) {
+        tag = BJ_FLOAT32;
+    }
+    len += putByte(out, len, tag);
+    if (tag == BJ_FLOAT16) {
+        uint16_t h = floatToHalf((float) n);
+        len += putBytes(out == NULL ? NULL : &out[len], &h, sizeof(h));
+    } else if (tag == BJ_FLOAT32) {
+        float f = (float) n;
+        len += putBytes(out == NULL ? NULL : &out[len], &f, sizeof(f));
+    } else {
+        double d = (double) n;
+        len += putBytes(out == NULL ? NULL : &out[len], &d, sizeof(d));
+    }
+    return len;
+}
+
+// Append a value, or just measure it if out is NULL.  The notefile of the values within
+// a note.add request is the one that it names, so that the formats learned for that
+// notefile apply to them.  Other requests, notably the note.template that declares the
+// formats with numbers whose fractions are type markers, have no notefile and so are
+// encoded exactly.
+static uint32_t encodeValue(J *item, const char *file, const char *key, uint8_t *out)
+{
+    uint32_t len = 0;
+    J *child;
+    switch (item->type & 0xff) {
+    case JFalse:
+        return putByte(out, 0, BJ_FALSE);
+    case JTrue:
+        return putByte(out, 0, BJ_TRUE);
+    case JNumber:
+        return encodeNumber(item->valuenumber, file, key, out);
+    case JString:
+        len += putByte(out, len, BJ_STRING);
+        len += encodeString(item->valuestring == NULL ? "" : item->valuestring, out == NULL ? NULL : &out[len]);
+        return len;
+    case JObject:
+    case JArray: {
+        bool isObject = (item->type & 0xff) == JObject;
+        if (isObject && JIsPresent(item, "req")) {
+            J *fileItem = JGetObjectItem(item, "file");
+            file = NULL;
+            if (strcmp(JGetString(item, "req"), "note.add") == 0 && fileItem != NULL
+                    && (fileItem->type & 0xff) == JString && fileItem->valuestring != NULL) {
+                file = fileItem->valuestring;
+            }
+        }
+        uint32_t count = 0;
+        JObjectForEach(child, item) {
+            count++;
+        }
+        len += putByte(out, len, isObject ? BJ_OBJECT : BJ_ARRAY);
+        len += putVarint(out == NULL ? NULL : &out[len], count);
+        JObjectForEach(child, item) {
+            if (isObject) {
+                len += encodeString(child->string == NULL ? "" : child->string, out == NULL ? NULL : &out[len]);
+            }
+            len += encodeValue(child, file, isObject ? child->string : key, out == NULL ? NULL : &out[len]);
+        }
+        return len;
+    }
+    default:
+        return putByte(out, 0, BJ_NULL);
+    }
+}
+
+// Encode a JSON object, returning an allocated buffer or NULL if it can't be encoded
+uint8_t *bjsonEncode(J *item, uint32_t *retLen)
+{
+    uint32_t len = 1 + encodeValue(item, NULL, NULL, NULL);
+    uint8_t *out = malloc(len);
+    if (out == NULL) {
+        return NULL;
+    }
+    out[0] = BJSON_MARKER;
+    encodeValue(item, NULL, NULL, &out[1]);
+    *retLen = len;
+    return out;
+}
+
+// See if a request is encoded
+bool bjsonIsEncoded(const uint8_t *data, uint32_t len)
+{
+    return (len > 0 && data[0] == BJSON_MARKER);
+}
+
+// Get a byte from the input
+static uint8_t getByte(bjsonCursor *c)
+{
+    if (c->p >= c->end) {
+        c->err = true;
+        return 0;
+    }
+    return *c->p++;
+}
+
+// Get a varint
+static uint64_t getVarint(bjsonCursor *c)
+{
+    uint64_t v = 0;
+    for (uint32_t shift=0; shift<64; shift+=7) {
+        uint8_t b = getByte(c);
+        v |= ((uint64_t) (b & 0x7f)) << shift;
+        if ((b & 0x80) == 0) {
+            return v;
+        }
+    }
+    c->err = true;
+    return 0;
+}
+
+// Get little-endian bytes
+static void getBytes(bjsonCursor *c, void *data, uint32_t bytes)
+{
+    if ((uint32_t) (c->end - c->p) < bytes) {
+        c->err = true;
+        memset(data, 0, bytes);
+        return;
+    }
+    memcpy(data, c->p, bytes);
+    c->p += bytes;
+}
+
+// Get a string, returning either a dictionary entry or an allocated copy (in *alloc)
+static const char *getString(bjsonCursor *c, char **alloc)
+{
+    *alloc = NULL;
+    uint32_t len = getByte(c);
+    if (len >= BJ_STR_DICT && len != BJ_STR_LONG) {
+        if (len - BJ_STR_DICT >= BJSON_DICT_ENTRIES) {
+            c->err = true;
+            return "";
+        }
+        return bjsonDict[len - BJ_STR_DICT];
+    }
+    if (len == BJ_STR_LONG) {
+        len = (uint32_t) getVarint(c);
+    }
+    if (c->err || (uint32_t) (c->end - c->p) < len) {
+        c->err = true;
+        return "";
+    }
+    *alloc = malloc(len+1);
+    if (*alloc == NULL) {
+        c->err = true;
+        return "";
+    }
+    memcpy(*alloc, c->p, len);
+    (*alloc)[len] = '\0';
+    c->p += len;
+    return *alloc;
+}
+
+// Decode a value
+static J *decodeValue(bjsonCursor *c, const char *key, uint32_t depth)
+{
+    uint8_t tag = getByte(c);
+    if (c->err) {
+        return NULL;
+    }
+    switch (tag) {
+    case BJ_FALSE:
+        return JCreateBool(false);
+    case BJ_TRUE:
+        return JCreateBool(true);
+    case BJ_NULL:
+        return JCreateNull();
+    case BJ_INT: {
+        uint64_t z = getVarint(c);
+        int64_t i = (int64_t) (z >> 1) ^ -((int64_t) (z & 1));
+        return JCreateNumber((JNUMBER) i);
+    }
+    case BJ_FLOAT16: {
+        uint16_t h;
+        getBytes(c, &h, sizeof(h));
+        return JCreateNumber((JNUMBER) halfToFloat(h));
+    }
+    case BJ_FLOAT32: {
+        float f;
+        getBytes(c, &f, sizeof(f));
+        return JCreateNumber((JNUMBER) f);
+    }
+    case BJ_FLOAT64: {
+        double d;
+        getBytes(c, &d, sizeof(d));
+        return JCreateNumber((JNUMBER) d);
+    }
+    case BJ_STRING: {
+        char *alloc;
+        const char *str = getString(c, &alloc);
+        J *item = c->err ? NULL : JCreateString(str);
+        if (alloc != NULL) {
+            free(alloc);
+        }
+        return item;
+    }
+    case BJ_OBJECT:
+    case BJ_ARRAY: {
+        if (depth >= BJSON_MAX_DEPTH) {
+            c->err = true;
+            return NULL;
+        }
+        J *item = (tag == BJ_OBJECT) ? JCreateObject() : JCreateArray();
+        if (item == NULL) {
+            c->err = true;
+            return NULL;
+        }
+        uint32_t count = (uint32_t) getVarint(c);
+        for (uint32_t i=0; i<count && !c->err; i++) {
+            char *alloc = NULL;
+            const char *childKey = key;
+            if (tag == BJ_OBJECT) {
+                childKey = getString(c, &alloc);
+            }
+            J *child = decodeValue(c, childKey, depth+1);
+            if (child != NULL) {
+                if (tag == BJ_OBJECT) {
+                    JAddItemToObject(item, childKey, child);
+                } else {
+                    JAddItemToArray(item, child);
+                }
+            }
+            if (alloc != NULL) {
+                free(alloc);
+            }
+        }
+        if (c->err) {
+            JDelete(item);
+            return NULL;
+        }
+        return item;
+    }
+    }
+    c->err = true;
+    return NULL;
+}
+
+// Decode an encoded request, returning NULL if it is invalid
+J *bjsonDecode(const uint8_t *data, uint32_t len)
+{
+    if (!bjsonIsEncoded(data, len)) {
+        return NULL;
+    }
+    bjsonCursor c = { .p = &data[1], .end = &data[len], .err = false };
+    J *item = decodeValue(&c, NULL, 0);
+    if (item != NULL && (c.err || c.p != c.end)) {
+        JDelete(item);
+        item = NULL;
+    }
+    return item;
+}
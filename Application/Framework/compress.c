@@ -0,0 +1,195 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// LZSS compression of payloads that would otherwise span several LoRa packets.
+// Both sides share a static dictionary of Notecard JSON fragments that is treated
+// as if it preceded the data, so that even short payloads compress well.
+//
+// The compressed form is a varint of the uncompressed length, followed by groups of
+// a control byte and eight items.  Each control bit, LSB first, is 1 for a literal
+// byte or 0 for a two-byte match: the low 8 bits of (distance-1), then the high 3
+// bits of (distance-1) followed by 5 bits of (length-COMPRESS_MIN_MATCH).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framework.h"
+
+// Match parameters
+#define COMPRESS_WINDOW         2048
+#define COMPRESS_MIN_MATCH      3
+#define COMPRESS_MAX_MATCH      (COMPRESS_MIN_MATCH+31)
+
+// Largest payload that will be decompressed, well beyond any request or response that is
+// exchanged, so that a corrupt or hostile length can neither wrap nor exhaust the heap
+#define COMPRESS_MAX_LEN        (16*1024)
+
+// Priming dictionary.  Like any dictionary that is part of the wire format, this
+// may never be changed.  The most common fragments are last, so that they're nearest.
+static const char compressDict[] =
+    "{\"req\":\"hub.log\",\"text\":\"note.get\",\"note.update\",\"env.get\",\"note.changes\","
+    "\"name\":\"loc\":\"notes\":\"total\":\"sensor\":\"radio\":\"time\":\"err\":\"pressure\":"
+    "\"voltage\":\"humidity\":\"temperature\":\"count\":\"id\":\"sync\":true,\"note.template\","
+    "{\"req\":\"note.add\",\"file\":\"*#data.qo\",\"body\":{\"";
+#define COMPRESS_DICT_LEN       (sizeof(compressDict)-1)
+
+// Get a byte of the virtual buffer made up of the dictionary followed by the data
+static inline uint8_t compressByte(const uint8_t *data, uint32_t i)
+{
+    return (i < COMPRESS_DICT_LEN) ? (uint8_t) compressDict[i] : data[i-COMPRESS_DICT_LEN];
+}
+
+// Compress a payload, returning an allocated buffer, or NULL if it wouldn't be smaller
+uint8_t *compressEncode(const uint8_t *data, uint32_t len, uint32_t *retLen)
+{
+    uint8_t *out = malloc(len);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    // Uncompressed length
+    uint32_t outLen = 0;
+    uint32_t v = len;
+    while (v >= 0x80 && outLen < len) {
+        out[outLen++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    if (outLen < len) {
+        out[outLen++] = (uint8_t) v;
+    }
+
+    // Items, where pos and everything else is in terms of the virtual buffer
+    uint32_t end = COMPRESS_DICT_LEN + len;
+    uint32_t pos = COMPRESS_DICT_LEN;
+    uint32_t control = 0;
+    uint32_t item = 8;
+    while (pos < end) {
+
+        // Leave room for a control byte and the largest item
+        if (item == 8) {
+            if (outLen+3 >= len) {
+                free(out);
+                return NULL;
+            }
+            control = outLen++;
+            out[control] = 0;
+            item = 0;
+        } else if (outLen+2 >= len) {
+            free(out);
+            return NULL;
+        }
+
+        // Find the longest match within the window
+        uint32_t bestLen = 0;
+        uint32_t bestDistance = 0;
+        uint32_t maxMatch = (end-pos < COMPRESS_MAX_MATCH) ? end-pos : COMPRESS_MAX_MATCH;
+        uint32_t windowStart = (pos > COMPRESS_WINDOW) ? pos-COMPRESS_WINDOW : 0;
+        if (maxMatch >= COMPRESS_MIN_MATCH) {
+            uint8_t first = compressByte(data, pos);
+            for (uint32_t candidate=windowStart; candidate<pos; candidate++) {
+                if (compressByte(data, candidate) != first) {
+                    continue;
+                }
+                uint32_t matchLen = 1;
+                while (matchLen < maxMatch && compressByte(data, candidate+matchLen) == compressByte(data, pos+matchLen)) {
+                    matchLen++;
+                }
+                if (matchLen >= bestLen) {
+                    bestLen = matchLen;
+                    bestDistance = pos - candidate;
+                    if (matchLen == maxMatch) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Emit the item
+        if (bestLen >= COMPRESS_MIN_MATCH) {
+            out[outLen++] = (uint8_t) (bestDistance-1);
+            out[outLen++] = (uint8_t) ((((bestDistance-1) >> 8) << 5) | (bestLen-COMPRESS_MIN_MATCH));
+            pos += bestLen;
+        } else {
+            out[control] |= (1 << item);
+            out[outLen++] = compressByte(data, pos);
+            pos++;
+        }
+        item++;
+
+    }
+
+    *retLen = outLen;
+    return out;
+}
+
+// Decompress a payload, returning an allocated buffer that has a null terminator
+// beyond its returned length, or NULL if the payload is invalid.
+uint8_t *compressDecode(const uint8_t *data, uint32_t len, uint32_t *retLen)
+{
+
+    // Uncompressed length
+    uint32_t in = 0;
+    uint32_t outLen = 0;
+    for (uint32_t shift=0;; shift+=7) {
+        if (in >= len || shift > 28) {
+            return NULL;
+        }
+        uint8_t b = data[in++];
+        outLen |= (uint32_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            break;
+        }
+    }
+    if (outLen > COMPRESS_MAX_LEN) {
+        return NULL;
+    }
+    uint8_t *out = malloc(outLen+1);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    // Items
+    uint32_t pos = 0;
+    uint8_t control = 0;
+    uint32_t item = 8;
+    while (pos < outLen) {
+        if (item == 8) {
+            if (in >= len) {
+                break;
+            }
+            control = data[in++];
+            item = 0;
+        }
+        if ((control & (1 << item)) != 0) {
+            if (in >= len) {
+                break;
+            }
+            out[pos++] = data[in++];
+        } else {
+            if (in+2 > len) {
+                break;
+            }
+            uint32_t distance = (data[in] | ((data[in+1] >> 5) << 8)) + 1;
+            uint32_t matchLen = (data[in+1] & 0x1f) + COMPRESS_MIN_MATCH;
+            in += 2;
+            if (distance > COMPRESS_DICT_LEN + pos || pos+matchLen > outLen) {
+                break;
+            }
+            for (uint32_t i=0; i<matchLen; i++, pos++) {
+                uint32_t from = COMPRESS_DICT_LEN + pos - distance;
+                out[pos] = (from < COMPRESS_DICT_LEN) ? (uint8_t) compressDict[from] : out[from-COMPRESS_DICT_LEN];
+            }
+        }
+        item++;
+    }
+    if (pos != outLen || in != len) {
+        memset(out, '?', outLen);
+        free(out);
+        return NULL;
+    }
+
+    out[outLen] = '\0';
+    *retLen = outLen;
+    return out;
+}
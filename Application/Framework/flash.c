@@ -9,7 +9,17 @@
 #include "main.h"
 #include "framework.h"
 
-// Flash config device descriptor
+// In-memory device descriptor
+typedef struct {
+    uint16_t type;
+    bool dirty;                     // Changed since last written to the journal
+    uint8_t address[ADDRESS_LEN];
+    char name[SENSOR_NAME_MAX];
+    uint8_t key[AES_KEY_BYTES];
+} peerConfig;
+
+// Flash config device descriptor, as stored by V1 firmware, which held at most 150
+#define FLASH_V1_MAX_PEERS          150
 typedef struct __attribute__((__packed__))
 {
     uint16_t type;
@@ -17,36 +27,100 @@ typedef struct __attribute__((__packed__))
     char name[SENSOR_NAME_MAX];
     uint8_t key[AES_KEY_BYTES];
 }
-peerConfig;
+peerConfigV1;
 
-// Flash configuration header
+// Flash configuration header.  In V1, the header was followed by a table of peers
+// which was rewritten in its entirety on every change.  In V2, the header is followed
+// by a journal of variable-length peer records, each of which is appended as it
+// changes, and the latest record for an address is the one that is in effect.
 #define FLASH_CONFIG_SIGNATURE_V1   0xF00DD00D
-#define FLASH_CONFIG_SIGNATURE      FLASH_CONFIG_SIGNATURE_V1
-#define MAX_PEERS                   150
+#define FLASH_CONFIG_SIGNATURE_V2   0xF00DD00E
+#define FLASH_CONFIG_SIGNATURE_V3   0xF00DD00F
+#define FLASH_CONFIG_SIGNATURE      FLASH_CONFIG_SIGNATURE_V3
 typedef struct {
     uint32_t signature;             // Both signature and version overloaded
-    uint32_t peers;                 // Number of peers located immediately after sizeof(flashConfig)
+    uint32_t peers;                 // V1: Number of peers located immediately after sizeof(flashConfig)
 } flashConfig;
 
+// In V3, the config area is split into two banks, each holding a header and a V2-style
+// journal.  Records are appended to the active bank.  When it fills, the live records
+// are compacted into the other bank and its header, written last, commits it with a
+// higher sequence number.  Because the active bank is never erased until another bank
+// has been committed, losing power at any point leaves a complete config in flash.
+typedef struct {
+    uint32_t signature;
+    uint32_t sequence;              // Bank with the highest valid sequence is active
+    uint32_t crc;                   // CRC-32 of the signature and sequence
+    uint32_t reserved;              // Pads the header to a doubleword boundary
+} flashBank;
+
+// Journal record, which is followed by the peer's name (not null-terminated) and
+// padded so that every record begins on a doubleword boundary.
+#define FLASH_RECORD_ERASED         0xFF
+#define FLASH_RECORD_PEER           0x01
+typedef struct __attribute__((__packed__))
+{
+    uint8_t op;                     // Record type
+    uint8_t nameLen;                // Length of the name following the record
+    uint16_t type;
+    uint32_t crc;                   // CRC-32 of the record and name, computed with this field zero
+    uint8_t address[ADDRESS_LEN];
+    uint8_t key[AES_KEY_BYTES];
+}
+flashRecord;
+#define FLASH_RECORD_ALIGN(n)       (((n)+7) & ~7)
+#define FLASH_RECORD_MIN_BYTES      FLASH_RECORD_ALIGN(sizeof(flashRecord))
+#define FLASH_RECORD_MAX_BYTES      FLASH_RECORD_ALIGN(sizeof(flashRecord)+SENSOR_NAME_MAX)
+
+// An older layout that reaches into bank B is copied verbatim into the DFU area before
+// bank B is erased to migrate it, and is imported from that copy should power be lost
+// before the migration is committed.  The copy is valid only while it matches what is
+// still in bank A, which isn't erased until bank B has been committed.
+#define FLASH_STAGED_SIGNATURE      0xF00DD0FF
+typedef struct {
+    uint32_t signature;
+    uint32_t bytes;                 // Length of the copy of the config area that follows
+    uint32_t crc;                   // CRC-32 of the signature, length and copy
+    uint32_t reserved;              // Pads the header to a doubleword boundary
+} flashStaged;
+
 // Locations of config data
-#define FLASH_CONFIG_BYTES          (FLASH_PAGE_SIZE*8)
+#define FLASH_CONFIG_PAGES          8
+#define FLASH_CONFIG_BYTES          (FLASH_PAGE_SIZE*FLASH_CONFIG_PAGES)
 #define FLASH_CONFIG_BASE_ADDRESS   ((FLASH_BASE+FLASH_SIZE)-FLASH_CONFIG_BYTES)
 #define FLASH_PEER_CONFIG_ADDRESS   (FLASH_CONFIG_BASE_ADDRESS)
 #define FLASH_PEER_CONFIG_BYTES     (sizeof(flashConfig))
 #define FLASH_PEER_TABLE_ADDRESS    (FLASH_PEER_CONFIG_ADDRESS+FLASH_PEER_CONFIG_BYTES)
-#define FLASH_PEER_ENTRY_BYTES      (sizeof(peerConfig))
-#define FLASH_PEER_TABLE_BYTES      (MAX_PEERS*FLASH_PEER_ENTRY_BYTES)
-#define FLASH_MAX_USED_BYTES        (FLASH_PEER_CONFIG_BYTES+FLASH_PEER_TABLE_BYTES)
+#define FLASH_BANK_PAGES            (FLASH_CONFIG_PAGES/2)
+#define FLASH_BANK_BYTES            (FLASH_PAGE_SIZE*FLASH_BANK_PAGES)
+#define FLASH_BANK_A_ADDRESS        (FLASH_CONFIG_BASE_ADDRESS)
+#define FLASH_BANK_B_ADDRESS        (FLASH_CONFIG_BASE_ADDRESS+FLASH_BANK_BYTES)
+
+// Every peer must be able to be compacted into a single bank
+_Static_assert(sizeof(flashBank) + MAX_PEERS*FLASH_RECORD_MIN_BYTES <= FLASH_BANK_BYTES,
+               "MAX_PEERS exceeds the number of peer records that fit within a config bank");
+_Static_assert(MAX_PEERS <= FLASH_V1_MAX_PEERS, "MAX_PEERS exceeds the peers that may be held in RAM");
 
 // Locations of firmware
 #define FLASH_CODE_PAGES            (((FLASH_SIZE-FLASH_CONFIG_BYTES)/2)/FLASH_PAGE_SIZE)
 #define FLASH_CODE_MAX_BYTES        (FLASH_CODE_PAGES*FLASH_PAGE_SIZE)
 #define FLASH_CODE_BASE             (FLASH_BASE)
 #define FLASH_CODE_DFU_BASE         (FLASH_BASE+FLASH_CODE_MAX_BYTES)
+#define FLASH_STAGED_ADDRESS        (FLASH_CODE_DFU_BASE)
+_Static_assert(sizeof(flashStaged) + FLASH_CONFIG_BYTES <= FLASH_CODE_MAX_BYTES,
+               "config area can't be staged within the DFU area");
 
-// In-memory flash config
+// In-memory flash config.  The peer table is kept sorted by address so that peers,
+// which are looked up on every packet encrypted or decrypted, can be found by binary search.
 static flashConfig config = {0};
 static peerConfig *peer = NULL;
+static uint32_t peerCapacity = 0;
+static uint32_t journalBank = 0;    // Address of the active bank
+static uint32_t journalSequence = 0;
+static uint32_t journalNext = 0;    // Address at which to append, or 0 if compaction is needed
+static uint32_t legacyBase = 0;     // Address of the older layout being migrated, if any
+static uint32_t legacyBytes = 0;    // Length of the older layout being migrated, or 0 if none
+static bool configReadOnly = false; // Older layout that doesn't fit a bank, which can't be changed
 
 // Macros
 #define GMAX(x, y) (((x) > (y)) ? (x) : (y))
@@ -56,6 +130,17 @@ static peerConfig *peer = NULL;
 // Forwards
 uint32_t FLASH_Init(void);
 bool FLASH_write_at(uint32_t address, uint64_t *pData, uint32_t datalen);
+uint32_t peerSearch(const uint8_t *address, bool *found);
+peerConfig *peerInsert(const uint8_t *address, bool import);
+bool flashErase(uint32_t address, uint32_t pages);
+bool flashProgram(uint32_t address, void *data, uint32_t bytes);
+bool bankValid(uint32_t bank, uint32_t *retSequence);
+uint32_t stagedBytes(void);
+bool legacyStage(void);
+void journalReplay(uint32_t address, uint32_t end);
+bool journalAppend(uint32_t address, peerConfig *p, uint32_t *retBytes);
+bool journalCompact(void);
+uint32_t journalCompactedBytes(void);
 
 // Get DFU-related flash parameters
 void flashCodeParams(uint8_t **activeBase, uint8_t **dfuBase, uint32_t *maxBytes, uint32_t *maxPages)
@@ -139,8 +224,8 @@ void flashDFUInit()
 {
     APP_PRINTF("\r\n");
     APP_PRINTF("flash:  peers: %d\r\n", MAX_PEERS);
-    APP_PRINTF("       config: %d bytes\r\n", FLASH_MAX_USED_BYTES);
-    APP_PRINTF("               %d spare\r\n", FLASH_CONFIG_BYTES-FLASH_MAX_USED_BYTES);
+    APP_PRINTF("       config: %d bytes\r\n", FLASH_CONFIG_BYTES);
+    APP_PRINTF("               %d per bank\r\n", FLASH_BANK_BYTES);
     APP_PRINTF("         code: %d bytes\r\n", MX_Image_Size());
     APP_PRINTF("               %d pages\r\n", MX_Image_Pages());
     APP_PRINTF("          max: %d bytes\r\n", FLASH_CODE_MAX_BYTES);
@@ -215,46 +300,359 @@ uint32_t flashConfigPeers()
     return config.peers;
 }
 
+// Erase config pages, returning true if success
+bool flashErase(uint32_t address, uint32_t pages)
+{
+    uint32_t PageError;
+    FLASH_EraseInitTypeDef EraseInit = {0};
+    EraseInit.NbPages = pages;
+    EraseInit.TypeErase = FLASH_TYPEERASE_PAGES;
+    EraseInit.Page = (address - FLASH_BASE) / FLASH_PAGE_SIZE;
+    FLASH_Init();
+    if (HAL_FLASH_Unlock() != HAL_OK) {
+        APP_PRINTF("flash: error unlocking flash for Erase\r\n");
+    }
+    bool success = (HAL_FLASHEx_Erase(&EraseInit, &PageError) == HAL_OK);
+    if (!success) {
+        APP_PRINTF("flash: hal erase error\r\n");
+    }
+    HAL_FLASH_Lock();
+    return success;
+}
+
+// Program previously-erased flash, returning true if success.  Both the address
+// and the data must be doubleword-aligned, and bytes must be a multiple of 8.
+bool flashProgram(uint32_t address, void *data, uint32_t bytes)
+{
+    FLASH_Init();
+    if (HAL_FLASH_Unlock() != HAL_OK) {
+        APP_PRINTF("flash: error unlocking flash for Program\r\n");
+    }
+    bool success = FLASH_write_at(address, (uint64_t *) data, bytes);
+    HAL_FLASH_Lock();
+    return success;
+}
+
 // Read peer config
 void flashConfigLoad()
 {
 
+    // Discard what we have
+    if (peer != NULL) {
+        free(peer);
+    }
+    peer = NULL;
+    peerCapacity = 0;
+    config.peers = 0;
+    journalNext = 0;
+    journalSequence = 0;
+    legacyBase = 0;
+    legacyBytes = 0;
+    configReadOnly = false;
+
     // Read the header
     memcpy(&config, (uint8_t *)FLASH_CONFIG_BASE_ADDRESS, sizeof(flashConfig));
-    if (config.signature != FLASH_CONFIG_SIGNATURE) {
-        config.signature = FLASH_CONFIG_SIGNATURE;
+    uint32_t signature = config.signature;
+    config.signature = FLASH_CONFIG_SIGNATURE;
+
+    // Replay the active bank
+    uint32_t seqA, seqB;
+    bool validA = bankValid(FLASH_BANK_A_ADDRESS, &seqA);
+    bool validB = bankValid(FLASH_BANK_B_ADDRESS, &seqB);
+    if (validA || validB) {
+        if (validA && (!validB || seqA > seqB)) {
+            journalBank = FLASH_BANK_A_ADDRESS;
+            journalSequence = seqA;
+        } else {
+            journalBank = FLASH_BANK_B_ADDRESS;
+            journalSequence = seqB;
+        }
         config.peers = 0;
+        journalReplay(journalBank + sizeof(flashBank), journalBank + FLASH_BANK_BYTES);
+        return;
     }
 
-    // Allocate peer buffer
-    if (peer != NULL) {
-        free(peer);
+    // Older formats occupy the start of the config area, and will be migrated into
+    // bank B upon the first update.  If power was lost during a migration after bank B
+    // began to be erased, they are imported from the copy that was staged beforehand.
+    journalBank = FLASH_BANK_A_ADDRESS;
+    config.peers = 0;
+    if (signature != FLASH_CONFIG_SIGNATURE_V1 && signature != FLASH_CONFIG_SIGNATURE_V2) {
+        return;
     }
-    peer = (peerConfig *) malloc(config.peers * sizeof(peerConfig));
-    if (peer == NULL) {
-        config.peers = 0;
-        APP_PRINTF("*** can't allocate peers - peer table reset ***\r\n");
+    legacyBase = FLASH_CONFIG_BASE_ADDRESS;
+    legacyBytes = FLASH_CONFIG_BYTES;
+    uint32_t staged = stagedBytes();
+    if (staged != 0) {
+        APP_PRINTF("flash: resuming migration of config from its staged copy\r\n");
+        legacyBase = FLASH_STAGED_ADDRESS + sizeof(flashStaged);
+        legacyBytes = staged;
+    }
+
+    // Replay a V2 journal
+    if (signature == FLASH_CONFIG_SIGNATURE_V2) {
+        journalReplay(legacyBase + sizeof(flashConfig), legacyBase + legacyBytes);
+        if (journalNext != 0) {
+            legacyBytes = journalNext - legacyBase;
+        }
+        journalNext = 0;
+        for (size_t i=0; i<config.peers; i++) {
+            peer[i].dirty = true;
+        }
         return;
     }
-    memcpy(peer, (uint8_t *)FLASH_PEER_TABLE_ADDRESS, config.peers * sizeof(peerConfig));
+
+    // Import a V1 peer table in its entirety
+    uint32_t v1peers = GMIN(((flashConfig *)legacyBase)->peers, FLASH_V1_MAX_PEERS);
+    legacyBytes = sizeof(flashConfig) + v1peers*sizeof(peerConfigV1);
+    peerConfigV1 *v1 = (peerConfigV1 *) (legacyBase + sizeof(flashConfig));
+    for (size_t i=0; i<v1peers; i++) {
+        peerConfig *entry = peerInsert(v1[i].address, true);
+        if (entry == NULL) {
+            config.peers = 0;
+            APP_PRINTF("*** can't allocate peers - peer table reset ***\r\n");
+            return;
+        }
+        entry->type = v1[i].type;
+        memcpy(entry->name, v1[i].name, sizeof(entry->name));
+        entry->name[sizeof(entry->name)-1] = '\0';
+        memcpy(entry->key, v1[i].key, sizeof(entry->key));
+        entry->dirty = true;
+    }
+
+    // A table holding more peers, or longer names, than fit within a bank can't be
+    // migrated without losing some of them, so it is used as-is but can't be changed.
+    uint32_t bytes = journalCompactedBytes();
+    if (config.peers > MAX_PEERS || bytes > FLASH_BANK_BYTES) {
+        configReadOnly = true;
+        APP_PRINTF("*** V1 config of %d peers needs %d bytes, but a bank holds %d peers within %d bytes ***\r\n",
+                   config.peers, bytes, MAX_PEERS, FLASH_BANK_BYTES);
+        APP_PRINTF("*** V1 config NOT MIGRATED: peers can't be paired or renamed until factory reset ***\r\n");
+    }
 
 }
 
-// Update the config
-bool flashConfigUpdate()
+// See if a copy of an older layout has been staged for its migration, and return its length
+uint32_t stagedBytes()
 {
+    flashStaged *hdr = (flashStaged *) FLASH_STAGED_ADDRESS;
+    if (hdr->signature != FLASH_STAGED_SIGNATURE || hdr->bytes <= FLASH_BANK_BYTES || hdr->bytes > FLASH_CONFIG_BYTES) {
+        return 0;
+    }
+    uint8_t *copy = (uint8_t *) FLASH_STAGED_ADDRESS + sizeof(flashStaged);
+    uint32_t crc = utilCRC32(0, hdr, offsetof(flashStaged, crc));
+    if (hdr->crc != utilCRC32(crc, copy, hdr->bytes)) {
+        return 0;
+    }
+    if (memcmp(copy, (uint8_t *) FLASH_BANK_A_ADDRESS, FLASH_BANK_BYTES) != 0) {
+        return 0;
+    }
+    return hdr->bytes;
+}
 
-    // Update peer table
-    if (!flashWrite((uint8_t *)FLASH_PEER_TABLE_ADDRESS, peer, config.peers * sizeof(peerConfig))) {
-        APP_PRINTF("*** can't write peers ***\r\n");
+// Copy the part of an older layout that is in bank B into the DFU area, so that bank B
+// may be erased to migrate it, returning true if success.  The header is written last.
+bool legacyStage()
+{
+    if (legacyBase != FLASH_CONFIG_BASE_ADDRESS || legacyBytes <= FLASH_BANK_BYTES) {
+        return true;
+    }
+    APP_PRINTF("flash: staging %d-byte config for migration\r\n", legacyBytes);
+    uint32_t bytes = FLASH_RECORD_ALIGN(legacyBytes);
+    uint32_t pages = (sizeof(flashStaged) + bytes + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    if (!flashErase(FLASH_STAGED_ADDRESS, pages)) {
+        return false;
+    }
+    if (!flashProgram(FLASH_STAGED_ADDRESS + sizeof(flashStaged), (void *) legacyBase, bytes)) {
+        return false;
+    }
+    uint64_t buf[sizeof(flashStaged)/sizeof(uint64_t)];
+    flashStaged *hdr = (flashStaged *) buf;
+    hdr->signature = FLASH_STAGED_SIGNATURE;
+    hdr->bytes = legacyBytes;
+    hdr->crc = utilCRC32(utilCRC32(0, hdr, offsetof(flashStaged, crc)), (void *) legacyBase, legacyBytes);
+    hdr->reserved = 0;
+    if (!flashProgram(FLASH_STAGED_ADDRESS, buf, sizeof(flashStaged))) {
         return false;
     }
+    legacyBase = FLASH_STAGED_ADDRESS + sizeof(flashStaged);
+    return true;
+}
 
-    // Update header
-    if (!flashWrite((uint8_t *)FLASH_CONFIG_BASE_ADDRESS, &config, sizeof(flashConfig))) {
-        APP_PRINTF("*** can't write config ***\r\n");
+// See if a bank has been committed, and return its sequence number
+bool bankValid(uint32_t bank, uint32_t *retSequence)
+{
+    flashBank *hdr = (flashBank *) bank;
+    if (hdr->signature != FLASH_CONFIG_SIGNATURE_V3) {
         return false;
     }
+    if (hdr->crc != utilCRC32(0, hdr, offsetof(flashBank, crc))) {
+        return false;
+    }
+    *retSequence = hdr->sequence;
+    return true;
+}
+
+// Replay a journal into the in-memory peer table
+void journalReplay(uint32_t address, uint32_t end)
+{
+    while (address + sizeof(flashRecord) <= end) {
+        flashRecord *rec = (flashRecord *) address;
+
+        // Stop at the end of the journal
+        if (rec->op == FLASH_RECORD_ERASED) {
+            journalNext = address;
+            break;
+        }
+
+        // Validate the record.  If it is corrupt (such as if power was lost while it was
+        // being written), the journal ends here and must be compacted before appending.
+        uint32_t recBytes = FLASH_RECORD_ALIGN(sizeof(flashRecord) + rec->nameLen);
+        if (rec->op != FLASH_RECORD_PEER || rec->nameLen >= SENSOR_NAME_MAX
+                || address + recBytes > end) {
+            APP_PRINTF("flash: journal ends with invalid record\r\n");
+            break;
+        }
+        flashRecord hdr = *rec;
+        hdr.crc = 0;
+        uint32_t crc = utilCRC32(0, &hdr, sizeof(hdr));
+        crc = utilCRC32(crc, (uint8_t *) address + sizeof(flashRecord), rec->nameLen);
+        if (crc != rec->crc) {
+            APP_PRINTF("flash: journal ends with bad CRC\r\n");
+            break;
+        }
+
+        // Apply it
+        peerConfig *entry = peerInsert(rec->address, false);
+        if (entry == NULL) {
+            APP_PRINTF("*** can't allocate peers ***\r\n");
+            break;
+        }
+        entry->type = rec->type;
+        memcpy(entry->key, rec->key, sizeof(entry->key));
+        memcpy(entry->name, (uint8_t *) address + sizeof(flashRecord), rec->nameLen);
+        entry->name[rec->nameLen] = '\0';
+        entry->dirty = false;
+        address += recBytes;
+
+    }
+
+}
+
+// Append a peer's record to the journal, returning true if success
+bool journalAppend(uint32_t address, peerConfig *p, uint32_t *retBytes)
+{
+    uint64_t buf[FLASH_RECORD_MAX_BYTES/sizeof(uint64_t)];
+    memset(buf, 0, sizeof(buf));
+    flashRecord *rec = (flashRecord *) buf;
+    uint32_t nameLen = strlen(p->name);
+    rec->op = FLASH_RECORD_PEER;
+    rec->nameLen = nameLen;
+    rec->type = p->type;
+    memcpy(rec->address, p->address, sizeof(rec->address));
+    memcpy(rec->key, p->key, sizeof(rec->key));
+    memcpy((uint8_t *) buf + sizeof(flashRecord), p->name, nameLen);
+    rec->crc = utilCRC32(0, buf, sizeof(flashRecord) + nameLen);
+    uint32_t recBytes = FLASH_RECORD_ALIGN(sizeof(flashRecord) + nameLen);
+    // A record always follows its bank's header, which locates the bank even when the
+    // record would begin at the very end of a full one
+    uint32_t bank = ROUND_DOWN(address - sizeof(flashBank) - FLASH_CONFIG_BASE_ADDRESS, FLASH_BANK_BYTES) + FLASH_CONFIG_BASE_ADDRESS;
+    if (address + recBytes > bank + FLASH_BANK_BYTES) {
+        return false;
+    }
+    *retBytes = recBytes;
+    return flashProgram(address, buf, recBytes);
+}
+
+// Number of bytes that the live records would occupy in a bank once compacted
+uint32_t journalCompactedBytes()
+{
+    uint32_t bytes = sizeof(flashBank);
+    for (size_t i=0; i<config.peers; i++) {
+        bytes += FLASH_RECORD_ALIGN(sizeof(flashRecord) + strlen(peer[i].name));
+    }
+    return bytes;
+}
+
+// Compact the journal by writing all live records to the inactive bank, and then
+// committing that bank by writing its header.
+bool journalCompact()
+{
+
+    // Erase the inactive bank, first staging any older layout that it still holds
+    uint32_t bank = (journalBank == FLASH_BANK_A_ADDRESS) ? FLASH_BANK_B_ADDRESS : FLASH_BANK_A_ADDRESS;
+    if (!legacyStage()) {
+        return false;
+    }
+    if (!flashErase(bank, FLASH_BANK_PAGES)) {
+        return false;
+    }
+
+    // Write the peers
+    uint32_t address = bank + sizeof(flashBank);
+    for (size_t i=0; i<config.peers; i++) {
+        uint32_t recBytes;
+        if (!journalAppend(address, &peer[i], &recBytes)) {
+            APP_PRINTF("flash: peers exceed capacity of config bank\r\n");
+            return false;
+        }
+        address += recBytes;
+    }
+
+    // Commit the bank
+    uint64_t buf[sizeof(flashBank)/sizeof(uint64_t)];
+    flashBank *hdr = (flashBank *) buf;
+    hdr->signature = FLASH_CONFIG_SIGNATURE_V3;
+    hdr->sequence = journalSequence + 1;
+    hdr->crc = utilCRC32(0, hdr, offsetof(flashBank, crc));
+    hdr->reserved = 0;
+    if (!flashProgram(bank, buf, sizeof(flashBank))) {
+        return false;
+    }
+
+    // Done
+    for (size_t i=0; i<config.peers; i++) {
+        peer[i].dirty = false;
+    }
+    journalBank = bank;
+    journalSequence = hdr->sequence;
+    journalNext = address;
+    legacyBase = 0;
+    legacyBytes = 0;
+    return true;
+
+}
+
+// Update the config by appending changed peers to the journal
+bool flashConfigUpdate()
+{
+
+    // An older layout that couldn't be migrated can't be changed
+    if (configReadOnly) {
+        APP_PRINTF("*** V1 config not migrated, so it can't be updated ***\r\n");
+        return false;
+    }
+
+    // Append changed peers, compacting if the journal fills
+    for (size_t i=0; journalNext != 0 && i<config.peers; i++) {
+        if (!peer[i].dirty) {
+            continue;
+        }
+        uint32_t recBytes;
+        if (!journalAppend(journalNext, &peer[i], &recBytes)) {
+            journalNext = 0;
+            break;
+        }
+        peer[i].dirty = false;
+        journalNext += recBytes;
+    }
+    if (journalNext == 0) {
+        APP_PRINTF("flash: compacting config journal\r\n");
+        if (!journalCompact()) {
+            APP_PRINTF("*** can't write config ***\r\n");
+            return false;
+        }
+    }
 
     // Success
     return true;
@@ -265,9 +663,7 @@ bool flashConfigUpdate()
 void flashConfigFactoryReset()
 {
 
-    config.signature = 0;
-    config.peers = 0;
-    if (!flashWrite((uint8_t *)FLASH_CONFIG_BASE_ADDRESS, &config, sizeof(flashConfig))) {
+    if (!flashErase(FLASH_CONFIG_BASE_ADDRESS, FLASH_CONFIG_PAGES)) {
         APP_PRINTF("*** can't reset config ***\r\n");
     }
 
@@ -277,6 +673,59 @@ void flashConfigFactoryReset()
 
 }
 
+// Binary search the peer table for an address, returning the index at which it
+// was found or else the index at which it should be inserted
+uint32_t peerSearch(const uint8_t *address, bool *found)
+{
+    uint32_t lo = 0, hi = config.peers;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(address, peer[mid].address, ADDRESS_LEN);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    *found = false;
+    return lo;
+}
+
+// Find a peer in the table, inserting a blank entry in sorted order if not present.  Peers
+// imported from a V1 table are limited only by what V1 held, so that the whole table is
+// loaded even if it can't be migrated into a bank.
+peerConfig *peerInsert(const uint8_t *address, bool import)
+{
+    bool found;
+    uint32_t i = peerSearch(address, &found);
+    if (found) {
+        return &peer[i];
+    }
+    if (import ? config.peers >= FLASH_V1_MAX_PEERS
+            : (config.peers >= MAX_PEERS || journalCompactedBytes() + FLASH_RECORD_MIN_BYTES > FLASH_BANK_BYTES)) {
+        APP_PRINTF("*** peer table full ***\r\n");
+        return NULL;
+    }
+    if (config.peers >= peerCapacity) {
+        uint32_t newCapacity = GMIN(peerCapacity + 8, FLASH_V1_MAX_PEERS);
+        peerConfig *new = (peerConfig *) realloc(peer, newCapacity * sizeof(peerConfig));
+        if (new == NULL) {
+            return NULL;
+        }
+        peer = new;
+        peerCapacity = newCapacity;
+    }
+    memmove(&peer[i+1], &peer[i], (config.peers - i) * sizeof(peerConfig));
+    config.peers++;
+    memset(&peer[i], 0, sizeof(peerConfig));
+    memcpy(peer[i].address, address, ADDRESS_LEN);
+    return &peer[i];
+}
+
 // Find a peer, returning true if found
 bool flashConfigFindPeerByType(uint16_t peertype, uint8_t *retAddress, uint8_t *retKey, char *retName)
 {
@@ -300,33 +749,43 @@ bool flashConfigFindPeerByType(uint16_t peertype, uint8_t *retAddress, uint8_t *
 // Find a peer by Address, returning true if found
 bool flashConfigFindPeerByAddress(uint8_t *address, uint16_t *retPeerType, uint8_t *retKey, char *retName)
 {
-    for (size_t i=0; i<config.peers; i++) {
-        if (memcmp(address, peer[i].address, ADDRESS_LEN) == 0) {
-            if (retPeerType != NULL) {
-                *retPeerType = peer->type;
-            }
-            if (retKey != NULL) {
-                memcpy(retKey, peer[i].key, AES_KEY_BYTES);
-            }
-            if (retName != NULL) {
-                memcpy(retName, peer[i].name, SENSOR_NAME_MAX);
-            }
-            return true;
-        }
+    bool found;
+    uint32_t i = peerSearch(address, &found);
+    if (!found) {
+        return false;
     }
-    return false;
+    if (retPeerType != NULL) {
+        *retPeerType = peer[i].type;
+    }
+    if (retKey != NULL) {
+        memcpy(retKey, peer[i].key, AES_KEY_BYTES);
+    }
+    if (retName != NULL) {
+        memcpy(retName, peer[i].name, SENSOR_NAME_MAX);
+    }
+    return true;
 }
 
 // Update the name of a sensor in-memory if the address matches at least the least significant bytes
 // of the address specified, and return true if it is found and if it was changed.
 bool flashConfigUpdatePeerName(uint8_t *address, uint8_t addressLen, char *name)
 {
+    if (configReadOnly) {
+        return false;
+    }
     for (size_t i=0; i<config.peers; i++) {
         if (memcmp(address, peer[i].address, addressLen) == 0) {
             if (strcmp(name, peer[i].name) == 0) {
                 return false;
             }
+            uint32_t oldBytes = FLASH_RECORD_ALIGN(sizeof(flashRecord) + strlen(peer[i].name));
+            uint32_t newBytes = FLASH_RECORD_ALIGN(sizeof(flashRecord) + GMIN(strlen(name), sizeof(peer[i].name)-1));
+            if (journalCompactedBytes() - oldBytes + newBytes > FLASH_BANK_BYTES) {
+                APP_PRINTF("*** no room in config for name of peer ***\r\n");
+                return false;
+            }
             strlcpy(peer[i].name, name, sizeof(peer[i].name));
+            peer[i].dirty = true;
             return true;
         }
     }
@@ -337,50 +796,30 @@ bool flashConfigUpdatePeerName(uint8_t *address, uint8_t addressLen, char *name)
 bool flashConfigUpdatePeer(uint16_t peertype, uint8_t *address, uint8_t *key)
 {
 
-    // Create a new entry
-    peerConfig newEntry = {0};
-    newEntry.type = peertype;
-    memcpy(newEntry.address, address, sizeof(newEntry.address));
-    memcpy(newEntry.key, key, sizeof(newEntry.key));
-
-    // Find the peer
-    peerConfig *entry = NULL;
-    for (size_t i=0; i<config.peers; i++) {
-        if (memcmp(address, peer[i].address, ADDRESS_LEN) == 0) {
-            entry = &peer[i];
-            memcpy(newEntry.name, entry->name, sizeof(newEntry.name));
-            break;
-        }
+    // An older layout that couldn't be migrated can't be changed
+    if (configReadOnly) {
+        APP_PRINTF("*** V1 config not migrated, so peer can't be paired ***\r\n");
+        return false;
     }
 
-    // If not present, grow, else update if different
-    bool update = false;
+    // Find the peer, adding it if not present
+    bool found;
+    peerSearch(address, &found);
+    peerConfig *entry = peerInsert(address, false);
     if (entry == NULL) {
-        peerConfig *new = (peerConfig *) malloc((config.peers+1) * sizeof(peerConfig));
-        if (new == NULL) {
-            return false;
-        }
-        memcpy(new, peer, config.peers * sizeof(peerConfig));
-        free(peer);
-        peer = new;
-        entry = &peer[config.peers++];
-        update = true;
-    } else {
-        if (entry->type != newEntry.type) {
-            update = true;
-        }
-        if (memcmp(entry->key, newEntry.key, sizeof(newEntry.key)) != 0) {
-            update = true;
-        }
+        return false;
     }
 
-    // Update if appropriate
-    if (update) {
-        memcpy(entry, &newEntry, sizeof(newEntry));
-        if (!flashConfigUpdate()) {
-            APP_PRINTF("*** can't update config ***\r\n");
-            return false;
-        }
+    // Update if different
+    if (found && entry->type == peertype && memcmp(entry->key, key, sizeof(entry->key)) == 0) {
+        return true;
+    }
+    entry->type = peertype;
+    memcpy(entry->key, key, sizeof(entry->key));
+    entry->dirty = true;
+    if (!flashConfigUpdate()) {
+        APP_PRINTF("*** can't update config ***\r\n");
+        return false;
     }
 
     // Done
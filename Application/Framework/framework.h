@@ -27,19 +27,23 @@ typedef enum {
     TX,
     TX_TIMEOUT,
     TW_OPEN,
+    LBT_CAD,
 } States_t;
 extern int64_t appBootMs;
 extern bool appIsGateway;
+extern bool ListenPhaseBeforeTalk;
 extern uint32_t gatewayBootTime;
 extern char ourAddressText[ADDRESS_LEN*3];
 extern uint8_t ourAddress[ADDRESS_LEN];
 extern uint8_t gatewayAddress[ADDRESS_LEN];
 extern uint8_t invalidAddress[ADDRESS_LEN];
 extern char sensorName[SENSOR_NAME_MAX];
+extern uint8_t gatewayMessageVersion;
 
 // So that receiver can access them
 extern wireMessageCarrier wireReceivedCarrier;
 extern uint32_t wireReceivedLen;
+extern uint32_t wireReceivedMs;
 extern uint32_t wireReceiveTimeoutMs;
 extern bool wireReceiveSignalValid;
 extern int8_t wireReceiveRSSI;
@@ -48,6 +52,74 @@ extern int8_t wireTransmitDb;
 
 typedef struct sensorConfig_c sensorConfig;
 
+// MAC statistics, so that airtime, channel contention, and loss can be measured
+// on a live deployment and compared across changes to the MAC.
+typedef struct {
+    int64_t beganMs;                // When these stats were last reset
+    uint32_t txPackets;             // Packets handed to the radio for transmit
+    uint32_t txTimeouts;            // Transmits that failed to complete
+    uint32_t txAirtimeMs;           // Computed time-on-air of transmitted packets
+    uint32_t rxPackets;             // Packets received by the radio
+    uint32_t rxInvalid;             // Received packets that were rejected (not for us, can't decrypt)
+    uint32_t rxErrors;              // Receive errors (typically CRC failures due to collisions)
+    uint32_t rxTimeouts;            // Receives that timed out
+    uint32_t rxListenMs;            // Time that the receiver was active
+    uint32_t lbtListens;            // Listen-before-talk attempts
+    uint32_t lbtBusy;               // Listen-before-talk attempts that found the channel busy
+    uint32_t lbtListenMs;           // Time that the receiver was active for listen-before-talk
+    uint32_t lbtTalks;              // Transmits that followed listen-before-talk
+    uint32_t lbtDelayMs;            // Time from first listen to transmit, including backoff
+    uint32_t duplicates;            // Chunks that were received more than once
+    uint32_t requestsCompleted;     // Requests that were successfully completed
+    uint32_t requestsRetried;       // Requests that were retried
+    uint32_t requestsFailed;        // Requests that were abandoned after all retries
+    uint32_t configSyncs;           // Syncs of sensor names from the configuration DB
+    uint32_t configNotes;           // Configuration notes that were fetched because they changed
+    uint32_t configSyncMs;          // Time spent syncing sensor names, during which we can't receive
+} macStats;
+extern macStats macStat;
+
+// The gateway's copy of what it last wrote to a sensor's record in the sensor DB, so that
+// the record needn't be read back from the Notecard each time that it is updated.
+typedef struct {
+    bool valid;
+    uint32_t nameCRC;
+    uint32_t received;
+    uint32_t lost;
+    uint32_t when;
+    int8_t gatewayRSSI;
+    int8_t gatewaySNR;
+    int8_t sensorRSSI;
+    int8_t sensorSNR;
+    int8_t sensorTXP;
+    int8_t sensorLTP;
+    uint16_t sensorMv;
+} sensorDBShadow;
+
+// A summary of samples of the link with a sensor
+typedef struct {
+    uint8_t samples;
+    uint8_t retriesMax;
+    uint16_t retries;
+    int8_t rssiMin;
+    int8_t rssiMax;
+    int16_t rssiSum;
+    int8_t snrMin;
+    int8_t snrMax;
+    int16_t snrSum;
+    int8_t txpMin;
+    int8_t txpMax;
+    int16_t txpSum;
+    uint16_t msMin;
+    uint16_t msMax;
+    uint32_t msSum;
+} linkBucket;
+typedef struct {
+    uint8_t head;                   // Bucket being filled
+    uint8_t unexported;             // Buckets, ending with head, that haven't been exported
+    linkBucket bucket[LINK_HISTORY_BUCKETS];
+} linkHistory;
+
 // appinit.c
 #define SKU_UNKNOWN     0
 #define SKU_CORE        1
@@ -81,12 +153,18 @@ bool appSensorCacheEntry(uint32_t i, uint8_t *address,
                          uint32_t *lastReceivedTime,
                          uint32_t *requestsProcessed, uint32_t *requestsLost);
 void appSensorCacheEntryResetStats(uint32_t index);
+sensorDBShadow *appSensorCacheShadow(uint32_t index);
+linkHistory *appSensorCacheLinks(uint32_t index);
+void appSensorCacheSetSendPeriod(uint8_t *address, uint32_t periodSecs);
+bool appSensorEvictedNext(uint32_t *index);
+void appSensorEvictedFlushed(void);
 void appSendBeaconToGateway(void);
 void appSendLoRaPacketSizeTestPing(void);
 bool appProcessButton(void);
 uint32_t appTransmitWindowWaitMaxSecs(void);
 uint32_t appNextTransmitWindowDueSecs(void);
 void appReceivedMessageStats(int8_t *gtxdb, int8_t *grssi, int8_t *grsnr, int8_t *stxdb, int8_t *srssi, int8_t *srsnr);
+uint32_t *appCarrierIV(wireMessageCarrier *carrier, uint32_t *iv);
 
 // led.c
 void ledSet(void);
@@ -132,9 +210,17 @@ void radioSetChannel(void);
 void radioSetRFFrequency(uint32_t frequency);
 uint32_t radioWakeupRequiredMs(void);
 void radioRx(uint32_t timeoutMs);
+void radioCad(void);
 void radioTx(uint8_t *buffer, uint8_t size);
+bool radioIsTransmitting(void);
 void radioSetTxPower(int8_t powerLevel);
 void radioSetTxPowerUnknown(void);
+uint32_t radioTimeOnAirMs(uint8_t size);
+uint32_t radioTimeOnAirAtMs(uint8_t sf, uint8_t size);
+bool radioSetSpreadingFactor(uint8_t sf);
+uint8_t radioSpreadingFactor(void);
+void radioStatsReset(void);
+void radioStatsShow(void);
 
 // sensor.c
 void sensorCmd(char *cmd);
@@ -148,6 +234,9 @@ void sensorTimerWakeFromISR(void);
 bool gatewayProcessSensorRequest(uint8_t *sensorAddress, uint8_t *req, uint32_t reqLen, uint8_t **rsp, uint32_t *rspLen);
 void gatewayInterrupt(uint16_t interruptType);
 bool gatewayHousekeeping(bool sensorsChanged, uint32_t cachedSensors);
+bool gatewayHousekeepingSlice(bool sensorsChanged, uint32_t cachedSensors);
+uint32_t gatewayHousekeepingDueSecs(void);
+bool gatewaySensorFlush(uint32_t i);
 void gatewayHousekeepingDefer(void);
 void gatewaySetEnvVarDefaults(void);
 bool gatewayEnvVarsLoaded(void);
@@ -157,12 +246,51 @@ void gatewayCmd(char *cmd);
 bool noteInit(void);
 bool noteSetup(void);
 void noteSendToGatewayAsync(J *req, bool responseExpected);
+void noteBatchPoll(void);
+uint32_t noteBatchDueSecs(void);
+bool noteBatchSending(void);
+uint32_t noteSendPeriodSecs(uint32_t addPeriodSecs);
+void noteRequestCompleted(void);
+void noteRequestFailed(uint8_t *data, uint32_t len, bool compressed);
 
 // util.c
 void utilHTOA8(unsigned char n, char *p);
 void utilAddressToText(const uint8_t *address, char *buf, uint32_t buflen);
+uint32_t utilCRC32(uint32_t crc, const void *data, uint32_t len);
+uint32_t utilHexToAddress(const char *hex, uint8_t *address);
 void extractNameComponents(char *in, char *namebuf, char *olcbuf, uint32_t olcbuflen);
 
+// bjson.c
+uint8_t *bjsonEncode(J *item, uint32_t *retLen);
+J *bjsonDecode(const uint8_t *data, uint32_t len);
+bool bjsonIsEncoded(const uint8_t *data, uint32_t len);
+void bjsonLearnTemplate(J *req);
+
+// compress.c
+uint8_t *compressEncode(const uint8_t *data, uint32_t len, uint32_t *retLen);
+uint8_t *compressDecode(const uint8_t *data, uint32_t len, uint32_t *retLen);
+
+// outbox.c
+void outboxInit(void);
+uint32_t outboxCount(void);
+bool outboxAdd(J *note);
+J *outboxGet(uint32_t index);
+void outboxRemove(uint32_t count);
+
+// linkstats.c
+void linkStatsSample(linkHistory *history, int8_t rssi, int8_t snr, int8_t txp, uint32_t ms, uint32_t retries);
+bool linkStatsPending(linkHistory *history);
+J *linkStatsExport(linkHistory *history);
+void linkStatsExported(linkHistory *history);
+
+// timesync.c
+bool timeSyncValid(void);
+uint64_t timeSyncAt(uint32_t timerMs);
+uint64_t timeSyncNowMs(void);
+uint32_t timeSyncNowSecs(void);
+uint32_t timeSyncMsUntil(uint32_t epochSecs);
+void timeSyncSet(uint64_t epochMs, uint32_t receivedMs);
+
 // auth.c
 J *authRequest(uint8_t *sensorAddress, char *sensorName, char *sensorLocationOLC, J *req);
 
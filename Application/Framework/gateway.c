@@ -14,6 +14,15 @@ uint32_t dbLastUpdateTime = 0;
 uint32_t envLastUpdateTime = 0;
 uint32_t envLastModifiedTime = 0;
 uint32_t envLastPeers = 0;
+uint32_t housekeepingRetryTime = 0;
+uint32_t housekeepingSensor = 0;
+uint32_t housekeepingSensors = 0;
+bool housekeepingLinksDue = false;
+uint32_t housekeepingLinksNext = 0;
+JTIME configLastSyncTime = 0;
+bool configChangesPending = false;
+bool configTrackerStarted = false;
+bool configNamesChanged = false;
 
 // Environment variables
 uint32_t var_gateway_env_update_mins;
@@ -25,22 +34,42 @@ uint32_t time_var_gateway_sensordb_reset_counts = 0;
 
 // Forwards
 void gatewayUpdateEnvVar(const char *name, const char *value);
+J *gatewayPerformSensorRequest(uint8_t *sensorAddress, char *sensorName, char *sensorLocationOLC, J *req);
+static bool housekeepingEnvDue(uint32_t now);
+static bool housekeepingEnv(uint32_t now);
+static void housekeepingResetCounts(void);
+static bool housekeepingDBDue(uint32_t now);
+static void housekeepingDB(uint32_t now, uint32_t cachedSensors);
+static void housekeepingConfigChanges(void);
+static void housekeepingLinks(uint32_t cachedSensors);
 
 // Process the received message
 bool gatewayProcessSensorRequest(uint8_t *sensorAddress, uint8_t *reqJSON, uint32_t reqJSONLen, uint8_t **rspJSON, uint32_t *rspJSONLen)
 {
 
-    // Marshal the JSON
-    char *reqstr = JAllocString(reqJSON, reqJSONLen);
-    J *req = JConvertFromJSONString(reqstr);
-    JFree(reqstr);
+    // Marshal the request, which is either binary or JSON
+    J *req;
+    if (bjsonIsEncoded(reqJSON, reqJSONLen)) {
+        req = bjsonDecode(reqJSON, reqJSONLen);
+    } else {
+        char *reqstr = JAllocString(reqJSON, reqJSONLen);
+        req = JConvertFromJSONString(reqstr);
+        JFree(reqstr);
+    }
     J *rsp = NULL;
     if (req == NULL) {
         rsp = JCreateObject();
         JAddStringToObject(rsp, "err", "unable to interpret JSON request");
     }
 
-    // Disallow certain requests
+    // Note the period at which the sensor expects to send, which isn't part of the request
+    if (req != NULL && JGetObjectItem(req, REQUEST_FIELD_PERIOD) != NULL) {
+        appSensorCacheSetSendPeriod(sensorAddress, (uint32_t) JGetInt(req, REQUEST_FIELD_PERIOD));
+        JDeleteItemFromObject(req, REQUEST_FIELD_PERIOD);
+    }
+
+    // Perform the request, or each of the requests in a batch, responding with the
+    // response to the last of them.
     if (rsp == NULL) {
         char compositeName[SENSOR_NAME_MAX] = {0};
         char sensorName[SENSOR_NAME_MAX] = {0};
@@ -48,17 +77,23 @@ bool gatewayProcessSensorRequest(uint8_t *sensorAddress, uint8_t *reqJSON, uint3
         if (flashConfigFindPeerByAddress(sensorAddress, NULL, NULL, compositeName)) {
             extractNameComponents(compositeName, sensorName, sensorLocationOLC, sizeof(sensorLocationOLC));
         }
-        rsp = authRequest(sensorAddress, sensorName, sensorLocationOLC, req);
-    }
-
-    // Perform the request
-    if (rsp != NULL) {
-        if (req != NULL) {
+        if (strcmp(JGetString(req, "req"), BATCH_REQUEST) == 0) {
+            J *requests = JDetachItemFromObject(req, BATCH_FIELD_REQUESTS);
             JDelete(req);
+            APP_PRINTF("%s processing batch of %d sensor requests\r\n", tracePeer(), JGetArraySize(requests));
+            while (requests != NULL && requests->child != NULL) {
+                if (rsp != NULL) {
+                    JDelete(rsp);
+                }
+                rsp = gatewayPerformSensorRequest(sensorAddress, sensorName, sensorLocationOLC,
+                                                  JDetachItemFromArray(requests, 0));
+            }
+            if (requests != NULL) {
+                JDelete(requests);
+            }
+        } else {
+            rsp = gatewayPerformSensorRequest(sensorAddress, sensorName, sensorLocationOLC, req);
         }
-    } else {
-        APP_PRINTF("%s processing sensor request:\r\n", tracePeer());
-        rsp = NoteRequestResponse(req);
         if (rsp == NULL) {
             return false;
         }
@@ -76,6 +111,23 @@ bool gatewayProcessSensorRequest(uint8_t *sensorAddress, uint8_t *reqJSON, uint3
 
 }
 
+// Perform a single request from a sensor if it is allowed, consuming the request
+J *gatewayPerformSensorRequest(uint8_t *sensorAddress, char *sensorName, char *sensorLocationOLC, J *req)
+{
+
+    // Disallow certain requests
+    J *rsp = authRequest(sensorAddress, sensorName, sensorLocationOLC, req);
+    if (rsp != NULL) {
+        JDelete(req);
+        return rsp;
+    }
+
+    // Perform the request
+    APP_PRINTF("%s processing sensor request:\r\n", tracePeer());
+    return NoteRequestResponse(req);
+
+}
+
 // Return true if the env vars are loaded
 bool gatewayEnvVarsLoaded()
 {
@@ -85,10 +137,120 @@ bool gatewayEnvVarsLoaded()
     return gatewayHousekeeping(false, 0);
 }
 
-// Do periodic housekeeping related to the gateway
+// Do all periodic housekeeping related to the gateway that is due, returning true if
+// the env vars have been loaded.
 bool gatewayHousekeeping(bool sensorsChanged, uint32_t cachedSensors)
 {
     uint32_t now = NoteTimeST();
+    if (sensorsChanged) {
+        dbLastUpdateTime = 0;
+    }
+    if (housekeepingEnvDue(now)) {
+        housekeepingEnv(now);
+    }
+    housekeepingResetCounts();
+    if (housekeepingDBDue(now)) {
+        housekeepingDB(now, cachedSensors);
+    }
+    while (configChangesPending) {
+        housekeepingConfigChanges();
+    }
+    uint32_t evicted;
+    while (appSensorEvictedNext(&evicted)) {
+        gatewaySensorFlush(evicted);
+        appSensorEvictedFlushed();
+    }
+    while (housekeepingSensor < housekeepingSensors) {
+        gatewaySensorFlush(housekeepingSensor++);
+    }
+    if (housekeepingLinksDue) {
+        housekeepingLinks(cachedSensors);
+    }
+    return (envLastUpdateTime != 0);
+}
+
+// Do the next slice of the housekeeping that is due, returning false if none was due.
+// A slice is a single Notecard exchange or so, allowing housekeeping to be spread
+// across the gaps between sensor transmissions.
+bool gatewayHousekeepingSlice(bool sensorsChanged, uint32_t cachedSensors)
+{
+    uint32_t now = NoteTimeST();
+    if (sensorsChanged) {
+        dbLastUpdateTime = 0;
+    }
+
+    // Apply the next page of changes to sensor names, which must precede the sensor DB
+    if (configChangesPending) {
+        housekeepingConfigChanges();
+        return true;
+    }
+
+    // Flush sensors that have been evicted from the cache, whose stats would otherwise be lost
+    uint32_t evicted;
+    if (appSensorEvictedNext(&evicted)) {
+        gatewaySensorFlush(evicted);
+        appSensorEvictedFlushed();
+        return true;
+    }
+
+    // Update the sensor DB one sensor at a time
+    if (housekeepingSensor < housekeepingSensors) {
+        if (housekeepingSensor < cachedSensors) {
+            gatewaySensorFlush(housekeepingSensor);
+        }
+        housekeepingSensor++;
+        return true;
+    }
+
+    // Export link history once the sensor DB has been updated
+    if (housekeepingLinksDue) {
+        housekeepingLinks(cachedSensors);
+        return true;
+    }
+
+    // Refresh the environment, backing off if the Notecard can't be reached
+    if (housekeepingEnvDue(now) && now >= housekeepingRetryTime) {
+        if (!housekeepingEnv(now)) {
+            housekeepingRetryTime = now + GATEWAY_HOUSEKEEPING_RETRY_SECS;
+        }
+        housekeepingResetCounts();
+        return true;
+    }
+
+    // Refresh the configuration, which begins an update of the sensor DB
+    if (housekeepingDBDue(now)) {
+        housekeepingDB(now, cachedSensors);
+        return true;
+    }
+
+    return false;
+}
+
+// Number of seconds until housekeeping is next due
+uint32_t gatewayHousekeepingDueSecs()
+{
+    uint32_t now = NoteTimeST();
+    uint32_t evicted;
+    if (appSensorEvictedNext(&evicted)) {
+        return 0;
+    }
+    if (configChangesPending || housekeepingSensor < housekeepingSensors || housekeepingLinksDue || housekeepingDBDue(now)) {
+        return 0;
+    }
+    if (housekeepingEnvDue(now)) {
+        return (now >= housekeepingRetryTime) ? 0 : housekeepingRetryTime - now;
+    }
+    int envMins = var_gateway_env_update_mins ? var_gateway_env_update_mins : DEFAULT_GATEWAY_ENV_UPDATE_MINS;
+    int dbMins = var_gateway_sensordb_update_mins ? var_gateway_sensordb_update_mins : DEFAULT_GATEWAY_SENSORDB_UPDATE_MINS;
+    uint32_t envDue = envLastUpdateTime + (envMins*60);
+    uint32_t dbDue = dbLastUpdateTime + (dbMins*60);
+    uint32_t due = (envDue < dbDue) ? envDue : dbDue;
+    return (due > now) ? due - now : 0;
+}
+
+// See if we need to refresh the environment
+static bool housekeepingEnvDue(uint32_t now)
+{
 
     // If we've added peers since last time, we need to refresh the environment so that
     // we force the peer table to get the new name for the peer.
@@ -98,120 +260,162 @@ bool gatewayHousekeeping(bool sensorsChanged, uint32_t cachedSensors)
         envLastPeers = flashConfigPeers();
     }
 
-    // See if we need to refresh the environment
     int mins = var_gateway_env_update_mins ? var_gateway_env_update_mins : DEFAULT_GATEWAY_ENV_UPDATE_MINS;
-    while (envLastUpdateTime == 0 || now >= envLastUpdateTime+(mins*60)) {
-        envLastUpdateTime = now;
-
-        // See if a firmware update is waiting for us.  If we return from this method with true, it
-        // means that the update wasn't successfully completed and so we need to restore our modes.
-        // A return with false means that no firmware update was available.
-        if (noteFirmwareUpdateIfAvailable()) {
-            noteSetup();
-        }
+    return (envLastUpdateTime == 0 || now >= envLastUpdateTime+(mins*60));
+}
 
-        // See if env vars need to be checked
-        bool refreshEnvVars = false;
-        J *rsp = NoteRequestResponse(NoteNewRequest("env.modified"));
-        if (rsp == NULL) {
+// Refresh the environment, returning false if it couldn't be refreshed
+static bool housekeepingEnv(uint32_t now)
+{
+    envLastUpdateTime = now;
+
+    // See if a firmware update is waiting for us.  If we return from this method with true, it
+    // means that the update wasn't successfully completed and so we need to restore our modes.
+    // A return with false means that no firmware update was available.
+    if (noteFirmwareUpdateIfAvailable()) {
+        noteSetup();
+    }
+
+    // See if env vars need to be checked
+    bool refreshEnvVars = false;
+    J *rsp = NoteRequestResponse(NoteNewRequest("env.modified"));
+    if (rsp == NULL) {
+        refreshEnvVars = true;
+        envLastUpdateTime = 0;
+    } else {
+        if (NoteResponseError(rsp)) {
             refreshEnvVars = true;
             envLastUpdateTime = 0;
         } else {
-            if (NoteResponseError(rsp)) {
+            uint32_t modifiedTime = (uint32_t) JGetNumber(rsp, "time");
+            if (envLastModifiedTime != modifiedTime) {
                 refreshEnvVars = true;
-                envLastUpdateTime = 0;
-            } else {
-                uint32_t modifiedTime = (uint32_t) JGetNumber(rsp, "time");
-                if (envLastModifiedTime != modifiedTime) {
-                    refreshEnvVars = true;
-                    envLastModifiedTime = modifiedTime;
-                }
+                envLastModifiedTime = modifiedTime;
             }
-            NoteDeleteResponse(rsp);
-        }
-        if (!refreshEnvVars) {
-            break;
-        }
-
-        // Load the entire set of env vars, to minimize latency.  We need
-        // to keep latency to a minimum because for every second we spend in
-        // here, it's a second we don't have a receive outstanding.
-        rsp = NoteRequestResponse(NoteNewRequest("env.get"));
-        if (rsp == NULL) {
-            envLastUpdateTime = 0;
-            break;
         }
-
-        // Get the body
-        J *body = JDetachItemFromObject(rsp, "body");
         NoteDeleteResponse(rsp);
+    }
+    if (!refreshEnvVars) {
+        return (envLastUpdateTime != 0);
+    }
 
-        // Enumerate fields in the environment body
-        J *field = NULL;
-        JObjectForEach(field, body) {
-            char *value = JStringValue(field);
-            const char *name = JGetItemName(field);
-            gatewayUpdateEnvVar(name, value);
+    // Load the entire set of env vars, to minimize latency.  We need
+    // to keep latency to a minimum because for every second we spend in
+    // here, it's a second we don't have a receive outstanding.
+    rsp = NoteRequestResponse(NoteNewRequest("env.get"));
+    if (rsp == NULL) {
+        envLastUpdateTime = 0;
+        return false;
+    }
 
-        }
+    // Get the body
+    J *body = JDetachItemFromObject(rsp, "body");
+    NoteDeleteResponse(rsp);
 
-        // Done with body, and done refreshing env vars as a batch
-        JDelete(body);
+    // Enumerate fields in the environment body
+    J *field = NULL;
+    JObjectForEach(field, body) {
+        char *value = JStringValue(field);
+        const char *name = JGetItemName(field);
+        gatewayUpdateEnvVar(name, value);
 
     }
 
-    // Update the last reset time
+    // Done with body, and done refreshing env vars as a batch
+    JDelete(body);
+
+    return true;
+
+}
+
+// Note when the sensor DB counts were last reset by the env var changing
+static void housekeepingResetCounts()
+{
     if (last_var_gateway_sensordb_reset_counts != 0
             && var_gateway_sensordb_reset_counts != 0
             && last_var_gateway_sensordb_reset_counts != var_gateway_sensordb_reset_counts) {
         time_var_gateway_sensordb_reset_counts = NoteTimeST();
     }
     last_var_gateway_sensordb_reset_counts = var_gateway_sensordb_reset_counts;
+}
 
-    // See if we need to refresh the db
-    if (sensorsChanged) {
-        dbLastUpdateTime = 0;
-    }
-    mins = var_gateway_sensordb_update_mins ? var_gateway_sensordb_update_mins : DEFAULT_GATEWAY_SENSORDB_UPDATE_MINS;
-    if (dbLastUpdateTime == 0 || now >= dbLastUpdateTime+(mins*60)) {
-        dbLastUpdateTime = now;
+// See if we need to refresh the sensor DB
+static bool housekeepingDBDue(uint32_t now)
+{
+    int mins = var_gateway_sensordb_update_mins ? var_gateway_sensordb_update_mins : DEFAULT_GATEWAY_SENSORDB_UPDATE_MINS;
+    return (dbLastUpdateTime == 0 || now >= dbLastUpdateTime+(mins*60));
+}
 
-        // Update from the config DB at most when we do a full sync with the service
-        bool updateFromConfigDatabase = false;
-        J *rsp = NoteRequestResponse(NoteNewRequest("hub.sync.status"));
-        if (rsp != NULL) {
-            if (!NoteResponseError(rsp)) {
-                static JTIME lastSyncTime = 0;
-                JTIME syncTime = JGetInt(rsp, "time");
-                if (lastSyncTime == 0 || syncTime != lastSyncTime) {
-                    lastSyncTime = syncTime;
-                    updateFromConfigDatabase = true;
-                }
+// Refresh sensor names from the configuration DB, and begin updating the sensor DB
+static void housekeepingDB(uint32_t now, uint32_t cachedSensors)
+{
+    dbLastUpdateTime = now;
+
+    // Update from the config DB at most when we do a full sync with the service
+    bool updateFromConfigDatabase = false;
+    J *rsp = NoteRequestResponse(NoteNewRequest("hub.sync.status"));
+    if (rsp != NULL) {
+        if (!NoteResponseError(rsp)) {
+            JTIME syncTime = JGetInt(rsp, "time");
+            if (configLastSyncTime == 0 || syncTime != configLastSyncTime) {
+                configLastSyncTime = syncTime;
+                updateFromConfigDatabase = true;
             }
-            NoteDeleteResponse(rsp);
         }
+        NoteDeleteResponse(rsp);
+    }
 
-        // Load the entire set of configuration notes, to minimize latency.  We need
-        // to keep latency to a minimum because for every second we spend in here
-        // it's a second we don't have a receive outstanding.
-        if (updateFromConfigDatabase) {
-            J *req = NoteNewRequest("note.changes");
-            JAddStringToObject(req, "file", CONFIGDB);
-            NoteSuspendTransactionDebug();
-            J *rsp = NoteRequestResponse(req);
-            NoteResumeTransactionDebug();
-            if (rsp != NULL) {
-
-                // Get the results
-                J *notes = JDetachItemFromObject(rsp, "notes");
+    // Fetch the changes to the configuration DB in pages, before updating the sensor DB
+    if (updateFromConfigDatabase) {
+        configChangesPending = true;
+    }
 
-                // We no longer need the response
-                NoteDeleteResponse(rsp);
+    // Now, loop over all sensors, updating them, and then export their link history
+    housekeepingSensor = 0;
+    housekeepingSensors = cachedSensors;
+    housekeepingLinksDue = true;
 
-                // Enumerate notes within the results
+}
+
+// Apply a page of changes to sensor names from the configuration DB.  The Notecard's change
+// tracker returns only those notes modified since the tracker last advanced, so that after
+// the first sync we don't spend time (during which no receive is outstanding) re-reading
+// names that haven't changed.  The flash config is written once, after the last page.
+static void housekeepingConfigChanges()
+{
+    uint32_t beganMs = TIMER_IF_GetTimeMs();
+
+    // Fetch the page, starting the tracker from the beginning on our first sync since boot
+    // because names in flash may have been changed while we weren't running.
+    bool success = false;
+    bool morePages = false;
+    J *req = NoteNewRequest("note.changes");
+    if (req != NULL) {
+        JAddStringToObject(req, "file", CONFIGDB);
+        JAddStringToObject(req, "tracker", CONFIGDB_TRACKER);
+        JAddNumberToObject(req, "max", CONFIGDB_CHANGES_PAGE);
+        if (!configTrackerStarted) {
+            JAddBoolToObject(req, "start", true);
+        }
+        NoteSuspendTransactionDebug();
+        J *rsp = NoteRequestResponse(req);
+        NoteResumeTransactionDebug();
+        if (rsp != NULL) {
+            if (!NoteResponseError(rsp)) {
+                success = true;
+                configTrackerStarted = true;
+                morePages = (JGetInt(rsp, "changes") > 0);
+
+                // Enumerate the changed notes
+                J *notes = JDetachItemFromObject(rsp, "notes");
                 J *note = NULL;
-                bool updateConfig = false;
                 JObjectForEach(note, notes) {
+                    macStat.configNotes++;
+
+                    // Names of deleted sensors are left as they are
+                    if (JGetBool(note, "deleted")) {
+                        continue;
+                    }
 
                     // Get the sensor ID (in hex)
                     const char *sensorIDHex = JGetItemName(note);
@@ -234,210 +438,278 @@ bool gatewayHousekeeping(bool sensorsChanged, uint32_t cachedSensors)
                         strlcat(sensorName, "]", sizeof(sensorName));
                     }
 
-                    // Convert the sensor ID from hex to binary
-                    bool validHex = true;
-                    uint8_t addrbuf[ADDRESS_LEN];
-                    int addrlen = 0;
-                    const char *p = sensorIDHex;
-                    while (*p != '\0' && *(p+1) != '\0') {
-                        char ch1 = *p++;
-                        char ch2 = *p++;
-                        uint8_t value = 0;
-                        if (ch1 >= '0' && ch1 <= '9') {
-                            value |= (ch1 - '0') << 4;
-                        } else if (ch1 >= 'a' && ch1 <= 'f') {
-                            value |= ((ch1 - 'a') + 10) << 4;
-                        } else if (ch1 >= 'A' && ch1 <= 'F') {
-                            value |= ((ch1 - 'A') + 10) << 4;
-                        } else {
-                            validHex = false;
-                            break;
-                        }
-                        if (ch2 >= '0' && ch2 <= '9') {
-                            value |= (ch2 - '0');
-                        } else if (ch2 >= 'a' && ch2 <= 'f') {
-                            value |= ((ch2 - 'a') + 10);
-                        } else if (ch2 >= 'A' && ch2 <= 'F') {
-                            value |= ((ch2 - 'A') + 10);
-                        } else {
-                            validHex = false;
-                            break;
-                        }
-                        if (addrlen >= ADDRESS_LEN) {
-                            validHex = false;
-                            break;
-                        }
-                        addrlen++;
-                        addrbuf[ADDRESS_LEN-addrlen] = value;
-                    }
-
                     // If valid hex and the length is at least 2 bytes, set the name
-                    if (validHex && addrlen >= 2) {
+                    uint8_t addrbuf[ADDRESS_LEN];
+                    uint32_t addrlen = utilHexToAddress(sensorIDHex, addrbuf);
+                    if (addrlen >= 2) {
                         if (flashConfigUpdatePeerName(&addrbuf[ADDRESS_LEN-addrlen], addrlen, sensorName)) {
                             APP_PRINTF("config: %s name updated to '%s'\r\n", sensorIDHex, sensorName);
-                            updateConfig = true;
-                        } else {
-#if 0
-                            APP_PRINTF("config: %s name remains '%s'\r\n", sensorIDHex, sensorName);
-#endif
+                            configNamesChanged = true;
                         }
                     }
 
                 }
-
-                // Done with all configured notes
                 JDelete(notes);
 
-                // Update the config if something changed
-                if (updateConfig) {
-                    flashConfigUpdate();
-                }
             }
+            NoteDeleteResponse(rsp);
         }
+    }
 
-        // Now, loop over all sensors, updating them
-        uint32_t notesUpdated = 0;
-        for (size_t i=0; i<cachedSensors; i++) {
-
-            // Get the info
-            uint8_t sensorAddress[ADDRESS_LEN];
-            uint16_t sensorMv;
-            int8_t gatewayRSSI, gatewaySNR, sensorRSSI, sensorSNR, sensorTXP, sensorLTP;
-            uint32_t lastReceivedTime, requestsProcessed, requestsLost;
-            bool valid = appSensorCacheEntry(i, sensorAddress,
-                                             &gatewayRSSI, &gatewaySNR,
-                                             &sensorRSSI, &sensorSNR,
-                                             &sensorTXP, &sensorLTP, &sensorMv,
-                                             &lastReceivedTime,
-                                             &requestsProcessed, &requestsLost);
-            if (!valid) {
-                continue;
-            }
+    // If we failed, retry from where the tracker left off after the next sync
+    if (!success) {
+        configLastSyncTime = 0;
+    }
 
-            // Load the record from the DB, creating the body if it doesn't exist
-            J *req = NoteNewRequest("note.get");
-            if (req == NULL) {
-                continue;
-            }
-            char noteID[40];
-            utilAddressToText(sensorAddress, noteID, sizeof(noteID));
-            JAddStringToObject(req, "note", noteID);
-            JAddStringToObject(req, "file", SENSORDB);
-            NoteSuspendTransactionDebug();
-            J *rsp = NoteRequestResponse(req);
-            NoteResumeTransactionDebug();
-            if (rsp == NULL) {
-                continue;
-            }
-            J *body;
-            bool updateRequired = false;
-            if (NoteResponseError(rsp)) {
-                if (!NoteResponseErrorContains(rsp, "{note-noexist}")) {
-                    NoteDeleteResponse(rsp);
-                    continue;
-                }
-                body = JCreateObject();
-                updateRequired = true;
-            } else {
-                body = JDetachItemFromObject(rsp, "body");
-                if (body == NULL) {
-                    body = JCreateObject();
-                    updateRequired = true;
-                }
-            }
-            NoteDeleteResponse(rsp);
+    // Update the config once, when there's nothing more to fetch
+    if (!morePages) {
+        configChangesPending = false;
+        if (configNamesChanged) {
+            flashConfigUpdate();
+            configNamesChanged = false;
+        }
+        if (success) {
+            macStat.configSyncs++;
+        }
+    }
 
-            // Update the name in the note if it has changed
-            char sensorName[SENSOR_NAME_MAX];
-            if (flashConfigFindPeerByAddress(sensorAddress, NULL, NULL, sensorName)) {
-                char cleanName[SENSOR_NAME_MAX];
-                extractNameComponents(sensorName, cleanName, NULL, 0);
-                if (strcmp(JGetString(body, SENSORDB_FIELD_NAME), cleanName) != 0) {
-                    JDeleteItemFromObject(body, SENSORDB_FIELD_NAME);
-                    JAddStringToObject(body, SENSORDB_FIELD_NAME, cleanName);
-                    updateRequired = true;
-                }
-            }
+    macStat.configSyncMs += (uint32_t) (TIMER_IF_GetTimeMs() - beganMs);
+}
 
-            // Update error/success counts, or reset them
-            if (var_gateway_sensordb_reset_counts != 0
-                    && time_var_gateway_sensordb_reset_counts != 0
-                    && (size_t)JGetInt(body, SENSORDB_FIELD_WHEN) < time_var_gateway_sensordb_reset_counts) {
-                JDeleteItemFromObject(body, SENSORDB_FIELD_RECEIVED);
-                JAddNumberToObject(body, SENSORDB_FIELD_RECEIVED, 0);
-                JDeleteItemFromObject(body, SENSORDB_FIELD_LOST);
-                JAddNumberToObject(body, SENSORDB_FIELD_LOST, 0);
-                updateRequired = true;
-            } else if (requestsProcessed > 0 || requestsLost > 0) {
-                requestsProcessed += JGetInt(body, SENSORDB_FIELD_RECEIVED);
-                JDeleteItemFromObject(body, SENSORDB_FIELD_RECEIVED);
-                JAddNumberToObject(body, SENSORDB_FIELD_RECEIVED, requestsProcessed);
-                requestsLost += JGetInt(body, SENSORDB_FIELD_LOST);
-                JDeleteItemFromObject(body, SENSORDB_FIELD_LOST);
-                JAddNumberToObject(body, SENSORDB_FIELD_LOST, requestsLost);
-                updateRequired = true;
-            }
+// Export the link history of sensors in a single note.  If there are too many sensors with
+// history for one note, the rest are exported first in the next cycle.
+static void housekeepingLinks(uint32_t cachedSensors)
+{
+    housekeepingLinksDue = false;
+    if (cachedSensors == 0) {
+        return;
+    }
 
-            // Update signal strength and quality
-            if (lastReceivedTime != (size_t)JGetInt(body, SENSORDB_FIELD_WHEN)) {
-                JDeleteItemFromObject(body, SENSORDB_FIELD_WHEN);
-                JAddNumberToObject(body, SENSORDB_FIELD_WHEN, lastReceivedTime);
-                if (gatewayRSSI != 0 || gatewaySNR != 0) {
-                    JDeleteItemFromObject(body, SENSORDB_FIELD_GATEWAY_RSSI);
-                    JAddNumberToObject(body, SENSORDB_FIELD_GATEWAY_RSSI, gatewayRSSI);
-                    JDeleteItemFromObject(body, SENSORDB_FIELD_GATEWAY_SNR);
-                    JAddNumberToObject(body, SENSORDB_FIELD_GATEWAY_SNR, gatewaySNR);
-                }
-                if (sensorRSSI != 0 || sensorSNR != 0) {
-                    JDeleteItemFromObject(body, SENSORDB_FIELD_SENSOR_RSSI);
-                    JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_RSSI, sensorRSSI);
-                    JDeleteItemFromObject(body, SENSORDB_FIELD_SENSOR_SNR);
-                    JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_SNR, sensorSNR);
-                }
-                JDeleteItemFromObject(body, SENSORDB_FIELD_SENSOR_TXP);
-                JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_TXP, sensorTXP);
-                JDeleteItemFromObject(body, SENSORDB_FIELD_SENSOR_LTP);
-                JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_LTP, sensorLTP);
-                JNUMBER voltage = ((JNUMBER) sensorMv) / 1000;
-                if (voltage != 0) {
-                    JDeleteItemFromObject(body, SENSORDB_FIELD_VOLTAGE);
-                    JAddNumberToObject(body, SENSORDB_FIELD_VOLTAGE, voltage);
-                }
-                updateRequired = true;
-            }
+    // Gather the history
+    J *body = JCreateObject();
+    if (body == NULL) {
+        return;
+    }
+    uint32_t sensors = 0;
+    uint32_t i = housekeepingLinksNext % cachedSensors;
+    for (uint32_t n=0; n<cachedSensors && sensors<LINK_EXPORT_MAX_SENSORS; n++) {
+        uint32_t index = (i + n) % cachedSensors;
+        housekeepingLinksNext = index + 1;
+        uint8_t sensorAddress[ADDRESS_LEN];
+        uint16_t sensorMv;
+        int8_t gatewayRSSI, gatewaySNR, sensorRSSI, sensorSNR, sensorTXP, sensorLTP;
+        uint32_t lastReceivedTime, requestsProcessed, requestsLost;
+        if (!appSensorCacheEntry(index, sensorAddress,
+                                 &gatewayRSSI, &gatewaySNR,
+                                 &sensorRSSI, &sensorSNR,
+                                 &sensorTXP, &sensorLTP, &sensorMv,
+                                 &lastReceivedTime,
+                                 &requestsProcessed, &requestsLost)) {
+            continue;
+        }
+        linkHistory *history = appSensorCacheLinks(index);
+        if (!linkStatsPending(history)) {
+            continue;
+        }
+        J *buckets = linkStatsExport(history);
+        if (buckets == NULL) {
+            break;
+        }
+        char sensorID[40];
+        utilAddressToText(sensorAddress, sensorID, sizeof(sensorID));
+        JAddItemToObject(body, sensorID, buckets);
+        linkStatsExported(history);
+        sensors++;
+    }
+    if (sensors == 0) {
+        JDelete(body);
+        return;
+    }
 
-            // If no update required, continue
-            if (!updateRequired) {
-                JDelete(body);
-                continue;
-            }
+    // Add the note.  If it can't be added the history is lost, which is preferable to
+    // sending it again along with subsequent history.
+    J *req = NoteNewRequest("note.add");
+    if (req == NULL) {
+        JDelete(body);
+        return;
+    }
+    JAddStringToObject(req, "file", LINKSQO);
+    JAddItemToObject(req, "body", body);
+    NoteSuspendTransactionDebug();
+    NoteRequest(req);
+    NoteResumeTransactionDebug();
+
+}
+
+// Flush the stats of a sensor cache entry to the sensor DB, returning true if the DB was updated.
+// The record is only read from the DB when we don't yet have a shadow of it, such as after a
+// restart, and is only written when something in it has changed.
+bool gatewaySensorFlush(uint32_t i)
+{
+
+    // Get the info
+    uint8_t sensorAddress[ADDRESS_LEN];
+    uint16_t sensorMv;
+    int8_t gatewayRSSI, gatewaySNR, sensorRSSI, sensorSNR, sensorTXP, sensorLTP;
+    uint32_t lastReceivedTime, requestsProcessed, requestsLost;
+    bool valid = appSensorCacheEntry(i, sensorAddress,
+                                     &gatewayRSSI, &gatewaySNR,
+                                     &sensorRSSI, &sensorSNR,
+                                     &sensorTXP, &sensorLTP, &sensorMv,
+                                     &lastReceivedTime,
+                                     &requestsProcessed, &requestsLost);
+    if (!valid) {
+        return false;
+    }
+    sensorDBShadow *shadow = appSensorCacheShadow(i);
+    char noteID[40];
+    utilAddressToText(sensorAddress, noteID, sizeof(noteID));
+
+    // Get the name that the record should have
+    char sensorName[SENSOR_NAME_MAX] = {0};
+    char cleanName[SENSOR_NAME_MAX] = {0};
+    bool named = flashConfigFindPeerByAddress(sensorAddress, NULL, NULL, sensorName);
+    if (named) {
+        extractNameComponents(sensorName, cleanName, NULL, 0);
+    }
 
-            // Update the note
-            req = NoteNewRequest("note.update");
-            if (req == NULL) {
-                JDelete(body);
-                APP_PRINTF("sensordb update error\r\n");
-                continue;
+    // Load the record from the DB into the shadow if necessary, noting that it must be
+    // written if it doesn't exist.  Without a name of our own, we retain the DB's.
+    bool updateRequired = false;
+    if (!shadow->valid || !named) {
+        J *req = NoteNewRequest("note.get");
+        if (req == NULL) {
+            return false;
+        }
+        JAddStringToObject(req, "note", noteID);
+        JAddStringToObject(req, "file", SENSORDB);
+        NoteSuspendTransactionDebug();
+        J *rsp = NoteRequestResponse(req);
+        NoteResumeTransactionDebug();
+        if (rsp == NULL) {
+            return false;
+        }
+        memset(shadow, 0, sizeof(sensorDBShadow));
+        J *body = NULL;
+        if (NoteResponseError(rsp)) {
+            if (!NoteResponseErrorContains(rsp, "{note-noexist}")) {
+                NoteDeleteResponse(rsp);
+                return false;
             }
-            JAddStringToObject(req, "note", noteID);
-            JAddStringToObject(req, "file", SENSORDB);
-            JAddItemToObject(req, "body", body);
-            bool success = NoteRequest(req);
-            if (!success) {
-                continue;
+        } else {
+            body = JGetObject(rsp, "body");
+        }
+        if (body == NULL) {
+            updateRequired = true;
+        } else {
+            const char *dbName = JGetString(body, SENSORDB_FIELD_NAME);
+            shadow->nameCRC = utilCRC32(0, dbName, strlen(dbName));
+            if (!named) {
+                strlcpy(cleanName, dbName, sizeof(cleanName));
             }
-            notesUpdated++;
+            shadow->received = JGetInt(body, SENSORDB_FIELD_RECEIVED);
+            shadow->lost = JGetInt(body, SENSORDB_FIELD_LOST);
+            shadow->when = JGetInt(body, SENSORDB_FIELD_WHEN);
+            shadow->gatewayRSSI = JGetInt(body, SENSORDB_FIELD_GATEWAY_RSSI);
+            shadow->gatewaySNR = JGetInt(body, SENSORDB_FIELD_GATEWAY_SNR);
+            shadow->sensorRSSI = JGetInt(body, SENSORDB_FIELD_SENSOR_RSSI);
+            shadow->sensorSNR = JGetInt(body, SENSORDB_FIELD_SENSOR_SNR);
+            shadow->sensorTXP = JGetInt(body, SENSORDB_FIELD_SENSOR_TXP);
+            shadow->sensorLTP = JGetInt(body, SENSORDB_FIELD_SENSOR_LTP);
+            shadow->sensorMv = (uint16_t) ((JGetNumber(body, SENSORDB_FIELD_VOLTAGE) * 1000) + 0.5);
+        }
+        NoteDeleteResponse(rsp);
+        shadow->valid = true;
+    }
+
+    // Update the name if it has changed
+    uint32_t nameCRC = utilCRC32(0, cleanName, strlen(cleanName));
+    if (shadow->nameCRC != nameCRC) {
+        shadow->nameCRC = nameCRC;
+        updateRequired = true;
+    }
 
-            // Now that we've updated the note, clear the stats in the cache
-            appSensorCacheEntryResetStats(i);
-            APP_PRINTF("sensordb updated %s\r\n", noteID);
+    // Update error/success counts, or reset them
+    if (var_gateway_sensordb_reset_counts != 0
+            && time_var_gateway_sensordb_reset_counts != 0
+            && shadow->when < time_var_gateway_sensordb_reset_counts) {
+        shadow->received = 0;
+        shadow->lost = 0;
+        updateRequired = true;
+    } else if (requestsProcessed > 0 || requestsLost > 0) {
+        shadow->received += requestsProcessed;
+        shadow->lost += requestsLost;
+        updateRequired = true;
+    }
 
+    // Update signal strength and quality
+    if (lastReceivedTime != shadow->when) {
+        shadow->when = lastReceivedTime;
+        if (gatewayRSSI != 0 || gatewaySNR != 0) {
+            shadow->gatewayRSSI = gatewayRSSI;
+            shadow->gatewaySNR = gatewaySNR;
+        }
+        if (sensorRSSI != 0 || sensorSNR != 0) {
+            shadow->sensorRSSI = sensorRSSI;
+            shadow->sensorSNR = sensorSNR;
         }
+        shadow->sensorTXP = sensorTXP;
+        shadow->sensorLTP = sensorLTP;
+        if (sensorMv != 0) {
+            shadow->sensorMv = sensorMv;
+        }
+        updateRequired = true;
+    }
 
+    // If no update required, we're done
+    if (!updateRequired) {
+        return false;
     }
 
-    // Return a flag as to whether or not env vars have been loaded
-    return (envLastUpdateTime != 0);
+    // Write the record from the shadow
+    J *body = JCreateObject();
+    if (body == NULL) {
+        shadow->valid = false;
+        return false;
+    }
+    JAddStringToObject(body, SENSORDB_FIELD_NAME, cleanName);
+    JAddNumberToObject(body, SENSORDB_FIELD_RECEIVED, shadow->received);
+    JAddNumberToObject(body, SENSORDB_FIELD_LOST, shadow->lost);
+    if (shadow->when != 0) {
+        JAddNumberToObject(body, SENSORDB_FIELD_WHEN, shadow->when);
+        if (shadow->gatewayRSSI != 0 || shadow->gatewaySNR != 0) {
+            JAddNumberToObject(body, SENSORDB_FIELD_GATEWAY_RSSI, shadow->gatewayRSSI);
+            JAddNumberToObject(body, SENSORDB_FIELD_GATEWAY_SNR, shadow->gatewaySNR);
+        }
+        if (shadow->sensorRSSI != 0 || shadow->sensorSNR != 0) {
+            JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_RSSI, shadow->sensorRSSI);
+            JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_SNR, shadow->sensorSNR);
+        }
+        JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_TXP, shadow->sensorTXP);
+        JAddNumberToObject(body, SENSORDB_FIELD_SENSOR_LTP, shadow->sensorLTP);
+        if (shadow->sensorMv != 0) {
+            JAddNumberToObject(body, SENSORDB_FIELD_VOLTAGE, ((JNUMBER) shadow->sensorMv) / 1000);
+        }
+    }
+    J *req = NoteNewRequest("note.update");
+    if (req == NULL) {
+        JDelete(body);
+        shadow->valid = false;
+        APP_PRINTF("sensordb update error\r\n");
+        return false;
+    }
+    JAddStringToObject(req, "note", noteID);
+    JAddStringToObject(req, "file", SENSORDB);
+    JAddItemToObject(req, "body", body);
+    if (!NoteRequest(req)) {
+        shadow->valid = false;
+        return false;
+    }
+
+    // Now that we've updated the note, clear the stats in the cache
+    appSensorCacheEntryResetStats(i);
+    APP_PRINTF("sensordb updated %s\r\n", noteID);
+    return true;
 
 }
 
@@ -0,0 +1,127 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Recent history of the quality of the link with a sensor, so that link degradation can be
+// diagnosed.  Rather than retaining every sample, samples are downsampled as they arrive
+// into a small ring of buckets that each hold the min, average, and max of each metric,
+// and the buckets that haven't yet been exported are exported once per housekeeping cycle.
+//
+// A bucket is exported as an array of numbers, in this order:
+//   samples, rssi min/avg/max, snr min/avg/max, txp min/avg/max, ms min/avg/max,
+//   retries, max retries of a single sample
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framework.h"
+
+// Forwards
+static void linkStatsAdvance(linkHistory *history);
+
+// Add a sample of the link, as observed when a transfer from the sensor has been received
+void linkStatsSample(linkHistory *history, int8_t rssi, int8_t snr, int8_t txp, uint32_t ms, uint32_t retries)
+{
+    if (ms > 0xffff) {
+        ms = 0xffff;
+    }
+    if (retries > 0xff) {
+        retries = 0xff;
+    }
+
+    // Begin a new bucket when the one being filled is full
+    linkBucket *b = &history->bucket[history->head];
+    if (b->samples >= LINK_BUCKET_SAMPLES) {
+        linkStatsAdvance(history);
+        b = &history->bucket[history->head];
+    }
+
+    // Add the sample
+    if (b->samples == 0) {
+        if (history->unexported < LINK_HISTORY_BUCKETS) {
+            history->unexported++;
+        }
+        b->rssiMin = b->rssiMax = rssi;
+        b->snrMin = b->snrMax = snr;
+        b->txpMin = b->txpMax = txp;
+        b->msMin = b->msMax = (uint16_t) ms;
+    }
+    b->samples++;
+    b->rssiMin = (rssi < b->rssiMin) ? rssi : b->rssiMin;
+    b->rssiMax = (rssi > b->rssiMax) ? rssi : b->rssiMax;
+    b->rssiSum += rssi;
+    b->snrMin = (snr < b->snrMin) ? snr : b->snrMin;
+    b->snrMax = (snr > b->snrMax) ? snr : b->snrMax;
+    b->snrSum += snr;
+    b->txpMin = (txp < b->txpMin) ? txp : b->txpMin;
+    b->txpMax = (txp > b->txpMax) ? txp : b->txpMax;
+    b->txpSum += txp;
+    b->msMin = (ms < b->msMin) ? (uint16_t) ms : b->msMin;
+    b->msMax = (ms > b->msMax) ? (uint16_t) ms : b->msMax;
+    b->msSum += ms;
+    b->retries += retries;
+    b->retriesMax = (retries > b->retriesMax) ? (uint8_t) retries : b->retriesMax;
+
+}
+
+// True if there are samples that haven't yet been exported
+bool linkStatsPending(linkHistory *history)
+{
+    return (history->unexported > 0);
+}
+
+// Export the buckets that haven't yet been exported, oldest first, as an array of arrays.
+// The bucket being filled is closed, so that subsequent samples go into the next export.
+J *linkStatsExport(linkHistory *history)
+{
+    if (history->unexported == 0) {
+        return NULL;
+    }
+    J *buckets = JCreateArray();
+    if (buckets == NULL) {
+        return NULL;
+    }
+    uint32_t i = (history->head + LINK_HISTORY_BUCKETS + 1 - history->unexported) % LINK_HISTORY_BUCKETS;
+    for (uint32_t n=0; n<history->unexported; n++) {
+        linkBucket *b = &history->bucket[i];
+        J *bucket = JCreateArray();
+        if (bucket == NULL) {
+            JDelete(buckets);
+            return NULL;
+        }
+        JAddItemToArray(bucket, JCreateNumber(b->samples));
+        JAddItemToArray(bucket, JCreateNumber(b->rssiMin));
+        JAddItemToArray(bucket, JCreateNumber(b->rssiSum / b->samples));
+        JAddItemToArray(bucket, JCreateNumber(b->rssiMax));
+        JAddItemToArray(bucket, JCreateNumber(b->snrMin));
+        JAddItemToArray(bucket, JCreateNumber(b->snrSum / b->samples));
+        JAddItemToArray(bucket, JCreateNumber(b->snrMax));
+        JAddItemToArray(bucket, JCreateNumber(b->txpMin));
+        JAddItemToArray(bucket, JCreateNumber(b->txpSum / b->samples));
+        JAddItemToArray(bucket, JCreateNumber(b->txpMax));
+        JAddItemToArray(bucket, JCreateNumber(b->msMin));
+        JAddItemToArray(bucket, JCreateNumber(b->msSum / b->samples));
+        JAddItemToArray(bucket, JCreateNumber(b->msMax));
+        JAddItemToArray(bucket, JCreateNumber(b->retries));
+        JAddItemToArray(bucket, JCreateNumber(b->retriesMax));
+        JAddItemToArray(buckets, bucket);
+        i = (i + 1) % LINK_HISTORY_BUCKETS;
+    }
+    return buckets;
+}
+
+// Note that the buckets have been exported
+void linkStatsExported(linkHistory *history)
+{
+    if (history->bucket[history->head].samples > 0) {
+        linkStatsAdvance(history);
+    }
+    history->unexported = 0;
+}
+
+// Begin filling the next bucket, overwriting the oldest
+static void linkStatsAdvance(linkHistory *history)
+{
+    history->head = (history->head + 1) % LINK_HISTORY_BUCKETS;
+    memset(&history->bucket[history->head], 0, sizeof(linkBucket));
+}
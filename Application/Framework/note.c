@@ -16,6 +16,22 @@ void noteDelay(uint32_t ms);
 uint32_t noteMillis(void);
 void noteBeginTransaction(void);
 void noteEndTransaction(void);
+bool noteBatchable(J *req, bool responseExpected);
+void noteBatchFromOutbox(void);
+void noteBatchSend(J *req, bool responseExpected);
+
+// Notes held for sending to the gateway in a batch
+static J *batchRequests = NULL;
+static uint32_t batchNotes = 0;
+static uint32_t batchOldestTime = 0;
+static bool batchCompletionPending = false;
+
+// A batch being sent on its own because of its age, rather than with an app's request
+static bool batchSending = false;
+static uint32_t batchSendingTime = 0;
+
+// Number of notes at the head of the request in flight that came from the outbox
+static uint32_t batchFromOutbox = 0;
 
 // Initialize the note subsystem
 bool noteInit()
@@ -254,7 +270,224 @@ void noteSendToGatewayAsync(J *req, bool responseExpected)
         JAddNumberToObject(req, "time", NoteTimeST());
     }
 
+    // Learn templates now, because they may be sent within a batch
+    bjsonLearnTemplate(req);
+
+    // Hold notes that don't need a response so that several can be sent in one transfer
+    if (noteBatchable(req, responseExpected)) {
+        if (batchRequests == NULL) {
+            batchRequests = JCreateArray();
+            batchOldestTime = NoteTimeST();
+        }
+        if (batchRequests != NULL) {
+            JAddItemToArray(batchRequests, req);
+            req = NULL;
+            batchNotes++;
+            bool expired = NoteTimeValidST() && NoteTimeST() >= batchOldestTime + SENSOR_BATCH_MAX_SECS;
+            if (batchNotes < SENSOR_BATCH_MAX_NOTES && !expired) {
+                APP_PRINTF("note held for batch (%d pending)\r\n", batchNotes);
+                schedSendingRequest(false);
+                batchCompletionPending = true;
+                return;
+            }
+        }
+    }
+
+    // Send it along with anything being held
+    noteBatchSend(req, responseExpected);
+
+}
+
+// Send a request to the gateway along with anything being held, or just what is being
+// held if req is NULL.
+void noteBatchSend(J *req, bool responseExpected)
+{
+
+    // Notes retained from earlier failures go ahead of anything being held, because they're oldest
+    noteBatchFromOutbox();
+
+    // Send anything being held along with this request, which is last so that
+    // its response is the one returned by the gateway.
+    if (batchRequests != NULL) {
+        if (req != NULL) {
+            JAddItemToArray(batchRequests, req);
+        }
+        req = NoteNewRequest(BATCH_REQUEST);
+        if (req == NULL) {
+            return;
+        }
+        APP_PRINTF("sending batch of %d requests\r\n", JGetArraySize(batchRequests));
+        JAddItemToObject(req, BATCH_FIELD_REQUESTS, batchRequests);
+        batchRequests = NULL;
+        batchNotes = 0;
+    }
+    if (req == NULL) {
+        return;
+    }
+
     // Enqueue it to the gateway
     sensorSendReqToGateway(req, responseExpected);
 
 }
+
+// See if a request may be held and sent later as part of a batch
+bool noteBatchable(J *req, bool responseExpected)
+{
+    if (responseExpected || gatewayMessageVersion < MESSAGE_VERSION_BATCH) {
+        return false;
+    }
+    if (strcmp(JGetString(req, "req"), "note.add") != 0) {
+        return false;
+    }
+    return !JGetBool(req, "sync");
+}
+
+// Period at which notes added at the specified period are sent to the gateway, which is longer
+// when they are held to be sent in batches
+uint32_t noteSendPeriodSecs(uint32_t addPeriodSecs)
+{
+    if (addPeriodSecs == 0 || gatewayMessageVersion < MESSAGE_VERSION_BATCH) {
+        return addPeriodSecs;
+    }
+    uint32_t sendPeriodSecs = addPeriodSecs * SENSOR_BATCH_MAX_NOTES;
+    if (sendPeriodSecs > SENSOR_BATCH_MAX_SECS) {
+        sendPeriodSecs = (addPeriodSecs > SENSOR_BATCH_MAX_SECS) ? addPeriodSecs : SENSOR_BATCH_MAX_SECS;
+    }
+    return sendPeriodSecs;
+}
+
+// Complete the request of an app whose note was held for a batch, which is done on the
+// next poll because the app only sets its completion state after sending the request.
+void noteBatchPoll()
+{
+    if (batchCompletionPending) {
+        batchCompletionPending = false;
+        schedRequestCompleted();
+    }
+
+    // Send the batch on its own once its oldest note has been held for too long, which
+    // must wait until no app is in the midst of a request that would be displaced by it
+    if (batchRequests != NULL && noteBatchDueSecs() == 0 && !schedAnyActive() && !noteBatchSending()) {
+        APP_PRINTF("sending batch because its oldest note has been held for %ds\r\n", NoteTimeST() - batchOldestTime);
+        batchSending = true;
+        batchSendingTime = NoteTimeST();
+        noteBatchSend(NULL, false);
+    }
+
+}
+
+// Number of seconds until the batch being held must be sent because of its age
+uint32_t noteBatchDueSecs()
+{
+    if (batchRequests == NULL || !NoteTimeValidST()) {
+        return 0xFFFFFFFFU;
+    }
+    uint32_t now = NoteTimeST();
+    uint32_t due = batchOldestTime + SENSOR_BATCH_MAX_SECS;
+    return (now >= due) ? 0 : due - now;
+}
+
+// See if a batch is being sent on its own, which ends when its request completes or fails
+bool noteBatchSending()
+{
+    if (batchSending && NoteTimeValidST() && NoteTimeST() > batchSendingTime + appTransmitWindowWaitMaxSecs()) {
+        batchSending = false;
+    }
+    return batchSending;
+}
+
+// Place notes retained in the outbox at the head of the batch
+void noteBatchFromOutbox()
+{
+    batchFromOutbox = 0;
+    uint32_t count = outboxCount();
+    if (count == 0 || gatewayMessageVersion < MESSAGE_VERSION_BATCH) {
+        return;
+    }
+    if (count > SENSOR_BATCH_MAX_NOTES) {
+        count = SENSOR_BATCH_MAX_NOTES;
+    }
+    J *requests = JCreateArray();
+    if (requests == NULL) {
+        return;
+    }
+    for (uint32_t i=0; i<count; i++) {
+        J *note = outboxGet(i);
+        if (note == NULL) {
+            break;
+        }
+        JAddItemToArray(requests, note);
+        batchFromOutbox++;
+    }
+    if (batchRequests != NULL) {
+        while (JGetArraySize(batchRequests) > 0) {
+            JAddItemToArray(requests, JDetachItemFromArray(batchRequests, 0));
+        }
+        JDelete(batchRequests);
+    }
+    batchRequests = requests;
+    APP_PRINTF("outbox: sending %d of %d retained notes\r\n", batchFromOutbox, outboxCount());
+}
+
+// The gateway acknowledged the request in flight, so any notes from the outbox were delivered
+void noteRequestCompleted()
+{
+    batchSending = false;
+    outboxRemove(batchFromOutbox);
+    batchFromOutbox = 0;
+}
+
+// The request in flight was abandoned, so retain the notes that it contained.  Those that
+// came from the outbox are still there, and are skipped.
+void noteRequestFailed(uint8_t *data, uint32_t len, bool compressed)
+{
+    uint32_t skip = batchFromOutbox;
+    batchFromOutbox = 0;
+    batchSending = false;
+    if (data == NULL) {
+        return;
+    }
+
+    // Recover the request
+    uint8_t *plain = data;
+    uint32_t plainLen = len;
+    if (compressed) {
+        plain = compressDecode(data, len, &plainLen);
+        if (plain == NULL) {
+            return;
+        }
+    }
+    J *req;
+    if (bjsonIsEncoded(plain, plainLen)) {
+        req = bjsonDecode(plain, plainLen);
+    } else {
+        char *reqstr = JAllocString(plain, plainLen);
+        req = JConvertFromJSONString(reqstr);
+        JFree(reqstr);
+    }
+    if (plain != data) {
+        memset(plain, '?', plainLen);
+        free(plain);
+    }
+    if (req == NULL) {
+        return;
+    }
+
+    // Retain its notes
+    uint32_t retained = 0;
+    if (strcmp(JGetString(req, "req"), BATCH_REQUEST) == 0) {
+        J *requests = JGetArray(req, BATCH_FIELD_REQUESTS);
+        for (int i=skip; i<JGetArraySize(requests); i++) {
+            J *item = JGetArrayItem(requests, i);
+            if (strcmp(JGetString(item, "req"), "note.add") == 0 && outboxAdd(item)) {
+                retained++;
+            }
+        }
+    } else if (strcmp(JGetString(req, "req"), "note.add") == 0 && outboxAdd(req)) {
+        retained++;
+    }
+    JDelete(req);
+    if (retained > 0) {
+        APP_PRINTF("outbox: %d notes retained (%d total)\r\n", retained, outboxCount());
+    }
+}
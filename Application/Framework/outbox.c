@@ -0,0 +1,169 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Outbox of notes that a sensor failed to send to the gateway, so that they aren't lost
+// while the gateway is rebooting or out of range.  The outbox is kept in RAM that isn't
+// initialized at startup, so that it survives both STOP2 and the reset that the sensor
+// performs when the gateway reboots.  A signature and CRC tell us whether it is intact.
+//
+// Notes are stored back-to-back in a ring, each as a two-byte length followed by the
+// bjson encoding of the note, which retains the time at which the note was added.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framework.h"
+#include "utilities_conf.h"
+
+#define OUTBOX_SIGNATURE        0x584f424f
+
+typedef struct {
+    uint32_t signature;
+    uint16_t head;                  // Offset of the oldest note
+    uint16_t used;                  // Bytes in use, including lengths
+    uint16_t notes;                 // Number of notes
+    uint16_t reserved;
+    uint32_t crc;                   // CRC of all of the above and of the data
+    uint8_t data[SENSOR_OUTBOX_BYTES];
+} outboxRing;
+static outboxRing outbox UTIL_PLACE_IN_SECTION(".noinit");
+
+// Forwards
+static uint32_t outboxCRC(void);
+static void outboxCopy(uint32_t offset, uint8_t *buf, uint32_t len, bool write);
+static uint32_t outboxNoteLen(uint32_t offset);
+static void outboxDiscard(uint32_t count);
+
+// Validate the outbox after a reset, clearing it if it has been lost
+void outboxInit()
+{
+    if (outbox.signature == OUTBOX_SIGNATURE && outbox.crc == outboxCRC()
+            && outbox.head < sizeof(outbox.data) && outbox.used <= sizeof(outbox.data)) {
+        if (outbox.notes > 0) {
+            APP_PRINTF("outbox: %d notes retained\r\n", outbox.notes);
+        }
+        return;
+    }
+    memset(&outbox, 0, sizeof(outbox));
+    outbox.signature = OUTBOX_SIGNATURE;
+    outbox.crc = outboxCRC();
+}
+
+// Number of notes in the outbox
+uint32_t outboxCount()
+{
+    return outbox.notes;
+}
+
+// Append a note, discarding the oldest notes if there's no room for it
+bool outboxAdd(J *note)
+{
+    uint32_t len;
+    uint8_t *data = bjsonEncode(note, &len);
+    if (data == NULL) {
+        return false;
+    }
+    if (len+2 > sizeof(outbox.data)) {
+        memset(data, '?', len);
+        free(data);
+        return false;
+    }
+
+    // Make room
+    uint32_t discarded = 0;
+    while (outbox.used+2+len > sizeof(outbox.data)) {
+        outboxDiscard(1);
+        discarded++;
+    }
+    if (discarded > 0) {
+        APP_PRINTF("outbox: full, %d oldest notes discarded\r\n", discarded);
+    }
+
+    // Append it
+    uint8_t hdr[2] = { (uint8_t) len, (uint8_t) (len >> 8) };
+    outboxCopy(outbox.used, hdr, sizeof(hdr), true);
+    outboxCopy(outbox.used+sizeof(hdr), data, len, true);
+    outbox.used += sizeof(hdr) + len;
+    outbox.notes++;
+    outbox.crc = outboxCRC();
+
+    memset(data, '?', len);
+    free(data);
+    return true;
+}
+
+// Get a copy of the note at the specified index, where 0 is the oldest
+J *outboxGet(uint32_t index)
+{
+    if (index >= outbox.notes) {
+        return NULL;
+    }
+    uint32_t offset = 0;
+    for (uint32_t i=0; i<index; i++) {
+        offset += 2 + outboxNoteLen(offset);
+    }
+    uint32_t len = outboxNoteLen(offset);
+    uint8_t *data = malloc(len);
+    if (data == NULL) {
+        return NULL;
+    }
+    outboxCopy(offset+2, data, len, false);
+    J *note = bjsonDecode(data, len);
+    memset(data, '?', len);
+    free(data);
+    return note;
+}
+
+// Remove the oldest notes, typically after they've been sent
+void outboxRemove(uint32_t count)
+{
+    if (count > 0) {
+        outboxDiscard(count);
+        outbox.crc = outboxCRC();
+    }
+}
+
+// Discard the oldest notes without updating the CRC
+static void outboxDiscard(uint32_t count)
+{
+    while (count-- > 0 && outbox.notes > 0) {
+        uint32_t len = 2 + outboxNoteLen(0);
+        outbox.head = (outbox.head + len) % sizeof(outbox.data);
+        outbox.used -= len;
+        outbox.notes--;
+    }
+    if (outbox.notes == 0) {
+        outbox.head = 0;
+        outbox.used = 0;
+    }
+}
+
+// Length of the note at the specified offset from the oldest note
+static uint32_t outboxNoteLen(uint32_t offset)
+{
+    uint8_t hdr[2];
+    outboxCopy(offset, hdr, sizeof(hdr), false);
+    return hdr[0] | (hdr[1] << 8);
+}
+
+// Copy into or out of the ring, at an offset from the oldest note
+static void outboxCopy(uint32_t offset, uint8_t *buf, uint32_t len, bool write)
+{
+    uint32_t pos = (outbox.head + offset) % sizeof(outbox.data);
+    for (uint32_t i=0; i<len; i++) {
+        if (write) {
+            outbox.data[pos] = buf[i];
+        } else {
+            buf[i] = outbox.data[pos];
+        }
+        pos = (pos + 1) % sizeof(outbox.data);
+    }
+}
+
+// Compute the CRC of the outbox
+static uint32_t outboxCRC()
+{
+    uint32_t crc = utilCRC32(0, &outbox, offsetof(outboxRing, crc));
+    return utilCRC32(crc, outbox.data, sizeof(outbox.data));
+}
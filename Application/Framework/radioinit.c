@@ -5,6 +5,7 @@
 #include "main.h"
 #include "framework.h"
 #include "radio.h"
+#include "radio_driver.h"
 
 // Global radio data
 bool wireReceiveSignalValid = false;
@@ -13,6 +14,13 @@ int8_t wireReceiveSNR = 0;
 int8_t wireTransmitDb = 0;
 bool radioIsDeepSleep = false;
 bool radioIOPending = false;
+static bool radioTransmitting = false;
+static uint8_t radioSF = LORA_SPREADING_FACTOR;
+static int8_t radioTxPowerDb = 0;
+
+// MAC statistics
+macStats macStat = {0};
+static int64_t rxBeganMs = 0;
 
 // IO vars
 uint32_t ioRFFrequency;
@@ -24,6 +32,7 @@ static void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
 static void OnTxTimeout(void);
 static void OnRxTimeout(void);
 static void OnRxError(void);
+static void OnCadDone(bool channelActivityDetected);
 
 // Initialize the radio
 void radioInit()
@@ -43,15 +52,17 @@ void radioInit()
     RadioEvents.TxTimeout = OnTxTimeout;
     RadioEvents.RxTimeout = OnRxTimeout;
     RadioEvents.RxError = OnRxError;
+    RadioEvents.CadDone = OnCadDone;
 
     radioIOPending = false;
+    radioTransmitting = false;
     Radio.Init(&RadioEvents);
 
 #if USE_MODEM_LORA
     radioSetTxPower(atpPowerLevel());
     Radio.SetRxConfig(MODEM_LORA,
                       LORA_BANDWIDTH,
-                      LORA_SPREADING_FACTOR,
+                      radioSF,
                       LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
                       LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
                       0, true, 0, 0, LORA_IQ_INVERSION_ON, true);
@@ -104,10 +115,25 @@ void radioDeepWake()
     }
 }
 
+// Accumulate the amount of time that the receiver was active
+static void rxListenCompleted(void)
+{
+    if (rxBeganMs != 0) {
+        uint32_t listenMs = (uint32_t) (TIMER_IF_GetTimeMs() - rxBeganMs);
+        macStat.rxListenMs += listenMs;
+        if (ListenPhaseBeforeTalk) {
+            macStat.lbtListenMs += listenMs;
+        }
+        rxBeganMs = 0;
+    }
+}
+
 // Transmit Timeout ISR
 static void OnTxTimeout(void)
 {
+    macStat.txTimeouts++;
     radioIOPending = false;
+    radioTransmitting = false;
     Radio.Sleep();
     ledIndicateTransmitInProgress(false);
     appSetCoreState(TX_TIMEOUT);
@@ -116,6 +142,8 @@ static void OnTxTimeout(void)
 // Receive Timeout ISR
 static void OnRxTimeout(void)
 {
+    macStat.rxTimeouts++;
+    rxListenCompleted();
     wireReceivedLen = 0;
     radioIOPending = false;
     Radio.Sleep();
@@ -126,6 +154,8 @@ static void OnRxTimeout(void)
 // Receive Error ISR
 static void OnRxError(void)
 {
+    macStat.rxErrors++;
+    rxListenCompleted();
     wireReceivedLen = 0;
     radioIOPending = false;
     Radio.Sleep();
@@ -133,10 +163,25 @@ static void OnRxError(void)
     appSetCoreState(RX_ERROR);
 }
 
+// Channel Activity Detection Completed ISR, which completes as though a listen-before-talk
+// receive had timed out if the channel is clear, or had failed if it is busy.
+static void OnCadDone(bool channelActivityDetected)
+{
+    if (rxBeganMs != 0) {
+        macStat.lbtListenMs += (uint32_t) (TIMER_IF_GetTimeMs() - rxBeganMs);
+        rxBeganMs = 0;
+    }
+    radioIOPending = false;
+    Radio.Sleep();
+    ledIndicateReceiveInProgress(false);
+    appSetCoreState(channelActivityDetected ? RX_ERROR : RX_TIMEOUT);
+}
+
 // Transmit Completed ISR
 static void OnTxDone(void)
 {
     radioIOPending = false;
+    radioTransmitting = false;
     Radio.Sleep();
     ledIndicateTransmitInProgress(false);
     appSetCoreState(TX);
@@ -146,6 +191,10 @@ static void OnTxDone(void)
 static void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
 {
 
+    wireReceivedMs = (uint32_t) TIMER_IF_GetTimeMs();
+    macStat.rxPackets++;
+    rxListenCompleted();
+
     if (size > sizeof(wireMessageCarrier)) {
         wireReceivedLen = 0;
     } else {
@@ -187,16 +236,36 @@ uint32_t radioWakeupRequiredMs()
 void radioRx(uint32_t timeoutMs)
 {
     radioDeepWake();
+    rxBeganMs = TIMER_IF_GetTimeMs();
     Radio.Rx(timeoutMs);
     radioIOPending = true;
 }
 
+// Start channel activity detection
+void radioCad()
+{
+    radioDeepWake();
+    rxBeganMs = TIMER_IF_GetTimeMs();
+    SUBGRF_SetCadParams(LBT_CAD_SYMBOLS, LBT_CAD_DET_PEAK(radioSF), LBT_CAD_DET_MIN, LORA_CAD_ONLY, 0);
+    Radio.StartCad();
+    radioIOPending = true;
+}
+
 // Transmit
 void radioTx(uint8_t *buffer, uint8_t size)
 {
     radioDeepWake();
+    macStat.txPackets++;
+    macStat.txAirtimeMs += radioTimeOnAirMs(size);
     Radio.Send(buffer, size);
     radioIOPending = true;
+    radioTransmitting = true;
+}
+
+// True if a transmission is in progress, which must not be abandoned
+bool radioIsTransmitting()
+{
+    return radioTransmitting;
 }
 
 // Set last known tx power to unknown
@@ -209,11 +278,12 @@ void radioSetTxPowerUnknown()
 void radioSetTxPower(int8_t powerLevel)
 {
     wireTransmitDb = powerLevel;
+    radioTxPowerDb = powerLevel;
     Radio.SetTxConfig(MODEM_LORA,
                       powerLevel,                   // output power in dBm
                       0,                            // unused for LoRa
                       LORA_BANDWIDTH,
-                      LORA_SPREADING_FACTOR,
+                      radioSF,
                       LORA_CODINGRATE,
                       LORA_PREAMBLE_LENGTH,
                       LORA_FIX_LENGTH_PAYLOAD_ON,
@@ -223,3 +293,81 @@ void radioSetTxPower(int8_t powerLevel)
                       LORA_IQ_INVERSION_ON,         // Invert IQ signal
                       TX_TIMEOUT_VALUE);            // Timeout on radio.Send()
 }
+
+// Change the spreading factor used for both transmit and receive, abandoning any receive in
+// progress so that the caller may restart it.  Returns true if it was changed.
+bool radioSetSpreadingFactor(uint8_t sf)
+{
+    if (sf == radioSF) {
+        return false;
+    }
+    radioSF = sf;
+    if (radioIsDeepSleep) {
+        return true;
+    }
+    if (radioIOPending) {
+        Radio.Standby();
+        rxListenCompleted();
+        radioIOPending = false;
+    }
+    Radio.SetRxConfig(MODEM_LORA,
+                      LORA_BANDWIDTH,
+                      radioSF,
+                      LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
+                      LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
+                      0, true, 0, 0, LORA_IQ_INVERSION_ON, true);
+    int8_t transmitDb = wireTransmitDb;
+    radioSetTxPower(radioTxPowerDb);
+    wireTransmitDb = transmitDb;
+    return true;
+}
+
+// Get the spreading factor currently in use
+uint8_t radioSpreadingFactor()
+{
+    return radioSF;
+}
+
+// Compute the time-on-air of a packet of the specified size using our modem parameters
+uint32_t radioTimeOnAirMs(uint8_t size)
+{
+    return radioTimeOnAirAtMs(radioSF, size);
+}
+
+// Compute the time-on-air of a packet of the specified size at the specified spreading factor
+uint32_t radioTimeOnAirAtMs(uint8_t sf, uint8_t size)
+{
+    return Radio.TimeOnAir(MODEM_LORA, LORA_BANDWIDTH, sf, LORA_CODINGRATE,
+                           LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON, size, true);
+}
+
+// Reset MAC statistics
+void radioStatsReset()
+{
+    memset(&macStat, 0, sizeof(macStat));
+    macStat.beganMs = TIMER_IF_GetTimeMs();
+}
+
+// Display MAC statistics
+void radioStatsShow()
+{
+    uint32_t elapsedSecs = (uint32_t) ((TIMER_IF_GetTimeMs() - macStat.beganMs) / 1000);
+    if (elapsedSecs == 0) {
+        elapsedSecs = 1;
+    }
+    APP_PRINTF("stats: over %ds\r\n", elapsedSecs);
+    APP_PRINTF("   tx: %d packets %d timeouts %dms airtime (%d.%d%% duty)\r\n",
+               macStat.txPackets, macStat.txTimeouts, macStat.txAirtimeMs,
+               macStat.txAirtimeMs / (elapsedSecs*10), (macStat.txAirtimeMs / elapsedSecs) % 10);
+    APP_PRINTF("   rx: %d packets %d invalid %d errors %d timeouts %dms listening\r\n",
+               macStat.rxPackets, macStat.rxInvalid, macStat.rxErrors, macStat.rxTimeouts, macStat.rxListenMs);
+    APP_PRINTF("  lbt: %d listens %d busy %dms listening, %d transmits %dms avg delay\r\n",
+               macStat.lbtListens, macStat.lbtBusy, macStat.lbtListenMs,
+               macStat.lbtTalks, macStat.lbtTalks ? macStat.lbtDelayMs / macStat.lbtTalks : 0);
+    APP_PRINTF("  req: %d completed %d retried %d failed %d duplicate chunks\r\n",
+               macStat.requestsCompleted, macStat.requestsRetried, macStat.requestsFailed, macStat.duplicates);
+    if (appIsGateway) {
+        APP_PRINTF("  cfg: %d syncs %d changed notes %dms\r\n",
+                   macStat.configSyncs, macStat.configNotes, macStat.configSyncMs);
+    }
+}
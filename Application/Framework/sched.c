@@ -66,7 +66,7 @@ int schedRegisterApp(schedAppConfig *appToRegister)
     newAppID = apps;
     memcpy(&newConfig[newAppID], appToRegister, sizeof(schedAppConfig));
     config = newConfig;
-    memset(&newState[newAppID], 0, sizeof(schedAppConfig));
+    memset(&newState[newAppID], 0, sizeof(schedAppState));
     state = newState;
     state[newAppID].currentState = STATE_ONCE;
     state[newAppID].completionSuccessState = STATE_UNDEFINED;
@@ -85,6 +85,22 @@ const char *schedAppName(int appID)
     return config[appID].name;
 }
 
+// Get the period at which we expect to send to the gateway, which is that of the app that is
+// activated most often, or 0 if there are no apps that are activated periodically
+uint32_t schedSendPeriodSecs()
+{
+    uint32_t periodSecs = 0;
+    for (int i=0; i<apps; i++) {
+        if (state[i].disabled || config[i].activationPeriodSecs == 0) {
+            continue;
+        }
+        if (periodSecs == 0 || config[i].activationPeriodSecs < periodSecs) {
+            periodSecs = config[i].activationPeriodSecs;
+        }
+    }
+    return periodSecs;
+}
+
 // Activate ASAP, as if from an ISR
 bool schedActivateNowFromISR(int appID, bool interruptIfActive, int nextState)
 {
@@ -155,6 +171,17 @@ bool schedIsActive(int appID)
     return state[appID].active;
 }
 
+// See if any app is currently active
+bool schedAnyActive()
+{
+    for (int i=0; i<apps; i++) {
+        if (!state[i].disabled && state[i].active) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Get the current state for an app
 int schedGetState(int appID)
 {
@@ -384,6 +411,11 @@ uint32_t schedPoll()
         }
     }
 
+    // Don't activate an app while held notes are being sent, because its request would displace them
+    if (noteBatchSending()) {
+        return now + SENSOR_BATCH_SENDING_POLL_SECS;
+    }
+
     // There are no active apps, so see what's available to activate
     while (true) {
 
@@ -67,9 +67,11 @@ void schedDispatchISR(uint16_t pins);
 void schedDispatchResponse(J *rsp);
 int schedGetState(int appID);
 void schedInit(void);
+bool schedAnyActive(void);
 bool schedIsActive(int appID);
 uint32_t schedPoll(void);
 int schedRegisterApp(schedAppConfig *sensorToRegister);
+uint32_t schedSendPeriodSecs(void);
 void schedRequestCompleted(void);
 void schedRequestResponseTimeout(void);
 void schedRequestResponseTimeoutCheck(void);
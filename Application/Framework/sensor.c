@@ -60,6 +60,13 @@ void sensorTimerStart()
         thisSleepSecs = sensorWakeupSecs;
     }
 
+    // Wake up when notes held for a batch will have been held for too long.  If they
+    // already have, they're waiting for the active app, which is polled in the meantime.
+    uint32_t batchDueSecs = noteBatchDueSecs();
+    if (batchDueSecs != 0 && batchDueSecs < thisSleepSecs) {
+        thisSleepSecs = batchDueSecs;
+    }
+
     // Schedule the timer
     if (thisSleepSecs > 1) {
         uint32_t transmitWindowDueSecs = appNextTransmitWindowDueSecs();
@@ -96,6 +103,9 @@ void sensorPoll()
     // Time-out any requests or responses that may have been pending
     schedRequestResponseTimeoutCheck();
 
+    // Complete requests that were held to be sent in a batch
+    noteBatchPoll();
+
     // Poll the scheduled app scheduler and restart the timer
     // be used in setTime
     sensorWorkDueTime = schedPoll();
@@ -0,0 +1,142 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Millisecond time synchronization between a gateway and its sensors, so that sensors
+// can transmit at the very start of their slots.  The gateway's clock is the Notecard's
+// time extended to milliseconds by the local timer, and is re-anchored to the Notecard
+// only when the two have drifted apart by TIME_SYNC_STEP_MS.  A sensor's clock is set
+// from the time that the gateway stamps into an ACK as of the moment that the sensor
+// finishes receiving it, and between syncs is corrected for the drift of the sensor's
+// timer relative to the gateway's, as estimated from the error found at each sync.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framework.h"
+
+typedef struct {
+    bool valid;
+    uint64_t epochMs;               // Epoch time at the anchor
+    uint32_t anchorMs;              // Local timer at the anchor
+    int32_t driftPpb;               // Rate of the reference's clock relative to our timer
+    uint32_t driftSamples;          // Number of syncs from which drift has been estimated
+} timeSyncClock;
+static timeSyncClock syncClock = {0};
+
+// Forwards
+static void timeSyncGatewayAnchor(void);
+
+// True if we have a millisecond clock
+bool timeSyncValid()
+{
+    if (appIsGateway) {
+        timeSyncGatewayAnchor();
+    }
+    return syncClock.valid;
+}
+
+// Get the epoch time in milliseconds at the specified value of the local timer
+uint64_t timeSyncAt(uint32_t timerMs)
+{
+    int32_t elapsedMs = (int32_t) (timerMs - syncClock.anchorMs);
+    int64_t correctionMs = ((int64_t) elapsedMs * syncClock.driftPpb) / 1000000000;
+    return syncClock.epochMs + elapsedMs + correctionMs;
+}
+
+// Get the current epoch time in milliseconds, or 0 if unknown
+uint64_t timeSyncNowMs()
+{
+    if (!timeSyncValid()) {
+        return 0;
+    }
+    return timeSyncAt((uint32_t) TIMER_IF_GetTimeMs());
+}
+
+// Get the current epoch time in seconds, falling back to the Notecard's time if unknown
+uint32_t timeSyncNowSecs()
+{
+    if (!timeSyncValid()) {
+        return NoteTimeST();
+    }
+    return (uint32_t) (timeSyncNowMs() / 1000);
+}
+
+// Number of milliseconds until the specified epoch second begins, or 0 if it has begun
+uint32_t timeSyncMsUntil(uint32_t epochSecs)
+{
+    uint64_t nowMs = timeSyncNowMs();
+    uint64_t thenMs = (uint64_t) epochSecs * 1000;
+    if (nowMs == 0 || thenMs <= nowMs) {
+        return 0;
+    }
+    return (uint32_t) (thenMs - nowMs);
+}
+
+// Set our clock from the gateway's time as of the moment that we finished receiving it, refining
+// the estimate of our drift from the error in our clock if it has been long enough since the
+// last sync for the error to be meaningful.
+void timeSyncSet(uint64_t epochMs, uint32_t receivedMs)
+{
+
+    // The first sync, or a step of the gateway's clock, says nothing about drift
+    if (syncClock.valid) {
+        int32_t elapsedMs = (int32_t) (receivedMs - syncClock.anchorMs);
+        int64_t errorMs = (int64_t) epochMs - (int64_t) timeSyncAt(receivedMs);
+        if (errorMs <= -TIME_SYNC_STEP_MS || errorMs >= TIME_SYNC_STEP_MS || elapsedMs <= 0) {
+            APP_PRINTF("timesync: clock stepped %dms\r\n", (int32_t) errorMs);
+        } else if (elapsedMs < TIME_SYNC_DRIFT_MIN_MS) {
+
+            // Too soon to measure drift, so correct the time while keeping the anchor to measure from
+            syncClock.epochMs += errorMs;
+            return;
+
+        } else {
+
+            // Estimate the drift, averaging it over successive syncs
+            int64_t samplePpb = syncClock.driftPpb + ((errorMs * 1000000000) / elapsedMs);
+            if (samplePpb > TIME_SYNC_DRIFT_MAX_PPB) {
+                samplePpb = TIME_SYNC_DRIFT_MAX_PPB;
+            }
+            if (samplePpb < -TIME_SYNC_DRIFT_MAX_PPB) {
+                samplePpb = -TIME_SYNC_DRIFT_MAX_PPB;
+            }
+            if (syncClock.driftSamples++ == 0) {
+                syncClock.driftPpb = (int32_t) samplePpb;
+            } else {
+                syncClock.driftPpb = (int32_t) (((3 * (int64_t) syncClock.driftPpb) + samplePpb) / 4);
+            }
+            APP_PRINTF("timesync: error %dms over %ds, drift %dppb\r\n",
+                       (int32_t) errorMs, elapsedMs / 1000, syncClock.driftPpb);
+
+        }
+    }
+
+    // Anchor the clock
+    syncClock.valid = true;
+    syncClock.epochMs = epochMs;
+    syncClock.anchorMs = receivedMs;
+
+}
+
+// Anchor the gateway's clock to the Notecard's time if it hasn't been, or if it has drifted
+// away from it.  Because the Notecard's time is truncated to the second, our clock is normally
+// ahead of it by less than a second.
+static void timeSyncGatewayAnchor()
+{
+    if (!NoteTimeValidST()) {
+        return;
+    }
+    uint32_t nowMs = (uint32_t) TIMER_IF_GetTimeMs();
+    uint64_t noteMs = (uint64_t) NoteTimeST() * 1000;
+    if (syncClock.valid) {
+        int64_t aheadMs = (int64_t) timeSyncAt(nowMs) - (int64_t) noteMs;
+        if (aheadMs > -TIME_SYNC_STEP_MS && aheadMs < 1000 + TIME_SYNC_STEP_MS) {
+            return;
+        }
+        APP_PRINTF("timesync: clock stepped %dms to match the notecard\r\n", (int32_t) -aheadMs);
+    }
+    syncClock.valid = true;
+    syncClock.epochMs = noteMs;
+    syncClock.anchorMs = nowMs;
+}
@@ -240,6 +240,19 @@ bool commonCmd(char *cmd)
         return true;
     }
 
+    // Display or reset MAC statistics
+    if (strcmp(cmd, "stats") == 0 || strcmp(cmd, "s") == 0) {
+        MX_DBG_Enable();
+        radioStatsShow();
+        return true;
+    }
+    if (strcmp(cmd, "stats-reset") == 0) {
+        MX_DBG_Enable();
+        radioStatsReset();
+        APP_PRINTF("STATS RESET\r\n");
+        return true;
+    }
+
     // Perform a self-test
     if (strcmp(cmd, "{\"req\":\"card.test\"}") == 0 || strcmp(cmd, "test") == 0) {
         post(POST_GPIO);
@@ -25,6 +25,48 @@ void utilHTOA8(unsigned char n, char *p)
     *p = '\0';
 }
 
+// Compute a CRC-32 (IEEE 802.3), continuing from a previous CRC or 0 to begin
+uint32_t utilCRC32(uint32_t crc, const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int bit=0; bit<8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// Value of each hex digit plus one, so that characters that aren't hex digits are zero
+static const uint8_t hexDigitValue[128] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+// Convert hex, as generated by utilAddressToText() but possibly shorter, to an address.
+// The bytes are placed at the end of the address buffer, and the number of bytes is
+// returned, or 0 if the hex isn't valid.
+uint32_t utilHexToAddress(const char *hex, uint8_t *address)
+{
+    uint32_t len = 0;
+    const uint8_t *p = (const uint8_t *) hex;
+    while (p[0] != '\0' && p[1] != '\0') {
+        uint8_t hi = (p[0] < sizeof(hexDigitValue)) ? hexDigitValue[p[0]] : 0;
+        uint8_t lo = (p[1] < sizeof(hexDigitValue)) ? hexDigitValue[p[1]] : 0;
+        if (hi == 0 || lo == 0 || len >= ADDRESS_LEN) {
+            return 0;
+        }
+        len++;
+        address[ADDRESS_LEN-len] = ((hi-1) << 4) | (lo-1);
+        p += 2;
+    }
+    return len;
+}
+
 // Convert an address to hex
 void utilAddressToText(const uint8_t *address, char *buf, uint32_t buflen)
 {
@@ -0,0 +1,175 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Software AES-256 in CTR mode, with the same API and the same results as the STM32WL's
+// AES peripheral as configured by MX_AES_Init().  The peripheral loads the key and the
+// IV a word at a time, most significant word first, so that the key that it uses is each
+// word of the caller's key taken as a little-endian integer, and the initial counter block
+// is the four IV words in big-endian order.  Data is byte-swapped (CRYP_DATATYPE_1B), so
+// that it is processed in its natural byte order, and the counter's low word increments.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+
+// Counter block used when the caller supplies no IV, as AESIV_CTR in main.c
+static const uint32_t defaultIV[4] = {0xF0F1F2F3, 0xF4F5F6F7, 0xF8F9FAFB, 0xFCFDFEFF};
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+// AES-256 expanded key: 15 round keys of 16 bytes
+typedef struct {
+    uint8_t roundKey[15][16];
+} aesSchedule;
+
+// Multiply by x in GF(2^8)
+static uint8_t xtime(uint8_t b)
+{
+    return (uint8_t) ((b << 1) ^ ((b & 0x80) ? 0x1b : 0));
+}
+
+// Expand a 256-bit key
+static void aesExpandKey(aesSchedule *ks, const uint8_t key[32])
+{
+    uint8_t *w = &ks->roundKey[0][0];
+    memcpy(w, key, 32);
+    uint8_t rcon = 1;
+    for (int i=8; i<60; i++) {
+        uint8_t t[4];
+        memcpy(t, &w[(i-1)*4], 4);
+        if ((i % 8) == 0) {
+            uint8_t first = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[first];
+            rcon = xtime(rcon);
+        } else if ((i % 8) == 4) {
+            for (int j=0; j<4; j++) {
+                t[j] = sbox[t[j]];
+            }
+        }
+        for (int j=0; j<4; j++) {
+            w[i*4+j] = w[(i-8)*4+j] ^ t[j];
+        }
+    }
+}
+
+// Encrypt a block
+static void aesEncryptBlock(const aesSchedule *ks, const uint8_t in[16], uint8_t out[16])
+{
+    uint8_t s[16];
+    for (int i=0; i<16; i++) {
+        s[i] = in[i] ^ ks->roundKey[0][i];
+    }
+    for (int round=1; round<=14; round++) {
+
+        // SubBytes and ShiftRows, in a state that is stored column by column
+        uint8_t t[16];
+        for (int c=0; c<4; c++) {
+            for (int r=0; r<4; r++) {
+                t[c*4+r] = sbox[s[((c+r)%4)*4+r]];
+            }
+        }
+
+        // MixColumns, except in the final round
+        if (round < 14) {
+            for (int c=0; c<4; c++) {
+                uint8_t *col = &t[c*4];
+                uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+                col[0] ^= all ^ xtime(a0 ^ a1);
+                col[1] ^= all ^ xtime(a1 ^ a2);
+                col[2] ^= all ^ xtime(a2 ^ a3);
+                col[3] ^= all ^ xtime(a3 ^ a0);
+            }
+        }
+
+        for (int i=0; i<16; i++) {
+            s[i] = t[i] ^ ks->roundKey[round][i];
+        }
+
+    }
+    memcpy(out, s, 16);
+}
+
+// Encrypt or decrypt, which in CTR mode are the same
+static bool aesCTR(uint8_t *key, uint32_t *iv, uint8_t *in, uint16_t len, uint8_t *out)
+{
+    if ((((uintptr_t) in) & 0x03) != 0 || (((uintptr_t) out) & 0x03) != 0) {
+        return false;
+    }
+
+    // Load the key and the counter as the peripheral does
+    uint8_t peripheralKey[32];
+    for (int i=0; i<8; i++) {
+        uint32_t word;
+        memcpy(&word, &key[i*4], sizeof(word));
+        peripheralKey[i*4+0] = (uint8_t) (word >> 24);
+        peripheralKey[i*4+1] = (uint8_t) (word >> 16);
+        peripheralKey[i*4+2] = (uint8_t) (word >> 8);
+        peripheralKey[i*4+3] = (uint8_t) word;
+    }
+    uint32_t counter[4];
+    memcpy(counter, iv == NULL ? defaultIV : iv, sizeof(counter));
+    aesSchedule ks;
+    aesExpandKey(&ks, peripheralKey);
+
+    // Generate the keystream a block at a time
+    for (uint32_t offset=0; offset<len; offset+=16) {
+        uint8_t block[16], keystream[16];
+        for (int i=0; i<4; i++) {
+            block[i*4+0] = (uint8_t) (counter[i] >> 24);
+            block[i*4+1] = (uint8_t) (counter[i] >> 16);
+            block[i*4+2] = (uint8_t) (counter[i] >> 8);
+            block[i*4+3] = (uint8_t) counter[i];
+        }
+        aesEncryptBlock(&ks, block, keystream);
+        for (uint32_t i=0; i<16 && offset+i<len; i++) {
+            out[offset+i] = in[offset+i] ^ keystream[i];
+        }
+        counter[3]++;
+    }
+
+    memset(&ks, 0, sizeof(ks));
+    memset(peripheralKey, 0, sizeof(peripheralKey));
+    return true;
+}
+
+bool MX_AES_CTR_Encrypt(uint8_t *key, uint32_t *iv, uint8_t *plaintext, uint16_t len, uint8_t *ciphertext)
+{
+    return aesCTR(key, iv, plaintext, len, ciphertext);
+}
+
+bool MX_AES_CTR_Decrypt(uint8_t *key, uint32_t *iv, uint8_t *ciphertext, uint16_t len, uint8_t *plaintext)
+{
+    return aesCTR(key, iv, ciphertext, len, plaintext);
+}
+
+void MX_AES_Init(void)
+{
+}
+
+void MX_AES_DeInit(void)
+{
+}
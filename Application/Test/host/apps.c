@@ -0,0 +1,13 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Applications scheduled on the host, where there are no sensors attached, and so only the
+// ping test app that simulates sampling a sensor is run.
+
+#include "appdefs.h"
+
+void schedAppInit()
+{
+    pingInit();
+}
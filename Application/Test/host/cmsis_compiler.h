@@ -0,0 +1,36 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the CMSIS compiler abstraction.  On the host nothing preempts the
+// firmware, because interrupts are delivered only while it is idle or delayed, and so
+// masking interrupts has nothing to do.
+
+#pragma once
+
+#include <stdint.h>
+
+#define __weak                  __attribute__((weak))
+#define __WEAK                  __attribute__((weak))
+#define __ALIGN_BEGIN
+#define __ALIGN_END             __attribute__((aligned(4)))
+#define __STATIC_INLINE         static inline
+#define __NOP()                 do { } while (0)
+
+static inline uint32_t __get_PRIMASK(void)
+{
+    return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t priMask)
+{
+    (void) priMask;
+}
+
+static inline void __disable_irq(void)
+{
+}
+
+static inline void __enable_irq(void)
+{
+}
@@ -0,0 +1,532 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-ins for the HAL, for the board support in Core/Src, and for the timer
+// interface beneath the ST timer server.  See host.h.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "main.h"
+#include "stm32_seq.h"
+#include "stm32_timer.h"
+#include "stm32_adv_trace.h"
+#include "timer_if.h"
+#include "framework.h"
+#include "host.h"
+
+// Default hooks, under which time advances only when the firmware delays or idles
+static uint64_t defaultNowMs = 0;
+static bool defaultAlarmSet = false;
+static uint64_t defaultAlarmMs = 0;
+static uint64_t defaultTimeMs(void *context);
+static void defaultDelayMs(void *context, uint32_t ms);
+static void defaultIdle(void *context);
+static void defaultAlarm(void *context, bool set, uint64_t atMs);
+static void defaultReset(void *context);
+static void defaultTrace(void *context, const char *text);
+hostHooks host = {
+    .timeMs = defaultTimeMs,
+    .delayMs = defaultDelayMs,
+    .idle = defaultIdle,
+    .alarm = defaultAlarm,
+    .reset = defaultReset,
+    .trace = defaultTrace,
+    .uid = { 0x484f5354, 0x00000001, 0x00000001 },
+};
+
+// Interrupt state
+uint32_t hostDelaysInISR = 0;
+uint32_t hostISRDepth = 0;
+
+// GPIO ports
+GPIO_TypeDef hostGPIOA, hostGPIOB, hostGPIOC, hostGPIOH;
+I2C_HandleTypeDef hi2c2;
+
+// Timer context, in ticks of a millisecond
+static uint32_t timerContext = 0;
+
+// Emulated flash
+uint32_t hostFlashBase = 0;
+jmp_buf hostPowerLoss;
+static bool flashLocked = true;
+static uint32_t flashOperations = 0;
+static uint32_t flashPowerLossCountdown = 0;
+static uint32_t flashNoise = 0x2545F491;
+
+// Pseudo-random number generator
+static uint32_t rngState = 0;
+
+// Default timer
+static uint64_t defaultTimeMs(void *context)
+{
+    return defaultNowMs;
+}
+
+// Default busy-wait
+static void defaultDelayMs(void *context, uint32_t ms)
+{
+    defaultNowMs += ms;
+}
+
+// Default sleep, which passes the time until the alarm and delivers it
+static void defaultIdle(void *context)
+{
+    if (defaultAlarmSet) {
+        if (defaultAlarmMs > defaultNowMs) {
+            defaultNowMs = defaultAlarmMs;
+        }
+        defaultAlarmSet = false;
+        hostTimerIRQ();
+    }
+}
+
+// Default alarm
+static void defaultAlarm(void *context, bool set, uint64_t atMs)
+{
+    defaultAlarmSet = set;
+    defaultAlarmMs = atMs;
+}
+
+// Default reset, for which there is no one to restart us
+static void defaultReset(void *context)
+{
+    fprintf(stderr, "host: reset requested\n");
+    abort();
+}
+
+// Default trace, shown only if requested
+static void defaultTrace(void *context, const char *text)
+{
+    if (getenv("HOST_TRACE") != NULL) {
+        fputs(text, stdout);
+    }
+}
+
+// Start the firmware, with erased flash unless flash was provided
+void hostMain()
+{
+    if (hostFlashBase == 0) {
+        hostFlashInit();
+    }
+    UTIL_TIMER_Init();
+    MX_AppMain();
+}
+
+// Timer interrupt
+void hostTimerIRQ()
+{
+    hostISRDepth++;
+    UTIL_TIMER_IRQ_Handler();
+    hostISRDepth--;
+}
+
+// Sleep until an interrupt
+void UTIL_SEQ_Idle(void)
+{
+    host.idle(host.context);
+}
+
+// Busy-wait, which can't pass time on the host while in an interrupt
+void HAL_Delay(uint32_t Delay)
+{
+    if (hostISRDepth > 0) {
+        hostDelaysInISR++;
+        return;
+    }
+    host.delayMs(host.context, Delay);
+}
+
+void MX_TIM17_DelayUs(uint32_t us)
+{
+    if (us >= 1000) {
+        HAL_Delay(us/1000);
+    }
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t) host.timeMs(host.context);
+}
+
+int64_t TIMER_IF_GetTimeMs(void)
+{
+    return (int64_t) host.timeMs(host.context);
+}
+
+// Timer interface, whose ticks are milliseconds of the host's timer
+static UTIL_TIMER_Status_t hostTimerInit(void)
+{
+    timerContext = 0;
+    return UTIL_TIMER_OK;
+}
+
+static UTIL_TIMER_Status_t hostTimerDeInit(void)
+{
+    host.alarm(host.context, false, 0);
+    return UTIL_TIMER_OK;
+}
+
+static UTIL_TIMER_Status_t hostTimerStart(uint32_t timeout)
+{
+    uint64_t nowMs = host.timeMs(host.context);
+    uint32_t elapsed = (uint32_t) nowMs - timerContext;
+    uint64_t atMs = nowMs + (timeout > elapsed ? timeout - elapsed : 0);
+    host.alarm(host.context, true, atMs);
+    return UTIL_TIMER_OK;
+}
+
+static UTIL_TIMER_Status_t hostTimerStop(void)
+{
+    host.alarm(host.context, false, 0);
+    return UTIL_TIMER_OK;
+}
+
+static uint32_t hostTimerSetContext(void)
+{
+    timerContext = (uint32_t) host.timeMs(host.context);
+    return timerContext;
+}
+
+static uint32_t hostTimerGetContext(void)
+{
+    return timerContext;
+}
+
+static uint32_t hostTimerElapsed(void)
+{
+    return (uint32_t) host.timeMs(host.context) - timerContext;
+}
+
+static uint32_t hostTimerValue(void)
+{
+    return (uint32_t) host.timeMs(host.context);
+}
+
+static uint32_t hostTimerMinimum(void)
+{
+    return 1;
+}
+
+static uint32_t hostTimerIdentity(uint32_t value)
+{
+    return value;
+}
+
+const UTIL_TIMER_Driver_s UTIL_TimerDriver = {
+    hostTimerInit,
+    hostTimerDeInit,
+    hostTimerStart,
+    hostTimerStop,
+    hostTimerSetContext,
+    hostTimerGetContext,
+    hostTimerElapsed,
+    hostTimerValue,
+    hostTimerMinimum,
+    hostTimerIdentity,
+    hostTimerIdentity,
+};
+
+// Trace
+UTIL_ADV_TRACE_Status_t UTIL_ADV_TRACE_COND_FSend(uint32_t VerboseLevel, uint32_t Region, uint32_t TimeStampState, const char *strFormat, ...)
+{
+    char text[512];
+    va_list args;
+    va_start(args, strFormat);
+    vsnprintf(text, sizeof(text), strFormat, args);
+    va_end(args);
+    host.trace(host.context, text);
+    return UTIL_ADV_TRACE_OK;
+}
+
+// Interrupt controller
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+}
+
+void NVIC_SystemReset(void)
+{
+    host.reset(host.context);
+    abort();
+}
+
+// GPIO, on which nothing external is connected
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+    uint16_t pins = (uint16_t) GPIO_Init->Pin;
+    bool output = (GPIO_Init->Mode == GPIO_MODE_OUTPUT_PP || GPIO_Init->Mode == GPIO_MODE_OUTPUT_OD);
+    GPIOx->outputs = output ? (GPIOx->outputs | pins) : (GPIOx->outputs & ~pins);
+    GPIOx->pullup = (GPIO_Init->Pull == GPIO_PULLUP) ? (GPIOx->pullup | pins) : (GPIOx->pullup & ~pins);
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin)
+{
+    GPIOx->outputs &= ~GPIO_Pin;
+    GPIOx->pullup &= ~GPIO_Pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    uint16_t level = (GPIOx->outputs & GPIOx->high) | (~GPIOx->outputs & GPIOx->pullup);
+    return ((level & GPIO_Pin) != 0) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    GPIOx->high = (PinState == GPIO_PIN_SET) ? (GPIOx->high | GPIO_Pin) : (GPIOx->high & ~GPIO_Pin);
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    GPIOx->high ^= GPIO_Pin;
+}
+
+void MX_GPIO_DeInit(void)
+{
+}
+
+// I2C, on which no device ever responds
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    return HAL_ERROR;
+}
+
+void MX_I2C2_Init(void)
+{
+}
+
+void MX_I2C2_DeInit(void)
+{
+}
+
+bool MY_I2C2_Ping(uint16_t i2cAddress, uint32_t timeoutMs, uint32_t attempts)
+{
+    return false;
+}
+
+bool MY_I2C2_ReadRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t maxdatalen, uint32_t timeoutMs)
+{
+    return false;
+}
+
+bool MY_I2C2_WriteRegister(uint16_t i2cAddress, uint8_t Reg, void *data, uint16_t datalen, uint32_t timeoutMs)
+{
+    return false;
+}
+
+// Identity
+uint32_t HAL_GetUIDw0(void)
+{
+    return host.uid[0];
+}
+
+uint32_t HAL_GetUIDw1(void)
+{
+    return host.uid[1];
+}
+
+uint32_t HAL_GetUIDw2(void)
+{
+    return host.uid[2];
+}
+
+// Random numbers, which are reproducible for a given device and entropy
+void MX_RNG_Init(void)
+{
+}
+
+void MX_RNG_DeInit(void)
+{
+}
+
+uint32_t MX_RNG_Get(void)
+{
+    if (rngState == 0) {
+        rngState = (host.uid[0] ^ (host.uid[1] * 2654435761U) ^ (host.uid[2] * 40503U) ^ host.entropy) | 1;
+    }
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// Board
+double MX_ADC_A0_Voltage(void)
+{
+    return 3.3;
+}
+
+uint32_t MX_Image_Size(void)
+{
+    return 0;
+}
+
+uint32_t MX_Heap_Size(uint8_t **base)
+{
+    if (base != NULL) {
+        *base = NULL;
+    }
+    return 0;
+}
+
+void MY_ActivePeripherals(char *buf, uint32_t buflen)
+{
+    if (buflen > 0) {
+        *buf = '\0';
+    }
+}
+
+// Debug console, which never has input
+void MX_DBG_Enable(void)
+{
+}
+
+void MX_DBG_Disable(void)
+{
+}
+
+bool MX_DBG_Enabled(void)
+{
+    return true;
+}
+
+bool MX_DBG_Active(void)
+{
+    return false;
+}
+
+bool MX_DBG_Available(void)
+{
+    return false;
+}
+
+uint8_t MX_DBG_Receive(bool *underrun, bool *overrun)
+{
+    if (underrun != NULL) {
+        *underrun = true;
+    }
+    if (overrun != NULL) {
+        *overrun = false;
+    }
+    return 0;
+}
+
+// Map erased flash below 4GB, where the firmware's 32-bit addresses can reach it
+void hostFlashInit()
+{
+    if (hostFlashBase == 0) {
+        void *flash = mmap(NULL, FLASH_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_32BIT, -1, 0);
+        if (flash == MAP_FAILED) {
+            perror("host: can't map flash");
+            abort();
+        }
+        hostFlashBase = (uint32_t) (uintptr_t) flash;
+    }
+    memset((void *) (uintptr_t) hostFlashBase, 0xFF, FLASH_SIZE);
+    flashLocked = true;
+    flashOperations = 0;
+    flashPowerLossCountdown = 0;
+}
+
+// Arm a power loss during the specified flash operation from now, or disarm if 0
+void hostFlashPowerLossAfter(uint32_t operations)
+{
+    flashPowerLossCountdown = operations;
+}
+
+// Number of flash operations performed
+uint32_t hostFlashOperations()
+{
+    return flashOperations;
+}
+
+// Noise with which an interrupted operation leaves the bits it had yet to change
+static uint64_t flashNoiseBits()
+{
+    uint64_t bits = 0;
+    for (int i=0; i<2; i++) {
+        flashNoise ^= flashNoise << 13;
+        flashNoise ^= flashNoise >> 17;
+        flashNoise ^= flashNoise << 5;
+        bits = (bits << 32) | flashNoise;
+    }
+    return bits;
+}
+
+// Count an operation, returning true if power is lost during it
+static bool flashPowerLost()
+{
+    flashOperations++;
+    return (flashPowerLossCountdown != 0 && --flashPowerLossCountdown == 0);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    flashLocked = false;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    flashLocked = true;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+    if (flashLocked || TypeProgram != FLASH_TYPEPROGRAM_DOUBLEWORD) {
+        return HAL_ERROR;
+    }
+    if ((Address & 7) != 0 || Address < hostFlashBase || Address+8 > hostFlashBase+FLASH_SIZE) {
+        return HAL_ERROR;
+    }
+    uint64_t *dw = (uint64_t *) (uintptr_t) Address;
+    if (*dw != 0xFFFFFFFFFFFFFFFFULL && Data != 0) {
+        return HAL_ERROR;
+    }
+    if (flashPowerLost()) {
+        *dw &= Data | flashNoiseBits();
+        longjmp(hostPowerLoss, 1);
+    }
+    *dw &= Data;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError)
+{
+    *PageError = 0xFFFFFFFFU;
+    if (flashLocked || pEraseInit->TypeErase != FLASH_TYPEERASE_PAGES) {
+        return HAL_ERROR;
+    }
+    if (pEraseInit->Page + pEraseInit->NbPages > FLASH_PAGE_NB) {
+        *PageError = pEraseInit->Page;
+        return HAL_ERROR;
+    }
+    for (uint32_t i=0; i<pEraseInit->NbPages; i++) {
+        uint64_t *page = (uint64_t *) (uintptr_t) (hostFlashBase + (pEraseInit->Page+i)*FLASH_PAGE_SIZE);
+        if (flashPowerLost()) {
+            for (uint32_t j=0; j<FLASH_PAGE_SIZE/sizeof(uint64_t); j++) {
+                page[j] |= flashNoiseBits();
+            }
+            longjmp(hostPowerLoss, 1);
+        }
+        memset(page, 0xFF, FLASH_PAGE_SIZE);
+    }
+    return HAL_OK;
+}
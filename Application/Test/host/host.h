@@ -0,0 +1,65 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host harness, in which the firmware runs unmodified against stand-ins for the hardware.
+// Everything that the firmware would get from the hardware is obtained through the hooks
+// below.  By default, time is virtual and advances only when the firmware delays, there is
+// no Notecard, and the radio is silent, which is what unit tests want.  The simulator
+// replaces the hooks so as to run many nodes against a virtual clock and a shared channel.
+
+#pragma once
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    void *context;                                      // Passed back to every hook
+    uint64_t (*timeMs)(void *context);                  // The node's timer
+    uint64_t (*epochMs)(void *context);                 // Notecard's time, or 0 if unknown
+    void (*delayMs)(void *context, uint32_t ms);        // Busy-wait
+    void (*idle)(void *context);                        // Sleep until an interrupt
+    void (*alarm)(void *context, bool set, uint64_t atMs);
+    void (*reset)(void *context);                       // Never returns
+    void (*trace)(void *context, const char *text);
+    char *(*notecard)(void *context, const char *req);  // NULL if there is no Notecard
+    void (*radioTx)(void *context, const uint8_t *payload, uint8_t size, uint8_t sf, int8_t power, uint32_t airtimeMs);
+    void (*radioRx)(void *context, uint8_t sf, uint32_t timeoutMs);   // 0 to listen until received
+    void (*radioCad)(void *context, uint8_t sf, uint32_t durationMs);
+    void (*radioSleep)(void *context);                  // Abandons any I/O in progress
+    uint32_t uid[3];                                    // Device unique ID
+    uint32_t entropy;                                   // Mixed into random numbers, which the
+                                                        // true RNG makes differ on every boot
+} hostHooks;
+extern hostHooks host;
+
+// Interrupts, which the driver of the harness delivers while the firmware is idle or delaying
+void hostTimerIRQ(void);
+void hostRadioTxDone(void);
+void hostRadioRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+void hostRadioRxTimeout(void);
+void hostRadioRxError(void);
+void hostRadioCadDone(bool channelActivityDetected);
+
+// Start the firmware as it would be started on reset
+void hostMain(void);
+
+// Emulated flash, which behaves as NOR flash does: programming can only clear bits, and
+// only a doubleword that is erased may be programmed.  If a power loss is armed, power is
+// lost partway through the flash operation that it counts down to, leaving that operation
+// partially done, and control returns to the setjmp() of hostPowerLoss.
+void hostFlashInit(void);
+void hostFlashPowerLossAfter(uint32_t operations);
+uint32_t hostFlashOperations(void);
+extern jmp_buf hostPowerLoss;
+
+// Retention RAM, which the firmware places in the .noinit section, and which the host
+// neither initializes at startup nor clears on reset, as on the target
+extern uint8_t hostRetentionStart[];
+extern uint8_t hostRetentionEnd[];
+
+// Depth of interrupts being delivered, and the number of times that the firmware delayed
+// within one, which the host can't do because it passes time only between interrupts
+extern uint32_t hostISRDepth;
+extern uint32_t hostDelaysInISR;
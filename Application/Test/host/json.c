@@ -0,0 +1,744 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host implementation of the J JSON API of note-c, so that the firmware's JSON handling
+// runs unmodified on the host.  Output is unformatted, as it is from note-c.
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "note.h"
+
+// Parser state
+typedef struct {
+    const char *p;
+    bool err;
+} jsonCursor;
+
+// Output buffer
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} jsonOutput;
+
+// Forwards
+static J *parseValue(jsonCursor *c, int depth);
+static bool printValue(jsonOutput *o, const J *item);
+
+// Allocate memory
+void *JMalloc(size_t size)
+{
+    return malloc(size);
+}
+
+// Free memory
+void JFree(void *p)
+{
+    free(p);
+}
+
+// Duplicate a string
+static char *jstrdup(const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = JMalloc(len+1);
+    if (copy != NULL) {
+        memcpy(copy, s, len+1);
+    }
+    return copy;
+}
+
+// Allocate a null-terminated copy of a buffer
+char *JAllocString(uint8_t *buffer, uint32_t len)
+{
+    char *s = JMalloc(len+1);
+    if (s != NULL) {
+        memcpy(s, buffer, len);
+        s[len] = '\0';
+    }
+    return s;
+}
+
+// Create an item of the specified type
+static J *newItem(int type)
+{
+    J *item = JMalloc(sizeof(J));
+    if (item != NULL) {
+        memset(item, 0, sizeof(J));
+        item->type = type;
+    }
+    return item;
+}
+
+J *JCreateObject()
+{
+    return newItem(JObject);
+}
+
+J *JCreateArray()
+{
+    return newItem(JArray);
+}
+
+J *JCreateNull()
+{
+    return newItem(JNULL);
+}
+
+J *JCreateBool(bool value)
+{
+    return newItem(value ? JTrue : JFalse);
+}
+
+J *JCreateNumber(JNUMBER number)
+{
+    J *item = newItem(JNumber);
+    if (item != NULL) {
+        item->valuenumber = number;
+        if (number >= (JNUMBER) INT64_MAX) {
+            item->valueint = INT64_MAX;
+        } else if (number <= (JNUMBER) INT64_MIN) {
+            item->valueint = INT64_MIN;
+        } else {
+            item->valueint = (JINTEGER) number;
+        }
+    }
+    return item;
+}
+
+J *JCreateString(const char *string)
+{
+    J *item = newItem(JString);
+    if (item != NULL) {
+        item->valuestring = jstrdup(string == NULL ? "" : string);
+        if (item->valuestring == NULL) {
+            JFree(item);
+            return NULL;
+        }
+    }
+    return item;
+}
+
+// Delete an item and everything beneath it, along with its siblings that follow it
+static void deleteChain(J *item)
+{
+    while (item != NULL) {
+        J *next = item->next;
+        deleteChain(item->child);
+        JFree(item->valuestring);
+        JFree(item->string);
+        JFree(item);
+        item = next;
+    }
+}
+
+// Delete an item that is not attached to a parent
+void JDelete(J *item)
+{
+    if (item == NULL) {
+        return;
+    }
+    item->next = NULL;
+    deleteChain(item);
+}
+
+// Append an item to the children of an object or array
+void JAddItemToArray(J *array, J *item)
+{
+    if (array == NULL || item == NULL) {
+        return;
+    }
+    item->next = NULL;
+    item->prev = NULL;
+    J *child = array->child;
+    if (child == NULL) {
+        array->child = item;
+        return;
+    }
+    while (child->next != NULL) {
+        child = child->next;
+    }
+    child->next = item;
+    item->prev = child;
+}
+
+// Add a named item to an object
+void JAddItemToObject(J *object, const char *name, J *item)
+{
+    if (object == NULL || name == NULL || item == NULL) {
+        return;
+    }
+    char *key = jstrdup(name);
+    if (key == NULL) {
+        return;
+    }
+    JFree(item->string);
+    item->string = key;
+    JAddItemToArray(object, item);
+}
+
+J *JAddStringToObject(J *object, const char *name, const char *string)
+{
+    J *item = JCreateString(string);
+    JAddItemToObject(object, name, item);
+    return item;
+}
+
+J *JAddNumberToObject(J *object, const char *name, JNUMBER number)
+{
+    J *item = JCreateNumber(number);
+    JAddItemToObject(object, name, item);
+    return item;
+}
+
+J *JAddBoolToObject(J *object, const char *name, bool value)
+{
+    J *item = JCreateBool(value);
+    JAddItemToObject(object, name, item);
+    return item;
+}
+
+// Unlink a child from its parent
+static J *detach(J *parent, J *item)
+{
+    if (parent == NULL || item == NULL) {
+        return NULL;
+    }
+    if (item->prev != NULL) {
+        item->prev->next = item->next;
+    }
+    if (item->next != NULL) {
+        item->next->prev = item->prev;
+    }
+    if (item == parent->child) {
+        parent->child = item->next;
+    }
+    item->prev = NULL;
+    item->next = NULL;
+    return item;
+}
+
+J *JGetObjectItem(const J *object, const char *name)
+{
+    if (object == NULL || name == NULL) {
+        return NULL;
+    }
+    for (J *item = object->child; item != NULL; item = item->next) {
+        if (item->string != NULL && strcmp(item->string, name) == 0) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+J *JDetachItemFromObject(J *object, const char *name)
+{
+    return detach(object, JGetObjectItem(object, name));
+}
+
+void JDeleteItemFromObject(J *object, const char *name)
+{
+    JDelete(JDetachItemFromObject(object, name));
+}
+
+J *JGetArrayItem(const J *array, int which)
+{
+    if (array == NULL || which < 0) {
+        return NULL;
+    }
+    J *item = array->child;
+    while (item != NULL && which-- > 0) {
+        item = item->next;
+    }
+    return item;
+}
+
+J *JDetachItemFromArray(J *array, int which)
+{
+    return detach(array, JGetArrayItem(array, which));
+}
+
+int JGetArraySize(const J *array)
+{
+    int size = 0;
+    if (array != NULL) {
+        for (J *item = array->child; item != NULL; item = item->next) {
+            size++;
+        }
+    }
+    return size;
+}
+
+J *JGetObject(J *object, const char *name)
+{
+    J *item = JGetObjectItem(object, name);
+    return (item != NULL && item->type == JObject) ? item : NULL;
+}
+
+J *JGetArray(J *object, const char *name)
+{
+    J *item = JGetObjectItem(object, name);
+    return (item != NULL && item->type == JArray) ? item : NULL;
+}
+
+char *JGetString(J *object, const char *name)
+{
+    J *item = JGetObjectItem(object, name);
+    if (item == NULL || item->type != JString || item->valuestring == NULL) {
+        return (char *) "";
+    }
+    return item->valuestring;
+}
+
+JNUMBER JGetNumber(J *object, const char *name)
+{
+    return JNumberValue(JGetObjectItem(object, name));
+}
+
+JINTEGER JGetInt(J *object, const char *name)
+{
+    J *item = JGetObjectItem(object, name);
+    if (item == NULL) {
+        return 0;
+    }
+    if (item->type == JNumber) {
+        return item->valueint;
+    }
+    if (item->type == JString) {
+        return JAtoI(item->valuestring);
+    }
+    return 0;
+}
+
+bool JGetBool(J *object, const char *name)
+{
+    J *item = JGetObjectItem(object, name);
+    return (item != NULL && item->type == JTrue);
+}
+
+bool JIsPresent(J *object, const char *name)
+{
+    return (JGetObjectItem(object, name) != NULL);
+}
+
+const char *JGetItemName(const J *item)
+{
+    return (item == NULL || item->string == NULL) ? "" : item->string;
+}
+
+char *JStringValue(J *item)
+{
+    if (item == NULL || item->type != JString || item->valuestring == NULL) {
+        return (char *) "";
+    }
+    return item->valuestring;
+}
+
+JNUMBER JNumberValue(J *item)
+{
+    if (item == NULL) {
+        return 0;
+    }
+    if (item->type == JNumber) {
+        return item->valuenumber;
+    }
+    if (item->type == JString) {
+        return atof(item->valuestring);
+    }
+    return 0;
+}
+
+long int JAtoI(const char *string)
+{
+    return (string == NULL) ? 0 : strtol(string, NULL, 10);
+}
+
+char *JItoA(long int n, char *s)
+{
+    sprintf(s, "%ld", n);
+    return s;
+}
+
+// Append to the output
+static bool put(jsonOutput *o, const char *s, size_t len)
+{
+    if (o->len + len + 1 > o->size) {
+        size_t size = (o->size == 0) ? 64 : o->size;
+        while (o->len + len + 1 > size) {
+            size *= 2;
+        }
+        char *buf = realloc(o->buf, size);
+        if (buf == NULL) {
+            return false;
+        }
+        o->buf = buf;
+        o->size = size;
+    }
+    memcpy(o->buf + o->len, s, len);
+    o->len += len;
+    o->buf[o->len] = '\0';
+    return true;
+}
+
+// Output a quoted string
+static bool printString(jsonOutput *o, const char *s)
+{
+    if (!put(o, "\"", 1)) {
+        return false;
+    }
+    for (; *s != '\0'; s++) {
+        char esc[8];
+        unsigned char ch = (unsigned char) *s;
+        switch (ch) {
+        case '"':
+            strcpy(esc, "\\\"");
+            break;
+        case '\\':
+            strcpy(esc, "\\\\");
+            break;
+        case '\n':
+            strcpy(esc, "\\n");
+            break;
+        case '\r':
+            strcpy(esc, "\\r");
+            break;
+        case '\t':
+            strcpy(esc, "\\t");
+            break;
+        default:
+            if (ch < 0x20) {
+                snprintf(esc, sizeof(esc), "\\u%04x", ch);
+            } else {
+                esc[0] = ch;
+                esc[1] = '\0';
+            }
+            break;
+        }
+        if (!put(o, esc, strlen(esc))) {
+            return false;
+        }
+    }
+    return put(o, "\"", 1);
+}
+
+// Output a number, as an integer if it is one
+static bool printNumber(jsonOutput *o, JNUMBER n)
+{
+    char buf[40];
+    if (isnan(n) || isinf(n)) {
+        strcpy(buf, "null");
+    } else if (n == floor(n) && fabs(n) < 1e15) {
+        snprintf(buf, sizeof(buf), "%lld", (long long) n);
+    } else {
+        snprintf(buf, sizeof(buf), "%.15g", n);
+        if (strtod(buf, NULL) != n) {
+            snprintf(buf, sizeof(buf), "%.17g", n);
+        }
+    }
+    return put(o, buf, strlen(buf));
+}
+
+// Output a value
+static bool printValue(jsonOutput *o, const J *item)
+{
+    switch (item->type) {
+    case JNULL:
+        return put(o, "null", 4);
+    case JFalse:
+        return put(o, "false", 5);
+    case JTrue:
+        return put(o, "true", 4);
+    case JNumber:
+        return printNumber(o, item->valuenumber);
+    case JString:
+        return printString(o, item->valuestring == NULL ? "" : item->valuestring);
+    case JArray:
+    case JObject: {
+        bool object = (item->type == JObject);
+        if (!put(o, object ? "{" : "[", 1)) {
+            return false;
+        }
+        for (J *child = item->child; child != NULL; child = child->next) {
+            if (child != item->child && !put(o, ",", 1)) {
+                return false;
+            }
+            if (object) {
+                if (!printString(o, child->string == NULL ? "" : child->string) || !put(o, ":", 1)) {
+                    return false;
+                }
+            }
+            if (!printValue(o, child)) {
+                return false;
+            }
+        }
+        return put(o, object ? "}" : "]", 1);
+    }
+    }
+    return false;
+}
+
+// Convert to an unformatted JSON string, which the caller must free
+char *JConvertToJSONString(J *item)
+{
+    if (item == NULL) {
+        return NULL;
+    }
+    jsonOutput o = {0};
+    if (!printValue(&o, item)) {
+        JFree(o.buf);
+        return NULL;
+    }
+    return o.buf;
+}
+
+// Skip whitespace
+static void skip(jsonCursor *c)
+{
+    while (*c->p != '\0' && isspace((unsigned char) *c->p)) {
+        c->p++;
+    }
+}
+
+// Parse four hex digits
+static bool parseHex4(const char *p, unsigned *value)
+{
+    *value = 0;
+    for (int i=0; i<4; i++) {
+        char ch = p[i];
+        *value <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            *value |= ch - '0';
+        } else if (ch >= 'a' && ch <= 'f') {
+            *value |= ch - 'a' + 10;
+        } else if (ch >= 'A' && ch <= 'F') {
+            *value |= ch - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse a quoted string, returning an allocated copy of it
+static char *parseString(jsonCursor *c)
+{
+    if (*c->p != '"') {
+        c->err = true;
+        return NULL;
+    }
+    c->p++;
+    jsonOutput o = {0};
+    put(&o, "", 0);
+    while (*c->p != '"') {
+        char ch = *c->p;
+        if (ch == '\0') {
+            c->err = true;
+            JFree(o.buf);
+            return NULL;
+        }
+        c->p++;
+        if (ch != '\\') {
+            put(&o, &ch, 1);
+            continue;
+        }
+        char esc = *c->p++;
+        switch (esc) {
+        case 'b':
+            ch = '\b';
+            break;
+        case 'f':
+            ch = '\f';
+            break;
+        case 'n':
+            ch = '\n';
+            break;
+        case 'r':
+            ch = '\r';
+            break;
+        case 't':
+            ch = '\t';
+            break;
+        case 'u': {
+            unsigned code;
+            if (!parseHex4(c->p, &code)) {
+                c->err = true;
+                JFree(o.buf);
+                return NULL;
+            }
+            c->p += 4;
+            char utf8[4];
+            size_t len;
+            if (code < 0x80) {
+                utf8[0] = code;
+                len = 1;
+            } else if (code < 0x800) {
+                utf8[0] = 0xC0 | (code >> 6);
+                utf8[1] = 0x80 | (code & 0x3F);
+                len = 2;
+            } else {
+                utf8[0] = 0xE0 | (code >> 12);
+                utf8[1] = 0x80 | ((code >> 6) & 0x3F);
+                utf8[2] = 0x80 | (code & 0x3F);
+                len = 3;
+            }
+            put(&o, utf8, len);
+            continue;
+        }
+        case '\0':
+            c->err = true;
+            JFree(o.buf);
+            return NULL;
+        default:
+            ch = esc;
+            break;
+        }
+        put(&o, &ch, 1);
+    }
+    c->p++;
+    return o.buf;
+}
+
+// Parse the members of an object or the elements of an array
+static J *parseContainer(jsonCursor *c, int depth, bool object)
+{
+    J *item = object ? JCreateObject() : JCreateArray();
+    if (item == NULL) {
+        c->err = true;
+        return NULL;
+    }
+    char close = object ? '}' : ']';
+    c->p++;
+    skip(c);
+    if (*c->p == close) {
+        c->p++;
+        return item;
+    }
+    while (!c->err) {
+        skip(c);
+        char *key = NULL;
+        if (object) {
+            key = parseString(c);
+            skip(c);
+            if (c->err || *c->p != ':') {
+                c->err = true;
+                JFree(key);
+                break;
+            }
+            c->p++;
+        }
+        J *child = parseValue(c, depth+1);
+        if (child == NULL) {
+            JFree(key);
+            break;
+        }
+        if (object) {
+            child->string = key;
+        }
+        JAddItemToArray(item, child);
+        skip(c);
+        if (*c->p == ',') {
+            c->p++;
+            continue;
+        }
+        if (*c->p == close) {
+            c->p++;
+            return item;
+        }
+        c->err = true;
+    }
+    JDelete(item);
+    return NULL;
+}
+
+// Parse a value
+static J *parseValue(jsonCursor *c, int depth)
+{
+    skip(c);
+    if (depth > 64) {
+        c->err = true;
+        return NULL;
+    }
+    switch (*c->p) {
+    case '{':
+        return parseContainer(c, depth, true);
+    case '[':
+        return parseContainer(c, depth, false);
+    case '"': {
+        char *s = parseString(c);
+        if (s == NULL) {
+            return NULL;
+        }
+        J *item = newItem(JString);
+        if (item == NULL) {
+            JFree(s);
+            c->err = true;
+            return NULL;
+        }
+        item->valuestring = s;
+        return item;
+    }
+    }
+    if (strncmp(c->p, "null", 4) == 0) {
+        c->p += 4;
+        return JCreateNull();
+    }
+    if (strncmp(c->p, "true", 4) == 0) {
+        c->p += 4;
+        return JCreateBool(true);
+    }
+    if (strncmp(c->p, "false", 5) == 0) {
+        c->p += 5;
+        return JCreateBool(false);
+    }
+    char *end;
+    double n = strtod(c->p, &end);
+    if (end == c->p) {
+        c->err = true;
+        return NULL;
+    }
+    c->p = end;
+    return JCreateNumber(n);
+}
+
+// Parse a JSON string
+J *JConvertFromJSONString(const char *json)
+{
+    if (json == NULL) {
+        return NULL;
+    }
+    jsonCursor c = { .p = json, .err = false };
+    J *item = parseValue(&c, 0);
+    skip(&c);
+    if (item == NULL || c.err || *c.p != '\0') {
+        JDelete(item);
+        return NULL;
+    }
+    return item;
+}
+
+// Bounded string copy, as provided by note-c where the C library lacks it
+size_t strlcpy(char *dst, const char *src, size_t siz)
+{
+    size_t len = strlen(src);
+    if (siz != 0) {
+        size_t n = (len >= siz) ? siz-1 : len;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+// Bounded string concatenation, as provided by note-c where the C library lacks it
+size_t strlcat(char *dst, const char *src, size_t siz)
+{
+    size_t dlen = strnlen(dst, siz);
+    if (dlen == siz) {
+        return siz + strlen(src);
+    }
+    return dlen + strlcpy(dst + dlen, src, siz - dlen);
+}
@@ -0,0 +1,124 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the subset of the note-c API that the firmware uses.  The J functions
+// are a complete JSON implementation (json.c), and the Note functions talk to an emulated
+// Notecard (notecard.c) whose behavior is supplied through host.h.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef double JNUMBER;
+typedef long long int JINTEGER;
+typedef unsigned long int JTIME;
+
+typedef struct J {
+    struct J *next;
+    struct J *prev;
+    struct J *child;
+    int type;
+    char *valuestring;
+    JINTEGER valueint;
+    JNUMBER valuenumber;
+    char *string;
+} J;
+
+#define JInvalid                0
+#define JFalse                  (1 << 0)
+#define JTrue                   (1 << 1)
+#define JNULL                   (1 << 2)
+#define JNumber                 (1 << 3)
+#define JString                 (1 << 4)
+#define JArray                  (1 << 5)
+#define JObject                 (1 << 6)
+#define JRaw                    (1 << 7)
+
+#define JObjectForEach(element, array) \
+    for (element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
+#define JArrayForEach(element, array)   JObjectForEach(element, array)
+
+// Template field types
+#define TBOOL                   true
+#define TINT8                   11
+#define TINT16                  12
+#define TINT24                  13
+#define TINT32                  14
+#define TINT64                  18
+#define TUINT8                  21
+#define TUINT16                 22
+#define TUINT24                 23
+#define TUINT32                 24
+#define TFLOAT16                12.1
+#define TFLOAT32                14.1
+#define TFLOAT64                18.1
+#define TSTRING(N)              #N
+
+#define NOTE_I2C_ADDR_DEFAULT   0
+#define NOTE_I2C_MAX_DEFAULT    0
+
+// JSON
+J *JCreateObject(void);
+J *JCreateArray(void);
+J *JCreateNumber(JNUMBER number);
+J *JCreateString(const char *string);
+J *JCreateBool(bool value);
+J *JCreateNull(void);
+void JDelete(J *item);
+void *JMalloc(size_t size);
+void JFree(void *p);
+char *JAllocString(uint8_t *buffer, uint32_t len);
+char *JConvertToJSONString(J *item);
+J *JConvertFromJSONString(const char *json);
+J *JAddStringToObject(J *object, const char *name, const char *string);
+J *JAddNumberToObject(J *object, const char *name, JNUMBER number);
+J *JAddBoolToObject(J *object, const char *name, bool value);
+void JAddItemToObject(J *object, const char *name, J *item);
+void JAddItemToArray(J *array, J *item);
+J *JDetachItemFromObject(J *object, const char *name);
+J *JDetachItemFromArray(J *array, int which);
+void JDeleteItemFromObject(J *object, const char *name);
+J *JGetObjectItem(const J *object, const char *name);
+J *JGetObject(J *object, const char *name);
+J *JGetArray(J *object, const char *name);
+char *JGetString(J *object, const char *name);
+JNUMBER JGetNumber(J *object, const char *name);
+JINTEGER JGetInt(J *object, const char *name);
+bool JGetBool(J *object, const char *name);
+bool JIsPresent(J *object, const char *name);
+const char *JGetItemName(const J *item);
+char *JStringValue(J *item);
+JNUMBER JNumberValue(J *item);
+int JGetArraySize(const J *array);
+J *JGetArrayItem(const J *array, int which);
+long int JAtoI(const char *string);
+char *JItoA(long int n, char *s);
+size_t strlcpy(char *dst, const char *src, size_t siz);
+size_t strlcat(char *dst, const char *src, size_t siz);
+
+// Notecard
+J *NoteNewRequest(const char *request);
+J *NoteNewCommand(const char *request);
+bool NoteRequest(J *req);
+J *NoteRequestResponse(J *req);
+void NoteDeleteResponse(J *rsp);
+bool NoteResponseError(J *rsp);
+bool NoteResponseErrorContains(J *rsp, const char *errstr);
+bool NoteReset(void);
+uint32_t NoteMemAvailable(void);
+void NoteSuspendTransactionDebug(void);
+void NoteResumeTransactionDebug(void);
+bool NoteSetEnvDefaultInt(const char *variable, JINTEGER defaultVal);
+JTIME NoteTimeST(void);
+bool NoteTimeValidST(void);
+void NoteTimeSet(JTIME secondsUTC, int offset, char *zone, char *country, char *area);
+bool NoteRegion(char **retCountry, char **retArea, char **retZone, int *retZoneOffset);
+void NoteSetFn(void *mallocfn, void *freefn, void *delayfn, void *millisfn);
+void NoteSetFnMutex(void *lockI2Cfn, void *unlockI2Cfn, void *lockNotefn, void *unlockNotefn);
+void NoteSetFnI2C(uint32_t i2caddr, uint32_t i2cmax, void *resetfn, void *transmitfn, void *receivefn);
+void NoteSetFnDisabled(void);
+void NoteSetFnDebugOutput(void *fn);
+
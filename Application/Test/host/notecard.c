@@ -0,0 +1,192 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the Notecard API of note-c.  Requests are serialized and handed to
+// the host, which plays the part of the Notecard; if it doesn't, there is no Notecard,
+// and the node is a sensor.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "note.h"
+#include "host.h"
+
+// Create a request
+J *NoteNewRequest(const char *request)
+{
+    J *req = JCreateObject();
+    if (req != NULL) {
+        JAddStringToObject(req, "req", request);
+    }
+    return req;
+}
+
+// Create a command, to which there is no response
+J *NoteNewCommand(const char *request)
+{
+    J *req = JCreateObject();
+    if (req != NULL) {
+        JAddStringToObject(req, "cmd", request);
+    }
+    return req;
+}
+
+// Perform a request, returning the response
+J *NoteRequestResponse(J *req)
+{
+    if (req == NULL) {
+        return NULL;
+    }
+    if (host.notecard == NULL) {
+        JDelete(req);
+        return NULL;
+    }
+    char *json = JConvertToJSONString(req);
+    JDelete(req);
+    if (json == NULL) {
+        return NULL;
+    }
+    char *response = host.notecard(host.context, json);
+    JFree(json);
+    if (response == NULL) {
+        return NULL;
+    }
+    J *rsp = JConvertFromJSONString(response);
+    free(response);
+    return rsp;
+}
+
+// Perform a request, returning true if it succeeded
+bool NoteRequest(J *req)
+{
+    J *rsp = NoteRequestResponse(req);
+    if (rsp == NULL) {
+        return false;
+    }
+    bool success = !NoteResponseError(rsp);
+    NoteDeleteResponse(rsp);
+    return success;
+}
+
+void NoteDeleteResponse(J *rsp)
+{
+    JDelete(rsp);
+}
+
+bool NoteResponseError(J *rsp)
+{
+    return JIsPresent(rsp, "err");
+}
+
+bool NoteResponseErrorContains(J *rsp, const char *errstr)
+{
+    return (strstr(JGetString(rsp, "err"), errstr) != NULL);
+}
+
+// The Notecard is present if the host is playing its part
+bool NoteReset()
+{
+    return (host.notecard != NULL);
+}
+
+uint32_t NoteMemAvailable()
+{
+    return 0;
+}
+
+void NoteSuspendTransactionDebug()
+{
+}
+
+void NoteResumeTransactionDebug()
+{
+}
+
+bool NoteSetEnvDefaultInt(const char *variable, JINTEGER defaultVal)
+{
+    J *req = NoteNewRequest("env.default");
+    if (req == NULL) {
+        return false;
+    }
+    char text[32];
+    JAddStringToObject(req, "name", variable);
+    JAddStringToObject(req, "text", JItoA((long int) defaultVal, text));
+    return NoteRequest(req);
+}
+
+// Time, which the Notecard knows to the second, or which has been set from the gateway's
+// time as note-c does when there is no Notecard
+static JTIME timeBaseSecs = 0;
+static uint64_t timeBaseMs = 0;
+static int timeZoneOffsetMins = 0;
+static char timeZone[16] = {0};
+
+JTIME NoteTimeST()
+{
+    if (host.epochMs != NULL) {
+        return (JTIME) (host.epochMs(host.context) / 1000);
+    }
+    if (timeBaseSecs == 0) {
+        return 0;
+    }
+    return timeBaseSecs + (JTIME) ((host.timeMs(host.context) - timeBaseMs) / 1000);
+}
+
+bool NoteTimeValidST()
+{
+    return (NoteTimeST() != 0);
+}
+
+void NoteTimeSet(JTIME secondsUTC, int offset, char *zone, char *country, char *area)
+{
+    timeBaseSecs = secondsUTC;
+    timeBaseMs = host.timeMs(host.context);
+    timeZoneOffsetMins = offset;
+    strlcpy(timeZone, zone != NULL ? zone : "", sizeof(timeZone));
+}
+
+bool NoteRegion(char **retCountry, char **retArea, char **retZone, int *retZoneOffset)
+{
+    bool notecard = (host.epochMs != NULL);
+    if (retCountry != NULL) {
+        *retCountry = (char *) (notecard ? "US" : "");
+    }
+    if (retArea != NULL) {
+        *retArea = (char *) (notecard ? "Massachusetts" : "");
+    }
+    if (retZone != NULL) {
+        *retZone = notecard ? (char *) "EST" : timeZone;
+    }
+    if (retZoneOffset != NULL) {
+        *retZoneOffset = notecard ? -300 : timeZoneOffsetMins;
+    }
+    return NoteTimeValidST();
+}
+
+// Hooks to the platform, which the host doesn't need
+void NoteSetFn(void *mallocfn, void *freefn, void *delayfn, void *millisfn)
+{
+}
+
+void NoteSetFnMutex(void *lockI2Cfn, void *unlockI2Cfn, void *lockNotefn, void *unlockNotefn)
+{
+}
+
+void NoteSetFnI2C(uint32_t i2caddr, uint32_t i2cmax, void *resetfn, void *transmitfn, void *receivefn)
+{
+}
+
+void NoteSetFnDisabled()
+{
+}
+
+void NoteSetFnDebugOutput(void *fn)
+{
+}
+
+// Firmware updates, which the emulated Notecard never has (dfu.c is not built on the host)
+bool noteFirmwareUpdateIfAvailable()
+{
+    return false;
+}
@@ -0,0 +1,218 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the SubGHz_Phy radio driver.  The radio's configuration is kept here,
+// and each operation is handed to the host with the spreading factor, power, and timing
+// that the channel needs to model it.  Time-on-air is computed exactly as the driver does.
+
+#include <stddef.h>
+
+#include "radio.h"
+#include "radio_driver.h"
+#include "host.h"
+
+// Wakeup time, as RBI_GetWakeUpTime() plus RADIO_WAKEUP_TIME in the driver
+#define HOST_RADIO_WAKEUP_MS    13
+
+// Radio state
+static RadioEvents_t *events = NULL;
+static uint8_t radioSF = 12;
+static uint32_t radioBandwidth = 1;
+static int8_t radioPower = 0;
+static uint8_t radioCodingRate = 1;
+static uint16_t radioPreambleLen = 8;
+static bool radioFixLen = false;
+static bool radioCrcOn = true;
+static uint8_t cadSymbols = 4;
+
+// Bandwidth in Hz of a LoRa bandwidth index
+static uint32_t bandwidthHz(uint32_t bandwidth)
+{
+    switch (bandwidth) {
+    case 0:
+        return 125000;
+    case 1:
+        return 250000;
+    case 2:
+        return 500000;
+    }
+    return 125000;
+}
+
+static void hostRadioInit(RadioEvents_t *radioEvents)
+{
+    events = radioEvents;
+}
+
+static void hostRadioDeInit(void)
+{
+    if (host.radioSleep != NULL) {
+        host.radioSleep(host.context);
+    }
+}
+
+static void hostRadioSetChannel(uint32_t freq)
+{
+}
+
+static void hostRadioSetRxConfig(RadioModems_t modem, uint32_t bandwidth,
+                                 uint32_t datarate, uint8_t coderate,
+                                 uint32_t bandwidthAfc, uint16_t preambleLen,
+                                 uint16_t symbTimeout, bool fixLen,
+                                 uint8_t payloadLen,
+                                 bool crcOn, bool freqHopOn, uint8_t hopPeriod,
+                                 bool iqInverted, bool rxContinuous)
+{
+    if (modem == MODEM_LORA) {
+        radioBandwidth = bandwidth;
+        radioSF = (uint8_t) datarate;
+    }
+}
+
+static void hostRadioSetTxConfig(RadioModems_t modem, int8_t power, uint32_t fdev,
+                                 uint32_t bandwidth, uint32_t datarate,
+                                 uint8_t coderate, uint16_t preambleLen,
+                                 bool fixLen, bool crcOn, bool freqHopOn,
+                                 uint8_t hopPeriod, bool iqInverted, uint32_t timeout)
+{
+    if (modem == MODEM_LORA) {
+        radioPower = power;
+        radioBandwidth = bandwidth;
+        radioSF = (uint8_t) datarate;
+        radioCodingRate = coderate;
+        radioPreambleLen = preambleLen;
+        radioFixLen = fixLen;
+        radioCrcOn = crcOn;
+    }
+}
+
+static void hostRadioSetMaxPayloadLength(RadioModems_t modem, uint8_t max)
+{
+}
+
+// Time-on-air in milliseconds, as computed by RadioGetLoRaTimeOnAirNumerator()
+static uint32_t hostRadioTimeOnAir(RadioModems_t modem, uint32_t bandwidth,
+                                   uint32_t datarate, uint8_t coderate,
+                                   uint16_t preambleLen, bool fixLen, uint8_t payloadLen,
+                                   bool crcOn)
+{
+    int32_t sf = (int32_t) datarate;
+    int32_t crDenom = coderate + 4;
+    bool lowDatarateOptimize = ((bandwidth == 0 && (sf == 11 || sf == 12)) || (bandwidth == 1 && sf == 12));
+    int32_t ceilNumerator = (payloadLen << 3) + (crcOn ? 16 : 0) - (4 * sf) + (fixLen ? 0 : 20);
+    int32_t ceilDenominator;
+    if (sf <= 6) {
+        ceilDenominator = 4 * sf;
+    } else {
+        ceilNumerator += 8;
+        ceilDenominator = lowDatarateOptimize ? 4 * (sf - 2) : 4 * sf;
+    }
+    if (ceilNumerator < 0) {
+        ceilNumerator = 0;
+    }
+    int32_t intermediate = ((ceilNumerator + ceilDenominator - 1) / ceilDenominator) * crDenom + preambleLen + 12;
+    if (sf <= 6) {
+        intermediate += 2;
+    }
+    uint32_t numerator = (uint32_t) ((4 * intermediate + 1) * (1 << (sf - 2)));
+    uint32_t denominator = bandwidthHz(bandwidth);
+    return (numerator * 1000 + denominator - 1) / denominator;
+}
+
+static void hostRadioSend(uint8_t *buffer, uint8_t size)
+{
+    uint32_t airtimeMs = hostRadioTimeOnAir(MODEM_LORA, radioBandwidth, radioSF, radioCodingRate,
+                                            radioPreambleLen, radioFixLen, size, radioCrcOn);
+    if (host.radioTx != NULL) {
+        host.radioTx(host.context, buffer, size, radioSF, radioPower, airtimeMs);
+    }
+}
+
+static void hostRadioSleep(void)
+{
+    if (host.radioSleep != NULL) {
+        host.radioSleep(host.context);
+    }
+}
+
+static void hostRadioRx(uint32_t timeout)
+{
+    if (host.radioRx != NULL) {
+        host.radioRx(host.context, radioSF, timeout);
+    }
+}
+
+// Channel activity detection takes the configured number of symbols plus about one more
+// symbol in which to process them
+static void hostRadioStartCad(void)
+{
+    uint32_t symbolUs = (uint32_t) (((uint64_t) 1000000 << radioSF) / bandwidthHz(radioBandwidth));
+    uint32_t durationMs = ((cadSymbols + 1) * symbolUs + 999) / 1000;
+    if (host.radioCad != NULL) {
+        host.radioCad(host.context, radioSF, durationMs);
+    }
+}
+
+static uint32_t hostRadioGetWakeupTime(void)
+{
+    return HOST_RADIO_WAKEUP_MS;
+}
+
+const struct Radio_s Radio = {
+    .Init = hostRadioInit,
+    .SetChannel = hostRadioSetChannel,
+    .SetRxConfig = hostRadioSetRxConfig,
+    .SetTxConfig = hostRadioSetTxConfig,
+    .TimeOnAir = hostRadioTimeOnAir,
+    .Send = hostRadioSend,
+    .Sleep = hostRadioSleep,
+    .Standby = hostRadioSleep,
+    .Rx = hostRadioRx,
+    .StartCad = hostRadioStartCad,
+    .SetMaxPayloadLength = hostRadioSetMaxPayloadLength,
+    .GetWakeupTime = hostRadioGetWakeupTime,
+    .DeInit = hostRadioDeInit,
+    .DeepSleep = hostRadioSleep,
+};
+
+void SUBGRF_SetCadParams(RadioLoRaCadSymbols_t cadSymbolNum, uint8_t cadDetPeak, uint8_t cadDetMin, RadioCadExitModes_t cadExitMode, uint32_t cadTimeout)
+{
+    cadSymbols = (uint8_t) (1 << cadSymbolNum);
+}
+
+// Radio interrupts
+void hostRadioTxDone()
+{
+    hostISRDepth++;
+    events->TxDone();
+    hostISRDepth--;
+}
+
+void hostRadioRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+{
+    hostISRDepth++;
+    events->RxDone(payload, size, rssi, snr);
+    hostISRDepth--;
+}
+
+void hostRadioRxTimeout()
+{
+    hostISRDepth++;
+    events->RxTimeout();
+    hostISRDepth--;
+}
+
+void hostRadioRxError()
+{
+    hostISRDepth++;
+    events->RxError();
+    hostISRDepth--;
+}
+
+void hostRadioCadDone(bool channelActivityDetected)
+{
+    hostISRDepth++;
+    events->CadDone(channelActivityDetected);
+    hostISRDepth--;
+}
@@ -0,0 +1,149 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the subset of the STM32WL HAL that the firmware uses.  GPIOs,
+// interrupts, and I2C are inert.  Flash is emulated in host memory mapped below 4GB,
+// because the firmware addresses flash with 32-bit integers; see host.h.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmsis_compiler.h"
+
+typedef enum {
+    HAL_OK       = 0x00,
+    HAL_ERROR    = 0x01,
+    HAL_BUSY     = 0x02,
+    HAL_TIMEOUT  = 0x03
+} HAL_StatusTypeDef;
+
+// Peripheral handles, which the host never looks inside
+typedef struct {
+    int unused;
+} RTC_HandleTypeDef, SUBGHZ_HandleTypeDef, UART_HandleTypeDef, DMA_HandleTypeDef, I2C_HandleTypeDef;
+
+// Interrupts
+typedef enum {
+    EXTI0_IRQn,
+    EXTI1_IRQn,
+    EXTI2_IRQn,
+    EXTI3_IRQn,
+    EXTI4_IRQn,
+    EXTI9_5_IRQn,
+    EXTI15_10_IRQn,
+} IRQn_Type;
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+void NVIC_SystemReset(void);
+
+// GPIO
+typedef struct {
+    uint16_t outputs;               // Pins configured as outputs
+    uint16_t high;                  // Outputs driven high
+    uint16_t pullup;                // Inputs pulled up
+} GPIO_TypeDef;
+extern GPIO_TypeDef hostGPIOA, hostGPIOB, hostGPIOC, hostGPIOH;
+#define GPIOA                   (&hostGPIOA)
+#define GPIOB                   (&hostGPIOB)
+#define GPIOC                   (&hostGPIOC)
+#define GPIOH                   (&hostGPIOH)
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+#define GPIO_PIN_0              0x0001U
+#define GPIO_PIN_1              0x0002U
+#define GPIO_PIN_2              0x0004U
+#define GPIO_PIN_3              0x0008U
+#define GPIO_PIN_4              0x0010U
+#define GPIO_PIN_5              0x0020U
+#define GPIO_PIN_6              0x0040U
+#define GPIO_PIN_7              0x0080U
+#define GPIO_PIN_8              0x0100U
+#define GPIO_PIN_9              0x0200U
+#define GPIO_PIN_10             0x0400U
+#define GPIO_PIN_11             0x0800U
+#define GPIO_PIN_12             0x1000U
+#define GPIO_PIN_13             0x2000U
+#define GPIO_PIN_14             0x4000U
+#define GPIO_PIN_15             0x8000U
+#define GPIO_PIN_All            0xFFFFU
+#define GPIO_MODE_INPUT         0x00000000U
+#define GPIO_MODE_OUTPUT_PP     0x00000001U
+#define GPIO_MODE_OUTPUT_OD     0x00000011U
+#define GPIO_MODE_AF_PP         0x00000002U
+#define GPIO_MODE_AF_OD         0x00000012U
+#define GPIO_MODE_ANALOG        0x00000003U
+#define GPIO_MODE_IT_RISING     0x10110000U
+#define GPIO_MODE_IT_FALLING    0x10210000U
+#define GPIO_MODE_IT_RISING_FALLING 0x10310000U
+#define GPIO_NOPULL             0x00000000U
+#define GPIO_PULLUP             0x00000001U
+#define GPIO_PULLDOWN           0x00000002U
+#define GPIO_SPEED_FREQ_LOW     0x00000000U
+#define GPIO_SPEED_FREQ_MEDIUM  0x00000001U
+#define GPIO_SPEED_FREQ_HIGH    0x00000002U
+#define GPIO_SPEED_FREQ_VERY_HIGH 0x00000003U
+#define GPIO_AF4_I2C2           0x04U
+#define GPIO_AF5_SPI1           0x05U
+#define GPIO_AF7_USART1         0x07U
+#define GPIO_AF7_USART2         0x07U
+#define GPIO_AF8_LPUART1        0x08U
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+// I2C, on which no device ever responds
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+
+// Time and identity
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+uint32_t HAL_GetUIDw0(void);
+uint32_t HAL_GetUIDw1(void);
+uint32_t HAL_GetUIDw2(void);
+
+// Flash
+extern uint32_t hostFlashBase;
+#define FLASH_BASE              hostFlashBase
+#define FLASH_SIZE              0x00040000U
+#define FLASH_PAGE_SIZE         0x00000800U
+#define FLASH_PAGE_NB           (FLASH_SIZE/FLASH_PAGE_SIZE)
+#define FLASH_TYPEERASE_PAGES   0x00U
+#define FLASH_TYPEERASE_MASSERASE 0x04U
+#define FLASH_TYPEPROGRAM_DOUBLEWORD 0x01U
+#define FLASH_FLAG_EOP          0x00000001U
+#define FLASH_FLAG_OPERR        0x00000002U
+#define FLASH_FLAG_PROGERR      0x00000008U
+#define FLASH_FLAG_WRPERR       0x00000010U
+#define FLASH_FLAG_PGAERR       0x00000020U
+#define FLASH_FLAG_SIZERR       0x00000040U
+#define FLASH_FLAG_PGSERR       0x00000080U
+#define FLASH_FLAG_OPTVERR      0x00008000U
+#define FLASH_FLAG_ALL_ERRORS   0x0000C3FAU
+#define __HAL_FLASH_CLEAR_FLAG(flags) do { (void) (flags); } while (0)
+typedef struct {
+    uint32_t TypeErase;
+    uint32_t Page;
+    uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
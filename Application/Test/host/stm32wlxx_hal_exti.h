@@ -0,0 +1,9 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the STM32WL EXTI HAL, whose definitions the firmware doesn't use
+
+#pragma once
+
+#include "stm32wlxx_hal.h"
@@ -0,0 +1,39 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Host stand-in for the STM32WL GPIO low-layer driver, as used to probe pin modes
+
+#pragma once
+
+#include "stm32wlxx_hal.h"
+
+#define LL_GPIO_PIN_0               GPIO_PIN_0
+#define LL_GPIO_MODE_INPUT          0x00000000U
+#define LL_GPIO_MODE_OUTPUT         0x00000001U
+#define LL_GPIO_MODE_ALTERNATE      0x00000002U
+#define LL_GPIO_MODE_ANALOG         0x00000003U
+#define LL_GPIO_PULL_NO             0x00000000U
+#define LL_GPIO_PULL_UP             0x00000001U
+#define LL_GPIO_PULL_DOWN           0x00000002U
+#define LL_GPIO_OUTPUT_PUSHPULL     0x00000000U
+#define LL_GPIO_OUTPUT_OPENDRAIN    0x00000001U
+
+static inline uint32_t LL_GPIO_GetPinMode(GPIO_TypeDef *GPIOx, uint32_t Pin)
+{
+    (void) GPIOx;
+    (void) Pin;
+    return LL_GPIO_MODE_ANALOG;
+}
+
+static inline uint32_t LL_GPIO_GetPinPull(GPIO_TypeDef *GPIOx, uint32_t Pin)
+{
+    return ((GPIOx->pullup & Pin) != 0) ? LL_GPIO_PULL_UP : LL_GPIO_PULL_NO;
+}
+
+static inline uint32_t LL_GPIO_GetPinOutputType(GPIO_TypeDef *GPIOx, uint32_t Pin)
+{
+    (void) GPIOx;
+    (void) Pin;
+    return LL_GPIO_OUTPUT_PUSHPULL;
+}
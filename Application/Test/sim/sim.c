@@ -0,0 +1,1484 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Discrete-event simulator of a cluster of gateways and sensors sharing a channel, each
+// running the unmodified firmware against a virtual clock.  Every node loads its own copy
+// of the firmware module, so that it has its own globals, and runs as a coroutine that
+// yields whenever the firmware delays or idles.  Interrupts (timer alarms and radio
+// completions) are delivered between yields, as they would preempt the firmware.
+//
+// The channel model places each gateway's sensors at random within a disk around it, with
+// the gateways spaced apart along a line, and uses log-distance path loss with fixed
+// per-link shadowing.  A receiver locks onto a packet whose preamble it hears with
+// enough SNR for the spreading factor, and loses it if another packet on that spreading
+// factor overlaps it without being at least SIM_CAPTURE_DB weaker.  Channel activity
+// detection finds any decodable packet on its spreading factor that overlaps it.
+//
+// Each gateway has an emulated Notecard.  Sensors run the ping app, and the notes that it
+// adds are counted as they reach the Notecard, so that loss can be measured end to end.
+// A sensor's count restarts when it reboots, so notes are matched to boots by their time.
+// The nonce of every packet sent is checked to have never before been used by its sender.
+//
+// A reset keeps a node's flash and its retention RAM, as on the target, so that a sensor's
+// outbox survives it.  The gateways can be switched off for a while, to measure how well
+// the sensors' outboxes carry notes across the outage.
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "framework.h"
+#include "host.h"
+
+// Channel model
+#define SIM_PATH_LOSS_1M_DB         40.0    // Free-space loss at 1m at 915MHz
+#define SIM_PATH_LOSS_EXPONENT      3.0     // Suburban/indoor
+#define SIM_SHADOWING_DB            4.0     // Standard deviation of per-link shadowing
+#define SIM_NOISE_FLOOR_DBM         -114.0  // Thermal noise in 250kHz plus a 6dB noise figure
+#define SIM_CAPTURE_DB              6.0     // A packet survives interference this much weaker
+#define SIM_PREAMBLE_SYMBOLS        12      // Preamble plus sync, within which a receiver can lock
+
+// Radio supply current in mA at 3.3V, from the STM32WL datasheet, for energy accounting
+#define SIM_RX_MA                   4.82
+#define SIM_SUPPLY_V                3.3
+
+// Node and event limits
+#define SIM_STACK_BYTES             (512*1024)
+#define SIM_MAX_PAYLOAD             256
+
+typedef enum {
+    NODE_BOOTING,
+    NODE_RUNNING,
+    NODE_DELAYING,
+    NODE_IDLE,
+    NODE_RESETTING,
+    NODE_OFF,
+} nodeState;
+
+typedef enum {
+    RADIO_SLEEP,
+    RADIO_TX,
+    RADIO_RX,
+    RADIO_CAD,
+} radioMode;
+
+typedef enum {
+    EVENT_BOOT,
+    EVENT_WAKE,
+    EVENT_ALARM,
+    EVENT_TX_END,
+    EVENT_RX_TIMEOUT,
+    EVENT_CAD_END,
+    EVENT_POWER_OFF,
+    EVENT_POWER_ON,
+} eventType;
+
+// A transmission on the channel
+typedef struct simTx {
+    struct simNode *sender;
+    uint64_t id;
+    uint64_t startMs;
+    uint64_t endMs;
+    uint8_t sf;
+    int8_t power;
+    uint8_t size;
+    uint8_t payload[SIM_MAX_PAYLOAD];
+    bool received;
+} simTx;
+
+// A note stored in the emulated Notecard
+typedef struct simNote {
+    struct simNote *next;
+    char *key;
+    char *body;
+} simNote;
+
+// Notes delivered from one boot of a sensor, indexed by the count that the ping app puts
+// into them, which restarts when the sensor reboots
+typedef struct {
+    char *sensor;
+    uint32_t boot;
+    uint32_t maxCount;
+    uint32_t delivered;
+    uint32_t duplicates;
+    uint8_t *seen;
+    uint32_t seenBytes;
+} simSensorNotes;
+
+typedef struct simNode {
+    int index;
+    bool gateway;
+    struct simNode *home;           // A sensor's gateway
+    double x, y;
+    uint32_t uid[3];
+    uint8_t address[ADDRESS_LEN];
+    char id[ADDRESS_LEN*2+1];       // Address as the gateway names the sensor's notefiles
+    uint8_t key[AES_KEY_BYTES];
+    int32_t driftPpm;
+    uint32_t localOffsetMs;
+
+    // Firmware
+    void *module;
+    hostHooks *hooks;
+    void (*main)(void);
+    void (*timerIRQ)(void);
+    void (*txDone)(void);
+    void (*rxDone)(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
+    void (*rxTimeout)(void);
+    void (*rxError)(void);
+    void (*cadDone)(bool channelActivityDetected);
+    macStats *macStat;
+    uint32_t *delaysInISR;
+    uint8_t *flash;
+    uint8_t *retention;
+    size_t retentionBytes;
+    bool provisioned;
+
+    // Execution
+    nodeState state;
+    ucontext_t context;
+    void *stack;
+    uint64_t bootAtMs;
+    uint64_t wakeToken;
+    uint64_t alarmToken;
+    uint64_t bootToken;
+    uint32_t boots;
+    uint32_t *bootEpochSecs;        // Time of each boot, by which notes are matched to boots
+    char trace[512];
+    size_t traceLen;
+
+    // Radio
+    radioMode mode;
+    uint64_t modeSinceMs;
+    uint64_t radioToken;
+    uint8_t sf;
+    int8_t power;
+    uint64_t lockedTx;              // Transmission being received, or 0
+    uint64_t cadStartMs;
+
+    // Energy, in mA*ms
+    double txCharge;
+    double rxCharge;
+    double cadCharge;
+    uint64_t rxMs;
+    uint64_t cadMs;
+
+    // Nonces sent, to detect reuse of a keystream across packets or across reboots
+    uint32_t *nonceSalts;
+    uint32_t nonceSaltCount;
+    uint32_t nonceSequence;
+
+    // Statistics accumulated across reboots
+    macStats mac;
+    uint32_t delaysInISRTotal;
+
+    // Emulated Notecard
+    simNote *notes[256];
+    uint32_t notesAdded;
+} simNode;
+
+typedef struct {
+    uint64_t atMs;
+    uint64_t seq;
+    eventType type;
+    simNode *node;
+    uint64_t token;
+} simEvent;
+
+// Configuration
+static uint32_t optSensors = 20;
+static uint32_t optGateways = 0;
+static double optDays = 1.0;
+static uint32_t optSeed = 1;
+static double optRadiusM = 300.0;
+static double optSpacingM = 2000.0;
+static int32_t optDriftPpm = 20;
+static double optDeployMins = 60.0;
+static double optMaxLossPercent = 100.0;
+static uint64_t optMaxDuplicates = UINT64_MAX;
+static double optOutageAtHours = 0;
+static double optOutageHours = 0;
+static int optTraceNode = -2;
+static const char *optFirmware = NULL;
+static const char *optLabel = "";
+
+// Simulation state
+static uint64_t nowMs = 0;
+static uint64_t endMs = 0;
+static const uint64_t epochBaseMs = 1700000000000ULL;
+static simNode *nodes = NULL;
+static uint32_t nodeCount = 0;
+static ucontext_t coordinator;
+static simNode *starting = NULL;
+static simNode *inISR = NULL;
+static jmp_buf isrEscape;
+static uint8_t *firmwareImage = NULL;
+static size_t firmwareImageBytes = 0;
+static uint32_t moduleLoads = 0;
+
+// Event queue, a binary heap ordered by time and then by order of scheduling
+static simEvent *heap = NULL;
+static size_t heapCount = 0;
+static size_t heapSize = 0;
+static uint64_t eventSeq = 0;
+
+// Transmissions that may still overlap a reception
+static simTx **txs = NULL;
+static size_t txCount = 0;
+static size_t txSize = 0;
+static uint64_t txNextID = 1;
+
+// Pairwise path loss
+static float *pathLoss = NULL;
+
+// Statistics
+static uint64_t statPackets = 0;
+static uint64_t statAirtimeMs = 0;
+static uint64_t statDeliveredAirtimeMs = 0;
+static uint64_t statCollisions = 0;
+static uint64_t statAborted = 0;
+static uint64_t statNonces = 0;
+static uint64_t statNonceReuses = 0;
+static uint64_t statLegacyPackets = 0;
+static simSensorNotes *sensorNotes = NULL;
+static uint32_t sensorNotesCount = 0;
+
+// Pseudo-random numbers
+static uint64_t rngState = 0;
+static uint64_t rng()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+static double rngUniform()
+{
+    return (double) (rng() >> 11) / (double) (1ULL << 53);
+}
+static double rngNormal()
+{
+    double u1 = rngUniform(), u2 = rngUniform();
+    if (u1 < 1e-12) {
+        u1 = 1e-12;
+    }
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// Fatal error
+static void fatal(const char *msg, const char *detail)
+{
+    fprintf(stderr, "sim: %s%s%s\n", msg, detail ? ": " : "", detail ? detail : "");
+    exit(2);
+}
+
+// Schedule an event
+static void schedule(uint64_t atMs, eventType type, simNode *node, uint64_t token)
+{
+    if (heapCount == heapSize) {
+        heapSize = heapSize ? heapSize*2 : 1024;
+        heap = realloc(heap, heapSize * sizeof(simEvent));
+        if (heap == NULL) {
+            fatal("out of memory", NULL);
+        }
+    }
+    simEvent e = { .atMs = atMs < nowMs ? nowMs : atMs, .seq = eventSeq++, .type = type, .node = node, .token = token };
+    size_t i = heapCount++;
+    while (i > 0) {
+        size_t parent = (i-1)/2;
+        if (heap[parent].atMs < e.atMs || (heap[parent].atMs == e.atMs && heap[parent].seq < e.seq)) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = e;
+}
+
+// Remove the earliest event
+static simEvent unschedule()
+{
+    simEvent top = heap[0];
+    simEvent last = heap[--heapCount];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2*i+1;
+        if (child >= heapCount) {
+            break;
+        }
+        if (child+1 < heapCount && (heap[child+1].atMs < heap[child].atMs
+                                    || (heap[child+1].atMs == heap[child].atMs && heap[child+1].seq < heap[child].seq))) {
+            child++;
+        }
+        if (last.atMs < heap[child].atMs || (last.atMs == heap[child].atMs && last.seq < heap[child].seq)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heapCount > 0) {
+        heap[i] = last;
+    }
+    return top;
+}
+
+// A node's timer at the specified simulation time, which runs fast or slow by its drift
+static uint64_t localAt(simNode *n, uint64_t atMs)
+{
+    int64_t elapsed = (atMs > n->bootAtMs) ? (int64_t) (atMs - n->bootAtMs) : 0;
+    return n->localOffsetMs + elapsed + (elapsed * n->driftPpm) / 1000000;
+}
+
+// The simulation time at which a node's timer reaches the specified value
+static uint64_t globalAt(simNode *n, uint64_t localMs)
+{
+    if (localMs <= n->localOffsetMs) {
+        return n->bootAtMs;
+    }
+    double elapsed = (double) (localMs - n->localOffsetMs) * 1000000.0 / (1000000.0 + n->driftPpm);
+    uint64_t atMs = n->bootAtMs + (uint64_t) elapsed;
+    while (localAt(n, atMs) < localMs) {
+        atMs++;
+    }
+    while (atMs > n->bootAtMs && localAt(n, atMs-1) >= localMs) {
+        atMs--;
+    }
+    return atMs;
+}
+
+// Received signal strength of a transmission at a node
+static double rssiAt(simTx *tx, simNode *receiver)
+{
+    return tx->power - pathLoss[tx->sender->index * nodeCount + receiver->index];
+}
+
+// Lowest SNR at which a spreading factor can be demodulated
+static double demodulationSNR(uint8_t sf)
+{
+    return -7.5 - 2.5 * (sf - 7);
+}
+
+// True if a transmission can be heard by a node
+static bool decodable(simTx *tx, simNode *receiver)
+{
+    return (rssiAt(tx, receiver) - SIM_NOISE_FLOOR_DBM >= demodulationSNR(tx->sf));
+}
+
+// Duration of the preamble, during which a receiver can still lock onto a packet
+static uint64_t preambleMs(uint8_t sf)
+{
+    return ((uint64_t) SIM_PREAMBLE_SYMBOLS * 1000 << sf) / 250000;
+}
+
+// Transmit current at a power level, for the low-power PA up to 14dBm and high-power above
+static double txMilliamps(int8_t power)
+{
+    if (power <= 10) {
+        return 11.0;
+    }
+    if (power <= 14) {
+        return 15.0;
+    }
+    if (power <= 17) {
+        return 58.0;
+    }
+    if (power <= 20) {
+        return 87.0;
+    }
+    return 118.0;
+}
+
+// Find a transmission by ID
+static simTx *txFind(uint64_t id)
+{
+    for (size_t i=0; i<txCount; i++) {
+        if (txs[i]->id == id) {
+            return txs[i];
+        }
+    }
+    return NULL;
+}
+
+// Change the radio mode, accounting for the energy of the mode that is ending.  A transmission
+// that is abandoned is cut short, and can't be received.
+static void radioSetMode(simNode *n, radioMode mode)
+{
+    uint64_t ms = nowMs - n->modeSinceMs;
+    switch (n->mode) {
+    case RADIO_TX:
+        n->txCharge += ms * txMilliamps(n->power);
+        simTx *tx = txFind(n->lockedTx);
+        if (tx != NULL && nowMs < tx->endMs) {
+            statAborted++;
+            statAirtimeMs -= tx->endMs - nowMs;
+            tx->endMs = nowMs;
+            for (uint32_t i=0; i<nodeCount; i++) {
+                if (nodes[i].lockedTx == tx->id) {
+                    nodes[i].lockedTx = 0;
+                }
+            }
+        }
+        break;
+    case RADIO_RX:
+        n->rxCharge += ms * SIM_RX_MA;
+        n->rxMs += ms;
+        break;
+    case RADIO_CAD:
+        n->cadCharge += ms * SIM_RX_MA;
+        n->cadMs += ms;
+        break;
+    case RADIO_SLEEP:
+        break;
+    }
+    n->mode = mode;
+    n->modeSinceMs = nowMs;
+    n->lockedTx = 0;
+    n->radioToken++;
+}
+
+// Discard transmissions that ended before any reception still in progress could have begun
+static void txPrune()
+{
+    uint64_t keepAfterMs = (nowMs > 60000) ? nowMs - 60000 : 0;
+    size_t kept = 0;
+    for (size_t i=0; i<txCount; i++) {
+        if (txs[i]->endMs >= keepAfterMs) {
+            txs[kept++] = txs[i];
+        } else {
+            free(txs[i]);
+        }
+    }
+    txCount = kept;
+}
+
+// Deliver an interrupt to a node, resuming it if it was waiting for one
+static void nodeResume(simNode *n);
+static void nodeReboot(simNode *n);
+static void deliverISR(simNode *n, void (*isr)(simNode *n, void *arg), void *arg)
+{
+    inISR = n;
+    if (setjmp(isrEscape) == 0) {
+        isr(n, arg);
+        inISR = NULL;
+    } else {
+        inISR = NULL;
+        nodeReboot(n);
+        return;
+    }
+    if (n->state == NODE_IDLE) {
+        nodeResume(n);
+    }
+}
+
+static void isrTimer(simNode *n, void *arg)
+{
+    n->timerIRQ();
+}
+
+static void isrTxDone(simNode *n, void *arg)
+{
+    n->txDone();
+}
+
+static void isrRxDone(simNode *n, void *arg)
+{
+    simTx *tx = arg;
+    double rssi = rssiAt(tx, n);
+    double snr = rssi - SIM_NOISE_FLOOR_DBM;
+    if (snr > 20) {
+        snr = 20;
+    }
+    n->rxDone(tx->payload, tx->size, (int16_t) lround(rssi), (int8_t) lround(snr));
+}
+
+static void isrRxTimeout(simNode *n, void *arg)
+{
+    n->rxTimeout();
+}
+
+static void isrRxError(simNode *n, void *arg)
+{
+    n->rxError();
+}
+
+static void isrCadDone(simNode *n, void *arg)
+{
+    n->cadDone(*(bool *) arg);
+}
+
+// Hooks, through which the firmware reaches the simulation
+static uint64_t hookTimeMs(void *context)
+{
+    return localAt(context, nowMs);
+}
+
+static uint64_t hookEpochMs(void *context)
+{
+    return epochBaseMs + nowMs;
+}
+
+static void hookDelayMs(void *context, uint32_t ms)
+{
+    simNode *n = context;
+    n->state = NODE_DELAYING;
+    schedule(globalAt(n, localAt(n, nowMs) + ms), EVENT_WAKE, n, ++n->wakeToken);
+    swapcontext(&n->context, &coordinator);
+}
+
+static void hookIdle(void *context)
+{
+    simNode *n = context;
+    n->state = NODE_IDLE;
+    swapcontext(&n->context, &coordinator);
+}
+
+static void hookAlarm(void *context, bool set, uint64_t atMs)
+{
+    simNode *n = context;
+    n->alarmToken++;
+    if (set) {
+        schedule(globalAt(n, atMs), EVENT_ALARM, n, n->alarmToken);
+    }
+}
+
+static void hookReset(void *context)
+{
+    simNode *n = context;
+    if (inISR == n) {
+        longjmp(isrEscape, 1);
+    }
+    n->state = NODE_RESETTING;
+    swapcontext(&n->context, &coordinator);
+}
+
+static void hookTrace(void *context, const char *text)
+{
+    simNode *n = context;
+    bool show = (optTraceNode == -1 || optTraceNode == n->index);
+    for (const char *p = text; *p != '\0'; p++) {
+        if (*p == '\r') {
+            continue;
+        }
+        if (*p == '\n' || n->traceLen == sizeof(n->trace)-1) {
+            n->trace[n->traceLen] = '\0';
+            if (show) {
+                printf("%10.3f %c%-3d %s\n", nowMs / 1000.0, n->gateway ? 'G' : 'S', n->index, n->trace);
+            }
+            n->traceLen = 0;
+            continue;
+        }
+        n->trace[n->traceLen++] = *p;
+    }
+}
+
+// Check that a packet's nonce was never used before by its sender, which within a boot means
+// that its sequence increases, and across boots that its salt is new
+static void nonceCheck(simNode *n, const uint8_t *payload, uint8_t size)
+{
+    wireMessageCarrier carrier;
+    if (size < offsetof(wireMessageCarrier, Message)) {
+        return;
+    }
+    memcpy(&carrier, payload, offsetof(wireMessageCarrier, Message));
+    if (carrier.Version < MESSAGE_VERSION_NONCE) {
+        statLegacyPackets++;
+        return;
+    }
+    statNonces++;
+    if (n->nonceSaltCount != 0 && n->nonceSalts[n->nonceSaltCount-1] == carrier.Nonce.Salt) {
+        if (carrier.Nonce.Sequence <= n->nonceSequence) {
+            statNonceReuses++;
+        }
+        n->nonceSequence = carrier.Nonce.Sequence;
+        return;
+    }
+    for (uint32_t i=0; i<n->nonceSaltCount; i++) {
+        if (n->nonceSalts[i] == carrier.Nonce.Salt) {
+            statNonceReuses++;
+        }
+    }
+    n->nonceSalts = realloc(n->nonceSalts, (n->nonceSaltCount+1) * sizeof(uint32_t));
+    if (n->nonceSalts == NULL) {
+        fatal("out of memory", NULL);
+    }
+    n->nonceSalts[n->nonceSaltCount++] = carrier.Nonce.Salt;
+    n->nonceSequence = carrier.Nonce.Sequence;
+}
+
+static void hookRadioTx(void *context, const uint8_t *payload, uint8_t size, uint8_t sf, int8_t power, uint32_t airtimeMs)
+{
+    simNode *n = context;
+    radioSetMode(n, RADIO_TX);
+    n->sf = sf;
+    n->power = power;
+    simTx *tx = malloc(sizeof(simTx));
+    if (tx == NULL) {
+        fatal("out of memory", NULL);
+    }
+    tx->sender = n;
+    tx->id = txNextID++;
+    tx->startMs = nowMs;
+    tx->endMs = nowMs + airtimeMs;
+    tx->sf = sf;
+    tx->power = power;
+    tx->size = size;
+    tx->received = false;
+    memcpy(tx->payload, payload, size);
+    if (txCount == txSize) {
+        txSize = txSize ? txSize*2 : 64;
+        txs = realloc(txs, txSize * sizeof(simTx *));
+        if (txs == NULL) {
+            fatal("out of memory", NULL);
+        }
+    }
+    txs[txCount++] = tx;
+    statPackets++;
+    statAirtimeMs += airtimeMs;
+    nonceCheck(n, payload, size);
+    n->lockedTx = tx->id;
+    schedule(tx->endMs, EVENT_TX_END, n, n->radioToken);
+
+    // Receivers that are listening on this spreading factor lock onto it if they can hear it
+    for (uint32_t i=0; i<nodeCount; i++) {
+        simNode *r = &nodes[i];
+        if (r != n && r->mode == RADIO_RX && r->lockedTx == 0 && r->sf == sf && decodable(tx, r)) {
+            r->lockedTx = tx->id;
+        }
+    }
+}
+
+static void hookRadioRx(void *context, uint8_t sf, uint32_t timeoutMs)
+{
+    simNode *n = context;
+    radioSetMode(n, RADIO_RX);
+    n->sf = sf;
+    if (timeoutMs != 0) {
+        schedule(nowMs + timeoutMs, EVENT_RX_TIMEOUT, n, n->radioToken);
+    }
+
+    // Lock onto a packet whose preamble is still being sent
+    double bestRSSI = -1000;
+    for (size_t i=0; i<txCount; i++) {
+        simTx *tx = txs[i];
+        if (tx->sender != n && tx->sf == sf && tx->endMs > nowMs && nowMs <= tx->startMs + preambleMs(sf)
+                && decodable(tx, n) && rssiAt(tx, n) > bestRSSI) {
+            bestRSSI = rssiAt(tx, n);
+            n->lockedTx = tx->id;
+        }
+    }
+}
+
+static void hookRadioCad(void *context, uint8_t sf, uint32_t durationMs)
+{
+    simNode *n = context;
+    radioSetMode(n, RADIO_CAD);
+    n->sf = sf;
+    n->cadStartMs = nowMs;
+    schedule(nowMs + durationMs, EVENT_CAD_END, n, n->radioToken);
+}
+
+static void hookRadioSleep(void *context)
+{
+    simNode *n = context;
+    if (n->mode != RADIO_SLEEP) {
+        radioSetMode(n, RADIO_SLEEP);
+    }
+}
+
+// Emulated Notecard storage
+static unsigned noteHash(const char *key)
+{
+    unsigned h = 5381;
+    while (*key != '\0') {
+        h = (h * 33) ^ (unsigned char) *key++;
+    }
+    return h % 256;
+}
+
+static simNote *noteFind(simNode *g, const char *key)
+{
+    for (simNote *note = g->notes[noteHash(key)]; note != NULL; note = note->next) {
+        if (strcmp(note->key, key) == 0) {
+            return note;
+        }
+    }
+    return NULL;
+}
+
+static void noteStore(simNode *g, const char *key, const char *body)
+{
+    simNote *note = noteFind(g, key);
+    if (note == NULL) {
+        note = calloc(1, sizeof(simNote));
+        if (note == NULL) {
+            fatal("out of memory", NULL);
+        }
+        note->key = strdup(key);
+        unsigned h = noteHash(key);
+        note->next = g->notes[h];
+        g->notes[h] = note;
+    }
+    free(note->body);
+    note->body = strdup(body);
+}
+
+// Find the boot of a sensor in which it added a note, which is the last boot before the
+// note's time, or the current boot if the sensor didn't yet know the time
+static uint32_t noteBoot(const char *sensor, J *req)
+{
+    simNode *n = NULL;
+    for (uint32_t i=0; i<nodeCount; i++) {
+        if (strcmp(nodes[i].id, sensor) == 0) {
+            n = &nodes[i];
+            break;
+        }
+    }
+    if (n == NULL || n->boots == 0) {
+        return 0;
+    }
+    uint32_t boot = n->boots - 1;
+    if (JIsPresent(req, "time")) {
+        uint32_t timeSecs = (uint32_t) JGetInt(req, "time");
+        while (boot > 0 && n->bootEpochSecs[boot] >= timeSecs) {
+            boot--;
+        }
+    }
+    return boot;
+}
+
+// Account for a note from the ping app reaching the Notecard
+static void noteDelivered(const char *file, J *req)
+{
+    J *body = JGetObject(req, "body");
+    char sensor[64];
+    strlcpy(sensor, file, sizeof(sensor));
+    char *hash = strchr(sensor, '#');
+    if (hash != NULL) {
+        *hash = '\0';
+    }
+    uint32_t boot = noteBoot(sensor, req);
+    simSensorNotes *s = NULL;
+    for (uint32_t i=0; i<sensorNotesCount; i++) {
+        if (strcmp(sensorNotes[i].sensor, sensor) == 0 && sensorNotes[i].boot == boot) {
+            s = &sensorNotes[i];
+            break;
+        }
+    }
+    if (s == NULL) {
+        sensorNotes = realloc(sensorNotes, (sensorNotesCount+1) * sizeof(simSensorNotes));
+        if (sensorNotes == NULL) {
+            fatal("out of memory", NULL);
+        }
+        s = &sensorNotes[sensorNotesCount++];
+        memset(s, 0, sizeof(*s));
+        s->sensor = strdup(sensor);
+        s->boot = boot;
+    }
+    uint32_t count = (uint32_t) JGetInt(body, "count");
+    if (count == 0) {
+        return;
+    }
+    if (count/8 >= s->seenBytes) {
+        uint32_t bytes = (count/8 + 1) * 2;
+        s->seen = realloc(s->seen, bytes);
+        if (s->seen == NULL) {
+            fatal("out of memory", NULL);
+        }
+        memset(s->seen + s->seenBytes, 0, bytes - s->seenBytes);
+        s->seenBytes = bytes;
+    }
+    if ((s->seen[count/8] & (1 << (count%8))) != 0) {
+        s->duplicates++;
+        return;
+    }
+    s->seen[count/8] |= (1 << (count%8));
+    s->delivered++;
+    if (count > s->maxCount) {
+        s->maxCount = count;
+    }
+}
+
+// Emulated Notecard, which answers the requests that the gateway makes
+static char *hookNotecard(void *context, const char *json)
+{
+    simNode *g = context;
+    J *req = JConvertFromJSONString(json);
+    if (req == NULL) {
+        return strdup("{\"err\":\"can't parse request\"}");
+    }
+    const char *r = JGetString(req, "req");
+    if (r[0] == '\0') {
+        r = JGetString(req, "cmd");
+    }
+    J *rsp = JCreateObject();
+    if (JIsPresent(req, "id")) {
+        JAddNumberToObject(rsp, "id", JGetNumber(req, "id"));
+    }
+    uint32_t epochSecs = (uint32_t) (hookEpochMs(g) / 1000);
+
+    if (strcmp(r, "card.time") == 0) {
+        JAddNumberToObject(rsp, "time", epochSecs);
+        JAddStringToObject(rsp, "zone", "EST,America/New_York");
+    } else if (strcmp(r, "hub.get") == 0) {
+        JAddStringToObject(rsp, "product", "com.blues.sparrow:simulator");
+    } else if (strcmp(r, "env.modified") == 0) {
+        JAddNumberToObject(rsp, "time", epochBaseMs / 1000);
+    } else if (strcmp(r, "env.get") == 0) {
+        JAddItemToObject(rsp, "body", JCreateObject());
+        JAddNumberToObject(rsp, "time", epochBaseMs / 1000);
+    } else if (strcmp(r, "hub.sync.status") == 0) {
+        JAddNumberToObject(rsp, "time", epochBaseMs / 1000);
+    } else if (strcmp(r, "note.changes") == 0) {
+        JAddItemToObject(rsp, "notes", JCreateObject());
+        JAddNumberToObject(rsp, "changes", 0);
+        JAddNumberToObject(rsp, "total", 0);
+    } else if (strcmp(r, "note.add") == 0) {
+        const char *file = JGetString(req, "file");
+        g->notesAdded++;
+        if (strstr(file, "#data.qo") != NULL) {
+            noteDelivered(file, req);
+        }
+    } else if (strcmp(r, "note.get") == 0 || strcmp(r, "note.update") == 0) {
+        char key[256];
+        snprintf(key, sizeof(key), "%s/%s", JGetString(req, "file"), JGetString(req, "note"));
+        if (r[5] == 'g') {
+            simNote *note = noteFind(g, key);
+            if (note == NULL) {
+                JAddStringToObject(rsp, "err", "note not found {note-noexist}");
+            } else {
+                J *body = JConvertFromJSONString(note->body);
+                if (body != NULL) {
+                    JAddItemToObject(rsp, "body", body);
+                }
+            }
+        } else {
+            J *body = JGetObject(req, "body");
+            char *text = (body != NULL) ? JConvertToJSONString(body) : NULL;
+            noteStore(g, key, text != NULL ? text : "{}");
+            JFree(text);
+        }
+    }
+
+    char *response = JConvertToJSONString(rsp);
+    JDelete(rsp);
+    JDelete(req);
+    return response;
+}
+
+// Entry point of a node's coroutine
+static void nodeEntry()
+{
+    simNode *n = starting;
+    n->main();
+    fatal("firmware returned from main", NULL);
+}
+
+// Sum MAC statistics
+static void macAccumulate(macStats *sum, const macStats *s)
+{
+    sum->txPackets += s->txPackets;
+    sum->txTimeouts += s->txTimeouts;
+    sum->txAirtimeMs += s->txAirtimeMs;
+    sum->rxPackets += s->rxPackets;
+    sum->rxInvalid += s->rxInvalid;
+    sum->rxErrors += s->rxErrors;
+    sum->rxTimeouts += s->rxTimeouts;
+    sum->rxListenMs += s->rxListenMs;
+    sum->lbtListens += s->lbtListens;
+    sum->lbtBusy += s->lbtBusy;
+    sum->lbtListenMs += s->lbtListenMs;
+    sum->lbtTalks += s->lbtTalks;
+    sum->lbtDelayMs += s->lbtDelayMs;
+    sum->duplicates += s->duplicates;
+    sum->requestsCompleted += s->requestsCompleted;
+    sum->requestsRetried += s->requestsRetried;
+    sum->requestsFailed += s->requestsFailed;
+}
+
+// Look up a symbol in a node's firmware
+static void *nodeSymbol(simNode *n, const char *name)
+{
+    void *sym = dlsym(n->module, name);
+    if (sym == NULL) {
+        fatal("firmware is missing symbol", name);
+    }
+    return sym;
+}
+
+// Load a fresh copy of the firmware into a node, as though it had been reset
+static void nodeLoad(simNode *n)
+{
+    const char *tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[512];
+    snprintf(path, sizeof(path), "%s/sparrow-sim-%d-%u.so", tmp, (int) getpid(), moduleLoads++);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(firmwareImage, 1, firmwareImageBytes, f) != firmwareImageBytes) {
+        fatal("can't write firmware copy", path);
+    }
+    fclose(f);
+    n->module = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+    unlink(path);
+    if (n->module == NULL) {
+        fatal("can't load firmware", dlerror());
+    }
+
+    n->hooks = nodeSymbol(n, "host");
+    n->main = (void (*)(void)) nodeSymbol(n, "hostMain");
+    n->timerIRQ = (void (*)(void)) nodeSymbol(n, "hostTimerIRQ");
+    n->txDone = (void (*)(void)) nodeSymbol(n, "hostRadioTxDone");
+    n->rxDone = (void (*)(uint8_t *, uint16_t, int16_t, int8_t)) nodeSymbol(n, "hostRadioRxDone");
+    n->rxTimeout = (void (*)(void)) nodeSymbol(n, "hostRadioRxTimeout");
+    n->rxError = (void (*)(void)) nodeSymbol(n, "hostRadioRxError");
+    n->cadDone = (void (*)(bool)) nodeSymbol(n, "hostRadioCadDone");
+    n->macStat = nodeSymbol(n, "macStat");
+    n->delaysInISR = nodeSymbol(n, "hostDelaysInISR");
+    *(uint32_t *) nodeSymbol(n, "hostFlashBase") = (uint32_t) (uintptr_t) n->flash;
+
+    hostHooks *h = n->hooks;
+    h->context = n;
+    h->timeMs = hookTimeMs;
+    h->epochMs = n->gateway ? hookEpochMs : NULL;
+    h->delayMs = hookDelayMs;
+    h->idle = hookIdle;
+    h->alarm = hookAlarm;
+    h->reset = hookReset;
+    h->trace = hookTrace;
+    h->notecard = n->gateway ? hookNotecard : NULL;
+    h->radioTx = hookRadioTx;
+    h->radioRx = hookRadioRx;
+    h->radioCad = hookRadioCad;
+    h->radioSleep = hookRadioSleep;
+    memcpy(h->uid, n->uid, sizeof(h->uid));
+    h->entropy = (uint32_t) rng();
+
+    n->state = NODE_BOOTING;
+    n->bootAtMs = nowMs;
+    n->localOffsetMs = 1 + (uint32_t) (rng() % 1000);
+    n->boots++;
+    n->bootEpochSecs = realloc(n->bootEpochSecs, n->boots * sizeof(uint32_t));
+    if (n->bootEpochSecs == NULL) {
+        fatal("out of memory", NULL);
+    }
+    n->bootEpochSecs[n->boots-1] = (uint32_t) ((epochBaseMs + nowMs) / 1000);
+}
+
+// Pair a node with its peers by writing them into its flash, as pairing would have
+static void nodeProvision(simNode *n)
+{
+    void (*flashConfigLoadFn)(void) = (void (*)(void)) nodeSymbol(n, "flashConfigLoad");
+    bool (*updatePeer)(uint16_t, uint8_t *, uint8_t *) = (bool (*)(uint16_t, uint8_t *, uint8_t *)) nodeSymbol(n, "flashConfigUpdatePeer");
+    flashConfigLoadFn();
+    if (n->gateway) {
+        for (uint32_t i=0; i<nodeCount; i++) {
+            if (nodes[i].home == n && !updatePeer(PEER_TYPE_SENSOR, nodes[i].address, nodes[i].key)) {
+                fatal("can't provision gateway", NULL);
+            }
+        }
+    } else {
+        uint8_t noKey[AES_KEY_BYTES] = {0};
+        if (!updatePeer(PEER_TYPE_SENSOR|PEER_TYPE_SELF, n->address, n->key)
+                || !updatePeer(PEER_TYPE_GATEWAY, n->home->address, noKey)) {
+            fatal("can't provision sensor", NULL);
+        }
+    }
+    n->provisioned = true;
+}
+
+// Start a node's firmware
+static void nodeStart(simNode *n)
+{
+    if (!n->provisioned) {
+        nodeProvision(n);
+    }
+    getcontext(&n->context);
+    n->context.uc_stack.ss_sp = n->stack;
+    n->context.uc_stack.ss_size = SIM_STACK_BYTES;
+    n->context.uc_link = &coordinator;
+    makecontext(&n->context, nodeEntry, 0);
+    starting = n;
+    nodeResume(n);
+}
+
+// Run a node until it delays, idles, or resets
+static void nodeResume(simNode *n)
+{
+    n->state = NODE_RUNNING;
+    swapcontext(&coordinator, &n->context);
+    if (n->state == NODE_RESETTING) {
+        nodeReboot(n);
+    }
+}
+
+// Discard a node's firmware, abandoning whatever it was doing
+static void nodeStop(simNode *n)
+{
+    macAccumulate(&n->mac, n->macStat);
+    n->delaysInISRTotal += *n->delaysInISR;
+    if (n->mode != RADIO_SLEEP) {
+        radioSetMode(n, RADIO_SLEEP);
+    }
+    n->wakeToken++;
+    n->alarmToken++;
+    n->radioToken++;
+    n->bootToken++;
+    dlclose(n->module);
+    n->module = NULL;
+    n->state = NODE_OFF;
+}
+
+// Discard a node's firmware and boot it again, keeping its flash and its retention RAM,
+// which a reset doesn't clear
+static void nodeReboot(simNode *n)
+{
+    uint8_t *start = nodeSymbol(n, "hostRetentionStart");
+    n->retentionBytes = (uint8_t *) nodeSymbol(n, "hostRetentionEnd") - start;
+    n->retention = realloc(n->retention, n->retentionBytes);
+    if (n->retention == NULL) {
+        fatal("out of memory", NULL);
+    }
+    memcpy(n->retention, start, n->retentionBytes);
+    nodeStop(n);
+    nodeLoad(n);
+    memcpy(nodeSymbol(n, "hostRetentionStart"), n->retention, n->retentionBytes);
+    schedule(nowMs + 100, EVENT_BOOT, n, ++n->bootToken);
+}
+
+// Resolve a transmission that has ended, at its sender and at every node receiving it
+static void txEnded(simNode *sender)
+{
+    simTx *tx = txFind(sender->lockedTx);
+    radioSetMode(sender, RADIO_SLEEP);
+    deliverISR(sender, isrTxDone, NULL);
+    if (tx == NULL) {
+        return;
+    }
+    for (uint32_t i=0; i<nodeCount; i++) {
+        simNode *r = &nodes[i];
+        if (r->mode != RADIO_RX || r->lockedTx != tx->id) {
+            continue;
+        }
+
+        // See if any overlapping transmission on this spreading factor was strong enough to corrupt it
+        bool collided = false;
+        double signal = rssiAt(tx, r);
+        for (size_t j=0; j<txCount && !collided; j++) {
+            simTx *other = txs[j];
+            if (other != tx && other->sender != r && other->sf == tx->sf
+                    && other->startMs < tx->endMs && other->endMs > tx->startMs
+                    && rssiAt(other, r) > signal - SIM_CAPTURE_DB) {
+                collided = true;
+            }
+        }
+        radioSetMode(r, RADIO_SLEEP);
+        if (collided) {
+            statCollisions++;
+            deliverISR(r, isrRxError, NULL);
+        } else {
+            if (!tx->received) {
+                tx->received = true;
+                statDeliveredAirtimeMs += tx->endMs - tx->startMs;
+            }
+            deliverISR(r, isrRxDone, tx);
+        }
+    }
+}
+
+// Resolve channel activity detection
+static void cadEnded(simNode *n)
+{
+    bool busy = false;
+    for (size_t i=0; i<txCount && !busy; i++) {
+        simTx *tx = txs[i];
+        if (tx->sender != n && tx->sf == n->sf && tx->startMs < nowMs && tx->endMs > n->cadStartMs && decodable(tx, n)) {
+            busy = true;
+        }
+    }
+    radioSetMode(n, RADIO_SLEEP);
+    deliverISR(n, isrCadDone, &busy);
+}
+
+// Process an event
+static void dispatch(simEvent *e)
+{
+    simNode *n = e->node;
+    switch (e->type) {
+    case EVENT_BOOT:
+        if (e->token == n->bootToken) {
+            nodeStart(n);
+        }
+        break;
+    case EVENT_WAKE:
+        if (e->token == n->wakeToken && n->state == NODE_DELAYING) {
+            nodeResume(n);
+        }
+        break;
+    case EVENT_ALARM:
+        if (e->token == n->alarmToken && n->state != NODE_BOOTING) {
+            n->alarmToken++;
+            deliverISR(n, isrTimer, NULL);
+        }
+        break;
+    case EVENT_TX_END:
+        if (e->token == n->radioToken && n->mode == RADIO_TX) {
+            txEnded(n);
+        }
+        break;
+    case EVENT_RX_TIMEOUT:
+        // As on the SX126x, the timeout stops once a packet has been detected
+        if (e->token == n->radioToken && n->mode == RADIO_RX && n->lockedTx == 0) {
+            radioSetMode(n, RADIO_SLEEP);
+            deliverISR(n, isrRxTimeout, NULL);
+        }
+        break;
+    case EVENT_CAD_END:
+        if (e->token == n->radioToken && n->mode == RADIO_CAD) {
+            cadEnded(n);
+        }
+        break;
+    case EVENT_POWER_OFF:
+        if (n->module != NULL) {
+            nodeStop(n);
+        }
+        break;
+    case EVENT_POWER_ON:
+        if (n->module == NULL) {
+            nodeLoad(n);
+            schedule(nowMs + 100, EVENT_BOOT, n, ++n->bootToken);
+        }
+        break;
+    }
+}
+
+// Read the firmware module that every node loads a copy of
+static void readFirmware(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fatal("can't open firmware", path);
+    }
+    fseek(f, 0, SEEK_END);
+    firmwareImageBytes = (size_t) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    firmwareImage = malloc(firmwareImageBytes);
+    if (firmwareImage == NULL || fread(firmwareImage, 1, firmwareImageBytes, f) != firmwareImageBytes) {
+        fatal("can't read firmware", path);
+    }
+    fclose(f);
+}
+
+// Create the nodes, with each gateway at the center of a disk holding its sensors, and the
+// gateways spaced apart along a line
+static void createNodes()
+{
+    nodeCount = optGateways + optSensors;
+    nodes = calloc(nodeCount, sizeof(simNode));
+    pathLoss = calloc((size_t) nodeCount * nodeCount, sizeof(float));
+    if (nodes == NULL || pathLoss == NULL) {
+        fatal("out of memory", NULL);
+    }
+    for (uint32_t i=0; i<nodeCount; i++) {
+        simNode *n = &nodes[i];
+        n->index = i;
+        n->gateway = (i < optGateways);
+        if (n->gateway) {
+            n->x = i * optSpacingM;
+            n->y = 0;
+        } else {
+            n->home = &nodes[(i - optGateways) % optGateways];
+            double radius = optRadiusM * sqrt(rngUniform());
+            double angle = 2 * M_PI * rngUniform();
+            n->x = n->home->x + radius * cos(angle);
+            n->y = n->home->y + radius * sin(angle);
+        }
+        n->uid[0] = 0x53494d00 | (i & 0xff);
+        n->uid[1] = i;
+        n->uid[2] = optSeed;
+        for (int w=0; w<3; w++) {
+            n->address[w*4+0] = (uint8_t) n->uid[w];
+            n->address[w*4+1] = (uint8_t) (n->uid[w] >> 8);
+            n->address[w*4+2] = (uint8_t) (n->uid[w] >> 16);
+            n->address[w*4+3] = (uint8_t) (n->uid[w] >> 24);
+        }
+        for (int k=0; k<ADDRESS_LEN; k++) {
+            snprintf(&n->id[k*2], 3, "%02x", n->address[ADDRESS_LEN-1-k]);
+        }
+        for (size_t k=0; k<sizeof(n->key); k++) {
+            n->key[k] = (uint8_t) rng();
+        }
+        n->driftPpm = n->gateway ? 0 : (int32_t) (rng() % (2*optDriftPpm+1)) - optDriftPpm;
+
+        n->flash = mmap(NULL, FLASH_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_32BIT, -1, 0);
+        n->stack = mmap(NULL, SIM_STACK_BYTES, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+        if (n->flash == MAP_FAILED || n->stack == MAP_FAILED) {
+            fatal("can't map node memory", NULL);
+        }
+        memset(n->flash, 0xFF, FLASH_SIZE);
+    }
+
+    // Path loss is symmetric, with shadowing fixed for each pair
+    for (uint32_t i=0; i<nodeCount; i++) {
+        for (uint32_t j=i+1; j<nodeCount; j++) {
+            double d = hypot(nodes[i].x - nodes[j].x, nodes[i].y - nodes[j].y);
+            if (d < 1) {
+                d = 1;
+            }
+            double loss = SIM_PATH_LOSS_1M_DB + 10 * SIM_PATH_LOSS_EXPONENT * log10(d) + SIM_SHADOWING_DB * rngNormal();
+            pathLoss[i*nodeCount+j] = pathLoss[j*nodeCount+i] = (float) loss;
+        }
+    }
+}
+
+// Report results, returning false if loss exceeded what was allowed
+static bool report()
+{
+    uint32_t outboxNotes = 0;
+    for (uint32_t i=0; i<nodeCount; i++) {
+        simNode *n = &nodes[i];
+        if (n->module == NULL) {
+            continue;
+        }
+        if (n->mode != RADIO_SLEEP) {
+            radioSetMode(n, RADIO_SLEEP);
+        }
+        macAccumulate(&n->mac, n->macStat);
+        n->delaysInISRTotal += *n->delaysInISR;
+        if (!n->gateway) {
+            outboxNotes += ((uint32_t (*)(void)) nodeSymbol(n, "outboxCount"))();
+        }
+    }
+
+    macStats sensors = {0}, gateways = {0};
+    double txCharge = 0, rxCharge = 0, cadCharge = 0;
+    uint64_t rxMs = 0, cadMs = 0;
+    uint32_t boots = 0, delaysInISR = 0;
+    for (uint32_t i=0; i<nodeCount; i++) {
+        simNode *n = &nodes[i];
+        macAccumulate(n->gateway ? &gateways : &sensors, &n->mac);
+        boots += n->boots - 1;
+        delaysInISR += n->delaysInISRTotal;
+        if (!n->gateway) {
+            txCharge += n->txCharge;
+            rxCharge += n->rxCharge;
+            cadCharge += n->cadCharge;
+            rxMs += n->rxMs;
+            cadMs += n->cadMs;
+        }
+    }
+
+    uint64_t delivered = 0, missing = 0, duplicates = 0;
+    uint32_t sensorsDelivering = 0;
+    for (uint32_t i=0; i<sensorNotesCount; i++) {
+        uint32_t j = 0;
+        while (j < i && strcmp(sensorNotes[j].sensor, sensorNotes[i].sensor) != 0) {
+            j++;
+        }
+        sensorsDelivering += (j == i);
+        delivered += sensorNotes[i].delivered;
+        missing += sensorNotes[i].maxCount - sensorNotes[i].delivered;
+        duplicates += sensorNotes[i].duplicates;
+    }
+    double lossPercent = (delivered + missing) ? (100.0 * missing) / (delivered + missing) : 100.0;
+    double days = (double) endMs / 86400000.0;
+    double perSensorDay = (optSensors && days > 0) ? 1.0 / (optSensors * days) : 0;
+    double mJ = SIM_SUPPLY_V / 1000.0;   // mA*ms at the supply voltage, in mJ
+
+    printf("sim%s%s: %u sensors, %u gateways %.0fm apart, %.2f days, radius %.0fm, drift %dppm, seed %u\n",
+           optLabel[0] ? " " : "", optLabel, optSensors, optGateways, optSpacingM, days, optRadiusM, optDriftPpm, optSeed);
+    if (optOutageHours > 0) {
+        printf("  outage:     gateways off for %.2f hours from %.2f hours\n", optOutageHours, optOutageAtHours);
+    }
+    printf("  notes:      %llu delivered by %u sensors, %llu missing (%.2f%% loss), %llu duplicates, %u in outboxes\n",
+           (unsigned long long) delivered, sensorsDelivering, (unsigned long long) missing, lossPercent,
+           (unsigned long long) duplicates, outboxNotes);
+    printf("  channel:    %llu packets (%llu abandoned), %.1f%% utilization, %llu collisions, %.1f%% of airtime received\n",
+           (unsigned long long) statPackets, (unsigned long long) statAborted,
+           endMs ? (100.0 * statAirtimeMs) / endMs : 0.0, (unsigned long long) statCollisions,
+           statAirtimeMs ? (100.0 * statDeliveredAirtimeMs) / statAirtimeMs : 0.0);
+    printf("  requests:   %u completed, %u retried, %u failed\n",
+           sensors.requestsCompleted, sensors.requestsRetried, sensors.requestsFailed);
+    printf("  sensor mac: tx %u in %ums (%u timeouts), rx %u (%u invalid, %u errors, %u timeouts), %u duplicates\n",
+           sensors.txPackets, sensors.txAirtimeMs, sensors.txTimeouts, sensors.rxPackets, sensors.rxInvalid, sensors.rxErrors,
+           sensors.rxTimeouts, sensors.duplicates);
+    printf("  gateway mac: tx %u, rx %u (%u invalid, %u errors), %u duplicates\n",
+           gateways.txPackets, gateways.rxPackets, gateways.rxInvalid, gateways.rxErrors, gateways.duplicates);
+    uint32_t lbtTalks = sensors.lbtTalks + gateways.lbtTalks;
+    uint64_t lbtListenMs = (uint64_t) sensors.lbtListenMs + gateways.lbtListenMs;
+    printf("  lbt:        %u listens, %u busy, %.1fms listening per listen, %.1fms from first listen to talk\n",
+           sensors.lbtListens + gateways.lbtListens, sensors.lbtBusy + gateways.lbtBusy,
+           (sensors.lbtListens + gateways.lbtListens) ? (double) lbtListenMs / (sensors.lbtListens + gateways.lbtListens) : 0.0,
+           lbtTalks ? (double) (sensors.lbtDelayMs + gateways.lbtDelayMs) / lbtTalks : 0.0);
+    printf("  lbt cost:   %u transmissions, each after %.1fms and %.2f mJ of listening\n", lbtTalks,
+           lbtTalks ? (double) lbtListenMs / lbtTalks : 0.0,
+           lbtTalks ? lbtListenMs * SIM_RX_MA * mJ / lbtTalks : 0.0);
+    printf("  energy:     %.1f mJ per sensor per day in the radio (tx %.1f, rx %.1f over %.1fs, cad %.1f over %.1fs)\n",
+           (txCharge + rxCharge + cadCharge) * mJ * perSensorDay, txCharge * mJ * perSensorDay,
+           rxCharge * mJ * perSensorDay, rxMs * perSensorDay / 1000.0,
+           cadCharge * mJ * perSensorDay, cadMs * perSensorDay / 1000.0);
+    printf("  nonces:     %llu packets with a nonce, %llu nonces reused, %llu legacy packets\n",
+           (unsigned long long) statNonces, (unsigned long long) statNonceReuses,
+           (unsigned long long) statLegacyPackets);
+    printf("  host:       %u reboots, %u delays within interrupts\n", boots, delaysInISR);
+
+    if (delivered == 0) {
+        printf("FAIL: no notes were delivered\n");
+        return false;
+    }
+    if (statNonceReuses != 0) {
+        printf("FAIL: nonces were reused\n");
+        return false;
+    }
+    if (lossPercent > optMaxLossPercent) {
+        printf("FAIL: loss of %.2f%% exceeds %.2f%%\n", lossPercent, optMaxLossPercent);
+        return false;
+    }
+    if (duplicates > optMaxDuplicates) {
+        printf("FAIL: %llu duplicates exceed %llu\n", (unsigned long long) duplicates, (unsigned long long) optMaxDuplicates);
+        return false;
+    }
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: sim --firmware module.so [options]\n"
+            "  --sensors N        sensors (default 20)\n"
+            "  --gateways N       gateways, by default as few as can hold the sensors\n"
+            "  --days D           simulated days (default 1)\n"
+            "  --radius M         radius in meters of the disk of sensors around a gateway (default 300)\n"
+            "  --spacing M        distance in meters between gateways (default 2000)\n"
+            "  --drift PPM        maximum clock drift of sensors (default 20)\n"
+            "  --deploy MINS      period over which sensors are switched on (default 60)\n"
+            "  --seed N           random seed (default 1)\n"
+            "  --max-loss PCT     fail if more than this percentage of notes are lost\n"
+            "  --max-duplicates N fail if more than this number of notes are delivered twice\n"
+            "  --outage AT,HOURS  switch the gateways off at AT hours for HOURS hours\n"
+            "  --label TEXT       label for the report\n"
+            "  --trace [NODE]     show firmware trace, of all nodes or of one\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option options[] = {
+        { "firmware", required_argument, NULL, 'f' },
+        { "sensors", required_argument, NULL, 's' },
+        { "gateways", required_argument, NULL, 'g' },
+        { "days", required_argument, NULL, 'd' },
+        { "radius", required_argument, NULL, 'r' },
+        { "spacing", required_argument, NULL, 'c' },
+        { "drift", required_argument, NULL, 'p' },
+        { "deploy", required_argument, NULL, 'm' },
+        { "seed", required_argument, NULL, 'x' },
+        { "max-loss", required_argument, NULL, 'l' },
+        { "max-duplicates", required_argument, NULL, 'u' },
+        { "outage", required_argument, NULL, 'o' },
+        { "label", required_argument, NULL, 'n' },
+        { "trace", optional_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            optFirmware = optarg;
+            break;
+        case 's':
+            optSensors = (uint32_t) atoi(optarg);
+            break;
+        case 'g':
+            optGateways = (uint32_t) atoi(optarg);
+            break;
+        case 'd':
+            optDays = atof(optarg);
+            break;
+        case 'r':
+            optRadiusM = atof(optarg);
+            break;
+        case 'c':
+            optSpacingM = atof(optarg);
+            break;
+        case 'p':
+            optDriftPpm = atoi(optarg);
+            break;
+        case 'm':
+            optDeployMins = atof(optarg);
+            break;
+        case 'x':
+            optSeed = (uint32_t) atoi(optarg);
+            break;
+        case 'l':
+            optMaxLossPercent = atof(optarg);
+            break;
+        case 'u':
+            optMaxDuplicates = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            if (sscanf(optarg, "%lf,%lf", &optOutageAtHours, &optOutageHours) != 2) {
+                usage();
+            }
+            break;
+        case 'n':
+            optLabel = optarg;
+            break;
+        case 't':
+            optTraceNode = (optarg != NULL) ? atoi(optarg) : -1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optFirmware == NULL || optSensors == 0 || optDays <= 0 || optDriftPpm < 0 || optDeployMins < 0) {
+        usage();
+    }
+    if (optGateways == 0) {
+        optGateways = (optSensors + MAX_PEERS - 1) / MAX_PEERS;
+    }
+    if ((optSensors + optGateways - 1) / optGateways > MAX_PEERS) {
+        fprintf(stderr, "sim: a gateway can hold at most %d sensors\n", MAX_PEERS);
+        return 2;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    rngState = 0x9E3779B97F4A7C15ULL ^ ((uint64_t) optSeed * 0xD1B54A32D192ED03ULL);
+    readFirmware(optFirmware);
+    createNodes();
+    endMs = (uint64_t) (optDays * 86400000.0);
+
+    // Boot the gateways first, and then the sensors as they are deployed
+    uint64_t deployMs = (uint64_t) (optDeployMins * 60000.0) + 1;
+    for (uint32_t i=0; i<nodeCount; i++) {
+        nowMs = 0;
+        nodeLoad(&nodes[i]);
+        uint64_t bootMs = nodes[i].gateway ? 0 : 5000 + rng() % deployMs;
+        nodes[i].bootAtMs = bootMs;
+        schedule(bootMs, EVENT_BOOT, &nodes[i], nodes[i].bootToken);
+        if (nodes[i].gateway && optOutageHours > 0) {
+            schedule((uint64_t) (optOutageAtHours * 3600000.0), EVENT_POWER_OFF, &nodes[i], 0);
+            schedule((uint64_t) ((optOutageAtHours + optOutageHours) * 3600000.0), EVENT_POWER_ON, &nodes[i], 0);
+        }
+    }
+
+    // Run
+    uint64_t pruneMs = 0;
+    while (heapCount > 0 && heap[0].atMs <= endMs) {
+        simEvent e = unschedule();
+        nowMs = e.atMs;
+        dispatch(&e);
+        if (nowMs >= pruneMs) {
+            txPrune();
+            pruneMs = nowMs + 60000;
+        }
+    }
+    nowMs = endMs;
+
+    return report() ? 0 : 1;
+}
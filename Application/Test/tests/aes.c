@@ -0,0 +1,149 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Test and benchmark of the host's software AES, which stands in for the AES peripheral
+// with the same API.  The FIPS-197 AES-256 block is checked by using it as the counter
+// block of a keystream, taking the key and counter words in the order in which the
+// peripheral loads them.  The counter blocks that the firmware derives from carriers are
+// then checked against CTR vectors, for both legacy carriers and those with a nonce, and
+// encryption of a packet is timed.
+
+#include <string.h>
+
+#include "main.h"
+#include "framework.h"
+#include "test.h"
+
+#define PACKETS     200000
+
+// Load bytes as the peripheral would see a key word, least significant byte first
+static void keyWords(uint8_t *key, const uint8_t *bytes, int len)
+{
+    for (int i=0; i<len; i+=4) {
+        key[i+0] = bytes[i+3];
+        key[i+1] = bytes[i+2];
+        key[i+2] = bytes[i+1];
+        key[i+3] = bytes[i+0];
+    }
+}
+
+// Load bytes as a counter block, most significant byte first
+static void counterWords(uint32_t *iv, const uint8_t *bytes)
+{
+    for (int i=0; i<4; i++) {
+        iv[i] = ((uint32_t) bytes[i*4] << 24) | ((uint32_t) bytes[i*4+1] << 16)
+                | ((uint32_t) bytes[i*4+2] << 8) | bytes[i*4+3];
+    }
+}
+
+int main()
+{
+
+    // FIPS-197 appendix C.3, whose ciphertext is the keystream of a zero block
+    static const uint8_t fipsKey[32] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    };
+    static const uint8_t fipsPlaintext[16] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+    };
+    static const uint8_t fipsCiphertext[16] = {
+        0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89,
+    };
+    uint8_t key[AES_KEY_BYTES];
+    uint32_t iv[4];
+    uint32_t zero[4] = {0}, out[4];
+    keyWords(key, fipsKey, sizeof(key));
+    counterWords(iv, fipsPlaintext);
+    CHECK(MX_AES_CTR_Encrypt(key, iv, (uint8_t *) zero, sizeof(zero), (uint8_t *) out));
+    CHECK(memcmp(out, fipsCiphertext, sizeof(out)) == 0);
+
+    // NIST SP 800-38A F.5.5, CTR-AES256, whose initial counter block is the static one with
+    // which legacy carriers are encrypted
+    static const uint8_t nistKey[32] = {
+        0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+        0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4,
+    };
+    static const uint8_t nistPlaintext[64] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+        0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+    };
+    static const uint8_t nistCiphertext[64] = {
+        0x60, 0x1e, 0xc3, 0x13, 0x77, 0x57, 0x89, 0xa5, 0xb7, 0xa7, 0xf5, 0x04, 0xbb, 0xf3, 0xd2, 0x28,
+        0xf4, 0x43, 0xe3, 0xca, 0x4d, 0x62, 0xb5, 0x9a, 0xca, 0x84, 0xe9, 0x90, 0xca, 0xca, 0xf5, 0xc5,
+        0x2b, 0x09, 0x30, 0xda, 0xa2, 0x3d, 0xe9, 0x4c, 0xe8, 0x70, 0x17, 0xba, 0x2d, 0x84, 0x98, 0x8d,
+        0xdf, 0xc9, 0xc5, 0x8d, 0xb6, 0x7a, 0xad, 0xa6, 0x13, 0xc2, 0xdd, 0x08, 0x45, 0x79, 0x41, 0xa6,
+    };
+    uint32_t nistIn[16], nistOut[16];
+    wireMessageCarrier carrier = {0};
+    keyWords(key, nistKey, sizeof(key));
+    memcpy(nistIn, nistPlaintext, sizeof(nistIn));
+    carrier.Version = MESSAGE_VERSION_LEGACY;
+    CHECK(appCarrierIV(&carrier, iv) == NULL);
+    CHECK(MX_AES_CTR_Encrypt(key, appCarrierIV(&carrier, iv), (uint8_t *) nistIn, sizeof(nistIn), (uint8_t *) nistOut));
+    CHECK(memcmp(nistOut, nistCiphertext, sizeof(nistOut)) == 0);
+
+    // A carrier with a nonce is encrypted with the nonce followed by a zero block counter,
+    // and the direction bit gives a sensor and a gateway that happen to share a salt and
+    // sequence different keystreams.  The ciphertexts are from OpenSSL's aes-256-ctr.
+    static const uint8_t gatewayCiphertext[40] = {
+        0xb0, 0x34, 0xe3, 0x83, 0xa4, 0x12, 0x4a, 0x9a, 0x06, 0xb9, 0x8e, 0xac, 0x54, 0x13, 0x3d, 0x82,
+        0x70, 0x26, 0x2b, 0xf9, 0x8b, 0x3e, 0x6c, 0xd4, 0x8e, 0x0e, 0xad, 0x4d, 0xfc, 0xa3, 0x3d, 0x2a,
+        0x2e, 0xcf, 0x07, 0x17, 0xde, 0x11, 0x5b, 0x84,
+    };
+    static const uint8_t sensorCiphertext[40] = {
+        0x7d, 0xe6, 0x14, 0x78, 0x53, 0x1a, 0x9c, 0x3e, 0xac, 0xd8, 0x0f, 0x2f, 0x7c, 0xd6, 0x5e, 0xf5,
+        0x4b, 0xdd, 0xf7, 0x8e, 0xab, 0x37, 0x0e, 0x39, 0xb0, 0xc9, 0xfb, 0x97, 0x39, 0x52, 0x3a, 0xe2,
+        0xa0, 0x93, 0xb1, 0x55, 0xdc, 0xd7, 0xd7, 0x02,
+    };
+    carrier.Version = MESSAGE_VERSION_NONCE;
+    carrier.Nonce.Salt = 0x12345678;
+    carrier.Nonce.Sequence = NONCE_SEQUENCE_GATEWAY | 5;
+    CHECK(appCarrierIV(&carrier, iv) == iv);
+    CHECK(iv[0] == 0x12345678 && iv[1] == 0x80000005 && iv[2] == 0 && iv[3] == 0);
+    CHECK(MX_AES_CTR_Encrypt(key, appCarrierIV(&carrier, iv), (uint8_t *) nistIn, sizeof(gatewayCiphertext), (uint8_t *) nistOut));
+    CHECK(memcmp(nistOut, gatewayCiphertext, sizeof(gatewayCiphertext)) == 0);
+    carrier.Nonce.Sequence = 5;
+    CHECK(MX_AES_CTR_Encrypt(key, appCarrierIV(&carrier, iv), (uint8_t *) nistIn, sizeof(sensorCiphertext), (uint8_t *) nistOut));
+    CHECK(memcmp(nistOut, sensorCiphertext, sizeof(sensorCiphertext)) == 0);
+    CHECK(MX_AES_CTR_Decrypt(key, appCarrierIV(&carrier, iv), (uint8_t *) nistOut, sizeof(sensorCiphertext), (uint8_t *) nistIn));
+    CHECK(memcmp(nistIn, nistPlaintext, sizeof(sensorCiphertext)) == 0);
+
+    // Decryption is the same keystream, and must restore a packet of any length
+    uint32_t plain[sizeof(wireMessage)/4+1], cipher[sizeof(wireMessage)/4+1], back[sizeof(wireMessage)/4+1];
+    for (size_t i=0; i<sizeof(plain); i++) {
+        ((uint8_t *) plain)[i] = (uint8_t) (i * 7);
+    }
+    for (uint16_t len=1; len<=sizeof(wireMessage); len++) {
+        memset(back, 0, sizeof(back));
+        CHECK(MX_AES_CTR_Encrypt(key, iv, (uint8_t *) plain, len, (uint8_t *) cipher));
+        CHECK(MX_AES_CTR_Decrypt(key, iv, (uint8_t *) cipher, len, (uint8_t *) back));
+        CHECK(memcmp(back, plain, len) == 0);
+        CHECK(((uint8_t *) back)[len] == 0);
+    }
+
+    // As with the peripheral, buffers must be word-aligned
+    CHECK(!MX_AES_CTR_Encrypt(key, iv, (uint8_t *) plain + 1, 16, (uint8_t *) cipher));
+    CHECK(!MX_AES_CTR_Decrypt(key, iv, (uint8_t *) cipher, 16, (uint8_t *) back + 2));
+
+    // Time the encryption of a full message, which includes expanding the key
+    uint64_t began = testNowNs();
+    for (int i=0; i<PACKETS; i++) {
+        iv[3] = i;
+        MX_AES_CTR_Encrypt(key, iv, (uint8_t *) plain, sizeof(wireMessage), (uint8_t *) cipher);
+    }
+    uint64_t packetNs = (testNowNs() - began) / PACKETS;
+    began = testNowNs();
+    for (int i=0; i<PACKETS; i++) {
+        iv[3] = i;
+        MX_AES_CTR_Encrypt(key, iv, (uint8_t *) plain, 16, (uint8_t *) cipher);
+    }
+    uint64_t blockNs = (testNowNs() - began) / PACKETS;
+    printf("aes: %u-byte message in %luns, single block in %luns\n",
+           (unsigned) sizeof(wireMessage), (unsigned long) packetNs, (unsigned long) blockNs);
+
+    return testResult("aes");
+}
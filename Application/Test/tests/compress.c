@@ -0,0 +1,205 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Compression benchmark on the payloads that the bme, pir and ping apps send, both as a
+// single note and as a batch.  Each payload is measured as JSON and as binary JSON, with
+// and without compression, and as sent by the firmware, which compresses binary JSON only
+// when it would otherwise need more than one chunk.  Every compressed payload must
+// decompress to the original, and binary JSON must decode to a request that encodes
+// identically.  A template, whose numbers are type markers, must decode exactly even
+// though its own formats have been learned.  A compressed payload with a malformed
+// length must be refused.
+
+#include <math.h>
+#include <string.h>
+
+#include "framework.h"
+#include "test.h"
+
+#define NOTES_PER_APP       SENSOR_BATCH_MAX_NOTES
+#define BASE_TIME           1700000000
+
+typedef J *(*noteFn)(int i);
+
+// The note that each app adds, with values that change as real readings would
+static J *noteBME(int i)
+{
+    J *req = NoteNewRequest("note.add");
+    J *body = JCreateObject();
+    JAddStringToObject(req, "file", "*#air.qo");
+    JAddNumberToObject(body, "temperature", 21.37 + 0.11 * i);
+    JAddNumberToObject(body, "humidity", 43.2 - 0.4 * i);
+    JAddNumberToObject(body, "pressure", 101325.4 + 6.5 * i);
+    JAddNumberToObject(body, "voltage", 3.61 - 0.01 * (i % 2));
+    JAddItemToObject(req, "body", body);
+    JAddNumberToObject(req, "time", BASE_TIME + 900 * i);
+    return req;
+}
+
+static J *notePIR(int i)
+{
+    J *req = NoteNewRequest("note.add");
+    J *body = JCreateObject();
+    JAddStringToObject(req, "file", "*#motion.qo");
+    JAddNumberToObject(body, "total", 1042 + 3 * i);
+    JAddNumberToObject(body, "count", 1 + (i % 3));
+    JAddItemToObject(req, "body", body);
+    JAddNumberToObject(req, "time", BASE_TIME + 287 * i);
+    return req;
+}
+
+static J *notePing(int i)
+{
+    J *req = NoteNewRequest("note.add");
+    J *body = JCreateObject();
+    JAddStringToObject(req, "file", "*#data.qo");
+    JAddNumberToObject(body, "count", 57 + i);
+    JAddStringToObject(body, "sensor", "warehouse east door");
+    JAddItemToObject(req, "body", body);
+    JAddNumberToObject(req, "time", BASE_TIME + 3600 * i);
+    return req;
+}
+
+// The template that each app registers, from which the binary encoding of its notes is learned
+static J *templateFor(const char *file, const char **fields, const JNUMBER *formats, int count)
+{
+    J *req = NoteNewRequest("note.template");
+    J *body = JCreateObject();
+    JAddNumberToObject(req, "id", 1);
+    JAddStringToObject(req, "file", file);
+    for (int i=0; i<count; i++) {
+        if (formats[i] < 0) {
+            JAddStringToObject(body, fields[i], TSTRING(40));
+        } else {
+            JAddNumberToObject(body, fields[i], formats[i]);
+        }
+    }
+    JAddItemToObject(req, "body", body);
+    return req;
+}
+
+// Chunks needed to send a payload
+static uint32_t chunks(uint32_t len)
+{
+    return (len + MESSAGE_MAX_CHUNK - 1) / MESSAGE_MAX_CHUNK;
+}
+
+// Compress a payload, check that it decompresses to the original, and return its length,
+// or the original length if it wouldn't compress
+static uint32_t compressedLen(const uint8_t *data, uint32_t len)
+{
+    uint32_t outLen, backLen;
+    uint8_t *out = compressEncode(data, len, &outLen);
+    if (out == NULL) {
+        return len;
+    }
+    uint8_t *back = compressDecode(out, outLen, &backLen);
+    CHECK(back != NULL && backLen == len && memcmp(back, data, len) == 0);
+    free(back);
+    free(out);
+    return outLen;
+}
+
+// Measure a request, consuming it
+static void measure(const char *name, J *req, uint32_t *totalJSON, uint32_t *totalSent)
+{
+    char *json = JConvertToJSONString(req);
+    uint32_t jsonLen = strlen(json);
+    uint32_t binLen;
+    uint8_t *bin = bjsonEncode(req, &binLen);
+    CHECK(json != NULL && bin != NULL);
+    CHECK(bjsonIsEncoded(bin, binLen));
+
+    // Binary JSON must decode to a request that encodes identically
+    J *decoded = bjsonDecode(bin, binLen);
+    CHECK(decoded != NULL);
+    uint32_t againLen = 0;
+    uint8_t *again = decoded == NULL ? NULL : bjsonEncode(decoded, &againLen);
+    CHECK(again != NULL && againLen == binLen && memcmp(again, bin, binLen) == 0);
+    JFree(again);
+    JDelete(decoded);
+
+    uint32_t jsonZLen = compressedLen((uint8_t *) json, jsonLen);
+    uint32_t binZLen = compressedLen(bin, binLen);
+    uint32_t sentLen = (binLen > MESSAGE_MAX_CHUNK) ? binZLen : binLen;
+    printf("  %-14s %5u %5u (%3.0f%%) %5u (%3.0f%%) %5u (%3.0f%%) %5u %u/%u\n", name,
+           jsonLen, jsonZLen, 100.0 * jsonZLen / jsonLen, binLen, 100.0 * binLen / jsonLen,
+           binZLen, 100.0 * binZLen / jsonLen, sentLen, chunks(sentLen), chunks(jsonLen));
+    *totalJSON += jsonLen;
+    *totalSent += sentLen;
+
+    JFree(json);
+    JFree(bin);
+    JDelete(req);
+}
+
+// Check that a request decodes from binary JSON to exactly what was encoded
+static bool roundTrips(J *req)
+{
+    uint32_t binLen;
+    uint8_t *bin = bjsonEncode(req, &binLen);
+    J *decoded = bin == NULL ? NULL : bjsonDecode(bin, binLen);
+    char *json = JConvertToJSONString(req);
+    char *decodedJSON = decoded == NULL ? NULL : JConvertToJSONString(decoded);
+    bool same = json != NULL && decodedJSON != NULL && strcmp(json, decodedJSON) == 0;
+    if (!same) {
+        fprintf(stderr, "compress: %s decoded as %s\n", json, decodedJSON == NULL ? "nothing" : decodedJSON);
+    }
+    JFree(decodedJSON);
+    JFree(json);
+    JDelete(decoded);
+    JFree(bin);
+    return same;
+}
+
+// Measure an app's template, its single note, and a batch of its notes
+static void measureApp(const char *name, J *template, noteFn note, uint32_t *totalJSON, uint32_t *totalSent)
+{
+    char label[32];
+    bjsonLearnTemplate(template);
+    CHECK(roundTrips(template));
+    snprintf(label, sizeof(label), "%s template", name);
+    measure(label, template, totalJSON, totalSent);
+    snprintf(label, sizeof(label), "%s note", name);
+    measure(label, note(0), totalJSON, totalSent);
+    J *batch = NoteNewRequest(BATCH_REQUEST);
+    J *requests = JCreateArray();
+    for (int i=0; i<NOTES_PER_APP; i++) {
+        JAddItemToArray(requests, note(i));
+    }
+    JAddItemToObject(batch, BATCH_FIELD_REQUESTS, requests);
+    snprintf(label, sizeof(label), "%s batch", name);
+    measure(label, batch, totalJSON, totalSent);
+}
+
+int main()
+{
+    static const char *bmeFields[] = { "temperature", "humidity", "pressure", "voltage" };
+    static const JNUMBER bmeFormats[] = { TFLOAT16, TFLOAT16, TFLOAT32, TFLOAT32 };
+    static const char *pirFields[] = { "count", "total" };
+    static const JNUMBER pirFormats[] = { TINT32, TINT32 };
+    static const char *pingFields[] = { "count", "sensor" };
+    static const JNUMBER pingFormats[] = { TINT32, -1 };
+
+    uint32_t totalJSON = 0, totalSent = 0;
+    printf("compress: bytes as json, json compressed, binary, binary compressed, sent; chunks sent/json\n");
+    measureApp("bme", templateFor("*#air.qo", bmeFields, bmeFormats, 4), noteBME, &totalJSON, &totalSent);
+    measureApp("pir", templateFor("*#motion.qo", pirFields, pirFormats, 2), notePIR, &totalJSON, &totalSent);
+    measureApp("ping", templateFor("*#data.qo", pingFields, pingFormats, 2), notePing, &totalJSON, &totalSent);
+    printf("compress: %u bytes sent where json would be %u (%.0f%%)\n",
+           totalSent, totalJSON, 100.0 * totalSent / totalJSON);
+    CHECK(totalSent < totalJSON);
+
+    // A malformed length must be refused rather than trusted, whether it would wrap the
+    // size of the allocation or is merely larger than any payload
+    static const uint8_t wrapping[] = { 0xff, 0xff, 0xff, 0xff, 0x0f, 0xff, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h' };
+    static const uint8_t huge[] = { 0x80, 0x80, 0x80, 0x01, 0xff, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h' };
+    static const uint8_t unterminated[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+    uint32_t badLen;
+    CHECK(compressDecode(wrapping, sizeof(wrapping), &badLen) == NULL);
+    CHECK(compressDecode(huge, sizeof(huge), &badLen) == NULL);
+    CHECK(compressDecode(unterminated, sizeof(unterminated), &badLen) == NULL);
+
+    return testResult("compress");
+}
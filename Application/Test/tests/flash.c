@@ -0,0 +1,389 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Power-loss test of the peer config.  A scenario of pairing, re-keying and renaming peers,
+// long enough to compact the journal several times, is first run to count its flash
+// operations.  It is then rerun once for each of those operations with power lost partway
+// through it.  After each power loss the config is reloaded as it would be on reboot, and
+// must be exactly as it was either before or after the update that was interrupted.  The
+// rest of the scenario is then run, and must end with the same config as an uninterrupted
+// run.  The scenario is run both on erased flash and on flash holding a V1 peer table,
+// whose migration to the two-bank journal must be just as safe.  Full-sized V1 tables,
+// which reach into the bank to which they are migrated, are then imported and migrated
+// with power lost during each operation, or refused if they can't fit within a bank.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "framework.h"
+#include "host.h"
+#include "test.h"
+
+#define PEERS               40
+#define STEPS               240
+#define V1_PEERS            150
+
+// Location of the config area, as in flash.c
+#define CONFIG_PAGES        8
+#define CONFIG_ADDRESS      (FLASH_BASE+FLASH_SIZE-(CONFIG_PAGES*FLASH_PAGE_SIZE))
+
+// Flash config header and peer, as stored by V1 firmware
+#define CONFIG_SIGNATURE_V1 0xF00DD00D
+typedef struct __attribute__((__packed__))
+{
+    uint16_t type;
+    uint8_t address[ADDRESS_LEN];
+    char name[SENSOR_NAME_MAX];
+    uint8_t key[AES_KEY_BYTES];
+}
+peerV1;
+
+// A peer as the config should hold it
+typedef struct {
+    bool present;
+    uint16_t type;
+    uint8_t key[AES_KEY_BYTES];
+    char name[SENSOR_NAME_MAX];
+} peerModel;
+typedef peerModel configModel[PEERS];
+
+// An update
+typedef enum {
+    STEP_PAIR,
+    STEP_RENAME,
+} stepOp;
+typedef struct {
+    stepOp op;
+    int peer;
+    uint8_t key[AES_KEY_BYTES];
+    char name[SENSOR_NAME_MAX];
+} step;
+
+static uint8_t address[PEERS][ADDRESS_LEN];
+static uint8_t v1Address[V1_PEERS][ADDRESS_LEN];
+static step steps[STEPS];
+static configModel initial;
+static configModel expected[STEPS];
+static uint32_t rngState = 0x9e3779b9;
+
+static uint32_t rng()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// Apply an update to a model of the config
+static void modelApply(peerModel *config, step *s)
+{
+    peerModel *p = &config[s->peer];
+    if (s->op == STEP_PAIR) {
+        p->present = true;
+        p->type = PEER_TYPE_SENSOR;
+        memcpy(p->key, s->key, sizeof(p->key));
+    } else if (p->present) {
+        strlcpy(p->name, s->name, sizeof(p->name));
+    }
+}
+
+// Make an update to the config, returning true if success
+static bool stepApply(step *s)
+{
+    if (s->op == STEP_PAIR) {
+        return flashConfigUpdatePeer(PEER_TYPE_SENSOR, address[s->peer], s->key);
+    }
+    flashConfigUpdatePeerName(address[s->peer], ADDRESS_LEN, s->name);
+    return flashConfigUpdate();
+}
+
+// See if the config matches a model
+static bool configMatches(peerModel *config)
+{
+    uint32_t present = 0;
+    for (int i=0; i<PEERS; i++) {
+        uint16_t type;
+        uint8_t key[AES_KEY_BYTES];
+        char name[SENSOR_NAME_MAX];
+        bool found = flashConfigFindPeerByAddress(address[i], &type, key, name);
+        if (found != config[i].present) {
+            return false;
+        }
+        if (!found) {
+            continue;
+        }
+        present++;
+        if (type != config[i].type || memcmp(key, config[i].key, sizeof(key)) != 0
+                || strcmp(name, config[i].name) != 0) {
+            return false;
+        }
+    }
+    return flashConfigPeers() == present;
+}
+
+// Write a V1 peer table holding the first half of the peers into erased flash
+static void flashWriteV1(peerModel *config)
+{
+    memset(config, 0, sizeof(configModel));
+    uint32_t header[2] = { CONFIG_SIGNATURE_V1, PEERS/2 };
+    memcpy((void *) (uintptr_t) CONFIG_ADDRESS, header, sizeof(header));
+    peerV1 *table = (peerV1 *) (uintptr_t) (CONFIG_ADDRESS + sizeof(header));
+    for (int i=0; i<PEERS/2; i++) {
+        peerV1 p = {0};
+        p.type = PEER_TYPE_SENSOR;
+        memcpy(p.address, address[i], sizeof(p.address));
+        snprintf(p.name, sizeof(p.name), "v1-sensor-%d", i);
+        for (size_t j=0; j<sizeof(p.key); j++) {
+            p.key[j] = (uint8_t) (i + j);
+        }
+        memcpy(&table[i], &p, sizeof(p));
+        config[i].present = true;
+        config[i].type = p.type;
+        memcpy(config[i].key, p.key, sizeof(p.key));
+        strlcpy(config[i].name, p.name, sizeof(config[i].name));
+    }
+}
+
+// Name a V1 peer uniquely, padding it to the specified length
+static void v1Name(char *name, int i, int nameLen)
+{
+    memset(name, 0, SENSOR_NAME_MAX);
+    memset(name, 'x', nameLen);
+    char prefix[8];
+    int prefixLen = snprintf(prefix, sizeof(prefix), "v1-%03d", i);
+    memcpy(name, prefix, prefixLen < nameLen ? prefixLen : nameLen);
+}
+
+// Write a V1 peer table of the specified number of peers, with names of the specified
+// length, into erased flash
+static void flashWriteV1Table(int peers, int nameLen)
+{
+    uint32_t header[2] = { CONFIG_SIGNATURE_V1, peers };
+    memcpy((void *) (uintptr_t) CONFIG_ADDRESS, header, sizeof(header));
+    peerV1 *table = (peerV1 *) (uintptr_t) (CONFIG_ADDRESS + sizeof(header));
+    for (int i=0; i<peers; i++) {
+        peerV1 p = {0};
+        p.type = PEER_TYPE_SENSOR;
+        memcpy(p.address, v1Address[i], sizeof(p.address));
+        v1Name(p.name, i, nameLen);
+        for (size_t j=0; j<sizeof(p.key); j++) {
+            p.key[j] = (uint8_t) (i*3 + j);
+        }
+        memcpy(&table[i], &p, sizeof(p));
+    }
+}
+
+// See if the config holds exactly the V1 table, with its first peer re-keyed if specified
+static bool v1Matches(int peers, int nameLen, bool rekeyed)
+{
+    if (flashConfigPeers() != (uint32_t) peers) {
+        return false;
+    }
+    for (int i=0; i<peers; i++) {
+        uint16_t type;
+        uint8_t key[AES_KEY_BYTES], expectedKey[AES_KEY_BYTES];
+        char name[SENSOR_NAME_MAX], expectedName[SENSOR_NAME_MAX] = {0};
+        if (!flashConfigFindPeerByAddress(v1Address[i], &type, key, name)) {
+            return false;
+        }
+        for (size_t j=0; j<sizeof(expectedKey); j++) {
+            expectedKey[j] = (rekeyed && i == 0) ? 0xA5 : (uint8_t) (i*3 + j);
+        }
+        v1Name(expectedName, i, nameLen);
+        if (type != PEER_TYPE_SENSOR || memcmp(key, expectedKey, sizeof(key)) != 0
+                || memcmp(name, expectedName, sizeof(name)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Import a V1 table, which must be loaded in full.  If it fits within a bank, it must be
+// migrated by re-keying a peer even with power lost during any flash operation, and if not
+// it must be refused and left unchanged.
+static void runV1Import(int peers, int nameLen, bool fits)
+{
+    uint32_t failures = testFailures;
+    uint8_t key[AES_KEY_BYTES];
+    memset(key, 0xA5, sizeof(key));
+    hostFlashInit();
+    flashWriteV1Table(peers, nameLen);
+    flashConfigLoad();
+    CHECK(v1Matches(peers, nameLen, false));
+    uint32_t base = hostFlashOperations();
+    CHECK(flashConfigUpdatePeer(PEER_TYPE_SENSOR, v1Address[0], key) == fits);
+    CHECK(flashConfigUpdatePeerName(v1Address[1], ADDRESS_LEN, "renamed") == fits);
+    CHECK(flashConfigUpdate() == fits);
+    uint32_t operations = hostFlashOperations() - base;
+    if (!fits) {
+        CHECK(operations == 0);
+        flashConfigLoad();
+        CHECK(v1Matches(peers, nameLen, false));
+        printf("flash: %d-peer V1 config with %d-byte names %s\n", peers, nameLen,
+               testFailures == failures ? "loaded and left unmigrated" : "not left intact");
+        return;
+    }
+
+    // Migrate with power lost during each operation of the re-keying that migrates it
+    base = 0;
+    for (uint32_t operation=1; ; operation++) {
+        hostFlashInit();
+        flashWriteV1Table(peers, nameLen);
+        flashConfigLoad();
+        hostFlashPowerLossAfter(operation);
+        if (setjmp(hostPowerLoss) == 0) {
+            CHECK(flashConfigUpdatePeer(PEER_TYPE_SENSOR, v1Address[0], key));
+            hostFlashPowerLossAfter(0);
+            base = operation - 1;
+            break;
+        }
+        HAL_FLASH_Lock();
+        flashConfigLoad();
+        if (!v1Matches(peers, nameLen, false) && !v1Matches(peers, nameLen, true)) {
+            fprintf(stderr, "flash: %d-peer V1 config corrupt after power loss in operation %u\n",
+                    peers, operation);
+            testFailures++;
+            continue;
+        }
+        CHECK(flashConfigUpdatePeer(PEER_TYPE_SENSOR, v1Address[0], key));
+        flashConfigLoad();
+        CHECK(v1Matches(peers, nameLen, true));
+    }
+    CHECK(base > 0);
+    printf("flash: %d-peer V1 config with %d-byte names migrated, surviving power loss in each of %u flash operations: %s\n",
+           peers, nameLen, base, testFailures == failures ? "yes" : "no");
+}
+
+// Start from erased flash or from a V1 table, as though just booted
+static void boot(bool v1)
+{
+    hostFlashInit();
+    if (v1) {
+        flashWriteV1(initial);
+    } else {
+        memset(initial, 0, sizeof(initial));
+    }
+    flashConfigLoad();
+}
+
+// Run the scenario with power lost during the specified flash operation, returning false
+// once the operation is beyond the end of the scenario
+static bool runWithPowerLoss(bool v1, uint32_t operation)
+{
+    static volatile int interrupted;
+    interrupted = -1;
+    boot(v1);
+    uint32_t base = hostFlashOperations();
+    hostFlashPowerLossAfter(operation);
+    if (setjmp(hostPowerLoss) == 0) {
+        for (int i=0; i<STEPS; i++) {
+            interrupted = i;
+            if (!stepApply(&steps[i])) {
+                fprintf(stderr, "flash: step %d failed without power loss\n", i);
+                testFailures++;
+            }
+        }
+        hostFlashPowerLossAfter(0);
+        CHECK(hostFlashOperations() - base < operation);
+        return false;
+    }
+
+    // Reboot, and check that the interrupted update was either done or not done at all
+    int i = interrupted;
+    HAL_FLASH_Lock();
+    flashConfigLoad();
+    bool before = configMatches(i == 0 ? initial : expected[i-1]);
+    bool after = configMatches(expected[i]);
+    if (!before && !after) {
+        fprintf(stderr, "flash: %s config corrupt after power loss in operation %u, during step %d\n",
+                v1 ? "V1" : "new", operation, i);
+        testFailures++;
+        return true;
+    }
+
+    // Redo the update if it was lost, as would happen when the peer paired again, and finish
+    for (; i<STEPS; i++) {
+        if (!stepApply(&steps[i])) {
+            fprintf(stderr, "flash: step %d failed after power loss in operation %u\n", i, operation);
+            testFailures++;
+            return true;
+        }
+    }
+    flashConfigLoad();
+    if (!configMatches(expected[STEPS-1])) {
+        fprintf(stderr, "flash: %s config wrong at end after power loss in operation %u\n",
+                v1 ? "V1" : "new", operation);
+        testFailures++;
+    }
+    return true;
+}
+
+// Run the scenario uninterrupted to check it and count its operations, and then with
+// power lost during each of them
+static void runScenario(bool v1)
+{
+    uint32_t failures = testFailures;
+    boot(v1);
+    uint32_t base = hostFlashOperations();
+    configModel model;
+    memcpy(model, initial, sizeof(model));
+    for (int i=0; i<STEPS; i++) {
+        CHECK(stepApply(&steps[i]));
+        modelApply(model, &steps[i]);
+        memcpy(expected[i], model, sizeof(model));
+        CHECK(configMatches(model));
+    }
+    flashConfigLoad();
+    CHECK(configMatches(model));
+    uint32_t operations = hostFlashOperations() - base;
+
+    uint32_t operation = 1;
+    while (runWithPowerLoss(v1, operation)) {
+        operation++;
+    }
+    CHECK(operation == operations+1);
+    printf("flash: %s config %s power loss in each of %u flash operations\n",
+           v1 ? "migrated V1" : "new", testFailures == failures ? "survived" : "did not survive", operations);
+}
+
+int main()
+{
+    for (int i=0; i<PEERS; i++) {
+        for (int j=0; j<ADDRESS_LEN; j++) {
+            address[i][j] = (uint8_t) rng();
+        }
+    }
+    for (int i=0; i<V1_PEERS; i++) {
+        for (int j=0; j<ADDRESS_LEN; j++) {
+            v1Address[i][j] = (uint8_t) rng();
+        }
+    }
+
+    // Pair every peer, and then re-key and rename them at random, with names of random
+    // lengths so that records vary in size
+    for (int i=0; i<STEPS; i++) {
+        step *s = &steps[i];
+        s->peer = (i < PEERS) ? i : (int) (rng() % PEERS);
+        s->op = (i < PEERS || (rng() & 1)) ? STEP_PAIR : STEP_RENAME;
+        for (size_t j=0; j<sizeof(s->key); j++) {
+            s->key[j] = (uint8_t) rng();
+        }
+        int nameLen = rng() % (SENSOR_NAME_MAX-1);
+        for (int j=0; j<nameLen; j++) {
+            s->name[j] = 'a' + (rng() % 26);
+        }
+        s->name[nameLen] = '\0';
+    }
+
+    runScenario(false);
+    runScenario(true);
+
+    // The most peers with 12-byte names that fit within a bank, and then a full V1 table
+    // and one of MAX_PEERS with full-length names, neither of which do
+    runV1Import(127, 12, true);
+    runV1Import(V1_PEERS, SENSOR_NAME_MAX-1, false);
+    runV1Import(MAX_PEERS, SENSOR_NAME_MAX-1, false);
+    return testResult("flash");
+}
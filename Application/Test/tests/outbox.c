@@ -0,0 +1,184 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Outbox test, on the retention RAM that the harness leaves uninitialized as the target does.
+// The outbox must start empty from whatever retention RAM holds at power-on, keep its notes
+// with their original times across a reset, and be cleared rather than trusted if retention
+// RAM is corrupted.  Against a model, it must keep the newest notes in order while its ring
+// wraps many times, and it must retain the notes of a failed request as the firmware does.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "framework.h"
+#include "host.h"
+#include "test.h"
+
+#define BASE_TIME       1700000000
+#define NOTES           400
+
+static uint32_t rngState = 0x5eed;
+
+static uint32_t rng()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// Fill retention RAM with noise, as at power-on
+static void retentionNoise()
+{
+    for (uint8_t *p=hostRetentionStart; p<hostRetentionEnd; p++) {
+        *p = (uint8_t) rng();
+    }
+}
+
+// A note as the ping app adds it, with a name of varying length so that notes vary in size
+static J *note(uint32_t count)
+{
+    J *req = NoteNewRequest("note.add");
+    J *body = JCreateObject();
+    JAddStringToObject(req, "file", "*#data.qo");
+    JAddNumberToObject(body, "count", count);
+    char name[32];
+    snprintf(name, sizeof(name), "sensor-%.*s", (int) (count % 20), "abcdefghijklmnopqrstuvwxyz");
+    JAddStringToObject(body, "sensor", name);
+    JAddItemToObject(req, "body", body);
+    JAddNumberToObject(req, "time", BASE_TIME + count * 60);
+    return req;
+}
+
+// See if a note retrieved from the outbox is the one with the specified count
+static bool noteIs(J *n, uint32_t count)
+{
+    if (n == NULL || strcmp(JGetString(n, "req"), "note.add") != 0 || strcmp(JGetString(n, "file"), "*#data.qo") != 0) {
+        return false;
+    }
+    J *body = JGetObject(n, "body");
+    char name[32];
+    snprintf(name, sizeof(name), "sensor-%.*s", (int) (count % 20), "abcdefghijklmnopqrstuvwxyz");
+    return JGetInt(body, "count") == (JINTEGER) count && strcmp(JGetString(body, "sensor"), name) == 0
+           && JGetInt(n, "time") == (JINTEGER) (BASE_TIME + count * 60);
+}
+
+// Check that the outbox holds exactly the notes with counts first..last, oldest first
+static bool outboxHolds(uint32_t first, uint32_t last)
+{
+    if (outboxCount() != last - first) {
+        return false;
+    }
+    for (uint32_t i=0; i<last-first; i++) {
+        J *n = outboxGet(i);
+        bool ok = noteIs(n, first + i);
+        JDelete(n);
+        if (!ok) {
+            return false;
+        }
+    }
+    return outboxGet(last - first) == NULL;
+}
+
+int main()
+{
+    CHECK((uintptr_t) hostRetentionEnd > (uintptr_t) hostRetentionStart);
+
+    // Power-on with noise in retention RAM
+    retentionNoise();
+    outboxInit();
+    CHECK(outboxCount() == 0);
+    CHECK(outboxGet(0) == NULL);
+
+    // Notes are kept across a reset, with their times
+    for (uint32_t i=0; i<5; i++) {
+        J *n = note(i);
+        CHECK(outboxAdd(n));
+        JDelete(n);
+    }
+    outboxInit();
+    CHECK(outboxHolds(0, 5));
+
+    // Corruption of any byte of the outbox clears it
+    for (int trial=0; trial<20; trial++) {
+        uint8_t *p = hostRetentionStart + (rng() % (hostRetentionEnd - hostRetentionStart));
+        uint8_t saved = *p;
+        *p ^= (uint8_t) (1 << (rng() % 8));
+        outboxInit();
+        CHECK(outboxCount() == 0);
+        *p = saved;
+        outboxInit();
+        if (outboxCount() == 0) {
+            for (uint32_t i=0; i<5; i++) {
+                J *n = note(i);
+                outboxAdd(n);
+                JDelete(n);
+            }
+        }
+        CHECK(outboxHolds(0, 5));
+    }
+
+    // A note too large for the outbox is refused without disturbing it
+    J *big = note(0);
+    char *text = malloc(SENSOR_OUTBOX_BYTES + 1);
+    memset(text, 'x', SENSOR_OUTBOX_BYTES);
+    text[SENSOR_OUTBOX_BYTES] = '\0';
+    JAddStringToObject(JGetObject(big, "body"), "text", text);
+    free(text);
+    CHECK(!outboxAdd(big));
+    JDelete(big);
+    CHECK(outboxHolds(0, 5));
+
+    // As the ring wraps, with notes removed as they are sent and resets along the way, the
+    // newest notes are kept in order
+    outboxRemove(outboxCount());
+    CHECK(outboxCount() == 0);
+    uint32_t first = 0, maxHeld = 0;
+    for (uint32_t count=0; count<NOTES; count++) {
+        J *n = note(count);
+        CHECK(outboxAdd(n));
+        JDelete(n);
+        if (outboxCount() > maxHeld) {
+            maxHeld = outboxCount();
+        }
+        first = count + 1 - outboxCount();
+        if ((rng() % 8) == 0) {
+            uint32_t sent = rng() % (outboxCount() + 1);
+            outboxRemove(sent);
+            first += sent;
+        }
+        if ((rng() % 16) == 0) {
+            outboxInit();
+        }
+        if (!outboxHolds(first, count+1)) {
+            fprintf(stderr, "outbox: wrong after adding note %u\n", count);
+            testFailures++;
+            break;
+        }
+    }
+    CHECK(maxHeld > 10);
+
+    // The notes of a failed batch, compressed as the firmware sends it, are retained
+    outboxRemove(outboxCount());
+    J *batch = NoteNewRequest(BATCH_REQUEST);
+    J *requests = JCreateArray();
+    for (uint32_t i=0; i<SENSOR_BATCH_MAX_NOTES; i++) {
+        JAddItemToArray(requests, note(1000+i));
+    }
+    JAddItemToObject(batch, BATCH_FIELD_REQUESTS, requests);
+    uint32_t len, zlen;
+    uint8_t *data = bjsonEncode(batch, &len);
+    JDelete(batch);
+    uint8_t *zdata = compressEncode(data, len, &zlen);
+    CHECK(zdata != NULL);
+    noteRequestFailed(zdata, zlen, true);
+    CHECK(outboxHolds(1000, 1000+SENSOR_BATCH_MAX_NOTES));
+    noteRequestFailed(data, len, false);
+    CHECK(outboxCount() == 2*SENSOR_BATCH_MAX_NOTES);
+    free(zdata);
+    free(data);
+
+    printf("outbox: up to %u notes held in %u bytes\n", maxHeld, SENSOR_OUTBOX_BYTES);
+    return testResult("outbox");
+}
@@ -0,0 +1,41 @@
+// Copyright 2022 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks and timing shared by the host tests, each of which is a program that links the
+// firmware and exits non-zero if any check failed.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static uint32_t testFailures = 0;
+
+// Report a failed check without stopping, so that one run shows every failure
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        testFailures++; \
+    } \
+} while (0)
+
+// Result of the test, for returning from main()
+static inline int testResult(const char *name)
+{
+    if (testFailures != 0) {
+        printf("%s: %u checks failed\n", name, testFailures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+// Monotonic time in nanoseconds, for benchmarks
+static inline uint64_t testNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
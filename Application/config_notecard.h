@@ -26,6 +26,8 @@
 
 // Configuration database
 #define CONFIGDB                            "config.db"
+#define CONFIGDB_TRACKER                    "gateway"
+#define CONFIGDB_CHANGES_PAGE               10
 
 // Sensor database
 #define SENSORDB                            "sensors.db"
@@ -41,12 +43,23 @@
 #define SENSORDB_FIELD_SENSOR_TXP           "sensor_txp"
 #define SENSORDB_FIELD_SENSOR_LTP           "sensor_ltp"
 
+// Link history, in which the gateway keeps a ring of buckets per sensor that each summarize
+// this many samples of link quality.  Buckets are exported to the link notefile once per
+// sensor DB update, with the buckets of at most this many sensors in each note.  The
+// history is part of each sensor cache entry, and so counts against SENSOR_CACHE_RAM_BYTES.
+#define LINKSQO                             "links.qo"
+#define LINK_HISTORY_BUCKETS                3
+#define LINK_BUCKET_SAMPLES                 8
+#define LINK_EXPORT_MAX_SENSORS             16
+
 // Amount of time that we should assume that it takes to transmit a request, process it,
 // and receive the response, given the type of application running on the sensors.  If,
 // for example, many requests or responses are desirable within a given time window,
 // then this can be made large.  The downside of making this smaller is that a given
 // node will "step on top of" the next sensor's window.  However, sensors do a
-// listen-before-talk, which mitigates this to a certain extent.
+// listen-before-talk, which mitigates this to a certain extent.  Once a sensor's transfers
+// have been observed its slot is instead sized from their time-on-air, but this remains
+// the slot of a sensor that hasn't yet been observed, and the minimum modulus.
 #define RADIO_TIME_WINDOW_SECS                          (17)
 
 // The very nature of our protocol is that every message sent from the sensor to the
@@ -61,6 +74,28 @@
 // The number of times we'll retry a request upon some kind of failure
 #define GATEWAY_REQUEST_FAILURE_RETRIES                 5
 
+// Gateway housekeeping (env vars, configuration, and the sensor DB) is broken into slices
+// that are only performed while no sensor is expected to be transmitting.  A slice is only
+// begun if this much quiet time remains, and housekeeping that fails is retried no sooner
+// than this.
+#define GATEWAY_HOUSEKEEPING_SLICE_SECS                 4
+#define GATEWAY_HOUSEKEEPING_RETRY_SECS                 60
+
+// Notes that a sensor adds without needing a response are held and sent to the gateway
+// together in a single transfer.  The batch is sent when it has this many notes, when its
+// oldest note has been held this long, or along with any request that can't be batched.
+#define SENSOR_BATCH_MAX_NOTES                          4
+#define SENSOR_BATCH_MAX_SECS                           (60*60)
+
+// While a batch is being sent because of its age rather than along with an app's request, no
+// app is activated, and the scheduler checks back this often to see if the batch has been sent.
+#define SENSOR_BATCH_SENDING_POLL_SECS                  15
+
+// Notes that couldn't be sent to the gateway after all retries are retained in an outbox
+// of this many bytes, and are sent at the head of a later batch.  When full, the oldest
+// notes are discarded.
+#define SENSOR_OUTBOX_BYTES                             1024
+
 // Environment variables
 extern uint32_t var_gateway_env_update_mins;
 #define VAR_GATEWAY_ENV_UPDATE_MINS                     "env_update_mins"
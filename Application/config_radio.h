@@ -54,9 +54,9 @@
 #define TX_TIMEOUT_VALUE                            4000
 
 // (DETERMINATIVE OF MESSAGE_MAX_BODY)
-// Note that unlike LoRaWAN, our MAC protocol does not vary the datarate but rather uses a single
-// datarate and uses a TDMA methodology wherein the gateway assigns slots to the sensors within which
-// they both transmit and receive.
+// Note that unlike LoRaWAN, our MAC protocol uses a TDMA methodology wherein the gateway assigns
+// slots to the sensors within which they both transmit and receive.  LORA_SPREADING_FACTOR is used
+// outside of slots, and the gateway may assign a sensor a lower spreading factor for its own slot.
 // The BW, SF, and coding rate Values chosen based on this document:
 // https://www.hindawi.com/journals/wcmc/2018/6931083/
 // Bandwidth, SF, and Coding Rate seems to be a good choice for high penetration based on the document.
@@ -70,6 +70,13 @@
 #define LORA_FIX_LENGTH_PAYLOAD_ON                  false
 #define LORA_IQ_INVERSION_ON                        false
 
+// The gateway assigns a sensor the lowest spreading factor, but no lower than the minimum,
+// at which the SNR of its link exceeds the demodulation floor by the margin.  The floor is
+// -7.5dB at SF7, and is 2.5dB lower for each higher spreading factor.  The spreading factor
+// is lowered by at most one step for each request that the sensor completes.
+#define LORA_SPREADING_FACTOR_MIN                   7
+#define LORA_SPREADING_FACTOR_MARGIN_DB             10
+
 #elif (( USE_MODEM_LORA == 0 ) && ( USE_MODEM_FSK == 1 ))
 
 #define FSK_FDEV                                    25000     // Hz
@@ -103,8 +110,28 @@
 // Device name
 #define SENSOR_NAME_MAX             50
 
-// Message structure definitions
-#define MESSAGE_VERSION             1
+// Message structure definitions.  The version is the feature level of the sender,
+// and all versions from MESSAGE_VERSION_NONCE upward share the same carrier layout.
+#define MESSAGE_VERSION_LEGACY      1           // Static IV, and no nonce in the carrier
+#define MESSAGE_VERSION_NONCE       2           // Per-message nonce in the carrier
+#define MESSAGE_VERSION_BINARY      3           // Sensor requests may be encoded by bjson.c
+#define MESSAGE_VERSION_COMPRESS    4           // Multi-chunk payloads may be compressed by compress.c
+#define MESSAGE_VERSION_WINDOW      5           // Multi-chunk payloads may be sent in windows
+#define MESSAGE_VERSION_COMPACT_ACK 6           // Gateway ACK bodies are epoch-based TLVs
+#define MESSAGE_VERSION_BATCH       7           // Sensor may send BATCH_REQUEST
+#define MESSAGE_VERSION_SF          8           // Gateway may assign a spreading factor for the sensor's slot
+#define MESSAGE_VERSION_PERIOD      9           // Sensor requests may carry REQUEST_FIELD_PERIOD
+#define MESSAGE_VERSION_TIME_MS     10          // Gateway ACKs carry ACK_TAG_TIME_MS rather than ACK_TAG_TIME
+#define MESSAGE_VERSION             10
+
+// A batch of requests from a sensor, which are in the "requests" array.  The gateway
+// performs them in order, and responds with the response to the last of them.
+#define BATCH_REQUEST               "sensor.batch"
+#define BATCH_FIELD_REQUESTS        "requests"
+
+// The period at which a sensor expects to send, in seconds, which the sensor adds to each
+// of its requests and which the gateway removes before performing the request.
+#define REQUEST_FIELD_PERIOD        "sensor_period"
 #define MESSAGE_ALG_CLEAR           0           // Cleartext
 #define MESSAGE_ALG_CTR             1           // AES CTR mode, 4 byte padding
 #define AES_KEY_LENGTH              256         // bits
@@ -140,6 +167,10 @@
 #define MESSAGE_FLAG_ACK        0x01    // This is an ACK message
 #define MESSAGE_FLAG_BEACON     0x02    // This is a BEACON message
 #define MESSAGE_FLAG_RESPONSE   0x04    // We require a response to this request
+#define MESSAGE_FLAG_COMPRESSED 0x08    // The payload being transferred is compressed
+#define MESSAGE_FLAG_WINDOW     0x10    // Chunk of a windowed transfer, or ACK ending with a wireWindowAck
+#define MESSAGE_FLAG_WINDOW_END 0x20    // Last chunk of a window, which must be acknowledged
+#define MESSAGE_FLAG_SYNC       0x40    // Sensor needs the gateway's entire configuration in the ACK
 #define MESSAGE_SIGNATURE       0xADAD
 typedef struct __attribute__((__packed__))
 {
@@ -159,7 +190,19 @@ typedef struct __attribute__((__packed__))
 }
 wireMessage;
 
-// The unencrypted outer wrapper of a message
+// The nonce that, followed by a zero block counter, forms the AES-CTR IV of a message.
+// Request IDs restart when a sensor reboots, so rather than being derived from them
+// the nonce is made unique by a random per-boot salt and a per-transmit sequence.
+#define NONCE_SEQUENCE_GATEWAY  0x80000000  // Direction bit, set when sent by a gateway
+typedef struct __attribute__((__packed__))
+{
+    uint32_t Salt;                  // Random for each boot of the sender
+    uint32_t Sequence;              // Direction, and sequence number of this transmission
+}
+wireNonce;
+
+// The unencrypted outer wrapper of a message.  In MESSAGE_VERSION_LEGACY, there is no
+// Nonce, and so the Message immediately follows the Receiver.
 typedef struct __attribute__((__packed__))
 {
     uint8_t Version;                // Format version number
@@ -167,10 +210,27 @@ typedef struct __attribute__((__packed__))
     uint16_t MessageLen;            // Length, always including padding
     uint8_t Sender[ADDRESS_LEN];    // Sender identity
     uint8_t Receiver[ADDRESS_LEN];  // Receiver identity
+    wireNonce Nonce;                // Nonce used when encrypting Message
     wireMessage Message;            // MUST BE ON 32-bit ALIGNED boundary
 }
 wireMessageCarrier;
 
+// MESSAGE_MAX_BODY was measured with the legacy carrier, so chunks are reduced by the
+// size of the nonce to keep packets within the same time on air.
+#define MESSAGE_MAX_CHUNK       (MESSAGE_MAX_BODY-sizeof(wireNonce))
+
+// In a windowed transfer, up to MESSAGE_WINDOW_CHUNKS chunks are sent back-to-back and
+// only the last of them is acknowledged.  The ACK ends with a selective acknowledgement,
+// and the next window consists of the chunks that it indicates are still missing.
+#define MESSAGE_WINDOW_CHUNKS   4       // Chunks sent before waiting for an ACK
+#define MESSAGE_WINDOW_GAP_MS   100     // Delay between chunks so that the receiver can restart
+typedef struct __attribute__((__packed__))
+{
+    uint32_t Offset;                // Length received contiguously from the start of the payload
+    uint32_t Received;              // Bit N set if chunk at Offset+(N*MESSAGE_MAX_CHUNK) was received
+}
+wireWindowAck;
+
 // Body of a gateway ACK message (LITTLE-ENDIAN on the wire)
 typedef struct __attribute__((__packed__))
 {
@@ -188,14 +248,102 @@ typedef struct __attribute__((__packed__))
 }
 gatewayAckBody;
 
-// Maximum number of cached sensors supported by a gateway, which determines
-// how many "transactions in flight" can be supported.
-#define MAX_CACHED_SENSORS  25
+// Compact gateway ACK body.  A one-byte epoch identifies the version of the fields of the
+// gatewayAckBody, other than the time, that the gateway has sent to this sensor.  It is
+// followed by TLVs of one-byte tag, one-byte length, and value.  All fields are sent when
+// the epoch changes or when the sensor sets MESSAGE_FLAG_SYNC because it has seen an epoch
+// for which it hasn't received the fields.  Otherwise the final ACK of a request carries only
+// the time, and the ACKs of intermediate chunks carry only the epoch.
+#define ACK_TAG_TW_MODULUS          1   // uint32_t TWModulusSecs
+#define ACK_TAG_TW_MODULUS_OFFSET   2   // uint16_t TWModulusOffsetSecs
+#define ACK_TAG_TW_SLOT             3   // uint16_t TWSlotBeginsSecs, uint16_t TWSlotEndsSecs
+#define ACK_TAG_TW_LBT              4   // uint16_t TWListenBeforeTalkMs
+#define ACK_TAG_LAST_PROCESSED      5   // uint32_t LastProcessedRequestID
+#define ACK_TAG_BOOT_TIME           6   // uint32_t BootTime
+#define ACK_TAG_TIME                7   // uint32_t Time
+#define ACK_TAG_ZONE                8   // int16_t ZoneOffsetMins, uint8_t ZoneName[3]
+#define ACK_TAG_NAME                9   // Name, without its terminator
+#define ACK_TAG_SF                  10  // uint8_t spreading factor to be used within the slot
+#define ACK_TAG_TIME_MS             11  // uint32_t Time, uint16_t milliseconds, as of the end of the ACK's receipt
+#define ACK_COMPACT_MAX             (1 + 11*2 + sizeof(gatewayAckBody) + 1 + sizeof(uint16_t))
+
+// Maximum number of peers that may be paired with a gateway.  This is bounded by the number
+// of peer records that fit within a bank of the flash config, even without names, which is
+// checked at build time.  Names are stored as space in the bank allows.  A V1 peer table
+// holding more peers, or names, than that is loaded in full but can't be changed.
+#define MAX_PEERS           140
+
+// RAM budget for the gateway's sensor cache.  The number of cached sensors, which
+// determines how many "transactions in flight" can be supported, is derived from
+// this at build time and is capped at the number of peers that can be paired.  Because
+// each entry also holds the sensor's link history and the shadow of its DB record, the
+// budget is sized to cache every peer, which is checked at build time.  When the cache
+// is full, the least recently used sensor is evicted, and its stats are held aside until
+// housekeeping flushes them to the DB.  If more than SENSOR_EVICTED_MAX are awaiting a
+// flush, the oldest of them is flushed at the time of the eviction.
+#define SENSOR_CACHE_RAM_BYTES  (31*1024)
+#define SENSOR_EVICTED_MAX      4
 
 // Amount of time beyond which we no longer consider a sensor to be "active",
 // and thus we no longer reserve a time window slot for it.
 #define TW_ACTIVE_SECS              (60*60*24)      // one day
+
+// A sensor that has advertised the period at which it sends is instead considered inactive
+// after TW_ACTIVE_PERIODS of them.  Rather than in every frame, its slot recurs every 2^n
+// frames, up to TW_SUPERFRAME_MAX, such that it recurs at least once per period.  Sensors
+// whose slots recur less often share a place in the frame by being assigned different
+// phases, which keeps the frame short so that sensors that send often have low latency.
+// The frame length and the recurrence of slots are refined over TW_SUPERFRAME_PASSES.
+#define TW_ACTIVE_PERIODS           8
+#define TW_SUPERFRAME_MAX           16
+#define TW_SUPERFRAME_PASSES        3
 #define TW_LBT_PERIOD_MS            1000            // Granularity of LBT period
 
+// Listen-before-talk is done either by receiving for the LBT period, or by LoRa channel
+// activity detection over a few symbols.  When CAD finds the channel busy, the next CAD is
+// after a random backoff, within a window of the time-on-air of the packet being sent that
+// doubles with each attempt, up to 2^LBT_CAD_BACKOFF_EXP_MAX times the time-on-air.
+#define LBT_MODE_RX                 0
+#define LBT_MODE_CAD                1
+#ifndef LBT_MODE
+#define LBT_MODE                    LBT_MODE_CAD
+#endif
+#define LBT_CAD_SYMBOLS             LORA_CAD_04_SYMBOL
+#define LBT_CAD_DET_PEAK(sf)        ((sf)+13)
+#define LBT_CAD_DET_MIN             10
+#define LBT_CAD_BACKOFF_EXP_MAX     4
+
+// A sensor that transmits within a window begins to do so within this many seconds of the
+// start of its slot, allowing for clock skew and listen-before-talk.  If it hasn't been
+// heard from by then, it isn't expected to transmit for the remainder of the slot, and so
+// the gateway only listens at the sensor's assigned spreading factor during this time.
+#define TW_SLOT_START_SECS          6
+
+// A sensor whose time is synchronized to the gateway's to the millisecond begins to transmit
+// within tens of milliseconds of the start of its slot, and so the start of its slot need
+// only allow for the granularity of slots and for a listen-before-talk backoff.
+#define TW_SLOT_START_SYNCED_SECS   2
+
+// The gateway stamps the time into an ACK as of when the sensor will have finished receiving it,
+// from its time-on-air and TIME_SYNC_LATENCY_MS for the radios to begin transmitting and to
+// signal that the packet was received.  A sensor's clock is stepped rather than slewed when it
+// is off by TIME_SYNC_STEP_MS, and the drift of its clock is estimated from its error when it
+// has been at least TIME_SYNC_DRIFT_MIN_MS since the last sync, within TIME_SYNC_DRIFT_MAX_PPB.
+#define TIME_SYNC_LATENCY_MS        2
+#define TIME_SYNC_STEP_MS           1500
+#define TIME_SYNC_DRIFT_MIN_MS      (10*60*1000)
+#define TIME_SYNC_DRIFT_MAX_PPB     200000
+
+// Once a sensor's transfers have been observed, its slot is sized from their time-on-air
+// rather than from RADIO_TIME_WINDOW_SECS.  The slot is its start allowance, plus the chunks
+// of the sensor's typical request and response at its spreading factor, an ACK of roughly
+// TW_SLOT_ACK_BYTES with the turnaround allowance on either side of it for each chunk or
+// window of chunks, and TW_SLOT_PROCESSING_MS for the gateway to process a request that
+// needs a response.  Slots are packed back-to-back, and are re-packed when a sensor has
+// outgrown its slot or when doing so would shrink the modulus by TW_SLOT_SHRINK_PCT.
+#define TW_SLOT_ACK_BYTES           24
+#define TW_SLOT_PROCESSING_MS       3000
+#define TW_SLOT_SHRINK_PCT          25
+
 // Whether or not to auto-reboot sensors when the gateway reboots
 #define REBOOT_SENSORS_WHEN_GATEWAY_REBOOTS true